@@ -0,0 +1,562 @@
+/*
+ * ASCII catalogs: one sample per line, whitespace or character separated
+ * columns.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "asciicat.h"
+#include "moc.h"
+#include "logger.h"
+#include "trace.h"
+#include "mem.h"
+
+/* do not split files in chunks smaller than this */
+#define MIN_CHUNK_SIZE (1 << 20)
+
+/* samples given at once to the sink */
+#define SAMPLE_BLOCK 1024
+
+/* longest token given to strtod() when the fast parser gives up */
+#define MAX_TOKEN 64
+
+#define DEFAULT_FORMAT { \
+	.idcol = 0, \
+	.loncol = 1, \
+	.latcol = 2, \
+	.units = ASCIICAT_RADIANS, \
+	.separator = 0, \
+	.comment = '#', \
+	.skiplines = 0, \
+	.nthreads = 1 \
+}
+
+const AsciiFormat AsciiCat_defaultFormat = DEFAULT_FORMAT;
+
+static AsciiFormat format_in_use = DEFAULT_FORMAT;
+
+/* exact powers of ten as doubles */
+static const double pow10_table[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* samples of a chunk, in radians */
+struct parse_args {
+	const AsciiFormat	*format;
+	const char			*start;	/* first line of the chunk */
+	const char			*end;	/* after the last line */
+	long				*ids;
+	double				*lons;
+	double				*cols;
+	long				nsamples;
+	long				size;
+	long				nerrors;
+};
+
+
+/******************************************************************************
+ * PRIVATE FUNCTIONS
+ */
+static inline bool
+is_blank(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+static bool
+parse_double_slow(
+	const char	*p,
+	const char	*end,
+	double		*value)
+{
+	char token[MAX_TOKEN], *endptr;
+	long len = end - p;
+
+	if (len == 0 || len >= MAX_TOKEN)
+		return false;
+	memcpy(token, p, len);
+	token[len] = '\0';
+
+	*value = strtod(token, &endptr);
+	return endptr == token + len;
+}
+
+/*
+ * Parse the decimal number [p, end[. Numbers with at most 19 significant
+ * digits whose mantissa is exactly representable and whose exponent is
+ * below 23 are computed with a single multiplication or division, which
+ * is correctly rounded. Other numbers are given to strtod().
+ */
+static bool
+parse_double(
+	const char	*p,
+	const char	*end,
+	double		*value)
+{
+	const char *s = p;
+	uint64_t mantissa = 0;
+	int ndigits = 0, exponent = 0, e = 0;
+	bool negative = false, esign = false, digits = false, truncated = false;
+
+	/* an empty field is not a number */
+	if (p == end)
+		return false;
+
+	if (s < end && (*s == '-' || *s == '+')) {
+		negative = *s == '-';
+		s++;
+	}
+
+	for (; s < end && *s >= '0' && *s <= '9'; s++) {
+		digits = true;
+		if (mantissa == 0 && *s == '0')
+			continue;
+		if (ndigits < 19) {
+			mantissa = mantissa * 10 + (*s - '0');
+			ndigits++;
+		} else {
+			truncated = true;
+		}
+	}
+
+	if (s < end && *s == '.') {
+		for (s++; s < end && *s >= '0' && *s <= '9'; s++) {
+			digits = true;
+			if (mantissa == 0 && *s == '0') {
+				exponent--;
+				continue;
+			}
+			if (ndigits < 19) {
+				mantissa = mantissa * 10 + (*s - '0');
+				ndigits++;
+				exponent--;
+			} else {
+				truncated = true;
+			}
+		}
+	}
+
+	if (!digits)
+		return parse_double_slow(p, end, value);
+
+	if (s < end && (*s == 'e' || *s == 'E')) {
+		s++;
+		if (s < end && (*s == '-' || *s == '+')) {
+			esign = *s == '-';
+			s++;
+		}
+		if (s == end)
+			return false;
+		for (; s < end && *s >= '0' && *s <= '9'; s++)
+			if (e < 10000)
+				e = e * 10 + (*s - '0');
+		exponent += esign ? -e : e;
+	}
+
+	if (s != end || truncated || mantissa > (((uint64_t) 1) << 53) ||
+			exponent > 22 || exponent < -22)
+		return parse_double_slow(p, end, value);
+
+	double v = (double) mantissa;
+	v = exponent < 0 ? v / pow10_table[-exponent] : v * pow10_table[exponent];
+	*value = negative ? -v : v;
+
+	return true;
+}
+
+static bool
+parse_long(
+	const char	*s,
+	const char	*end,
+	long		*value)
+{
+	bool negative = false;
+	long v = 0;
+
+	if (s < end && (*s == '-' || *s == '+')) {
+		negative = *s == '-';
+		s++;
+	}
+	if (s == end)
+		return false;
+	for (; s < end; s++) {
+		if (*s < '0' || *s > '9')
+			return false;
+		v = v * 10 + (*s - '0');
+	}
+	*value = negative ? -v : v;
+
+	return true;
+}
+
+/*
+ * Parse the line [p, eol[ in "id", "lon" and "col". Return false if a
+ * column is missing or can not be parsed, or if the position is not on
+ * the sphere: lon not finite or col not in [0, pi].
+ */
+static bool
+parse_line(
+	const AsciiFormat	*f,
+	const char			*p,
+	const char			*eol,
+	long				*id,
+	double				*lon,
+	double				*col)
+{
+	int column, maxcol = f->idcol;
+	double lonv = 0, latv = 0;
+	const char *q, *tend;
+
+	if (f->loncol > maxcol)
+		maxcol = f->loncol;
+	if (f->latcol > maxcol)
+		maxcol = f->latcol;
+
+	for (column=0; column<=maxcol; column++) {
+		while (p < eol && is_blank(*p))
+			p++;
+		if (p >= eol)
+			return false;
+
+		if (f->separator)
+			for (q=p; q < eol && *q != f->separator; q++);
+		else
+			for (q=p; q < eol && !is_blank(*q); q++);
+
+		/* separated tokens may end with blanks */
+		for (tend=q; tend > p && is_blank(tend[-1]); tend--);
+
+		if (column == f->idcol && !parse_long(p, tend, id))
+			return false;
+		if (column == f->loncol && !parse_double(p, tend, &lonv))
+			return false;
+		if (column == f->latcol && !parse_double(p, tend, &latv))
+			return false;
+
+		p = (f->separator && q < eol) ? q + 1 : q;
+	}
+
+	if (f->units == ASCIICAT_DEGREES) {
+		*lon = lonv * TO_RAD;
+		*col = SC_HALFPI - latv * TO_RAD;
+	} else {
+		*lon = lonv;
+		*col = latv;
+	}
+
+	return isfinite(*lon) && *col >= 0 && *col <= SC_PI;
+}
+
+static void*
+parse_thread(void *args)
+{
+	struct parse_args *pa = args;
+	const AsciiFormat *f = pa->format;
+	const char *p = pa->start, *eol, *s;
+
+	Trace_begin("parse", "%li bytes", (long) (pa->end - pa->start));
+
+	pa->size = (pa->end - pa->start) / 32 + 64;
+	pa->ids = ALLOC(sizeof(long) * pa->size);
+	pa->lons = ALLOC(sizeof(double) * pa->size);
+	pa->cols = ALLOC(sizeof(double) * pa->size);
+	pa->nsamples = 0;
+	pa->nerrors = 0;
+
+	while (p < pa->end) {
+		eol = memchr(p, '\n', pa->end - p);
+		if (!eol)
+			eol = pa->end;
+
+		for (s=p; s < eol && is_blank(*s); s++);
+		if (s == eol || *s == '\r' || *s == f->comment) {
+			p = eol + 1;
+			continue;
+		}
+
+		if (pa->nsamples == pa->size) {
+			pa->size *= 2;
+			pa->ids = REALLOC(pa->ids, sizeof(long) * pa->size);
+			pa->lons = REALLOC(pa->lons, sizeof(double) * pa->size);
+			pa->cols = REALLOC(pa->cols, sizeof(double) * pa->size);
+		}
+
+		if (parse_line(f, s, eol > s && eol[-1] == '\r' ? eol - 1 : eol,
+					&pa->ids[pa->nsamples], &pa->lons[pa->nsamples],
+					&pa->cols[pa->nsamples]))
+			pa->nsamples++;
+		else
+			pa->nerrors++;
+
+		p = eol + 1;
+	}
+
+	Trace_end();
+	return NULL;
+}
+
+/*
+ * Map "file" and parse it in line aligned chunks. Return the chunks
+ * results, and their number in "nchunks".
+ */
+static struct parse_args*
+parse_file(
+	char				*file,
+	const AsciiFormat	*format,
+	int					*nchunks)
+{
+	struct stat st;
+	const char *data, *p, *end;
+	int i, n, fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0)
+		Logger_log(LOGGER_CRITICAL, "Can not open %s\n", file);
+
+	if (st.st_size == 0) {
+		close(fd);
+		*nchunks = 0;
+		return NULL;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+		Logger_log(LOGGER_CRITICAL, "Can not map %s\n", file);
+	close(fd);
+	madvise((void*) data, st.st_size, MADV_SEQUENTIAL);
+
+	p = data;
+	end = data + st.st_size;
+	for (i=0; i<format->skiplines && p < end; i++) {
+		p = memchr(p, '\n', end - p);
+		p = p ? p + 1 : end;
+	}
+
+	n = format->nthreads > 0 ? format->nthreads : 1;
+	if ((end - p) / MIN_CHUNK_SIZE + 1 < n)
+		n = (end - p) / MIN_CHUNK_SIZE + 1;
+
+	struct parse_args *args = ALLOC(sizeof(struct parse_args) * n);
+	pthread_t *threads = ALLOC(sizeof(pthread_t) * n);
+
+	for (i=0; i<n; i++) {
+		const char *cut = end;
+		if (i < n - 1) {
+			cut = p + (end - p) / (n - i);
+			cut = memchr(cut, '\n', end - cut);
+			cut = cut ? cut + 1 : end;
+		}
+		args[i].format = format;
+		args[i].start = p;
+		args[i].end = cut;
+		p = cut;
+	}
+
+	for (i=1; i<n; i++)
+		pthread_create(&threads[i], NULL, parse_thread, &args[i]);
+	parse_thread(&args[0]);
+	for (i=1; i<n; i++)
+		pthread_join(threads[i], NULL);
+
+	munmap((void*) data, st.st_size);
+	FREE(threads);
+
+	long nerrors = 0;
+	for (i=0; i<n; i++)
+		nerrors += args[i].nerrors;
+	if (nerrors > 0)
+		Logger_log(LOGGER_ERROR,
+				"%li lines of %s could not be parsed\n", nerrors, file);
+
+	*nchunks = n;
+	return args;
+}
+
+static void
+free_chunks(
+	struct parse_args	*chunks,
+	int					nchunks)
+{
+	int i;
+	for (i=0; i<nchunks; i++) {
+		FREE(chunks[i].ids);
+		FREE(chunks[i].lons);
+		FREE(chunks[i].cols);
+	}
+	FREE(chunks);
+}
+
+/*
+ * MOC at "order" of the samples of all chunks.
+ */
+static Moc*
+chunks_moc(
+	struct parse_args	*chunks,
+	int					nchunks,
+	int					order)
+{
+	Moc *moc = Moc_new(), *cmoc, *u;
+	int i;
+
+	for (i=0; i<nchunks; i++) {
+		cmoc = Moc_fromPositions(order, chunks[i].cols, chunks[i].lons,
+				chunks[i].nsamples);
+		u = Moc_union(moc, cmoc);
+		Moc_free(moc);
+		Moc_free(cmoc);
+		moc = u;
+	}
+
+	return moc;
+}
+
+/**
+ * PRIVATE FUNCTIONS END
+ ******************************************************************************/
+
+
+
+/******************************************************************************
+ * PUBLIC FUNCTIONS
+ */
+void
+AsciiCat_setFormat(const AsciiFormat *format)
+{
+	format_in_use = *format;
+}
+
+
+void
+AsciiCat_openFormat(
+	char				*file,
+	const AsciiFormat	*format,
+	Field				*field,
+	Catalog_addFunc		add,
+	void				*sink)
+{
+	Sample samples[SAMPLE_BLOCK];
+	Sample **exts[SAMPLE_BLOCK];
+	long nsamples = 0, k, b, j, n;
+	int i, nchunks;
+
+	Trace_begin("AsciiCat_open", "%s", file);
+
+	struct parse_args *chunks = parse_file(file, format, &nchunks);
+	for (i=0; i<nchunks; i++)
+		nsamples += chunks[i].nsamples;
+
+	/* This is a single set file */
+	field->nsets = 1;
+	field->sets = ALLOC(sizeof(Set));
+
+	Set *set = &field->sets[0];
+	set->samples = ALLOC(sizeof(Sample*) * (nsamples > 0 ? nsamples : 1));
+	set->nsamples = nsamples;
+	set->wcs = NULL;
+	set->nwcs = 0;
+	set->field = field;
+
+	/* samples are built and inserted by blocks */
+	Trace_begin("insert", "%li samples", nsamples);
+	for (i=0, k=0; i<nchunks; i++) {
+		struct parse_args *c = &chunks[i];
+		for (b=0; b<c->nsamples; b+=SAMPLE_BLOCK, k+=n) {
+			n = c->nsamples - b < SAMPLE_BLOCK ? c->nsamples - b : SAMPLE_BLOCK;
+			for (j=0; j<n; j++) {
+				samples[j].id = c->ids[b+j];
+				samples[j].lon = c->lons[b+j];
+				samples[j].col = c->cols[b+j];
+				samples[j].ra = c->lons[b+j] / TO_RAD;
+				samples[j].dec = (SC_HALFPI - c->cols[b+j]) / TO_RAD;
+				samples[j].set = set;
+				exts[j] = &set->samples[k+j];
+			}
+
+			/* PixelStore sinks compute healpix values by blocks */
+			if (add == (Catalog_addFunc) PixelStore_add) {
+				PixelStore_addBatch(sink, samples, n, exts);
+			} else {
+				for (j=0; j<n; j++)
+					add(sink, samples[j], exts[j]);
+			}
+		}
+	}
+
+	Trace_end();
+
+	set->moc = chunks_moc(chunks, nchunks, MOC_FIELD_ORDER);
+	Catalog_coverField(field);
+
+	LOGGER_LOG(LOGGER_TRACE, "File %s read, %li samples\n", file, nsamples);
+
+	free_chunks(chunks, nchunks);
+	Trace_end();
+}
+
+
+void
+AsciiCat_openWith(
+	char			*file,
+	Field			*field,
+	Catalog_addFunc	add,
+	void			*sink)
+{
+	AsciiCat_openFormat(file, &format_in_use, field, add, sink);
+}
+
+
+void
+AsciiCat_open(
+	char		*file,
+	Field		*field,
+	PixelStore	*store)
+{
+	AsciiCat_openWith(file, field, (Catalog_addFunc) PixelStore_add, store);
+}
+
+
+long
+AsciiCat_footprint(
+	char	*file,
+	int		order,
+	int64_t	**pixels)
+{
+	long npixels = 0, j;
+	int nchunks, shift = 2 * (MOC_MAXORDER - order);
+	int64_t p;
+
+	struct parse_args *chunks = parse_file(file, &format_in_use, &nchunks);
+	Moc *moc = chunks_moc(chunks, nchunks, order);
+	free_chunks(chunks, nchunks);
+
+	/* the MOC gives sorted unique pixels */
+	*pixels = ALLOC(sizeof(int64_t) * ((Moc_npixels(moc) >> shift) + 1));
+	for (j=0; j<moc->nranges; j++)
+		for (p=moc->ranges[2*j] >> shift; p<moc->ranges[2*j+1] >> shift; p++)
+			(*pixels)[npixels++] = p;
+	Moc_free(moc);
+
+	return npixels;
+}
+/**
+ * PUBLIC FUNCTIONS END
+ ******************************************************************************/
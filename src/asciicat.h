@@ -0,0 +1,87 @@
+/*
+ * ASCII catalogs: one sample per line, whitespace or character separated
+ * columns.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __ASCIICAT_H__
+#define __ASCIICAT_H__
+
+#include <stdint.h>
+
+#include "scamp.h"
+#include "catalog.h"
+#include "pixelstore.h"
+
+/* longitude and colatitude in radians */
+#define ASCIICAT_RADIANS 0
+/* right ascension and declination in degrees */
+#define ASCIICAT_DEGREES 1
+
+/**
+ * Layout of the lines of an ASCII catalog. Columns are numbered from 0.
+ * Empty lines, lines starting with "comment", and the first "skiplines"
+ * lines are ignored.
+ */
+typedef struct AsciiFormat {
+    int  idcol;
+    int  loncol;
+    int  latcol;
+    int  units;     /* ASCIICAT_RADIANS or ASCIICAT_DEGREES */
+    char separator; /* 0 for spaces and tabulations */
+    char comment;
+    int  skiplines;
+    int  nthreads;  /* number of parser threads */
+} AsciiFormat;
+
+/*
+ * Default format: "id lon col" in radians, separated by spaces, as used
+ * by the test catalogs.
+ */
+extern const AsciiFormat AsciiCat_defaultFormat;
+
+/**
+ * Set the format used by AsciiCat_openWith() and AsciiCat_footprint().
+ * Defaults to AsciiCat_defaultFormat. Not thread safe.
+ */
+extern void
+AsciiCat_setFormat(const AsciiFormat *format);
+
+/**
+ * Load an ASCII catalog in a single set field. The file is memory mapped
+ * and split in line aligned chunks parsed by "format->nthreads" threads.
+ * Lines that can not be parsed are skipped.
+ */
+extern void
+AsciiCat_openFormat(char *file, const AsciiFormat *format, Field *field,
+        Catalog_addFunc add, void *sink);
+
+/**
+ * Catalog_loadFunc with the format given to AsciiCat_setFormat().
+ *
+ * Thread safe.
+ */
+extern void
+AsciiCat_openWith(char *file, Field *field, Catalog_addFunc add, void *sink);
+
+extern void
+AsciiCat_open(char *file, Field *field, PixelStore *store);
+
+/**
+ * Catalog_footprintFunc for ASCII catalogs. There is no header, positions
+ * are read to get the exact footprint.
+ *
+ * Thread safe.
+ */
+extern long
+AsciiCat_footprint(char *file, int order, int64_t **pixels);
+
+#endif /* __ASCIICAT_H__ */
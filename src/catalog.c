@@ -12,23 +12,323 @@
  */
 
 
+#include <stdlib.h>
 #include <string.h>
 #include <cfitsio/fitsio.h>
 #include <chealpix.h>
 
 #include "catalog.h"
+#include "moc.h"
+#include "asciicat.h"
+#include "fitsmap.h"
+#include "fastwcs.h"
+#include "skycache.h"
 #include "mem.h"
 #include "logger.h"
+#include "trace.h"
 
 static char* read_field_card(fitsfile*,int*,char*);
+static int card_int(char*,int,char*,int*);
+static long unique_pixels(int64_t*,long);
 static char charnull[2] = {' ', '\0'};
 
+/* fast approximate WCS tolerance in arcsec, 0 if disabled */
+static double fastwcs_tolerance = 0;
+
 
 void
 Catalog_open(
 	char 		*filename, 
 	Field 		*field, 
 	PixelStore 	*store) 
+{
+	Catalog_openWith(filename, field, (Catalog_addFunc) PixelStore_add, store);
+}
+
+
+/*
+ * FastWcs_projectFunc with wcsp2s, "udata" is the wcsprm.
+ */
+static int
+wcs_project(
+	void			*udata,
+	long			n,
+	const double	*pixcrd,
+	double			*world)
+{
+	int status;
+	long j;
+
+	double *imgcrd = ALLOC(sizeof(double) * n * 2);
+	double *phi = ALLOC(sizeof(double) * n);
+	double *theta = ALLOC(sizeof(double) * n);
+	int *stat = CALLOC(sizeof(int), n);
+
+	status = wcsp2s(udata, n, 2, pixcrd, imgcrd, phi, theta, world, stat);
+
+	for (j=0; j < n; j++) {
+		if (stat[j] != 0) {
+			Logger_log(LOGGER_ERROR, "ERROR %i: for %li\n", stat[j], j);
+		}
+	}
+
+	FREE(imgcrd);
+	FREE(phi);
+	FREE(theta);
+	FREE(stat);
+
+	return status;
+}
+
+/*
+ * Set "l" of "field" is an empty table.
+ */
+static void
+empty_set(
+	Field			*field,
+	int				l,
+	struct wcsprm	*wcs,
+	int				nwcs)
+{
+	field->sets[l].samples = NULL;
+	field->sets[l].nsamples = 0;
+	field->sets[l].wcs = wcs;
+	field->sets[l].nwcs = nwcs;
+	field->sets[l].field = field;
+	field->sets[l].moc = NULL;
+}
+
+/*
+ * Create set "l" of "field" from the "nrows" sextractor numbers and image
+ * coordinates in "pixcrd", and give its samples to "add".
+ */
+static void
+load_set(
+	char			*filename,
+	Field			*field,
+	int				l,
+	struct wcsprm	*wcs,
+	int				nwcs,
+	long			nrows,
+	long			*col_number,
+	double			*pixcrd,
+	Catalog_addFunc	add,
+	void			*sink)
+{
+	long j, k;
+
+	Trace_begin("load_set", "%s[%i]", filename, l);
+
+	/*
+	 * WCS transformation
+	 */
+	Trace_begin("wcsp2s", "%li rows", nrows);
+	double *world = ALLOC(sizeof(double) * nrows * 2);
+	FastWcs *fw = NULL;
+
+	if (fastwcs_tolerance > 0) {
+		double xmin = pixcrd[0], xmax = pixcrd[0];
+		double ymin = pixcrd[1], ymax = pixcrd[1];
+		for (j=1; j < nrows; j++) {
+			xmin = pixcrd[2*j] < xmin ? pixcrd[2*j] : xmin;
+			xmax = pixcrd[2*j] > xmax ? pixcrd[2*j] : xmax;
+			ymin = pixcrd[2*j+1] < ymin ? pixcrd[2*j+1] : ymin;
+			ymax = pixcrd[2*j+1] > ymax ? pixcrd[2*j+1] : ymax;
+		}
+		/* the grid must cost much less than the exact projection */
+		fw = FastWcs_new(wcs_project, wcs, xmin, xmax, ymin, ymax,
+				fastwcs_tolerance, nrows / 4);
+	}
+
+	if (fw) {
+		FastWcs_p2s(fw, nrows, pixcrd, world);
+		FastWcs_free(fw);
+	} else {
+		wcs_project(wcs, nrows, pixcrd, world);
+	}
+	Trace_end();
+
+	LOGGER_LOG(LOGGER_TRACE, "File %s read. Create samples \n", filename);
+
+	/*
+	 * Create a set of samples (a CCD)
+	 */
+	field->sets[l].samples = ALLOC(sizeof(Sample*) * nrows);
+	field->sets[l].nsamples = nrows;
+	field->sets[l].wcs = wcs;
+	field->sets[l].nwcs = nwcs;
+	field->sets[l].field = field;
+
+	Sample *samples = ALLOC(sizeof(Sample) * nrows);
+	Sample ***exts = ALLOC(sizeof(Sample**) * nrows);
+	for (j=0, k=0; j < nrows; j++, k+=2) {
+		samples[j].id   = col_number[j];
+		samples[j].ra   = world[k];
+		samples[j].dec  = world[k+1];
+		samples[j].lon  = world[k] * TO_RAD;
+		/* degree latitude to radian colatitude */
+		samples[j].col	 = SC_HALFPI - world[k+1] * TO_RAD;
+		samples[j].set	 = &field->sets[l];
+		exts[j] = &field->sets[l].samples[j];
+	}
+
+	/* PixelStore sinks compute healpix values by blocks */
+	Trace_begin("insert", "%li samples", nrows);
+	if (add == (Catalog_addFunc) PixelStore_add) {
+		PixelStore_addBatch(sink, samples, nrows, exts);
+	} else {
+		for (j=0; j < nrows; j++)
+			add(sink, samples[j], exts[j]);
+	}
+	Trace_end();
+
+	/* coverage of the set */
+	double *lon = ALLOC(sizeof(double) * nrows);
+	double *col = ALLOC(sizeof(double) * nrows);
+	for (j=0; j < nrows; j++) {
+		lon[j] = samples[j].lon;
+		col[j] = samples[j].col;
+	}
+	field->sets[l].moc = Moc_fromPositions(MOC_FIELD_ORDER, col, lon, nrows);
+
+	FREE(lon);
+	FREE(col);
+	FREE(samples);
+	FREE(exts);
+	FREE(world);
+
+	Trace_end();
+}
+
+/* "name" is a column of "table" decodable from the mapping */
+static bool
+mapped_column(
+	FitsHdu		*table,
+	char		*name,
+	bool		integer)
+{
+	FitsColumn *c = FitsMap_column(table, name);
+	if (!c || c->scaled || c->repeat < 1)
+		return false;
+	if (integer)
+		return strchr("BIJK", c->type) != NULL;
+	return strchr("BIJKED", c->type) != NULL;
+}
+
+/*
+ * Return true if "map" is a plain LDAC catalog: the primary HDU followed
+ * by pairs of field card and object tables.
+ */
+static bool
+mapped_ldac(FitsMap *map)
+{
+	int i;
+
+	if (map->nhdus < 1 || (map->nhdus - 1) % 2 != 0)
+		return false;
+
+	for (i=1; i<map->nhdus; i+=2) {
+		FitsHdu *head = &map->hdus[i], *table = &map->hdus[i+1];
+		if (head->compressed || table->compressed ||
+				!head->bintable || !table->bintable)
+			return false;
+		if (head->nrows != 1 || head->ncolumns < 1 ||
+				head->columns[0].type != 'A')
+			return false;
+		if (!mapped_column(table, "NUMBER", true) ||
+				!mapped_column(table, "X_IMAGE", false) ||
+				!mapped_column(table, "Y_IMAGE", false))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Load "filename" by decoding its tables straight from a memory mapping.
+ * Return false, without loading anything, if the file is not a plain LDAC
+ * catalog.
+ */
+static bool
+open_mapped(
+	char			*filename,
+	Field			*field,
+	Catalog_addFunc	add,
+	void			*sink)
+{
+	int i, l, nkeys, nwcsreject, nwcs, status;
+	long nrows;
+	struct wcsprm *wcs;
+
+	FitsMap *map = FitsMap_open(filename);
+	if (!map)
+		return false;
+	if (!mapped_ldac(map)) {
+		FitsMap_close(map);
+		return false;
+	}
+
+	LOGGER_LOG(LOGGER_TRACE, "Reading mapped %s\n", filename);
+
+	field->nsets = (map->nhdus - 1) / 2;
+	field->sets = ALLOC(sizeof(Set) * (field->nsets > 0 ? field->nsets : 1));
+
+	for (i=1, l=0; i<map->nhdus; i+=2, l++) {
+		FitsHdu *head = &map->hdus[i], *table = &map->hdus[i+1];
+
+		/* the field card is the single row of the first column */
+		nkeys = head->columns[0].repeat / FITSMAP_CARD;
+		char *field_card = ALLOC(nkeys * FITSMAP_CARD + 1);
+		memcpy(field_card, head->data + head->columns[0].offset,
+				nkeys * FITSMAP_CARD);
+		field_card[nkeys * FITSMAP_CARD] = '\0';
+
+		status = wcsbth(field_card, nkeys, WCSHDR_all, 0, 0, NULL,
+							&nwcsreject, &nwcs, &wcs);
+		if (status != 0)
+			Logger_log(LOGGER_CRITICAL,
+					"Can not read WCS in sextractor field card\n");
+		FREE(field_card);
+
+		nrows = table->nrows;
+		if (nrows <= 0) {
+			Logger_log(LOGGER_ERROR,
+					"file %s hdu %i contain an empty table\n", filename, i + 1);
+			empty_set(field, l, wcs, nwcs);
+			continue;
+		}
+
+		/* columns are decoded in place, in the layout given to wcsp2s */
+		long *col_number = ALLOC(sizeof(long) * nrows);
+		double *pixcrd = ALLOC(sizeof(double) * nrows * 2);
+		FitsMap_readLong(table, FitsMap_column(table, "NUMBER"), col_number, 1);
+		FitsMap_readDouble(table,
+				FitsMap_column(table, "X_IMAGE"), &pixcrd[0], 2);
+		FitsMap_readDouble(table,
+				FitsMap_column(table, "Y_IMAGE"), &pixcrd[1], 2);
+
+		load_set(filename, field, l, wcs, nwcs, nrows, col_number, pixcrd,
+				add, sink);
+
+		FREE(col_number);
+		FREE(pixcrd);
+	}
+
+	FitsMap_close(map);
+	Catalog_coverField(field);
+
+	return true;
+}
+
+/*
+ * Load any sextractor catalog with CFITSIO.
+ */
+static void
+open_fits(
+	char 			*filename, 
+	Field 			*field, 
+	Catalog_addFunc	add,
+	void			*sink) 
 {
 	fitsfile *fptr;
 	int i, j, k, l;
@@ -40,13 +340,12 @@ Catalog_open(
 	// short shortnull;
 	int   anynull;
 	long  longnull;
-	float floatnull;
+	double doublenull;
 
 	// shortnull = 0;
 	status	  = 0;
 	longnull	= 0;
-	floatnull   = 0.0;
-
+	doublenull  = 0.0;
 
 	if (fits_open_file(&fptr, filename, READONLY, &status)) {
 		if (status) {
@@ -83,7 +382,7 @@ Catalog_open(
 
 	for (i=2, l=0; i <= nhdus; i+=2, l++) {
 
-		Logger_log(LOGGER_TRACE, "Reading fits HDU %s %i\n", filename, i);
+		LOGGER_LOG(LOGGER_TRACE, "Reading fits HDU %s %i\n", filename, i);
 
 		/*
 		 * even hdu contain original image FITS header
@@ -91,7 +390,7 @@ Catalog_open(
 		fits_movabs_hdu(fptr, i, &hdutype, &status);
 		field_card = read_field_card(fptr, &nkeys, charnull);
 
-		Logger_log(LOGGER_TRACE, "Read fieldcard %s %i\n", field_card, strlen(field_card));
+		LOGGER_LOG(LOGGER_TRACE, "Read fieldcard %s %zu\n", field_card, strlen(field_card));
 		/*
 		 * create wcsprm with the image FITS header
 		 */
@@ -102,15 +401,15 @@ Catalog_open(
 			Logger_log(LOGGER_CRITICAL,
 					"Can not read WCS in sextractor field card\n");
 
-		Logger_log(LOGGER_TRACE, "Reading fits hav successfuly applyed wcsbth %s\n", filename);
-		Logger_log(LOGGER_TRACE,
+		LOGGER_LOG(LOGGER_TRACE, "Reading fits hav successfuly applyed wcsbth %s\n", filename);
+		LOGGER_LOG(LOGGER_TRACE,
 				"Number of WCS coordinate representations: %i with naxis %i\n",
 				nwcs, wcs[0].naxis);
 
 		/*
 		 * Now we should have required informations in "struct wcsprm *wcs".
 		 */
-		Logger_log(LOGGER_TRACE, "Reading fits ffffffffffffffff %s\n", filename);
+		LOGGER_LOG(LOGGER_TRACE, "Reading fits ffffffffffffffff %s\n", filename);
 
 		FREE(field_card);
 
@@ -125,10 +424,11 @@ Catalog_open(
 		fits_get_num_cols(fptr, &ncolumns, &status);
 
 		fits_get_num_rows(fptr, &nrows, &status);
-		Logger_log(LOGGER_TRACE, "Have %i rows and %i cols in the table\n", nrows, ncolumns);
+		LOGGER_LOG(LOGGER_TRACE, "Have %li rows and %i cols in the table\n", nrows, ncolumns);
 
 		if (nrows <= 0) {
-			Logger_log(LOGGER_ERROR, "file %i hdu %i contain an empty table\n", filename, i);
+			Logger_log(LOGGER_ERROR, "file %s hdu %i contain an empty table\n", filename, i);
+			empty_set(field, l, wcs, nwcs);
 			continue;
 		}
 
@@ -146,81 +446,158 @@ Catalog_open(
 		fits_read_col(fptr, TLONG, num_col, 1, 1, nrows, &longnull,  col_number,
 				&anynull, &status);
 
-		/* Get "x_image" row */
-		float *x_image = ALLOC(sizeof(float) * nrows);
-		fits_read_col(fptr, TFLOAT, x_image_col, 1, 1, nrows, &floatnull,  x_image,
-				&anynull, &status);
+		/* Get "x_image" row, in doubles as open_mapped() does */
+		double *x_image = ALLOC(sizeof(double) * nrows);
+		fits_read_col(fptr, TDOUBLE, x_image_col, 1, 1, nrows, &doublenull,
+				x_image, &anynull, &status);
 
 		/* Get "y_image" row */
-		float *y_image = ALLOC(sizeof(float) * nrows);
-		fits_read_col(fptr, TFLOAT, y_image_col, 1, 1, nrows, &floatnull,  y_image,
-				&anynull, &status);
+		double *y_image = ALLOC(sizeof(double) * nrows);
+		fits_read_col(fptr, TDOUBLE, y_image_col, 1, 1, nrows, &doublenull,
+				y_image, &anynull, &status);
 
-		/*
-		 * WCS transformation
-		 */
-		double *pixcrd, *imgcrd, *phi, *theta, *world;
-		int *stat;
-		pixcrd  = ALLOC(sizeof(double) * nrows * 3);
-		imgcrd  = ALLOC(sizeof(double) * nrows * 2);
-		phi	 = ALLOC(sizeof(double) * nrows * 2);
-		theta   = ALLOC(sizeof(double) * nrows * 2);
-		world   = ALLOC(sizeof(double) * nrows * 2);
-		stat	= CALLOC(sizeof(int), nrows * 2);
-
-		for (j=0, k=0; j < nrows; j++, k+=3) {
-			pixcrd[k] = 0;
-			pixcrd[k+1]   = x_image[j];
-			pixcrd[k+2] = y_image[j];
+		double *pixcrd = ALLOC(sizeof(double) * nrows * 2);
+		for (j=0, k=0; j < nrows; j++, k+=2) {
+			pixcrd[k]   = x_image[j];
+			pixcrd[k+1] = y_image[j];
 		}
 
+		load_set(filename, field, l, wcs, nwcs, nrows, col_number, pixcrd,
+				add, sink);
+
+		FREE(col_number);
+		FREE(x_image);
+		FREE(y_image);
+		FREE(pixcrd);
+	}
+
+	fits_close_file(fptr, &status);
 
-		wcsp2s(wcs, nrows, 2, pixcrd, imgcrd, phi, theta, world, stat);
+	Catalog_coverField(field);
+}
 
-		for (j=0; j < nrows * 2; j++) {
-			if (stat[j] != 0) {
-				Logger_log(LOGGER_ERROR, "ERROR %i: for %i\n", stat[j], j);
-			}
+void
+Catalog_openWith(
+	char 			*filename, 
+	Field 			*field, 
+	Catalog_addFunc	add,
+	void			*sink) 
+{
+	uint64_t key = 0;
+
+	Trace_begin("Catalog_open", "%s", filename);
+
+	/* cache files hold samples inserted in a pixel store */
+	bool cached = SkyCache_enabled() && add == (Catalog_addFunc) PixelStore_add;
+	if (cached) {
+		uint64_t salt;
+		memcpy(&salt, &fastwcs_tolerance, sizeof(salt));
+		key = SkyCache_key(filename, salt);
+		if (SkyCache_load(key, field, sink)) {
+			Trace_end();
+			return;
 		}
+	}
 
-		Logger_log(LOGGER_TRACE, "File %s read. Create samples \n", filename);
+	/* plain LDAC catalogs are decoded from a mapping, without CFITSIO */
+	if (!open_mapped(filename, field, add, sink))
+		open_fits(filename, field, add, sink);
 
-		/*
-		 * Create a set of samples (a CCD)
-		 */
-		field->sets[l].samples = ALLOC(sizeof(Sample*) * nrows);
-		field->sets[l].nsamples = nrows;
-		field->sets[l].wcs = wcs;
-		field->sets[l].nwcs = nwcs;
-		field->sets[l].field = field;
+	if (cached)
+		SkyCache_save(key, field, sink);
 
-		Sample sample;
-		for (j=0, k=0; j < nrows; j++, k+=2) {
-			sample.id   = col_number[j];
-			sample.ra   = world[k];
-			sample.dec  = world[k+1];
-			sample.lon  = world[k] * TO_RAD;
-			/* degree latitude to radian colatitude */
-			sample.col	 = SC_HALFPI - world[k+1] * TO_RAD;
-			sample.set	 = &field->sets[l];
-			PixelStore_add(store, sample, &field->sets[l].samples[j]);
+	Trace_end();
+}
+
+
+/*
+ * Images are sampled on a grid of (FOOTPRINT_STEPS + 1)^2 points.
+ */
+#define FOOTPRINT_STEPS 16
+#define FOOTPRINT_NPOINTS ((FOOTPRINT_STEPS + 1) * (FOOTPRINT_STEPS + 1))
+
+long
+Catalog_footprint(
+	char	*filename,
+	int		order,
+	int64_t	**pixels)
+{
+	fitsfile *fptr;
+	int i, j, k, status, nhdus, hdutype, nkeys, nwcsreject, nwcs;
+	int naxis1, naxis2;
+	char *field_card;
+	struct wcsprm *wcs;
+	long npixels = 0;
+	int64_t nsides = ((int64_t) 1) << order;
+
+	int npoints = FOOTPRINT_NPOINTS;
+	double pixcrd[2 * FOOTPRINT_NPOINTS], imgcrd[2 * FOOTPRINT_NPOINTS];
+	double world[2 * FOOTPRINT_NPOINTS];
+	double phi[FOOTPRINT_NPOINTS], theta[FOOTPRINT_NPOINTS];
+	int stat[FOOTPRINT_NPOINTS];
+
+	status = 0;
+	if (fits_open_file(&fptr, filename, READONLY, &status))
+		Logger_log(LOGGER_CRITICAL,
+				"Open FITS file %s failed with status %i\n", filename, status);
+
+	if (fits_get_num_hdus(fptr, &nhdus, &status))
+		Logger_log(LOGGER_CRITICAL,
+				"Read FITS HDUs number failed with status %i\n", status);
+	nhdus--;
+
+	*pixels = ALLOC(sizeof(int64_t) * npoints * (nhdus / 2 + 1));
+
+	for (i=2; i <= nhdus; i+=2) {
+
+		fits_movabs_hdu(fptr, i, &hdutype, &status);
+		field_card = read_field_card(fptr, &nkeys, charnull);
+
+		if (!card_int(field_card, nkeys, "NAXIS1", &naxis1) ||
+				!card_int(field_card, nkeys, "NAXIS2", &naxis2))
+			Logger_log(LOGGER_CRITICAL,
+					"No image size in %s field card %i\n", filename, i);
+
+		status = wcsbth(field_card, nkeys, WCSHDR_all, 0, 0, NULL,
+							&nwcsreject, &nwcs, &wcs);
+		if (status != 0)
+			Logger_log(LOGGER_CRITICAL,
+					"Can not read WCS in sextractor field card\n");
+		FREE(field_card);
+
+		/* pixel centers run from 1 to NAXIS, edges are 0.5 away */
+		for (j=0, k=0; j<=FOOTPRINT_STEPS; j++) {
+			int l;
+			for (l=0; l<=FOOTPRINT_STEPS; l++) {
+				pixcrd[k++] = 0.5 + (double) l / FOOTPRINT_STEPS * naxis1;
+				pixcrd[k++] = 0.5 + (double) j / FOOTPRINT_STEPS * naxis2;
+			}
 		}
 
-		FREE(col_number);
-		FREE(x_image);
-		FREE(y_image);
-		FREE(pixcrd);
-		FREE(imgcrd);
-		FREE(phi);
-		FREE(theta);
-		FREE(world);
-		FREE(stat);
+		wcsp2s(wcs, npoints, 2, pixcrd, imgcrd, phi, theta, world, stat);
 
+		for (j=0; j<npoints; j++) {
+			if (stat[j] != 0)
+				continue;
+			ang2pix_nest64(nsides,
+					SC_HALFPI - world[2*j+1] * TO_RAD,
+					world[2*j] * TO_RAD,
+					&(*pixels)[npixels++]);
+		}
 
+		wcsvfree(&nwcs, &wcs);
 	}
 
 	fits_close_file(fptr, &status);
 
+	return unique_pixels(*pixels, npixels);
+}
+
+
+void
+Catalog_setFastWcs(double tolerance)
+{
+	fastwcs_tolerance = tolerance;
 }
 
 
@@ -230,8 +607,27 @@ Catalog_freeField(Field *field) {
 	for (i=0; i<field->nsets; i++) {
 		FREE(field->sets[i].samples);
 		wcsvfree(&field->sets[i].nwcs, &field->sets[i].wcs);
+		Moc_free(field->sets[i].moc);
 	}
 	FREE(field->sets);
+	Moc_free(field->moc);
+}
+
+
+void
+Catalog_coverField(Field *field)
+{
+	Moc *moc = Moc_new(), *u;
+	int i;
+
+	for (i=0; i<field->nsets; i++) {
+		if (!field->sets[i].moc)
+			continue;
+		u = Moc_union(moc, field->sets[i].moc);
+		Moc_free(moc);
+		moc = u;
+	}
+	field->moc = moc;
 }
 
 
@@ -249,6 +645,65 @@ Catalog_dump(Field *field)
 }
 
 
+static int
+cmp_int64(const void *a, const void *b)
+{
+	int64_t ia = *(const int64_t*) a;
+	int64_t ib = *(const int64_t*) b;
+	return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
+
+/*
+ * Sort "pixels" and remove duplicates. Return the new count.
+ */
+static long
+unique_pixels(
+	int64_t	*pixels,
+	long	npixels)
+{
+	long i, n;
+
+	if (npixels == 0)
+		return 0;
+
+	qsort(pixels, npixels, sizeof(int64_t), cmp_int64);
+	for (i=1, n=1; i<npixels; i++)
+		if (pixels[i] != pixels[n-1])
+			pixels[n++] = pixels[i];
+
+	return n;
+}
+
+/*
+ * Read the integer value of keyword "key" in "card". Return 0 if not found.
+ */
+static int
+card_int(
+	char	*card,
+	int		nkeys,
+	char	*key,
+	int		*value)
+{
+	int i, len = strlen(key);
+	char *rec;
+
+	for (i=0; i<nkeys; i++) {
+		rec = &card[i * 80];
+		if (strncmp(rec, key, len) != 0)
+			continue;
+		if (rec[len] != ' ' && rec[len] != '=')
+			continue;
+		rec = strchr(rec, '=');
+		if (!rec || rec - &card[i * 80] >= 80)
+			continue;
+		*value = atoi(rec + 1);
+		return 1;
+	}
+
+	return 0;
+}
+
+
 static char*
 read_field_card(
 	fitsfile 	*fptr, 
@@ -272,7 +727,7 @@ read_field_card(
 	field_card = ALLOC(sizeof(char) * field_card_size);
 	*nkeys = field_card_size / 80;
 
-	Logger_log(LOGGER_TRACE, "fieldcard size %i, nkeys %i\n", field_card_size, *nkeys);
+	LOGGER_LOG(LOGGER_TRACE, "fieldcard size %i, nkeys %i\n", field_card_size, *nkeys);
 
 	/*
 	 * XXX this is a hack. Fitsio do not know how to read this single column
@@ -291,37 +746,55 @@ read_field_card(
 }
 
 
+void
+test_Catalog_open_ascii_with(
+	char 			*filename, 
+	Field 			*field, 
+	Catalog_addFunc	add,
+	void			*sink) 
+{
+	AsciiCat_openFormat(filename, &AsciiCat_defaultFormat, field, add, sink);
+}
+
+
 void
 test_Catalog_open_ascii(
 	char 		*filename, 
 	Field 		*field, 
 	PixelStore 	*store) 
 {
-	FILE *fp = fopen(filename, "r");
-	int set_size = 10;
-
-	/* This is a single set file */
-	field->nsets = 1;
-	field->sets = ALLOC(sizeof(Set));
-
-	Set set;
-	set.nsamples = 0;
-	set.samples = ALLOC(sizeof(Sample*) * set_size);
-	set.field = field;
-
-	Sample spl;
-	spl.set = &field->sets[0];
-	while (fscanf(fp, "%li %lf %lf\n", &spl.id, &spl.lon, &spl.col) > 0) {
-		if (set.nsamples == set_size) {
-			set.samples = REALLOC(set.samples, sizeof(Sample*) * set_size * 2);
-			set_size *= 2;
-		}
-		PixelStore_add(store, spl, &set.samples[set.nsamples]);
-		set.nsamples++;
-	}
+	test_Catalog_open_ascii_with(
+			filename, field, (Catalog_addFunc) PixelStore_add, store);
+}
+
+
+long
+test_Catalog_footprint_ascii(
+	char	*filename,
+	int		order,
+	int64_t	**pixels)
+{
+	return AsciiCat_footprint(filename, order, pixels);
+}
 
-	field->sets[0] = set;
 
-	fclose(fp);
+bool
+test_Catalog_open_mapped(
+	char 			*filename, 
+	Field 			*field, 
+	Catalog_addFunc	add,
+	void			*sink) 
+{
+	return open_mapped(filename, field, add, sink);
 }
 
+
+void
+test_Catalog_open_cfitsio(
+	char 			*filename, 
+	Field 			*field, 
+	Catalog_addFunc	add,
+	void			*sink) 
+{
+	open_fits(filename, field, add, sink);
+}
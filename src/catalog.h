@@ -18,6 +18,28 @@
 #include "scamp.h"
 #include "pixelstore.h"
 
+/**
+ * Called by catalog loaders for every sample read. "sink" is the store the
+ * sample goes to, and "ext" must be set to point to the stored sample
+ * (see PixelStore_add), or to NULL if the sample is not kept in memory.
+ */
+typedef void (*Catalog_addFunc)(void *sink, Sample spl, Sample **ext);
+
+/**
+ * A catalog loader: Catalog_openWith or any function with the same
+ * signature.
+ */
+typedef void (*Catalog_loadFunc)(
+        char *file, Field *field, Catalog_addFunc add, void *sink);
+
+/**
+ * Return the number of pixels at "order" covered by the samples of a
+ * catalog, and allocate and fill "pixels" with their nested ids. Pixels
+ * must be computed without loading samples (from headers), and may
+ * include more pixels than the samples actually cover.
+ */
+typedef long (*Catalog_footprintFunc)(char *file, int order, int64_t **pixels);
+
 /**
  * Open a catalog. Presently only support sextractor catalogs. The Field
  * structure given in input must be freed by the user with Catalog_free().
@@ -27,6 +49,38 @@
 extern void
 Catalog_open(char *file, Field *field, PixelStore *store);
 
+/**
+ * Same as Catalog_open() but samples are given to "add" with "sink" as
+ * first argument instead of being inserted in a PixelStore.
+ *
+ * When add is PixelStore_add and a cache directory is set (see
+ * SkyCache_setDir), samples are loaded from the cache file of the catalog
+ * if there is one, and written to it otherwise.
+ *
+ * Tread safe.
+ */
+extern void
+Catalog_openWith(char *file, Field *field, Catalog_addFunc add, void *sink);
+
+/**
+ * Project samples with a FastWcs grid, whose error must be below
+ * "tolerance" arcsec, instead of wcsp2s. Sets for which the tolerance can
+ * not be met, or too small to be worth a grid, still use wcsp2s. 0
+ * disables it (the default). Not thread safe.
+ */
+extern void
+Catalog_setFastWcs(double tolerance);
+
+/**
+ * Catalog_footprintFunc for sextractor catalogs. A grid of points over
+ * each image is projected with the WCS of its set, the field card must
+ * contain NAXIS1 and NAXIS2.
+ *
+ * Thread safe.
+ */
+extern long
+Catalog_footprint(char *file, int order, int64_t **pixels);
+
 /**
  * Print the content of catalogs. Used for debugging purpose.
  *
@@ -43,6 +97,13 @@ Catalog_dump(Field *field);
 extern void
 Catalog_freeField(Field *field);
 
+/**
+ * Set the MOC of "field" to the union of the MOCs of its sets. Used by
+ * catalog loaders once every set is loaded.
+ */
+extern void
+Catalog_coverField(Field *field);
+
 
 
 #endif /* __CATALOG_H__ */
@@ -154,9 +154,6 @@ static long nside2order(long nside) {
         return ((nside) & (nside - 1)) ? -1 : ilog2(nside);
 }
 
-static int spread_bits(int v) {
-    return utab[v & 0xff] | (utab[(v >> 8) & 0xff] << 16);
-}
 static void swap_int(int *a, int *b) {int c = *a; *a = *b; *b = c;}
 
 #ifndef __BMI2__
@@ -531,15 +528,14 @@ static long isqrt64(int64_t v) {
     return (long) res;
 }
 
-#ifndef __BMI2__
-static int64_t spread_bits64(int v) {
+static int64_t spread_bits64_table(int v) {
     return (int64_t) (utab[v & 0xff])
             | ((int64_t) (utab[(v >> 8) & 0xff]) << 16)
             | ((int64_t) (utab[(v >> 16) & 0xff]) << 32)
             | ((int64_t) (utab[(v >> 24) & 0xff]) << 48);
 }
 
-static int64_t compress_bits64(int64_t v) {
+static int64_t compress_bits64_table(int64_t v) {
     int64_t raw = v & 0x5555555555555555ull;
     raw |= raw >> 15;
     return ctab[raw & 0xff] | (ctab[(raw >> 8) & 0xff] << 4)
@@ -547,39 +543,107 @@ static int64_t compress_bits64(int64_t v) {
             | (ctab[(raw >> 40) & 0xff] << 20);
 }
 
-static int64_t xyf2nest64(int64_t nside, int ix, int iy, int face_num) {
-    return (face_num * nside * nside) + spread_bits64(ix)
-            + (spread_bits64(iy) << 1);
+static int64_t xyf2nest64_table(int64_t nside, int ix, int iy, int face_num) {
+    return (face_num * nside * nside) + spread_bits64_table(ix)
+            + (spread_bits64_table(iy) << 1);
 }
 
-static void nest2xyf64(int64_t nside, int64_t pix, int *ix, int *iy,
+static void nest2xyf64_table(int64_t nside, int64_t pix, int *ix, int *iy,
+        int *face_num) {
+    int64_t npface_ = nside * nside;
+    *face_num = pix / npface_;
+    pix &= (npface_ - 1);
+    *ix = compress_bits64_table(pix);
+    *iy = compress_bits64_table(pix >> 1);
+}
+
+/* BMI2 versions are compiled for the target whatever the compiler flags,
+   and selected at run time when the CPU supports them. */
+#if defined(__GNUC__) && defined(__x86_64__)
+
+#include <x86intrin.h>
+#include <cpuid.h>
+
+#define HEALPIX_BMI2 1
+
+__attribute__((target("bmi2")))
+static int64_t xyf2nest64_bmi2(int64_t nside, int ix, int iy, int face_num) {
+    return (face_num * nside * nside)
+            + _pdep_u64((uint32_t) ix, 0x5555555555555555ull)
+            + _pdep_u64((uint32_t) iy, 0xaaaaaaaaaaaaaaaaull);
+}
+
+__attribute__((target("bmi2")))
+static void nest2xyf64_bmi2(int64_t nside, int64_t pix, int *ix, int *iy,
         int *face_num) {
     int64_t npface_ = nside * nside;
     *face_num = pix / npface_;
     pix &= (npface_ - 1);
-    *ix = compress_bits64(pix);
-    *iy = compress_bits64(pix >> 1);
+    *ix = _pext_u64(pix, 0x5555555555555555ull);
+    *iy = _pext_u64(pix, 0xaaaaaaaaaaaaaaaaull);
+}
+
+/* pdep/pext are microcoded, and much slower than the tables, before AMD
+   family 19h (Zen 3). */
+static int cpu_has_fast_bmi2(void) {
+    unsigned int eax, ebx, ecx, edx, family;
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("bmi2"))
+        return 0;
+    if (!__builtin_cpu_is("amd"))
+        return 1;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+    family = (eax >> 8) & 0xf;
+    if (family == 0xf)
+        family += (eax >> 20) & 0xff;
+    return family >= 0x19;
+}
+
+/* -1 until the CPU is checked */
+static int use_bmi2 = -1;
+
+static inline int bmi2_enabled(void) {
+    if (use_bmi2 < 0)
+        use_bmi2 = cpu_has_fast_bmi2();
+    return use_bmi2;
 }
 
 #else
 
-static int64_t xyf2nest64 (int64_t nside, int ix, int iy, int face_num)
-{
-    return (face_num*nside*nside)
-    + _pdep_u64(ix,0x5555555555555555ull) + _pdep_u64(iy,0xaaaaaaaaaaaaaaaaull);
+static inline int bmi2_enabled(void) {
+    return 0;
 }
 
-static void nest2xyf64 (int64_t nside, int64_t pix, int *ix, int *iy,
-        int *face_num)
-{
-    int64_t npface_=nside*nside;
-    *face_num = pix/npface_;
-    pix &= (npface_-1);
-    *ix = _pext_u64(pix,0x5555555555555555ull);
-    *iy = _pext_u64(pix,0xaaaaaaaaaaaaaaaaull);
+#endif
+
+int healpix_bmi2(int enable) {
+#ifdef HEALPIX_BMI2
+    use_bmi2 = enable ? cpu_has_fast_bmi2() : 0;
+    return use_bmi2;
+#else
+    return 0;
+#endif
+}
+
+static int64_t xyf2nest64(int64_t nside, int ix, int iy, int face_num) {
+#ifdef HEALPIX_BMI2
+    if (bmi2_enabled())
+        return xyf2nest64_bmi2(nside, ix, iy, face_num);
+#endif
+    return xyf2nest64_table(nside, ix, iy, face_num);
 }
 
+static void nest2xyf64(int64_t nside, int64_t pix, int *ix, int *iy,
+        int *face_num) {
+#ifdef HEALPIX_BMI2
+    if (bmi2_enabled()) {
+        nest2xyf64_bmi2(nside, pix, ix, iy, face_num);
+        return;
+    }
 #endif
+    nest2xyf64_table(nside, pix, ix, iy, face_num);
+}
 
 static inline int64_t special_div64(int64_t a, int64_t b) {
     int64_t t = (a >= (b << 1));
@@ -858,6 +922,128 @@ void ang2pix_nest64(int64_t nside, double theta, double phi, int64_t *ipix) {
     double cth = cos(theta), sth = (fabs(cth) > 0.99) ? sin(theta) : -5;
     *ipix = ang2pix_nest_z_phi64(nside, cth, sth, phi);
 }
+/* batch functions */
+
+#define BATCH_BLOCK 256
+
+/* Same as spread_bits64() with shifts and masks instead of lookups. */
+static inline int64_t spread_bits64_mask(int64_t v) {
+    uint64_t x = (uint64_t) v & 0xffffffffull;
+    x = (x | (x << 16)) & 0x0000ffff0000ffffull;
+    x = (x | (x << 8)) & 0x00ff00ff00ff00ffull;
+    x = (x | (x << 4)) & 0x0f0f0f0f0f0f0f0full;
+    x = (x | (x << 2)) & 0x3333333333333333ull;
+    x = (x | (x << 1)) & 0x5555555555555555ull;
+    return (int64_t) x;
+}
+
+/* Same as ang2pix_nest_z_phi64() for a power of two nside, both regions are
+   computed and the result selected, so that the loop calling it has no
+   branches and can be vectorized. */
+static inline int64_t ang2pix_nest_z_phi64_select(int64_t nside_, int order,
+        double z, double s, double phi) {
+    double za = fabs(z);
+    double tt = ((phi >= 0) && (phi < twopi)) ? phi : fmodulo(phi, twopi);
+    tt *= inv_halfpi; /* in [0,4) */
+
+    /* Equatorial region */
+    double temp1 = nside_ * (0.5 + tt);
+    double temp2 = nside_ * (z * 0.75);
+    int64_t ejp = (int64_t) (temp1 - temp2);
+    int64_t ejm = (int64_t) (temp1 + temp2);
+    int64_t ifp = ejp >> order;
+    int64_t ifm = ejm >> order;
+    int64_t eface = (ifp == ifm) ? (ifp | 4) : ((ifp < ifm) ? ifp : (ifm + 8));
+    int64_t eix = ejm & (nside_ - 1);
+    int64_t eiy = nside_ - (ejp & (nside_ - 1)) - 1;
+
+    /* polar region */
+    int ntt = (int) tt;
+    ntt = (ntt >= 4) ? 3 : ntt;
+    double tp = tt - ntt;
+    double tmp = (s > -2.) ?
+            nside_ * s / sqrt((1. + za) / 3.) : nside_ * sqrt(3 * (1 - za));
+    int pjp = (int64_t) (tp * tmp);
+    int pjm = (int64_t) ((1.0 - tp) * tmp);
+    pjp = (pjp >= nside_) ? nside_ - 1 : pjp;
+    pjm = (pjm >= nside_) ? nside_ - 1 : pjm;
+    int64_t pface = (z >= 0) ? ntt : ntt + 8;
+    int64_t pix = (z >= 0) ? nside_ - pjm - 1 : pjp;
+    int64_t piy = (z >= 0) ? nside_ - pjp - 1 : pjm;
+
+    int equatorial = (za <= twothird);
+    int64_t face_num = equatorial ? eface : pface;
+    int64_t ix = equatorial ? eix : pix;
+    int64_t iy = equatorial ? eiy : piy;
+
+    return (face_num << (2 * order)) + spread_bits64_mask(ix)
+            + (spread_bits64_mask(iy) << 1);
+}
+
+/* Pixels of the "m" positions of cosines "z", sines "s" (or -5, see
+   ang2pix_nest64()) and longitudes "phi". */
+static void pix_nest64_block(int64_t nside, long order, long m,
+        const double *z, const double *s, const double *phi, int64_t *ipix) {
+    long i;
+
+    if (order < 0) {
+        for (i = 0; i < m; ++i)
+            ipix[i] = ang2pix_nest_z_phi64(nside, z[i], s[i], phi[i]);
+        return;
+    }
+
+    for (i = 0; i < m; ++i)
+        ipix[i] = ang2pix_nest_z_phi64_select(nside, order, z[i], s[i], phi[i]);
+}
+
+void ang2pix_nest64_batch(int64_t nside, long n, const double *theta,
+        const double *phi, int64_t *ipix) {
+    double z[BATCH_BLOCK], s[BATCH_BLOCK];
+    long order = nside2order(nside);
+    long i, b, m;
+
+    for (b = 0; b < n; b += BATCH_BLOCK) {
+        m = (n - b < BATCH_BLOCK) ? n - b : BATCH_BLOCK;
+
+        /* same libm calls as ang2pix_nest64(), for identical results */
+        for (i = 0; i < m; ++i) {
+            UTIL_ASSERT((theta[b + i] >= 0) && (theta[b + i] <= pi),
+                    "theta out of range");
+            z[i] = cos(theta[b + i]);
+        }
+        for (i = 0; i < m; ++i)
+            s[i] = (fabs(z[i]) > 0.99) ? sin(theta[b + i]) : -5;
+
+        pix_nest64_block(nside, order, m, z, s, &phi[b], &ipix[b]);
+    }
+}
+
+void ang2pix_vec_nest64_batch(int64_t nside, long n, const double *theta,
+        const double *phi, int64_t *ipix, double *vec) {
+    double z[BATCH_BLOCK], s[BATCH_BLOCK];
+    long order = nside2order(nside);
+    long i, b, m;
+
+    for (b = 0; b < n; b += BATCH_BLOCK) {
+        m = (n - b < BATCH_BLOCK) ? n - b : BATCH_BLOCK;
+
+        /* a single trigonometric pass, with the libm calls of ang2vec()
+           and ang2pix_nest64(), for identical results */
+        for (i = 0; i < m; ++i) {
+            double t = theta[b + i], p = phi[b + i], st;
+            UTIL_ASSERT((t >= 0) && (t <= pi), "theta out of range");
+            st = sin(t);
+            z[i] = cos(t);
+            s[i] = (fabs(z[i]) > 0.99) ? st : -5;
+            vec[3 * (b + i)] = st * cos(p);
+            vec[3 * (b + i) + 1] = st * sin(p);
+            vec[3 * (b + i) + 2] = z[i];
+        }
+
+        pix_nest64_block(nside, order, m, z, s, &phi[b], &ipix[b]);
+    }
+}
+
 void vec2pix_ring64(int64_t nside, const double *vec, int64_t *ipix) {
     double vlen = sqrt(vec[0] * vec[0] + vec[1] * vec[1] + vec[2] * vec[2]);
     double cth = vec[2] / vlen;
@@ -920,6 +1106,49 @@ void ring2nest64(int64_t nside, int64_t ipring, int64_t *ipnest) {
     ring2xyf64(nside, ipring, &ix, &iy, &face_num);
     *ipnest = xyf2nest64(nside, ix, iy, face_num);
 }
+/* Neighbors of a pixel not on the border of its face. */
+static void neighbours_interior64_table(int64_t fpix, int ix, int iy,
+        int64_t *neighbours) {
+    int64_t px0 = spread_bits64_table(ix);
+    int64_t py0 = spread_bits64_table(iy) << 1;
+    int64_t pxp = spread_bits64_table(ix + 1);
+    int64_t pyp = spread_bits64_table(iy + 1) << 1;
+    int64_t pxm = spread_bits64_table(ix - 1);
+    int64_t pym = spread_bits64_table(iy - 1) << 1;
+
+    neighbours[0] = fpix + pxm + py0;
+    neighbours[1] = fpix + pxm + pyp;
+    neighbours[2] = fpix + px0 + pyp;
+    neighbours[3] = fpix + pxp + pyp;
+    neighbours[4] = fpix + pxp + py0;
+    neighbours[5] = fpix + pxp + pym;
+    neighbours[6] = fpix + px0 + pym;
+    neighbours[7] = fpix + pxm + pym;
+}
+
+#ifdef HEALPIX_BMI2
+__attribute__((target("bmi2")))
+static void neighbours_interior64_bmi2(int64_t fpix, int ix, int iy,
+        int64_t *neighbours) {
+    const uint64_t mx = 0x5555555555555555ull, my = 0xaaaaaaaaaaaaaaaaull;
+    int64_t px0 = _pdep_u64((uint32_t) ix, mx);
+    int64_t py0 = _pdep_u64((uint32_t) iy, my);
+    int64_t pxp = _pdep_u64((uint32_t) (ix + 1), mx);
+    int64_t pyp = _pdep_u64((uint32_t) (iy + 1), my);
+    int64_t pxm = _pdep_u64((uint32_t) (ix - 1), mx);
+    int64_t pym = _pdep_u64((uint32_t) (iy - 1), my);
+
+    neighbours[0] = fpix + pxm + py0;
+    neighbours[1] = fpix + pxm + pyp;
+    neighbours[2] = fpix + px0 + pyp;
+    neighbours[3] = fpix + pxp + pyp;
+    neighbours[4] = fpix + pxp + py0;
+    neighbours[5] = fpix + pxp + pym;
+    neighbours[6] = fpix + px0 + pym;
+    neighbours[7] = fpix + pxm + pym;
+}
+#endif
+
 void neighbours_nest64(int64_t nside, int64_t pix, int64_t *neighbours) {
     int i, x, y, nbnum, ix, iy, face_num;
     int64_t nsm1;
@@ -927,24 +1156,14 @@ void neighbours_nest64(int64_t nside, int64_t pix, int64_t *neighbours) {
     int order = nside2order(nside);
     nsm1 = nside -1;
     if ((ix>0) && (ix<nsm1) && (iy>0) && (iy<nsm1)) {
-        int64_t fpix = (long) face_num << (2 * order);
-        int64_t px0 = spread_bits(ix);
-        int64_t py0 = spread_bits(iy) << 1;
-        int64_t pxp = spread_bits(ix + 1);
-        int64_t pyp = spread_bits(iy + 1) << 1;
-        int64_t pxm = spread_bits(ix - 1);
-        int64_t pym = spread_bits(iy - 1) << 1;
-
-        neighbours[0] = fpix + pxm + py0;
-        neighbours[1] = fpix + pxm + pyp;
-        neighbours[2] = fpix + px0 + pyp;
-        neighbours[3] = fpix + pxp + pyp;
-        neighbours[4] = fpix + pxp + py0;
-        neighbours[5] = fpix + pxp + pym;
-        neighbours[6] = fpix + px0 + pym;
-        neighbours[7] = fpix + pxm + pym;
-
-
+        int64_t fpix = (int64_t) face_num << (2 * order);
+#ifdef HEALPIX_BMI2
+        if (bmi2_enabled()) {
+            neighbours_interior64_bmi2(fpix, ix, iy, neighbours);
+            return;
+        }
+#endif
+        neighbours_interior64_table(fpix, ix, iy, neighbours);
     } else {
         for (i=0; i<8; i++) {
             x = ix + nb_xoffset[i];
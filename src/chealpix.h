@@ -110,6 +110,16 @@ void pix2vec_ring(long nside, long ipix, double *vec);
 /*! Sets \a *ipix to the pixel number in NEST scheme at resolution \a nside,
     which contains the position \a theta, \a phi. */
 void ang2pix_nest64(int64_t nside, double theta, double phi, int64_t *ipix);
+/*! Same as ang2pix_nest64() for the \a n positions \a theta, \a phi.
+    Results are identical to the scalar version. */
+void ang2pix_nest64_batch(int64_t nside, long n, const double *theta,
+        const double *phi, int64_t *ipix);
+/*! Same as ang2pix_nest64() and ang2vec() for the \a n positions \a theta,
+    \a phi, with the sines and cosines computed once. \a vec must point to
+    storage sufficient for 3 * \a n doubles. Results are identical to the
+    scalar versions. */
+void ang2pix_vec_nest64_batch(int64_t nside, long n, const double *theta,
+        const double *phi, int64_t *ipix, double *vec);
 /*! Sets \a *ipix to the pixel number in RING scheme at resolution \a nside,
     which contains the position \a theta, \a phi. */
 void ang2pix_ring64(int64_t nside, double theta, double phi, int64_t *ipix);
@@ -150,6 +160,10 @@ void pix2vec_ring64(int64_t nside, int64_t ipix, double *vec);
     of 8 long minimum. Negative number in neighbors, means it is inexistent.
     There can be 7 to 8 valid neighbors. */
 void neighbours_nest64(long nside, long pix, long *neighbours);
+/*! Enable or disable the BMI2 (pdep/pext) versions of the 64 bit nested
+    functions. They are enabled by default when the CPU has fast BMI2
+    instructions. Returns 1 if they are now in use. */
+int healpix_bmi2(int enable);
 /*! Returns the distance angle between two vectors in radiant. Vectors do not
     have to be normalized. TODO tests*/
 double angdist(double *vector_A, double *vector_B);
@@ -0,0 +1,441 @@
+/*
+ * Out of core cross matching, by chunks of coarse healpix pixels.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chunkstore.h"
+#include "crossmatch.h"
+#include "pixelstore.h"
+#include "chealpix.h"
+#include "logger.h"
+#include "trace.h"
+#include "mem.h"
+
+#define SPILL_BUFSIZE (1 << 18)
+#define READ_BLOCK 4096
+
+
+/******************************************************************************
+ * PRIVATE FUNCTIONS
+ */
+static int
+nsides_order(int64_t nsides)
+{
+	int order = 0;
+	while ((((int64_t) 1) << order) < nsides)
+		order++;
+	return order;
+}
+
+static int
+cmp_int64(const void *a, const void *b)
+{
+	int64_t ia = *(const int64_t*) a;
+	int64_t ib = *(const int64_t*) b;
+	return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
+
+static void
+spill_path(ChunkStore *store, int order, int64_t chunk, char *path, int size)
+{
+	snprintf(path, size, "%s/scamp-chunk-%i-%i-%li.spl",
+			store->spilldir, (int) getpid(), order, (long) chunk);
+}
+
+static FILE*
+spill_open(char *path, char *mode)
+{
+	FILE *fp = fopen(path, mode);
+	if (!fp)
+		Logger_log(LOGGER_CRITICAL, "Can not open spill file %s\n", path);
+	return fp;
+}
+
+static void
+spill_write(FILE *fp, ChunkRecord *rec)
+{
+	if (fwrite(rec, sizeof(ChunkRecord), 1, fp) != 1)
+		Logger_log(LOGGER_CRITICAL, "Write to spill file failed\n");
+}
+
+/*
+ * Write "rec", a record of "chunk" at "order", to the files of the four sub
+ * pixels of "chunk" it belongs to.
+ */
+static void
+split_record(
+	ChunkStore	*store,
+	int			order,
+	int64_t		chunk,
+	ChunkRecord	*rec,
+	FILE		**children,
+	long		*nchildren)
+{
+	int64_t routes[9];
+	int i, n;
+
+	n = ChunkStore_route(store->nsides, order + 1, rec->pix_nest, routes);
+	for (i=0; i<n; i++) {
+		if ((routes[i] >> 2) != chunk)
+			continue;
+		spill_write(children[routes[i] & 3], rec);
+		nchildren[routes[i] & 3]++;
+	}
+}
+
+static long process_chunk(ChunkStore*,int,int64_t,long,double,int,
+		ChunkStore_matchFunc,void*);
+
+/*
+ * Split the content of "fp" (or "records" if already in memory) in the four
+ * sub pixels of "chunk", then process them.
+ */
+static long
+split_chunk(
+	ChunkStore				*store,
+	int						order,
+	int64_t					chunk,
+	FILE					*fp,
+	ChunkRecord				*records,
+	long					nrecords,
+	double					radius_arcsec,
+	int						nthreads,
+	ChunkStore_matchFunc	onmatch,
+	void					*udata)
+{
+	char path[1024];
+	FILE *children[4];
+	long nchildren[4];
+	long i, n, nmatches;
+	int k;
+
+	for (k=0; k<4; k++) {
+		spill_path(store, order + 1, chunk * 4 + k, path, sizeof(path));
+		children[k] = spill_open(path, "w");
+		setvbuf(children[k], NULL, _IOFBF, SPILL_BUFSIZE);
+		nchildren[k] = 0;
+	}
+
+	if (records) {
+		for (i=0; i<nrecords; i++)
+			split_record(store, order, chunk, &records[i], children, nchildren);
+	} else {
+		ChunkRecord *block = ALLOC(sizeof(ChunkRecord) * READ_BLOCK);
+		while ((n = fread(block, sizeof(ChunkRecord), READ_BLOCK, fp)) > 0)
+			for (i=0; i<n; i++)
+				split_record(store, order, chunk, &block[i], children, nchildren);
+		FREE(block);
+	}
+
+	for (k=0; k<4; k++)
+		if (fclose(children[k]) != 0)
+			Logger_log(LOGGER_CRITICAL, "Write to spill file failed\n");
+
+	LOGGER_LOG(LOGGER_DEBUG, "Chunk %li at order %i split: %li %li %li %li\n",
+			chunk, order, nchildren[0], nchildren[1], nchildren[2], nchildren[3]);
+
+	nmatches = 0;
+	for (k=0; k<4; k++)
+		nmatches += process_chunk(store, order + 1, chunk * 4 + k,
+				nchildren[k], radius_arcsec, nthreads, onmatch, udata);
+
+	return nmatches;
+}
+
+/*
+ * Cross match the chunk spilled in its file, or split it if it does not fit
+ * in the memory budget. The spill file is removed.
+ */
+static long
+process_chunk(
+	ChunkStore				*store,
+	int						order,
+	int64_t					chunk,
+	long					nrecords,
+	double					radius_arcsec,
+	int						nthreads,
+	ChunkStore_matchFunc	onmatch,
+	void					*udata)
+{
+	char path[1024];
+	FILE *fp;
+	ChunkRecord *records;
+	long i, npixels, nmatches;
+	bool splittable = order < store->order;
+
+	spill_path(store, order, chunk, path, sizeof(path));
+	if (nrecords == 0) {
+		unlink(path);
+		return 0;
+	}
+
+	fp = spill_open(path, "r");
+
+	/* records alone do not fit, split without loading them */
+	if (splittable && sizeof(ChunkRecord) * nrecords > store->budget) {
+		unlink(path);
+		nmatches = split_chunk(store, order, chunk, fp, NULL, 0,
+				radius_arcsec, nthreads, onmatch, udata);
+		fclose(fp);
+		return nmatches;
+	}
+
+	records = ALLOC(sizeof(ChunkRecord) * nrecords);
+	if (fread(records, sizeof(ChunkRecord), nrecords, fp) != nrecords)
+		Logger_log(LOGGER_CRITICAL, "Short read on spill file %s\n", path);
+	fclose(fp);
+	unlink(path);
+
+	/* count pixels to estimate the memory used by the store */
+	int64_t *pixids = ALLOC(sizeof(int64_t) * nrecords);
+	for (i=0; i<nrecords; i++)
+		pixids[i] = records[i].pix_nest;
+	qsort(pixids, nrecords, sizeof(int64_t), cmp_int64);
+	for (i=1, npixels=1; i<nrecords; i++)
+		if (pixids[i] != pixids[i-1])
+			npixels++;
+	FREE(pixids);
+
+	long bytes = sizeof(ChunkRecord) * nrecords + sizeof(Sample*) * nrecords +
+			PixelStore_estimateBytes(nrecords, npixels);
+
+	if (bytes > store->budget) {
+		if (splittable) {
+			nmatches = split_chunk(store, order, chunk, NULL, records, nrecords,
+					radius_arcsec, nthreads, onmatch, udata);
+			FREE(records);
+			return nmatches;
+		}
+		Logger_log(LOGGER_NORMAL,
+				"Chunk %li at order %i exceeds memory budget (%li bytes)\n",
+				chunk, order, bytes);
+	}
+
+	Trace_begin("chunk", "order %i chunk %li", order, (long) chunk);
+	nmatches = ChunkStore_crossRecords(store->nsides, order, chunk, chunk,
+			records, nrecords, radius_arcsec, nthreads, onmatch, udata);
+	Trace_end();
+	FREE(records);
+
+	return nmatches;
+}
+
+/**
+ * PRIVATE FUNCTIONS END
+ ******************************************************************************/
+
+
+
+/******************************************************************************
+ * PUBLIC FUNCTIONS
+ */
+ChunkStore*
+ChunkStore_new(
+	int64_t	nsides,
+	char	*spilldir,
+	long	budget_bytes)
+{
+	char path[1024];
+	int i;
+
+	ChunkStore *store = ALLOC(sizeof(ChunkStore));
+	store->nsides	= nsides;
+	store->order	= nsides_order(nsides);
+	store->spilldir	= strdup(spilldir);
+	store->budget	= budget_bytes;
+	store->nsamples	= 0;
+
+	for (i=0; i<CHUNKSTORE_NBASE; i++) {
+		spill_path(store, 0, i, path, sizeof(path));
+		store->spill[i] = spill_open(path, "w");
+		setvbuf(store->spill[i], NULL, _IOFBF, SPILL_BUFSIZE);
+		store->nspill[i] = 0;
+	}
+
+	return store;
+}
+
+
+void
+ChunkStore_add(
+	ChunkStore	*store,
+	Sample		spl,
+	Sample		**ext)
+{
+	ChunkRecord rec;
+	int64_t routes[9];
+	int i, n;
+
+	rec.set = spl.set;
+	rec.row = ext - spl.set->samples;
+	rec.id  = spl.id;
+	rec.lon = spl.lon;
+	rec.col = spl.col;
+	ang2pix_nest64(store->nsides, spl.col, spl.lon, &rec.pix_nest);
+
+	n = ChunkStore_route(store->nsides, 0, rec.pix_nest, routes);
+	for (i=0; i<n; i++) {
+		spill_write(store->spill[routes[i]], &rec);
+		store->nspill[routes[i]]++;
+	}
+	store->nsamples++;
+
+	*ext = NULL;
+}
+
+
+long
+ChunkStore_crossSamples(
+	ChunkStore				*store,
+	double					radius_arcsec,
+	int						nthreads,
+	ChunkStore_matchFunc	onmatch,
+	void					*udata)
+{
+	long nmatches = 0;
+	int i;
+
+	for (i=0; i<CHUNKSTORE_NBASE; i++) {
+		if (!store->spill[i])
+			continue;
+		if (fclose(store->spill[i]) != 0)
+			Logger_log(LOGGER_CRITICAL, "Write to spill file failed\n");
+		store->spill[i] = NULL;
+	}
+
+	for (i=0; i<CHUNKSTORE_NBASE; i++)
+		nmatches += process_chunk(store, 0, i, store->nspill[i],
+				radius_arcsec, nthreads, onmatch, udata);
+
+	Logger_log(LOGGER_NORMAL,
+			"Chunked crossmatch end: %li matches for %li samples\n",
+			nmatches, store->nsamples);
+
+	return nmatches;
+}
+
+
+void
+ChunkStore_free(ChunkStore *store)
+{
+	char path[1024];
+	int i;
+
+	for (i=0; i<CHUNKSTORE_NBASE; i++) {
+		if (!store->spill[i])
+			continue;
+		fclose(store->spill[i]);
+		spill_path(store, 0, i, path, sizeof(path));
+		unlink(path);
+	}
+
+	free(store->spilldir);
+	FREE(store);
+}
+
+
+int
+ChunkStore_route(
+	int64_t	nsides,
+	int		order,
+	int64_t	pix_nest,
+	int64_t	*chunks)
+{
+	int64_t neighbors[8], c;
+	int shift = 2 * (nsides_order(nsides) - order);
+	int i, j, n;
+
+	chunks[0] = pix_nest >> shift;
+	n = 1;
+
+	neighbours_nest64(nsides, pix_nest, neighbors);
+	for (i=0; i<8; i++) {
+		if (neighbors[i] < 0)
+			continue;
+		c = neighbors[i] >> shift;
+		for (j=0; j<n; j++)
+			if (chunks[j] == c)
+				break;
+		if (j == n)
+			chunks[n++] = c;
+	}
+
+	return n;
+}
+
+
+long
+ChunkStore_crossRecords(
+	int64_t					nsides,
+	int						order,
+	int64_t					first,
+	int64_t					last,
+	ChunkRecord				*records,
+	long					nrecords,
+	double					radius_arcsec,
+	int						nthreads,
+	ChunkStore_matchFunc	onmatch,
+	void					*udata)
+{
+	int shift = 2 * (nsides_order(nsides) - order);
+	long i, nmatches = 0;
+	int64_t chunk;
+	Sample *s;
+
+	PixelStore *store = PixelStore_new(nsides);
+	Sample **slots = ALLOC(sizeof(Sample*) * nrecords);
+	Sample *spls = ALLOC(sizeof(Sample) * nrecords);
+	Sample ***exts = ALLOC(sizeof(Sample**) * nrecords);
+
+	/*
+	 * Sample id is the record index, so that we can go back from
+	 * bestMatch to the original sample.
+	 */
+	for (i=0; i<nrecords; i++) {
+		spls[i].id	= i;
+		spls[i].lon	= records[i].lon;
+		spls[i].col	= records[i].col;
+		spls[i].set	= records[i].set;
+		exts[i] = &slots[i];
+	}
+	PixelStore_addBatch(store, spls, nrecords, exts);
+	FREE(spls);
+	FREE(exts);
+
+	Crossmatch_crossSamples(store, radius_arcsec, nthreads);
+
+	/* halo samples may miss some of their neighbors, ignore them */
+	for (i=0; i<nrecords; i++) {
+		chunk = records[i].pix_nest >> shift;
+		if (chunk < first || chunk > last)
+			continue;
+		s = slots[i];
+		if (s->bestMatch == NULL)
+			continue;
+		nmatches++;
+		if (onmatch)
+			onmatch(udata, &records[i], &records[s->bestMatch->id],
+					s->bestMatchDistance);
+	}
+
+	FREE(slots);
+	PixelStore_free(store);
+
+	return nmatches;
+}
+/**
+ * PUBLIC FUNCTIONS END
+ ******************************************************************************/
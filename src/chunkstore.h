@@ -0,0 +1,103 @@
+/*
+ * Out of core cross matching, by chunks of coarse healpix pixels.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __CHUNKSTORE_H__
+#define __CHUNKSTORE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "scamp.h"
+
+/*
+ * Compact copy of a sample, as written to spill files.
+ */
+typedef struct ChunkRecord {
+    Set     *set;       /* set of the original sample */
+    long    row;        /* index of the sample in set->samples */
+    long    id;
+    double  lon;
+    double  col;
+    int64_t pix_nest;   /* at the ChunkStore nsides */
+} ChunkRecord;
+
+/*
+ * Called for every sample owned by a chunk having a match. "distance" is the
+ * euclidean distance between the two samples vectors.
+ */
+typedef void (*ChunkStore_matchFunc)(
+        void *udata, ChunkRecord *spl, ChunkRecord *match, double distance);
+
+#define CHUNKSTORE_NBASE 12
+
+/**
+ * A ChunkStore does not keep samples in memory, but spill them in one file
+ * per base healpix pixel (a chunk). At cross match time, each chunk is
+ * loaded with its halo (samples from neighbor chunks lying in a pixel
+ * adjacent to the chunk), and cross matched in a temporary PixelStore.
+ * Chunks too large for the memory budget are split in their four nested
+ * sub pixels until they fit.
+ */
+typedef struct ChunkStore {
+    int64_t nsides;
+    int     order;          /* log2(nsides) */
+    char    *spilldir;      /* where spill files are written */
+    long    budget;         /* max bytes used by a chunk in memory */
+    FILE    *spill[CHUNKSTORE_NBASE];
+    long    nspill[CHUNKSTORE_NBASE];
+    long    nsamples;
+} ChunkStore;
+
+
+extern ChunkStore*
+ChunkStore_new(int64_t nsides, char *spilldir, long budget_bytes);
+
+/*
+ * Spill "spl". Used as a Catalog_addFunc, set "ext" to NULL: the sample is
+ * not kept in memory.
+ */
+extern void
+ChunkStore_add(ChunkStore *store, Sample spl, Sample **ext);
+
+/*
+ * Cross match every chunks one after the other, and call "onmatch" for
+ * every matching sample. Spill files are removed. Return the number of
+ * samples having a match.
+ */
+extern long
+ChunkStore_crossSamples(ChunkStore *store, double radius_arcsec, int nthreads,
+        ChunkStore_matchFunc onmatch, void *udata);
+
+extern void
+ChunkStore_free(ChunkStore *store);
+
+/*
+ * Fill "chunks" with the pixels at "order" where a sample in pixel
+ * "pix_nest" at "nsides" must be: its own pixel first, then pixels it is
+ * in the halo of. Return the number of pixels written (up to 9).
+ */
+extern int
+ChunkStore_route(int64_t nsides, int order, int64_t pix_nest, int64_t *chunks);
+
+/*
+ * Cross match "records", the content of chunks "first" to "last" at "order"
+ * with their halo, and call "onmatch" for samples owned by these chunks.
+ * Return the number of owned samples having a match.
+ */
+extern long
+ChunkStore_crossRecords(int64_t nsides, int order, int64_t first,
+        int64_t last, ChunkRecord *records, long nrecords,
+        double radius_arcsec, int nthreads, ChunkStore_matchFunc onmatch,
+        void *udata);
+
+#endif /* __CHUNKSTORE_H__ */
@@ -17,43 +17,155 @@
 #include <omp.h>
 #include <time.h>
 #include <pthread.h>
+#include <string.h>
 
 #include "crossmatch.h"
 #include "logger.h"
 #include "mem.h"
 #include "chealpix.h"
 #include "pixelstore.h"
+#include "perfcount.h"
+#include "trace.h"
 
 static void crossmatch(Sample*,Sample*);
 static long cross_pixel(HealPixel*,PixelStore*,double);
+static void cross_pixel_atomic(HealPixel*,PixelStore*,double);
+static inline double dist(double*,double*);
 
 static long ntestmatches;
 
+static int engine = CROSSMATCH_LOCKED;
+
+/* Sample.packedMatch value of a sample without match */
+#define PACKED_NONE UINT64_MAX
+
 static pthread_mutex_t CMUTEX = PTHREAD_MUTEX_INITIALIZER;
 
 #define NNEIGHBORS 8
 
+/* pixels of a trace span of the crossmatch threads */
+#define TRACE_PIXELS 4096
+
 struct thread_args {
 	PixelStore 	*store;
 	int64_t 	*pixelindex;
 	int 		npixs;
 	double 		radius;
 	int 		*result;
+	int 		thread;
 };
 
+/* a query of Crossmatch_coneSearch, sorted by pixel */
+struct cone_query {
+	int64_t	pix;
+	long	index;
+};
+
+enum {
+	CONES_PREPARE,	/* pixel and vector of queries by index */
+	CONES_COUNT,	/* results of sorted queries */
+	CONES_FILL
+};
+
+struct cones_args {
+	PixelStore		*store;
+	CrossmatchCones	*cones;
+	double			*ra;
+	double			*dec;
+	double			radius;
+	int				phase;
+	long			first;
+	long			last;
+	int				thread;
+};
+
+
+/*
+ * Give every sample a store wide index, following pixelids order, and
+ * reset packedMatch. Return the index to sample table.
+ */
+static Sample**
+index_samples(PixelStore *store)
+{
+	HealPixel *pix;
+	long i, j, n;
+	Sample **index;
+
+	for (i=0, n=0; i<store->npixels; i++)
+		n += PixelStore_get(store, store->pixelids[i])->nsamples;
+
+	if (n >= PACKED_NONE >> 32)
+		Logger_log(LOGGER_CRITICAL,
+				"Too many samples for the atomic crossmatch (%li)\n", n);
+
+	index = ALLOC(sizeof(Sample*) * (n + 1));
+
+	for (i=0, n=0; i<store->npixels; i++) {
+		pix = PixelStore_get(store, store->pixelids[i]);
+		pix->first = n;
+		for (j=0; j<pix->nsamples; j++) {
+			pix->samples[j].packedMatch = PACKED_NONE;
+			index[n++] = &pix->samples[j];
+		}
+	}
+
+	return index;
+}
+
+/*
+ * Set bestMatch and bestMatchDistance from packedMatch. Return the number
+ * of samples having a match.
+ */
+static long
+resolve_samples(PixelStore *store, Sample **index)
+{
+	HealPixel *pix;
+	Sample *spl;
+	long i, j, nmatches = 0;
+
+	for (i=0; i<store->npixels; i++) {
+		pix = PixelStore_get(store, store->pixelids[i]);
+		for (j=0; j<pix->nsamples; j++) {
+			spl = &pix->samples[j];
+			if (spl->packedMatch == PACKED_NONE)
+				continue;
+			spl->bestMatch = index[spl->packedMatch & 0xffffffff];
+			spl->bestMatchDistance = dist(spl->vector, spl->bestMatch->vector);
+			nmatches++;
+		}
+	}
+
+	return nmatches;
+}
 
 void*
 pthread_cross_pixel(void *args) 
 {
 	struct thread_args *ta = (struct thread_args*) args;
 
+	PerfCounters counters;
+	PerfCount_start(&counters);
+
 	int i;
 	int nmatches = 0;
 	for (i=0; i<ta->npixs; i++) {
+		if (i % TRACE_PIXELS == 0) {
+			if (i > 0)
+				Trace_end();
+			Trace_begin("cross_pixels", "%i to %i", i,
+					i + TRACE_PIXELS < ta->npixs ? i + TRACE_PIXELS : ta->npixs);
+		}
 		HealPixel *pix = PixelStore_get(ta->store, ta->pixelindex[i]);
-		nmatches += cross_pixel(pix, ta->store, ta->radius);
+		if (engine == CROSSMATCH_ATOMIC)
+			cross_pixel_atomic(pix, ta->store, ta->radius);
+		else
+			nmatches += cross_pixel(pix, ta->store, ta->radius);
 	}
 
+	if (ta->npixs > 0)
+		Trace_end();
+	PerfCount_stop(&counters, "match", ta->thread);
+
 	*(ta->result) = nmatches;
 	return NULL;
 }
@@ -67,10 +179,19 @@ Crossmatch_crossSamples(
 {
 	int i;
 
+	Trace_begin("Crossmatch_crossSamples", "%li pixels", pixstore->npixels);
+
 	/* arcsec to radiant */
 	double radius = radius_arcsec / 3600 * TO_RAD;
 	PixelStore_setMaxRadius(pixstore, radius);
 
+	if (!pixstore->linked)
+		PixelStore_linkNeighbors(pixstore, nthreads);
+
+	Sample **index = NULL;
+	if (engine == CROSSMATCH_ATOMIC)
+		index = index_samples(pixstore);
+
 
 	/* allocate mem */
 	pthread_t *threads			= ALLOC(sizeof(pthread_t) * nthreads);
@@ -97,6 +218,7 @@ Crossmatch_crossSamples(
 		arg->pixelindex = pixelindex;
 		arg->npixs 		= npixs[i];
 		arg->result 	= &results[i];
+		arg->thread 	= i;
 
 		/* launch! */
 		pthread_create(&threads[i], NULL, pthread_cross_pixel, arg);
@@ -114,8 +236,15 @@ Crossmatch_crossSamples(
 
 	/* reduce */
 	long nmatches = 0;
-	for (i=0; i<nthreads; i++)
-		nmatches += results[i];
+	if (engine == CROSSMATCH_ATOMIC) {
+		Trace_begin("resolve", NULL);
+		nmatches = resolve_samples(pixstore, index);
+		Trace_end();
+		FREE(index);
+	} else {
+		for (i=0; i<nthreads; i++)
+			nmatches += results[i];
+	}
 
 
 	/* cleanup */
@@ -128,6 +257,8 @@ Crossmatch_crossSamples(
 	Logger_log(LOGGER_NORMAL,
 			"Crossmatch end: %li matches for all pixels!\n", nmatches);
 
+	Trace_end();
+
 	return nmatches;
 
 }
@@ -272,6 +403,385 @@ cross_pixel(HealPixel *pix, PixelStore *store, double radius)
 }
 
 
+static inline uint64_t
+pack_match(double distance, long index)
+{
+	float f = (float) distance;
+	uint32_t bits;
+
+	/* positive floats sort as their bits */
+	memcpy(&bits, &f, sizeof(bits));
+	return ((uint64_t) bits << 32) | (uint64_t) index;
+}
+
+static inline void
+update_match(uint64_t *word, uint64_t packed)
+{
+	uint64_t current = __atomic_load_n(word, __ATOMIC_RELAXED);
+
+	while (packed < current)
+		if (__atomic_compare_exchange_n(word, &current, packed, true,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			break;
+}
+
+static inline void
+crossmatch_atomic(
+	Sample	*a,
+	long	ia,
+	Sample	*b,
+	long	ib,
+	double	maxradius)
+{
+	double distance = dist(a->vector, b->vector);
+
+	if (distance >= maxradius)
+		return;
+
+	update_match(&a->packedMatch, pack_match(distance, ib));
+	update_match(&b->packedMatch, pack_match(distance, ia));
+}
+
+/*
+ * Same as cross_pixel(), without locks: a pixel is crossed with the
+ * neighbors having a greater id only, so that every pair of pixels is
+ * crossed once.
+ */
+static void
+cross_pixel_atomic(HealPixel *pix, PixelStore *store, double radius)
+{
+	long j, k, l;
+	Sample *current_spl, *test_spl;
+	HealPixel *test_pixel;
+
+	for (j=0; j<pix->nsamples; j++) {
+		current_spl = &pix->samples[j];
+
+		for (k=0; k<j; k++) {
+			test_spl = &pix->samples[k];
+
+			if (current_spl->set->field == test_spl->set->field)
+				continue;
+
+			if (fabs(current_spl->col - test_spl->col) > radius)
+				continue;
+
+			crossmatch_atomic(current_spl, pix->first + j,
+					test_spl, pix->first + k, store->maxradius);
+		}
+
+		for (k=0; k<NNEIGHBORS; k++) {
+			test_pixel = pix->pneighbors[k];
+			if (test_pixel == NULL || test_pixel->id <= pix->id)
+				continue;
+
+			for (l=0; l<test_pixel->nsamples; l++) {
+				test_spl = &test_pixel->samples[l];
+
+				if (current_spl->set->field == test_spl->set->field)
+					continue;
+
+				if (fabs(current_spl->col - test_spl->col) > radius)
+					continue;
+
+				crossmatch_atomic(current_spl, pix->first + j,
+						test_spl, test_pixel->first + l, store->maxradius);
+			}
+		}
+	}
+}
+
+
+/*
+ * The euclidean distance between unit vectors "radius_arcsec" apart, the
+ * distance samples are compared with, see PixelStore_setMaxRadius.
+ */
+static double
+chord_radius(double radius_arcsec)
+{
+	double va[3], vb[3];
+	ang2vec(0, 0, va);
+	ang2vec(radius_arcsec / 3600 * TO_RAD, 0, vb);
+	return euclidean_distance(va, vb);
+}
+
+/*
+ * Update "best" and "bestdist" with the samples of "pix" closer to
+ * "vector".
+ */
+static inline void
+nearest_in_pixel(HealPixel *pix, double *vector, Sample **best,
+		double *bestdist)
+{
+	double d;
+	int j;
+
+	for (j=0; j<pix->nsamples; j++) {
+		d = dist(vector, pix->samples[j].vector);
+		if (d < *bestdist) {
+			*bestdist = d;
+			*best = &pix->samples[j];
+		}
+	}
+}
+
+/*
+ * PixelStore_get() for any store, searching the sorted ids of linked
+ * stores, faster than the tree.
+ */
+static inline HealPixel*
+lookup_pixel(PixelStore *store, int64_t id)
+{
+	long i;
+
+	if (!store->linked)
+		return PixelStore_get(store, id);
+	i = PixelStore_find(store, id);
+	return i >= 0 ? store->pixelarray[i] : NULL;
+}
+
+
+Sample*
+Crossmatch_nearest(
+	PixelStore	*store,
+	double		ra,
+	double		dec,
+	double		radius_arcsec,
+	double		*distance)
+{
+	double col = SC_HALFPI - dec * TO_RAD, lon = ra * TO_RAD;
+	double vector[3], bestdist = chord_radius(radius_arcsec);
+	int64_t id;
+	long nb[NNEIGHBORS];
+	Sample *best = NULL;
+	HealPixel *pix, *test_pixel;
+	int k;
+
+	ang2pix_nest64(store->nsides, col, lon, &id);
+	ang2vec(col, lon, vector);
+
+	pix = lookup_pixel(store, id);
+	if (pix)
+		nearest_in_pixel(pix, vector, &best, &bestdist);
+
+	if (pix && store->linked) {
+		for (k=0; k<NNEIGHBORS; k++)
+			if (pix->pneighbors[k])
+				nearest_in_pixel(pix->pneighbors[k], vector, &best,
+						&bestdist);
+	} else {
+		/* the neighbors of an empty or unlinked pixel are computed */
+		neighbours_nest64(store->nsides, id, nb);
+		for (k=0; k<NNEIGHBORS; k++) {
+			if (nb[k] < 0)
+				continue;
+			test_pixel = lookup_pixel(store, nb[k]);
+			if (test_pixel)
+				nearest_in_pixel(test_pixel, vector, &best, &bestdist);
+		}
+	}
+
+	if (best && distance)
+		*distance = bestdist;
+
+	return best;
+}
+
+/*
+ * Grow "*array" of "*capacity" elements of "size" bytes to hold "n"
+ * elements. Contents are not kept.
+ */
+static void
+grow_array(void **array, long *capacity, long n, long size)
+{
+	if (*array && *capacity >= n)
+		return;
+	if (*array)
+		FREE(*array);
+	*capacity = n > 0 ? n : 1;
+	*array = ALLOC(size * *capacity);
+}
+
+static int
+cmp_cone_query(const void *a, const void *b)
+{
+	const struct cone_query *qa = a, *qb = b;
+	if (qa->pix != qb->pix)
+		return qa->pix < qb->pix ? -1 : 1;
+	return (qa->index > qb->index) - (qa->index < qb->index);
+}
+
+/*
+ * A phase of Crossmatch_coneSearch on a range of queries. Sorted queries
+ * of the same pixel share the lookup of its neighborhood.
+ */
+static void*
+cones_thread(void *args)
+{
+	struct cones_args *ca = args;
+	CrossmatchCones *cones = ca->cones;
+	struct cone_query *sorted = cones->work;
+	HealPixel *hood[NNEIGHBORS + 1], *pix;
+	int64_t hoodid = -1;
+	long nb[NNEIGHBORS], i, j, n, q;
+	double col, lon, d, *vector;
+	int k, nhood = 0;
+
+	if (ca->phase == CONES_PREPARE) {
+		for (i=ca->first; i<ca->last; i++) {
+			col = SC_HALFPI - ca->dec[i] * TO_RAD;
+			lon = ca->ra[i] * TO_RAD;
+			ang2pix_nest64(ca->store->nsides, col, lon, &sorted[i].pix);
+			ang2vec(col, lon, &cones->vectors[3 * i]);
+			sorted[i].index = i;
+		}
+		return NULL;
+	}
+
+	Trace_begin(ca->phase == CONES_COUNT ? "cones_count" : "cones_fill",
+			"%li queries", ca->last - ca->first);
+	for (i=ca->first; i<ca->last; i++) {
+		if (sorted[i].pix != hoodid) {
+			hoodid = sorted[i].pix;
+			nhood = 0;
+			pix = lookup_pixel(ca->store, hoodid);
+			if (pix) {
+				hood[nhood++] = pix;
+				for (k=0; k<NNEIGHBORS; k++)
+					if (pix->pneighbors[k])
+						hood[nhood++] = pix->pneighbors[k];
+			} else {
+				neighbours_nest64(ca->store->nsides, hoodid, nb);
+				for (k=0; k<NNEIGHBORS; k++)
+					if (nb[k] >= 0 && (pix = lookup_pixel(ca->store, nb[k])))
+						hood[nhood++] = pix;
+			}
+		}
+
+		q = sorted[i].index;
+		vector = &cones->vectors[3 * q];
+		n = ca->phase == CONES_COUNT ? 0 : cones->offsets[q];
+		for (k=0; k<nhood; k++) {
+			for (j=0; j<hood[k]->nsamples; j++) {
+				d = dist(vector, hood[k]->samples[j].vector);
+				if (d >= ca->radius)
+					continue;
+				if (ca->phase == CONES_FILL) {
+					cones->samples[n] = &hood[k]->samples[j];
+					cones->distances[n] = d;
+				}
+				n++;
+			}
+		}
+		if (ca->phase == CONES_COUNT)
+			cones->offsets[q + 1] = n;
+	}
+	Trace_end();
+
+	return NULL;
+}
+
+static void
+run_cones_phase(struct cones_args *args, pthread_t *threads, int nthreads,
+		int phase)
+{
+	int t;
+
+	for (t=0; t<nthreads; t++) {
+		args[t].phase = phase;
+		pthread_create(&threads[t], NULL, cones_thread, &args[t]);
+	}
+	for (t=0; t<nthreads; t++)
+		pthread_join(threads[t], NULL);
+}
+
+
+long
+Crossmatch_coneSearch(
+	PixelStore		*store,
+	double			*ra,
+	double			*dec,
+	long			nqueries,
+	double			radius_arcsec,
+	int				nthreads,
+	CrossmatchCones	*cones)
+{
+	long q;
+	int t;
+
+	Trace_begin("Crossmatch_coneSearch", "%li queries", nqueries);
+
+	if (!store->linked)
+		PixelStore_linkNeighbors(store, nthreads);
+
+	grow_array((void**) &cones->offsets, &cones->qcapacity, nqueries + 1,
+			sizeof(long));
+	grow_array((void**) &cones->work, &cones->wcapacity, nqueries,
+			sizeof(struct cone_query));
+	grow_array((void**) &cones->vectors, &cones->vcapacity, 3 * nqueries,
+			sizeof(double));
+	cones->nqueries = nqueries;
+
+	if (nthreads < 1)
+		nthreads = 1;
+	pthread_t *threads = ALLOC(sizeof(pthread_t) * nthreads);
+	struct cones_args *args = ALLOC(sizeof(struct cones_args) * nthreads);
+	for (t=0; t<nthreads; t++) {
+		args[t].store = store;
+		args[t].cones = cones;
+		args[t].ra = ra;
+		args[t].dec = dec;
+		args[t].radius = chord_radius(radius_arcsec);
+		args[t].first = nqueries * t / nthreads;
+		args[t].last = nqueries * (t + 1) / nthreads;
+		args[t].thread = t;
+	}
+
+	/* queries in pixel order, for the locality of the store accesses */
+	run_cones_phase(args, threads, nthreads, CONES_PREPARE);
+	Trace_begin("sort", NULL);
+	qsort(cones->work, nqueries, sizeof(struct cone_query), cmp_cone_query);
+	Trace_end();
+
+	/* count, then write the results at their offsets */
+	run_cones_phase(args, threads, nthreads, CONES_COUNT);
+	cones->offsets[0] = 0;
+	for (q=0; q<nqueries; q++)
+		cones->offsets[q + 1] += cones->offsets[q];
+	cones->nresults = cones->offsets[nqueries];
+
+	grow_array((void**) &cones->samples, &cones->rcapacity, cones->nresults,
+			sizeof(Sample*));
+	grow_array((void**) &cones->distances, &cones->dcapacity,
+			cones->nresults, sizeof(double));
+	run_cones_phase(args, threads, nthreads, CONES_FILL);
+
+	FREE(threads);
+	FREE(args);
+
+	Trace_end();
+
+	return cones->nresults;
+}
+
+
+void
+Crossmatch_freeCones(CrossmatchCones *cones)
+{
+	FREE(cones->offsets);
+	FREE(cones->samples);
+	FREE(cones->distances);
+	FREE(cones->work);
+	FREE(cones->vectors);
+}
+
+void
+Crossmatch_setEngine(int e)
+{
+	engine = e;
+}
+
+
 int
 get_iterate_count() 
 {
@@ -15,7 +15,79 @@
 #include "scamp.h"
 #include "pixelstore.h"
 
+/*
+ * Crossmatch engines. CROSSMATCH_LOCKED locks pixels while crossing them
+ * with their neighbors. CROSSMATCH_ATOMIC does not lock, but update best
+ * matches with a compare and swap on Sample.packedMatch: ties on distance
+ * are broken on the lowest sample index, and results do not depend on the
+ * number of threads. Distances are compared in single precision.
+ */
+#define CROSSMATCH_LOCKED 0
+#define CROSSMATCH_ATOMIC 1
+
 extern long
 Crossmatch_crossSamples(PixelStore *store, double radius_arcsec, int nthreads);
 
+/*
+ * Select the engine used by Crossmatch_crossSamples(). Default to
+ * CROSSMATCH_LOCKED.
+ */
+extern void
+Crossmatch_setEngine(int engine);
+
+/*
+ * Return the sample of "store" closest to the position "ra", "dec"
+ * (degrees) within "radius_arcsec", or NULL, and set "distance" to the
+ * euclidean distance to it if not NULL. Only the pixel of the position and
+ * its neighbors are probed, so the radius must not exceed the pixel size,
+ * as for Crossmatch_crossSamples(). Does not allocate nor lock: any number
+ * of threads may query a store which is not modified meanwhile. Link the
+ * store first (PixelStore_linkNeighbors) for the lowest latency.
+ */
+extern Sample*
+Crossmatch_nearest(PixelStore *store, double ra, double dec,
+        double radius_arcsec, double *distance);
+
+/*
+ * Results of Crossmatch_coneSearch() in compressed sparse rows: the samples
+ * within the radius of query "q" are samples[offsets[q]] to
+ * samples[offsets[q + 1] - 1]. Arrays only grow, and are reused by the next
+ * searches with the same structure: zero it before the first search.
+ */
+typedef struct CrossmatchCones {
+    long    nqueries;
+    long    nresults;
+    long    *offsets;   /* nqueries + 1 */
+    Sample  **samples;
+    double  *distances; /* euclidean distance of every result */
+
+    /* PRIVATE, capacities and work arrays */
+    long    qcapacity;
+    long    rcapacity;
+    long    dcapacity;
+    long    wcapacity;
+    long    vcapacity;
+    void    *work;
+    double  *vectors;
+} CrossmatchCones;
+
+/*
+ * Find the samples of "store" within "radius_arcsec" of each of the
+ * "nqueries" positions "ra", "dec" (degrees), with "nthreads" threads. The
+ * queries are sorted by nested pixel, and processed in that order so that
+ * close queries share the store accesses. Results of a query are in the
+ * order of its pixel and of the neighbor pixels. The store is linked if
+ * required. Return the total number of results.
+ */
+extern long
+Crossmatch_coneSearch(PixelStore *store, double *ra, double *dec,
+        long nqueries, double radius_arcsec, int nthreads,
+        CrossmatchCones *cones);
+
+/*
+ * Free the arrays of "cones".
+ */
+extern void
+Crossmatch_freeCones(CrossmatchCones *cones);
+
 #endif /* __CROSSMATCH_H__ */
@@ -0,0 +1,520 @@
+/*
+ * Output of cross match results.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "export.h"
+#include "logger.h"
+#include "mem.h"
+
+#define FITS_BLOCK 2880
+#define FITS_CARD 80
+
+/* bytes of a binary table row, see write_fits_header() */
+#define FITS_ROW 40
+
+/* upper bound of the length of a CSV line */
+#define CSV_ROW 160
+
+/* formatted batches in flight, per thread */
+#define SLOTS_PER_THREAD 2
+
+typedef struct match_row {
+	int32_t	field;
+	int32_t	set;
+	int64_t	id;
+	int32_t	mfield;
+	int32_t	mset;
+	int64_t	mid;
+	double	separation;	/* arcsec */
+} match_row;
+
+struct batch {
+	char	*buf;
+	size_t	len;
+	size_t	size;
+	long	nrows;
+	bool	ready;
+};
+
+struct exporter {
+	PixelStore		*store;
+	Field			*fields;
+	int				nfields;
+	int				format;
+
+	long			nbatches;
+	long			next;		/* next batch to format */
+	long			written;	/* batches written */
+	struct batch	*slots;		/* batch k is formatted in slot k % nslots */
+	int				nslots;
+
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+};
+
+
+/******************************************************************************
+ * PRIVATE FUNCTIONS
+ */
+static void
+sample_row(
+	struct exporter	*ex,
+	Sample			*spl,
+	match_row		*row)
+{
+	Sample *m = spl->bestMatch;
+	Field *f = spl->set->field, *mf = m->set->field;
+
+	if (f < ex->fields || f >= ex->fields + ex->nfields ||
+			mf < ex->fields || mf >= ex->fields + ex->nfields)
+		Logger_log(LOGGER_CRITICAL,
+				"Exported sample %li is not in the given fields\n", spl->id);
+
+	row->field = f - ex->fields;
+	row->set = spl->set - f->sets;
+	row->id = spl->id;
+	row->mfield = mf - ex->fields;
+	row->mset = m->set - mf->sets;
+	row->mid = m->id;
+
+	/* chord to angle */
+	row->separation = 2 * asin(spl->bestMatchDistance / 2) / TO_RAD * 3600;
+}
+
+static inline char*
+format_long(
+	char	*p,
+	long	v)
+{
+	char tmp[24];
+	int n = 0;
+	unsigned long u = v < 0 ? -(unsigned long) v : (unsigned long) v;
+
+	if (v < 0)
+		*p++ = '-';
+	do {
+		tmp[n++] = '0' + u % 10;
+		u /= 10;
+	} while (u);
+	while (n)
+		*p++ = tmp[--n];
+
+	return p;
+}
+
+/* "v" with 6 decimals */
+static inline char*
+format_fixed(
+	char	*p,
+	double	v)
+{
+	if (!isfinite(v) || fabs(v) >= 1e12)
+		return p + sprintf(p, "%.6e", v);
+
+	if (v < 0) {
+		*p++ = '-';
+		v = -v;
+	}
+	long micro = (long) (v * 1e6 + 0.5);
+	p = format_long(p, micro / 1000000);
+	*p++ = '.';
+
+	long frac = micro % 1000000, div;
+	for (div=100000; div>0; div/=10)
+		*p++ = '0' + (frac / div) % 10;
+
+	return p;
+}
+
+static inline char*
+format_csv(
+	char		*p,
+	match_row	*row)
+{
+	p = format_long(p, row->field);
+	*p++ = ',';
+	p = format_long(p, row->set);
+	*p++ = ',';
+	p = format_long(p, row->id);
+	*p++ = ',';
+	p = format_long(p, row->mfield);
+	*p++ = ',';
+	p = format_long(p, row->mset);
+	*p++ = ',';
+	p = format_long(p, row->mid);
+	*p++ = ',';
+	p = format_fixed(p, row->separation);
+	*p++ = '\n';
+
+	return p;
+}
+
+static inline char*
+put_be32(
+	char	*p,
+	int32_t	v)
+{
+	uint32_t u = __builtin_bswap32((uint32_t) v);
+	memcpy(p, &u, 4);
+	return p + 4;
+}
+
+static inline char*
+put_be64(
+	char	*p,
+	int64_t	v)
+{
+	uint64_t u = __builtin_bswap64((uint64_t) v);
+	memcpy(p, &u, 8);
+	return p + 8;
+}
+
+static inline char*
+format_fits(
+	char		*p,
+	match_row	*row)
+{
+	int64_t sep;
+
+	p = put_be32(p, row->field);
+	p = put_be32(p, row->set);
+	p = put_be64(p, row->id);
+	p = put_be32(p, row->mfield);
+	p = put_be32(p, row->mset);
+	p = put_be64(p, row->mid);
+	memcpy(&sep, &row->separation, 8);
+	p = put_be64(p, sep);
+
+	return p;
+}
+
+/*
+ * Format the rows of the pixels of batch "k" in "b".
+ */
+static void
+format_batch(
+	struct exporter	*ex,
+	long			k,
+	struct batch	*b)
+{
+	PixelStore *store = ex->store;
+	long i, j, last;
+	match_row row;
+	HealPixel *pix;
+	char *p;
+	int rowsize = ex->format == EXPORT_CSV ? CSV_ROW : FITS_ROW;
+
+	b->len = 0;
+	b->nrows = 0;
+
+	last = (k + 1) * EXPORT_BATCH_PIXELS;
+	if (last > store->npixels)
+		last = store->npixels;
+
+	for (i=k*EXPORT_BATCH_PIXELS; i<last; i++) {
+		pix = PixelStore_get(store, store->pixelids[i]);
+
+		if (b->len + (size_t) pix->nsamples * rowsize > b->size) {
+			b->size = 2 * (b->len + (size_t) pix->nsamples * rowsize);
+			b->buf = b->buf ? REALLOC(b->buf, b->size) : ALLOC(b->size);
+		}
+
+		p = b->buf + b->len;
+		for (j=0; j<pix->nsamples; j++) {
+			if (!pix->samples[j].bestMatch)
+				continue;
+			sample_row(ex, &pix->samples[j], &row);
+			if (ex->format == EXPORT_CSV)
+				p = format_csv(p, &row);
+			else
+				p = format_fits(p, &row);
+			b->nrows++;
+		}
+		b->len = p - b->buf;
+	}
+}
+
+static void*
+format_thread(void *args)
+{
+	struct exporter *ex = args;
+	struct batch *b;
+	long k;
+
+	for (;;) {
+		/* wait for the slot of the next batch to be written */
+		pthread_mutex_lock(&ex->mutex);
+		while (ex->next < ex->nbatches &&
+				ex->next >= ex->written + ex->nslots)
+			pthread_cond_wait(&ex->cond, &ex->mutex);
+		if (ex->next >= ex->nbatches) {
+			pthread_mutex_unlock(&ex->mutex);
+			break;
+		}
+		k = ex->next++;
+		pthread_mutex_unlock(&ex->mutex);
+
+		b = &ex->slots[k % ex->nslots];
+		format_batch(ex, k, b);
+
+		pthread_mutex_lock(&ex->mutex);
+		b->ready = true;
+		pthread_cond_broadcast(&ex->cond);
+		pthread_mutex_unlock(&ex->mutex);
+	}
+
+	return NULL;
+}
+
+static bool
+write_all(
+	int			fd,
+	const char	*buf,
+	size_t		len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n < 0)
+			return false;
+		buf += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+static void
+card(
+	char		*header,
+	int			*ncards,
+	const char	*key,
+	const char	*value)
+{
+	char c[FITS_CARD + 1];
+
+	if (value)
+		snprintf(c, sizeof(c), "%-8.8s= %-70.70s", key, value);
+	else
+		snprintf(c, sizeof(c), "%-80.80s", key);
+	memcpy(header + FITS_CARD * (*ncards)++, c, FITS_CARD);
+}
+
+/* a string value, padded to 8 characters */
+static void
+card_string(
+	char		*header,
+	int			*ncards,
+	const char	*key,
+	const char	*value)
+{
+	char v[72];
+	snprintf(v, sizeof(v), "'%-8s'", value);
+	card(header, ncards, key, v);
+}
+
+/* a logical or integer value, right justified in columns 11 to 30 */
+static void
+card_value(
+	char		*header,
+	int			*ncards,
+	const char	*key,
+	const char	*value)
+{
+	char v[32];
+	snprintf(v, sizeof(v), "%20s", value);
+	card(header, ncards, key, v);
+}
+
+static void
+card_long(
+	char		*header,
+	int			*ncards,
+	const char	*key,
+	long		value)
+{
+	char v[32];
+	snprintf(v, sizeof(v), "%li", value);
+	card_value(header, ncards, key, v);
+}
+
+/*
+ * Write the primary HDU and the binary table header, with NAXIS2 set to
+ * "nrows". Return false on failure.
+ */
+static bool
+write_fits_header(
+	int		fd,
+	long	nrows)
+{
+	static const char *columns[][3] = {
+		{"FIELD", "1J", NULL},
+		{"SET", "1J", NULL},
+		{"ID", "1K", NULL},
+		{"MATCH_FIELD", "1J", NULL},
+		{"MATCH_SET", "1J", NULL},
+		{"MATCH_ID", "1K", NULL},
+		{"SEPARATION", "1D", "arcsec"}};
+	char header[2 * FITS_BLOCK], key[16];
+	int n = 0, i;
+
+	memset(header, ' ', sizeof(header));
+
+	card_value(header, &n, "SIMPLE", "T");
+	card_value(header, &n, "BITPIX", "8");
+	card_value(header, &n, "NAXIS", "0");
+	card_value(header, &n, "EXTEND", "T");
+	card(header, &n, "END", NULL);
+
+	n = FITS_BLOCK / FITS_CARD;
+	card_string(header, &n, "XTENSION", "BINTABLE");
+	card_value(header, &n, "BITPIX", "8");
+	card_value(header, &n, "NAXIS", "2");
+	card_long(header, &n, "NAXIS1", FITS_ROW);
+	card_long(header, &n, "NAXIS2", nrows);
+	card_value(header, &n, "PCOUNT", "0");
+	card_value(header, &n, "GCOUNT", "1");
+	card_long(header, &n, "TFIELDS", 7);
+	for (i=0; i<7; i++) {
+		snprintf(key, sizeof(key), "TTYPE%i", i + 1);
+		card_string(header, &n, key, columns[i][0]);
+		snprintf(key, sizeof(key), "TFORM%i", i + 1);
+		card_string(header, &n, key, columns[i][1]);
+		if (columns[i][2]) {
+			snprintf(key, sizeof(key), "TUNIT%i", i + 1);
+			card_string(header, &n, key, columns[i][2]);
+		}
+	}
+	card_string(header, &n, "EXTNAME", "MATCHES");
+	card(header, &n, "END", NULL);
+
+	return pwrite(fd, header, sizeof(header), 0) == sizeof(header);
+}
+
+/**
+ * PRIVATE FUNCTIONS END
+ ******************************************************************************/
+
+
+
+/******************************************************************************
+ * PUBLIC FUNCTIONS
+ */
+long
+Export_matches(
+	char		*path,
+	int			format,
+	PixelStore	*store,
+	Field		*fields,
+	int			nfields,
+	int			nthreads)
+{
+	static const char csv_header[] =
+		"field,set,id,match_field,match_set,match_id,separation\n";
+	struct exporter ex;
+	long k, nrows = 0;
+	bool ok = true;
+	int fd, t;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		Logger_log(LOGGER_ERROR, "Can not create %s\n", path);
+		return -1;
+	}
+
+	if (format == EXPORT_CSV)
+		ok = write_all(fd, csv_header, sizeof(csv_header) - 1);
+	else
+		ok = write_fits_header(fd, 0) &&
+			lseek(fd, 2 * FITS_BLOCK, SEEK_SET) == 2 * FITS_BLOCK;
+
+	if (nthreads < 1)
+		nthreads = 1;
+	ex.store = store;
+	ex.fields = fields;
+	ex.nfields = nfields;
+	ex.format = format;
+	ex.nbatches = (store->npixels + EXPORT_BATCH_PIXELS - 1) /
+		EXPORT_BATCH_PIXELS;
+	ex.next = 0;
+	ex.written = 0;
+	ex.nslots = SLOTS_PER_THREAD * nthreads;
+	ex.slots = CALLOC(ex.nslots, sizeof(struct batch));
+	pthread_mutex_init(&ex.mutex, NULL);
+	pthread_cond_init(&ex.cond, NULL);
+
+	pthread_t *threads = ALLOC(sizeof(pthread_t) * nthreads);
+	for (t=0; t<nthreads; t++)
+		pthread_create(&threads[t], NULL, format_thread, &ex);
+
+	/* write batches in order while the next ones are formatted */
+	for (k=0; k<ex.nbatches; k++) {
+		struct batch *b = &ex.slots[k % ex.nslots];
+
+		pthread_mutex_lock(&ex.mutex);
+		while (!b->ready)
+			pthread_cond_wait(&ex.cond, &ex.mutex);
+		pthread_mutex_unlock(&ex.mutex);
+
+		if (ok)
+			ok = write_all(fd, b->buf, b->len);
+		nrows += b->nrows;
+
+		pthread_mutex_lock(&ex.mutex);
+		b->ready = false;
+		ex.written++;
+		pthread_cond_broadcast(&ex.cond);
+		pthread_mutex_unlock(&ex.mutex);
+	}
+
+	for (t=0; t<nthreads; t++)
+		pthread_join(threads[t], NULL);
+
+	if (format == EXPORT_FITS && ok) {
+		/* pad the table, and set the actual number of rows */
+		char zeros[FITS_BLOCK];
+		size_t datasize = (size_t) nrows * FITS_ROW;
+		memset(zeros, 0, sizeof(zeros));
+		if (datasize % FITS_BLOCK)
+			ok = write_all(fd, zeros, FITS_BLOCK - datasize % FITS_BLOCK);
+		ok = ok && write_fits_header(fd, nrows);
+	}
+	ok &= close(fd) == 0;
+
+	for (t=0; t<ex.nslots; t++)
+		FREE(ex.slots[t].buf);
+	FREE(ex.slots);
+	FREE(threads);
+	pthread_mutex_destroy(&ex.mutex);
+	pthread_cond_destroy(&ex.cond);
+
+	if (!ok) {
+		Logger_log(LOGGER_ERROR, "Can not write %s\n", path);
+		return -1;
+	}
+
+	Logger_log(LOGGER_NORMAL, "%li matches written to %s\n", nrows, path);
+
+	return nrows;
+}
+/**
+ * PUBLIC FUNCTIONS END
+ ******************************************************************************/
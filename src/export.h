@@ -0,0 +1,42 @@
+/*
+ * Output of cross match results.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __EXPORT_H__
+#define __EXPORT_H__
+
+#include "scamp.h"
+#include "pixelstore.h"
+
+#define EXPORT_CSV  0
+#define EXPORT_FITS 1
+
+/* pixels formatted at once by a thread */
+#define EXPORT_BATCH_PIXELS 4096
+
+/**
+ * Write a row for every sample of "store" having a bestMatch: field, set
+ * and id of the sample and of its match, and their separation in arcsec.
+ * Fields are indexes in "fields", sets indexes in their field.
+ *
+ * EXPORT_CSV writes a header line then one line per row. EXPORT_FITS writes
+ * an empty primary HDU and a MATCHES binary table.
+ *
+ * Rows are formatted by "nthreads" threads, by batches of
+ * EXPORT_BATCH_PIXELS pixels, while the calling thread writes the formatted
+ * batches in pixelids order. Return the number of rows, or -1 on failure.
+ */
+extern long
+Export_matches(char *path, int format, PixelStore *store, Field *fields,
+        int nfields, int nthreads);
+
+#endif /* __EXPORT_H__ */
@@ -0,0 +1,246 @@
+/*
+ * Fast approximate pixel to world transformation, interpolated on a grid
+ * of exact projections.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "fastwcs.h"
+#include "logger.h"
+#include "mem.h"
+
+#define DEG_TO_RAD (M_PI / 180)
+#define RAD_TO_ARCSEC (180 * 3600 / M_PI)
+
+
+/******************************************************************************
+ * PRIVATE FUNCTIONS
+ */
+static inline void
+radec_to_vec(
+	double	ra,
+	double	dec,
+	double	*v)
+{
+	double cd = cos(dec * DEG_TO_RAD);
+	v[0] = cd * cos(ra * DEG_TO_RAD);
+	v[1] = cd * sin(ra * DEG_TO_RAD);
+	v[2] = sin(dec * DEG_TO_RAD);
+}
+
+/* normalized bilinear interpolation of the unit vectors around (x, y) */
+static inline void
+interpolate(
+	FastWcs	*fw,
+	double	x,
+	double	y,
+	double	*v)
+{
+	double u = (x - fw->xmin) / fw->dx;
+	double w = (y - fw->ymin) / fw->dy;
+	int i = (int) floor(u), j = (int) floor(w), c;
+
+	i = i < 0 ? 0 : (i >= fw->nx ? fw->nx - 1 : i);
+	j = j < 0 ? 0 : (j >= fw->ny ? fw->ny - 1 : j);
+	u -= i;
+	w -= j;
+
+	const double *n00 = &fw->nodes[3 * (j * (fw->nx + 1) + i)];
+	const double *n10 = n00 + 3;
+	const double *n01 = n00 + 3 * (fw->nx + 1);
+	const double *n11 = n01 + 3;
+
+	for (c=0; c<3; c++)
+		v[c] = (1 - w) * ((1 - u) * n00[c] + u * n10[c]) +
+			w * ((1 - u) * n01[c] + u * n11[c]);
+
+	double norm = 1 / sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	v[0] *= norm;
+	v[1] *= norm;
+	v[2] *= norm;
+}
+
+/*
+ * Project the nodes of a grid of "ncells" x "ncells".
+ */
+static int
+project_nodes(
+	FastWcs				*fw,
+	int					ncells,
+	FastWcs_projectFunc	project,
+	void				*udata,
+	double				xmax,
+	double				ymax)
+{
+	long i, j, k, n = (long) (ncells + 1) * (ncells + 1);
+	int status;
+
+	fw->nx = fw->ny = ncells;
+	fw->dx = (xmax - fw->xmin) / ncells;
+	fw->dy = (ymax - fw->ymin) / ncells;
+
+	double *pixcrd = ALLOC(sizeof(double) * 2 * n);
+	double *world = ALLOC(sizeof(double) * 2 * n);
+	for (j=0, k=0; j<=ncells; j++) {
+		for (i=0; i<=ncells; i++, k++) {
+			pixcrd[2*k] = fw->xmin + i * fw->dx;
+			pixcrd[2*k+1] = fw->ymin + j * fw->dy;
+		}
+	}
+
+	status = project(udata, n, pixcrd, world);
+
+	FREE(fw->nodes);
+	fw->nodes = ALLOC(sizeof(double) * 3 * n);
+	for (k=0; k<n; k++)
+		radec_to_vec(world[2*k], world[2*k+1], &fw->nodes[3*k]);
+
+	FREE(pixcrd);
+	FREE(world);
+
+	return status;
+}
+
+/*
+ * Largest distance, in arcsec, between the exact and interpolated
+ * projections of the centers and edge middles of the cells.
+ */
+static double
+measure_error(
+	FastWcs				*fw,
+	FastWcs_projectFunc	project,
+	void				*udata)
+{
+	long i, j, k, n = 0;
+	double v[3], e[3], d, maxerror = 0;
+	long npoints = (long) (2 * fw->nx + 1) * (2 * fw->ny + 1);
+
+	double *pixcrd = ALLOC(sizeof(double) * 2 * npoints);
+	double *world = ALLOC(sizeof(double) * 2 * npoints);
+	for (j=0; j<=2*fw->ny; j++) {
+		for (i=0; i<=2*fw->nx; i++) {
+			if (i % 2 == 0 && j % 2 == 0)
+				continue;	/* a node */
+			pixcrd[2*n] = fw->xmin + i * fw->dx / 2;
+			pixcrd[2*n+1] = fw->ymin + j * fw->dy / 2;
+			n++;
+		}
+	}
+
+	if (project(udata, n, pixcrd, world) != 0) {
+		maxerror = INFINITY;
+	} else {
+		for (k=0; k<n; k++) {
+			radec_to_vec(world[2*k], world[2*k+1], e);
+			interpolate(fw, pixcrd[2*k], pixcrd[2*k+1], v);
+			d = sqrt((v[0] - e[0]) * (v[0] - e[0]) +
+					(v[1] - e[1]) * (v[1] - e[1]) +
+					(v[2] - e[2]) * (v[2] - e[2]));
+			/* NaN from failed projections must fail too */
+			if (!(d <= maxerror))
+				maxerror = d;
+		}
+		maxerror *= RAD_TO_ARCSEC;
+	}
+
+	FREE(pixcrd);
+	FREE(world);
+
+	return maxerror;
+}
+
+/**
+ * PRIVATE FUNCTIONS END
+ ******************************************************************************/
+
+
+
+/******************************************************************************
+ * PUBLIC FUNCTIONS
+ */
+FastWcs*
+FastWcs_new(
+	FastWcs_projectFunc	project,
+	void				*udata,
+	double				xmin,
+	double				xmax,
+	double				ymin,
+	double				ymax,
+	double				tolerance,
+	long				maxevals)
+{
+	long nevals = 0;
+	int ncells;
+
+	/* a single row or column of samples */
+	if (xmax <= xmin)
+		xmax = xmin + 1;
+	if (ymax <= ymin)
+		ymax = ymin + 1;
+
+	FastWcs *fw = ALLOC(sizeof(FastWcs));
+	fw->xmin = xmin;
+	fw->ymin = ymin;
+	fw->nodes = NULL;
+
+	for (ncells=FASTWCS_MIN_CELLS; ncells<=FASTWCS_MAX_CELLS; ncells*=2) {
+		nevals += (long) (2 * ncells + 1) * (2 * ncells + 1);
+		if (nevals > maxevals)
+			break;
+
+		if (project_nodes(fw, ncells, project, udata, xmax, ymax) != 0)
+			break;
+
+		fw->maxerror = measure_error(fw, project, udata);
+		if (fw->maxerror <= tolerance) {
+			LOGGER_LOG(LOGGER_DEBUG,
+					"Fast WCS grid of %i cells, error %g arcsec\n",
+					ncells, fw->maxerror);
+			return fw;
+		}
+	}
+
+	FastWcs_free(fw);
+	return NULL;
+}
+
+
+void
+FastWcs_p2s(
+	FastWcs			*fw,
+	long			n,
+	const double	*pixcrd,
+	double			*world)
+{
+	double v[3], ra;
+	long i;
+
+	for (i=0; i<n; i++) {
+		interpolate(fw, pixcrd[2*i], pixcrd[2*i+1], v);
+		ra = atan2(v[1], v[0]) / DEG_TO_RAD;
+		world[2*i] = ra < 0 ? ra + 360 : ra;
+		world[2*i+1] = asin(v[2] > 1 ? 1 : v[2]) / DEG_TO_RAD;
+	}
+}
+
+
+void
+FastWcs_free(FastWcs *fw)
+{
+	FREE(fw->nodes);
+	FREE(fw);
+}
+/**
+ * PUBLIC FUNCTIONS END
+ ******************************************************************************/
@@ -0,0 +1,63 @@
+/*
+ * Fast approximate pixel to world transformation, interpolated on a grid
+ * of exact projections.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __FASTWCS_H__
+#define __FASTWCS_H__
+
+/* first and last grid sizes tried, in cells per axis */
+#define FASTWCS_MIN_CELLS 8
+#define FASTWCS_MAX_CELLS 256
+
+/**
+ * Exact transformation of "n" pixel coordinates (x, y pairs) to world
+ * coordinates (ra, dec pairs in degrees). Return non zero on failure.
+ */
+typedef int (*FastWcs_projectFunc)(
+        void *udata, long n, const double *pixcrd, double *world);
+
+/**
+ * Nodes of the grid hold the unit vectors of the exact projection. Other
+ * positions are bilinearly interpolated and normalized.
+ */
+typedef struct FastWcs {
+    double  xmin, ymin;     /* pixel coordinates of the first node */
+    double  dx, dy;         /* size of the cells */
+    int     nx, ny;         /* number of cells */
+    double  *nodes;         /* (nx + 1) * (ny + 1) unit vectors */
+    double  maxerror;       /* measured error, in arcsec */
+} FastWcs;
+
+/**
+ * Build a grid covering [xmin, xmax] x [ymin, ymax]. The grid is refined
+ * until the error, measured at the center and edges of every cell, is
+ * below "tolerance" arcsec. Return NULL if the tolerance can not be met
+ * with FASTWCS_MAX_CELLS, or with less than "maxevals" calls of "project"
+ * per point, in which case the exact transformation should be used.
+ */
+extern FastWcs*
+FastWcs_new(FastWcs_projectFunc project, void *udata,
+        double xmin, double xmax, double ymin, double ymax,
+        double tolerance, long maxevals);
+
+/**
+ * Same as "project" for the "n" x, y pairs of "pixcrd", "world" being
+ * ra, dec pairs in degrees.
+ */
+extern void
+FastWcs_p2s(FastWcs *fw, long n, const double *pixcrd, double *world);
+
+extern void
+FastWcs_free(FastWcs *fw);
+
+#endif /* __FASTWCS_H__ */
@@ -0,0 +1,474 @@
+/*
+ * Memory mapped FITS files: headers and binary tables are read in place,
+ * without CFITSIO.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fitsmap.h"
+#include "logger.h"
+#include "mem.h"
+
+#define BASE_NHDUS 8
+
+
+/******************************************************************************
+ * PRIVATE FUNCTIONS
+ */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define BE16(x) __builtin_bswap16(x)
+#define BE32(x) __builtin_bswap32(x)
+#define BE64(x) __builtin_bswap64(x)
+#else
+#define BE16(x) (x)
+#define BE32(x) (x)
+#define BE64(x) (x)
+#endif
+
+/* rows are not aligned, values are loaded with memcpy */
+static inline uint16_t
+load16(const uint8_t *p)
+{
+	uint16_t v;
+	memcpy(&v, p, 2);
+	return BE16(v);
+}
+
+static inline uint32_t
+load32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return BE32(v);
+}
+
+static inline uint64_t
+load64(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return BE64(v);
+}
+
+static bool
+keyword_long(
+	FitsHdu		*hdu,
+	const char	*key,
+	long		*value)
+{
+	char buf[72], *end;
+	if (!FitsMap_keyword(hdu, key, buf, sizeof(buf)))
+		return false;
+	*value = strtol(buf, &end, 10);
+	return end != buf;
+}
+
+/* true if keyword "key" exists and is not "neutral" */
+static bool
+keyword_set(
+	FitsHdu		*hdu,
+	const char	*key,
+	double		neutral)
+{
+	char buf[72];
+	if (!FitsMap_keyword(hdu, key, buf, sizeof(buf)))
+		return false;
+	return strtod(buf, NULL) != neutral;
+}
+
+/*
+ * Parse TFORMn, TTYPEn, TSCALn and TZEROn of a binary table. Return false
+ * if the row size does not match the columns.
+ */
+static bool
+parse_columns(FitsHdu *hdu)
+{
+	char key[16], tform[72], *p;
+	long nfields, offset = 0;
+	int i;
+
+	if (!keyword_long(hdu, "TFIELDS", &nfields) || nfields < 0 ||
+			nfields > 999)
+		return false;
+
+	hdu->ncolumns = nfields;
+	hdu->columns = ALLOC(sizeof(FitsColumn) * (nfields > 0 ? nfields : 1));
+
+	for (i=0; i<nfields; i++) {
+		FitsColumn *c = &hdu->columns[i];
+
+		snprintf(key, sizeof(key), "TFORM%i", i + 1);
+		if (!FitsMap_keyword(hdu, key, tform, sizeof(tform)))
+			return false;
+		snprintf(key, sizeof(key), "TTYPE%i", i + 1);
+		if (!FitsMap_keyword(hdu, key, c->name, sizeof(c->name)))
+			c->name[0] = '\0';
+
+		c->repeat = strtol(tform, &p, 10);
+		if (p == tform)
+			c->repeat = 1;
+		c->type = *p;
+
+		switch (c->type) {
+		case 'L': case 'B': case 'A':
+			c->width = 1; break;
+		case 'I':
+			c->width = 2; break;
+		case 'J': case 'E':
+			c->width = 4; break;
+		case 'K': case 'D': case 'C': case 'P':
+			c->width = 8; break;
+		case 'M': case 'Q':
+			c->width = 16; break;
+		case 'X':
+			c->width = 0; break;
+		default:
+			return false;
+		}
+
+		snprintf(key, sizeof(key), "TSCAL%i", i + 1);
+		c->scaled = keyword_set(hdu, key, 1);
+		snprintf(key, sizeof(key), "TZERO%i", i + 1);
+		c->scaled |= keyword_set(hdu, key, 0);
+
+		c->offset = offset;
+		if (c->type == 'X')
+			offset += (c->repeat + 7) / 8;
+		else if (c->type == 'P' || c->type == 'Q')
+			offset += c->width;
+		else
+			offset += c->width * c->repeat;
+	}
+
+	return offset == hdu->rowsize;
+}
+
+/*
+ * Parse the header starting at "offset", fill "hdu" and return the offset
+ * of the next HDU, or 0 if the header is invalid.
+ */
+static size_t
+parse_hdu(
+	FitsMap	*map,
+	size_t	offset,
+	FitsHdu	*hdu)
+{
+	const char *card;
+	long bitpix, naxis, n, pcount = 0, gcount = 1, size = 1;
+	char key[16], value[72];
+	int i;
+
+	memset(hdu, 0, sizeof(FitsHdu));
+	hdu->header = (const char*) map->map + offset;
+
+	for (;;) {
+		if (offset + (hdu->ncards + 1) * FITSMAP_CARD > map->size)
+			return 0;
+		card = hdu->header + hdu->ncards * FITSMAP_CARD;
+		hdu->ncards++;
+		if (strncmp(card, "END     ", 8) == 0)
+			break;
+	}
+	offset += (hdu->ncards * FITSMAP_CARD + FITSMAP_BLOCK - 1)
+		/ FITSMAP_BLOCK * FITSMAP_BLOCK;
+
+	if (!keyword_long(hdu, "BITPIX", &bitpix) ||
+			!keyword_long(hdu, "NAXIS", &naxis) || naxis < 0 || naxis > 999)
+		return 0;
+
+	for (i=1; i<=naxis; i++) {
+		snprintf(key, sizeof(key), "NAXIS%i", i);
+		if (!keyword_long(hdu, key, &n) || n < 0)
+			return 0;
+		size *= n;
+		if (i == 1)
+			hdu->rowsize = n;
+		if (i == 2)
+			hdu->nrows = n;
+	}
+	if (naxis == 0)
+		size = 0;
+	keyword_long(hdu, "PCOUNT", &pcount);
+	keyword_long(hdu, "GCOUNT", &gcount);
+
+	hdu->datasize = (size_t) (labs(bitpix) / 8) * gcount * (pcount + size);
+	hdu->data = map->map + (offset < map->size ? offset : map->size);
+
+	if (FitsMap_keyword(hdu, "XTENSION", value, sizeof(value)))
+		hdu->bintable = strcmp(value, "BINTABLE") == 0;
+	hdu->compressed =
+		(FitsMap_keyword(hdu, "ZIMAGE", value, sizeof(value)) &&
+		 value[0] == 'T') ||
+		(FitsMap_keyword(hdu, "ZTABLE", value, sizeof(value)) &&
+		 value[0] == 'T');
+
+	if (hdu->bintable && (naxis != 2 || bitpix != 8 || !parse_columns(hdu)))
+		return 0;
+
+	if (offset > map->size || hdu->datasize > map->size - offset)
+		return 0;
+
+	offset += (hdu->datasize + FITSMAP_BLOCK - 1)
+		/ FITSMAP_BLOCK * FITSMAP_BLOCK;
+
+	/* the last block may not be padded */
+	return offset < map->size ? offset : map->size;
+}
+
+/**
+ * PRIVATE FUNCTIONS END
+ ******************************************************************************/
+
+
+
+/******************************************************************************
+ * PUBLIC FUNCTIONS
+ */
+FitsMap*
+FitsMap_open(char *file)
+{
+	struct stat st;
+	int fd, size = BASE_NHDUS;
+	size_t offset = 0;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) != 0 || st.st_size < FITSMAP_BLOCK) {
+		close(fd);
+		return NULL;
+	}
+
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+
+	FitsMap *map = ALLOC(sizeof(FitsMap));
+	map->map = data;
+	map->size = st.st_size;
+	map->nhdus = 0;
+	map->hdus = ALLOC(sizeof(FitsHdu) * size);
+
+	if (strncmp(data, "SIMPLE  =", 9) != 0) {
+		FitsMap_close(map);
+		return NULL;
+	}
+
+	while (offset < map->size) {
+		if (map->nhdus == size) {
+			size *= 2;
+			map->hdus = REALLOC(map->hdus, sizeof(FitsHdu) * size);
+		}
+		/* trailing blocks that are not an extension are ignored */
+		if (map->nhdus > 0 && (map->size - offset < FITSMAP_CARD ||
+				strncmp((char*) map->map + offset, "XTENSION=", 9) != 0))
+			break;
+
+		offset = parse_hdu(map, offset, &map->hdus[map->nhdus]);
+		if (offset == 0) {
+			/* columns may have been allocated */
+			map->nhdus++;
+			LOGGER_LOG(LOGGER_DEBUG,
+					"%s can not be mapped, bad HDU %i\n", file, map->nhdus);
+			FitsMap_close(map);
+			return NULL;
+		}
+		map->nhdus++;
+	}
+
+	madvise(data, st.st_size, MADV_WILLNEED);
+
+	return map;
+}
+
+
+void
+FitsMap_close(FitsMap *map)
+{
+	int i;
+	for (i=0; i<map->nhdus; i++)
+		FREE(map->hdus[i].columns);
+	munmap((void*) map->map, map->size);
+	FREE(map->hdus);
+	FREE(map);
+}
+
+
+bool
+FitsMap_keyword(
+	FitsHdu		*hdu,
+	const char	*key,
+	char		*value,
+	int			size)
+{
+	const char *card, *p, *end;
+	int i, n, klen = strlen(key);
+
+	if (klen > 8)
+		return false;
+
+	for (i=0; i<hdu->ncards; i++) {
+		card = hdu->header + i * FITSMAP_CARD;
+		if (strncmp(card, key, klen) != 0)
+			continue;
+		for (n=klen; n<8 && card[n] == ' '; n++);
+		if (n < 8 || card[8] != '=')
+			continue;
+
+		p = card + 10;
+		end = card + FITSMAP_CARD;
+		while (p < end && *p == ' ')
+			p++;
+
+		n = 0;
+		if (p < end && *p == '\'') {
+			/* string, '' is a quote */
+			for (p++; p < end && n < size - 1; p++) {
+				if (*p == '\'') {
+					if (p + 1 < end && p[1] == '\'')
+						p++;
+					else
+						break;
+				}
+				value[n++] = *p;
+			}
+		} else {
+			while (p < end && *p != '/' && n < size - 1)
+				value[n++] = *p++;
+		}
+
+		while (n > 0 && value[n-1] == ' ')
+			n--;
+		value[n] = '\0';
+
+		return true;
+	}
+
+	return false;
+}
+
+
+FitsColumn*
+FitsMap_column(
+	FitsHdu		*hdu,
+	const char	*name)
+{
+	int i;
+	for (i=0; i<hdu->ncolumns; i++)
+		if (strcmp(hdu->columns[i].name, name) == 0)
+			return &hdu->columns[i];
+	return NULL;
+}
+
+
+bool
+FitsMap_readDouble(
+	FitsHdu		*hdu,
+	FitsColumn	*column,
+	double		*out,
+	int			stride)
+{
+	const uint8_t *p = hdu->data + column->offset;
+	long i, rs = hdu->rowsize, n = hdu->nrows;
+	uint32_t u32;
+	uint64_t u64;
+	float f;
+	double d;
+
+	if (column->scaled || column->repeat < 1)
+		return false;
+
+	switch (column->type) {
+	case 'B':
+		for (i=0; i<n; i++)
+			out[i * stride] = p[i * rs];
+		break;
+	case 'I':
+		for (i=0; i<n; i++)
+			out[i * stride] = (int16_t) load16(p + i * rs);
+		break;
+	case 'J':
+		for (i=0; i<n; i++)
+			out[i * stride] = (int32_t) load32(p + i * rs);
+		break;
+	case 'K':
+		for (i=0; i<n; i++)
+			out[i * stride] = (int64_t) load64(p + i * rs);
+		break;
+	case 'E':
+		for (i=0; i<n; i++) {
+			u32 = load32(p + i * rs);
+			memcpy(&f, &u32, 4);
+			out[i * stride] = f;
+		}
+		break;
+	case 'D':
+		for (i=0; i<n; i++) {
+			u64 = load64(p + i * rs);
+			memcpy(&d, &u64, 8);
+			out[i * stride] = d;
+		}
+		break;
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+
+bool
+FitsMap_readLong(
+	FitsHdu		*hdu,
+	FitsColumn	*column,
+	long		*out,
+	int			stride)
+{
+	const uint8_t *p = hdu->data + column->offset;
+	long i, rs = hdu->rowsize, n = hdu->nrows;
+
+	if (column->scaled || column->repeat < 1)
+		return false;
+
+	switch (column->type) {
+	case 'B':
+		for (i=0; i<n; i++)
+			out[i * stride] = p[i * rs];
+		break;
+	case 'I':
+		for (i=0; i<n; i++)
+			out[i * stride] = (int16_t) load16(p + i * rs);
+		break;
+	case 'J':
+		for (i=0; i<n; i++)
+			out[i * stride] = (int32_t) load32(p + i * rs);
+		break;
+	case 'K':
+		for (i=0; i<n; i++)
+			out[i * stride] = (int64_t) load64(p + i * rs);
+		break;
+	default:
+		return false;
+	}
+
+	return true;
+}
+/**
+ * PUBLIC FUNCTIONS END
+ ******************************************************************************/
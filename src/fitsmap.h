@@ -0,0 +1,93 @@
+/*
+ * Memory mapped FITS files: headers and binary tables are read in place,
+ * without CFITSIO.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __FITSMAP_H__
+#define __FITSMAP_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define FITSMAP_BLOCK 2880
+#define FITSMAP_CARD 80
+
+/**
+ * A column of a binary table. Only the first element of each row is
+ * decoded by FitsMap_readDouble() and FitsMap_readLong().
+ */
+typedef struct FitsColumn {
+    char    name[72];   /* TTYPEn */
+    char    type;       /* TFORMn data type: L X B I J K A E D C M P Q */
+    long    repeat;
+    long    offset;     /* in the row, in bytes */
+    int     width;      /* of one element, in bytes */
+    bool    scaled;     /* TSCALn or TZEROn are set */
+} FitsColumn;
+
+typedef struct FitsHdu {
+    const char      *header;    /* "ncards" cards of FITSMAP_CARD chars */
+    int             ncards;
+    bool            bintable;
+    bool            compressed; /* tile compressed image or table */
+    long            rowsize;    /* NAXIS1 of tables */
+    long            nrows;      /* NAXIS2 of tables */
+    const uint8_t   *data;
+    size_t          datasize;
+    FitsColumn      *columns;
+    int             ncolumns;
+} FitsHdu;
+
+typedef struct FitsMap {
+    const uint8_t   *map;
+    size_t          size;
+    FitsHdu         *hdus;      /* hdus[0] is the primary HDU */
+    int             nhdus;
+} FitsMap;
+
+/**
+ * Map "file" and parse the headers of all its HDUs. Return NULL if the file
+ * can not be mapped or is not a plain FITS file (gzipped, truncated...),
+ * in which case it should be read with CFITSIO.
+ */
+extern FitsMap*
+FitsMap_open(char *file);
+
+extern void
+FitsMap_close(FitsMap *map);
+
+/**
+ * Copy in "value" the value of keyword "key", without quotes, comment and
+ * trailing spaces. Return false if "hdu" has no such keyword.
+ */
+extern bool
+FitsMap_keyword(FitsHdu *hdu, const char *key, char *value, int size);
+
+/**
+ * Return the column named "name", or NULL.
+ */
+extern FitsColumn*
+FitsMap_column(FitsHdu *hdu, const char *name);
+
+/**
+ * Decode the big endian values of "column" straight from the mapping, in
+ * out[0], out[stride], ... out[(nrows - 1) * stride]. Return false if the
+ * column is not numeric or is scaled.
+ */
+extern bool
+FitsMap_readDouble(FitsHdu *hdu, FitsColumn *column, double *out, int stride);
+
+extern bool
+FitsMap_readLong(FitsHdu *hdu, FitsColumn *column, long *out, int stride);
+
+#endif /* __FITSMAP_H__ */
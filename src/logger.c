@@ -1,6 +1,18 @@
 /*
  * Logger utils.
  *
+ * In asynchronous mode every logging thread owns a single producer, single
+ * consumer ring of messages. Rings are pushed on a lock free list when a
+ * thread logs for the first time, and marked closed when the thread ends.
+ * The writer thread drains the rings in list order, and frees the closed
+ * empty rings it can unlink: producers only ever change the list head, so
+ * the writer never unlinks it.
+ *
+ * A LOGGER_CRITICAL message first stops the writer, so that the messages
+ * logged before it are written before abort(). A forked child has no
+ * writer: it drops the pending messages of its parent, which writes them,
+ * and logs synchronously.
+ *
  * Copyright (C) 2017 University of Bordeaux. All right reserved.
  * Written by Emmanuel Bertin
  * Written by Sebastien Serre
@@ -14,16 +26,170 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "logger.h"
+#include "mem.h"
+
+typedef struct log_message {
+	LoggerLevel	level;
+	char		text[LOGGER_MESSAGE_SIZE];
+} log_message;
+
+typedef struct log_ring {
+	log_message		slots[LOGGER_RING_SLOTS];
+	uint64_t		head;	/* next slot written, by the producer */
+	uint64_t		tail;	/* next slot read, by the writer */
+	int				closed;
+	struct log_ring	*next;
+} log_ring;
 
 static LoggerLevel L_LEVEL = LOGGER_NORMAL;
 
+static int async = 0;
+static int stopping = 0;
+static long dropped = 0;
+static log_ring *rings = NULL;
+static pthread_t writer;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static __thread log_ring *local_ring = NULL;
+
+/* writer sleep when all rings are empty */
+#define WRITER_SLEEP_NS 1000000
+
+
+static void
+write_message(LoggerLevel level, const char *text)
+{
+	fputs(text, level < LOGGER_QUIET ? stderr : stdout);
+}
+
+static void
+close_ring(void *ring)
+{
+	__atomic_store_n(&((log_ring*) ring)->closed, 1, __ATOMIC_RELEASE);
+}
+
+static void
+make_ring_key()
+{
+	pthread_key_create(&ring_key, close_ring);
+}
+
+static log_ring*
+thread_ring()
+{
+	if (local_ring)
+		return local_ring;
+
+	log_ring *ring = ALLOC(sizeof(log_ring));
+	ring->head = ring->tail = 0;
+	ring->closed = 0;
+	ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, true,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	pthread_once(&ring_key_once, make_ring_key);
+	pthread_setspecific(ring_key, ring);
+	local_ring = ring;
+
+	return ring;
+}
+
+/* write the pending messages of "ring", return their number */
+static long
+drain_ring(log_ring *ring)
+{
+	uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	uint64_t tail = ring->tail;
+	long n = head - tail;
+
+	for (; tail<head; tail++) {
+		log_message *m = &ring->slots[tail % LOGGER_RING_SLOTS];
+		write_message(m->level, m->text);
+	}
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+static long
+drain_rings()
+{
+	log_ring *ring, *prev = NULL, *next;
+	long n = 0;
+
+	for (ring=__atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring=next) {
+		next = ring->next;
+		int closed = __atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE);
+		n += drain_ring(ring);
+		if (closed && prev) {
+			prev->next = next;
+			FREE(ring);
+			continue;
+		}
+		prev = ring;
+	}
+	if (n > 0) {
+		fflush(stdout);
+		fflush(stderr);
+	}
+
+	return n;
+}
+
+static void*
+writer_thread(void *args)
+{
+	struct timespec pause = {0, WRITER_SLEEP_NS};
+
+	while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+		if (drain_rings() == 0)
+			nanosleep(&pause, NULL);
+	drain_rings();
+
+	return NULL;
+}
+
+/* write every pending message and join the writer, false if stopped */
+static bool
+stop_writer()
+{
+	if (!__atomic_exchange_n(&async, 0, __ATOMIC_ACQ_REL))
+		return false;
+
+	__atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+	pthread_join(writer, NULL);
+
+	return true;
+}
+
+static void
+fork_child()
+{
+	log_ring *ring;
+
+	if (!async)
+		return;
+	async = 0;
+	for (ring=rings; ring; ring=ring->next)
+		ring->tail = ring->head;
+}
+
+
 void
 Logger_setLevel(LoggerLevel level) {
 	L_LEVEL = level;
 }
 
+bool
+Logger_enabled(LoggerLevel level) {
+	return level <= L_LEVEL;
+}
+
 void
 Logger_log(LoggerLevel level, char *format, ...) {
     FILE *output;
@@ -34,13 +200,65 @@ Logger_log(LoggerLevel level, char *format, ...) {
 	else
 	    output = stdout;
 
+	if (level == LOGGER_CRITICAL)
+		stop_writer();
+
+	if (level <= L_LEVEL && __atomic_load_n(&async, __ATOMIC_ACQUIRE)) {
+		log_ring *ring = thread_ring();
+		uint64_t head = ring->head;
+		if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >=
+				LOGGER_RING_SLOTS) {
+			__atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		log_message *m = &ring->slots[head % LOGGER_RING_SLOTS];
+		m->level = level;
+		va_start(args, format);
+		vsnprintf(m->text, LOGGER_MESSAGE_SIZE, format, args);
+		va_end(args);
+		__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+		return;
+	}
+
 	if (level <= L_LEVEL) {
 		va_start(args, format);
 		vfprintf(output, format, args);
 		va_end(args);
 	}
 
-	if (level == LOGGER_CRITICAL)
-	    abort();
+	if (level == LOGGER_CRITICAL) {
+		fflush(output);
+		abort();
+	}
+
+}
+
+void
+Logger_startAsync() {
+	static int registered = 0;
+
+	if (async)
+		return;
+
+	stopping = 0;
+	dropped = 0;
+	if (pthread_create(&writer, NULL, writer_thread, NULL) != 0)
+		return;
+	async = 1;
+
+	if (!registered) {
+		atexit(Logger_stopAsync);
+		pthread_atfork(NULL, NULL, fork_child);
+		registered = 1;
+	}
+}
+
+void
+Logger_stopAsync() {
+	stop_writer();
+}
 
+long
+Logger_dropped() {
+	return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
 }
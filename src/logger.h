@@ -12,6 +12,8 @@
 #ifndef __LOGGER_H__
 #define __LOGGER_H__
 
+#include <stdbool.h>
+
 typedef enum {
     LOGGER_CRITICAL = 0,
     LOGGER_ERROR    = 3,
@@ -22,17 +24,72 @@ typedef enum {
 	LOGGER_TRACE    = 25
 } LoggerLevel;
 
+/*
+ * Most verbose level compiled in, see LOGGER_LOG. Set it with
+ * ./configure --with-max-log-level=N.
+ */
+#ifndef LOGGER_MAX_LEVEL
+#define LOGGER_MAX_LEVEL 25
+#endif
+
+/* bytes of a message in asynchronous mode, longer messages are truncated */
+#define LOGGER_MESSAGE_SIZE 256
+
+/* messages of a thread ring, messages are dropped when it is full */
+#define LOGGER_RING_SLOTS 256
+
+/*
+ * Log a message if "level" is compiled in and enabled. Above
+ * LOGGER_MAX_LEVEL the call, and the evaluation of its arguments, are
+ * removed by the compiler. Otherwise the arguments are only formatted if
+ * the level is enabled at run time.
+ */
+#define LOGGER_LOG(level, ...) \
+    do { \
+        if ((level) <= LOGGER_MAX_LEVEL && Logger_enabled(level)) \
+            Logger_log((level), __VA_ARGS__); \
+    } while (0)
+
 /*
  * Set log level.
  */
 extern void
 Logger_setLevel(LoggerLevel level);
 
+/*
+ * True if messages of "level" are printed.
+ */
+extern bool
+Logger_enabled(LoggerLevel level);
+
 /*
  * Log a message.
- * TODO put this in a macro and print file and line number.
  */
 extern void
-Logger_log(LoggerLevel level, char *format, ...);
+Logger_log(LoggerLevel level, char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/*
+ * Asynchronous mode: messages are formatted by the calling thread into a
+ * ring buffer of its own, without locking, and written by a background
+ * thread. A full ring drops messages rather than blocking. A
+ * LOGGER_CRITICAL message writes the pending messages, then itself
+ * synchronously before abort(). Forked children log synchronously.
+ * Messages of different threads may be reordered.
+ *
+ * Logger_stopAsync writes the pending messages and returns to synchronous
+ * mode, it is called at exit. Neither function is thread safe.
+ */
+extern void
+Logger_startAsync();
+
+extern void
+Logger_stopAsync();
+
+/*
+ * Messages dropped because of full rings since Logger_startAsync.
+ */
+extern long
+Logger_dropped();
 
 #endif /* __LOGGER_H__ */
@@ -11,6 +11,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
 #include <math.h>
@@ -20,10 +21,80 @@
 #include "catalog.h"
 #include "crossmatch.h"
 #include "pixelstore.h"
+#include "chunkstore.h"
+#include "partition.h"
+#include "pipeline.h"
+#include "moc.h"
+#include "asciicat.h"
+#include "skycache.h"
+#include "snapshot.h"
+#include "export.h"
+#include "perfcount.h"
+#include "trace.h"
+#include "server.h"
 
 #include "chealpix.h"
 #include "scamp.h"
 
+/*
+ * Remove from "files" the catalogs whose footprint can not overlap any
+ * other, and return the number of remaining files.
+ */
+static int
+prune_files(char **files, int nfiles, Catalog_footprintFunc footprint) {
+    Moc **mocs = ALLOC(sizeof(Moc*) * nfiles);
+    bool *overlap = ALLOC(sizeof(bool) * nfiles);
+    int64_t *pixels;
+    int i, n;
+
+    for (i=0; i<nfiles; i++) {
+        long npixels = footprint(files[i], MOC_FIELD_ORDER, &pixels);
+        /* footprints are sampled on a grid, dilate them to be safe */
+        mocs[i] = Moc_fromPixels(MOC_FIELD_ORDER, pixels, npixels, true);
+        FREE(pixels);
+    }
+    Moc_overlapping(mocs, nfiles, MOC_FIELD_ORDER, overlap);
+
+    for (i=0, n=0; i<nfiles; i++) {
+        Moc_free(mocs[i]);
+        if (!overlap[i]) {
+            Logger_log(LOGGER_NORMAL,
+                    "%s does not overlap any other catalog, skip it\n", files[i]);
+            continue;
+        }
+        files[n++] = files[i];
+    }
+    FREE(mocs);
+    FREE(overlap);
+
+    return n;
+}
+
+/*
+ * Remove from "store" the samples of fields whose coverage does not
+ * overlap any other field.
+ */
+static void
+prune_fields(PixelStore *store, Field *fields, int nfields) {
+    Moc **mocs = ALLOC(sizeof(Moc*) * nfields);
+    bool *overlap = ALLOC(sizeof(bool) * nfields);
+    int i;
+
+    for (i=0; i<nfields; i++)
+        mocs[i] = fields[i].moc;
+    Moc_overlapping(mocs, nfields, MOC_FIELD_ORDER, overlap);
+
+    for (i=0; i<nfields; i++) {
+        if (overlap[i])
+            continue;
+        Logger_log(LOGGER_NORMAL,
+                "field %i does not overlap any other field, skip it\n", i);
+        PixelStore_removeField(store, &fields[i]);
+    }
+    FREE(mocs);
+    FREE(overlap);
+}
+
 /**
  * TODO:
  * 1 - get nsides depending of the max error from all files with the neighbors
@@ -38,8 +109,19 @@ int main(int argc, char** argv) {
     int nsides_power = 16, c;
     double radius_arcsec = 2.0; /* in arcsec */
 	int nthreads= 4;
+    long budget_mb = 0; /* chunked mode if set */
+    char *spilldir = "/tmp";
+    int nworkers = 0; /* multi process mode if set */
+    int nloaders = 0; /* pipelined mode if set */
+    bool prune = false; /* skip catalogs that can not match */
+    bool ascii = false; /* ascii catalogs instead of sextractor ones */
+    char *snapshot = NULL; /* snapshot written after loading if set */
+    char *reference = NULL; /* reference snapshot if set */
+    char *output = NULL; /* matches written if set */
+    char *trace = NULL; /* timeline written if set */
+    char *server = NULL; /* resident match server socket if set */
 
-    while ((c=getopt(argc,argv,"n:r:t:b")) != -1) {
+    while ((c=getopt(argc,argv,"n:r:t:m:d:w:p:f:C:s:R:o:T:S:abcAPL")) != -1) {
         switch(c) {
         case 'n':
             nsides_power = atoi(optarg);
@@ -50,38 +132,245 @@ int main(int argc, char** argv) {
         case 't':
             nthreads = atoi(optarg);
             break;
+        case 'm':
+            budget_mb = atol(optarg);
+            break;
+        case 'd':
+            spilldir = optarg;
+            break;
+        case 'w':
+            nworkers = atoi(optarg);
+            break;
+        case 'p':
+            nloaders = atoi(optarg);
+            break;
+        case 'a':
+            Crossmatch_setEngine(CROSSMATCH_ATOMIC);
+            break;
+        case 'c':
+            prune = true;
+            break;
+        case 'A':
+            ascii = true;
+            break;
+        case 'P':
+            /* hardware counters of the load, index and match phases */
+            PerfCount_setEnabled(true);
+            break;
+        case 'L':
+            /* log from a background thread, see Logger_startAsync */
+            Logger_startAsync();
+            break;
+        case 'f':
+            /* fast WCS, tolerance in milliarcsec */
+            Catalog_setFastWcs(atof(optarg) / 1000);
+            break;
+        case 'C':
+            /* cache of projected samples */
+            SkyCache_setDir(optarg);
+            break;
+        case 's':
+            /* write a snapshot of the loaded store */
+            snapshot = optarg;
+            break;
+        case 'R':
+            /* crossmatch with a reference snapshot */
+            reference = optarg;
+            break;
+        case 'o':
+            /* matches output, CSV if named *.csv, FITS otherwise */
+            output = optarg;
+            break;
+        case 'T':
+            /* Chrome trace of the run */
+            trace = optarg;
+            Trace_enable();
+            break;
+        case 'S':
+            /* serve matches against the loaded catalogs on a socket */
+            server = optarg;
+            break;
         default:
             abort();
         }
     }
 
+    /* matches are only exported from an in memory crossmatch */
+    if (output && (nworkers > 0 || nloaders > 0 || budget_mb > 0 ||
+                reference || server)) {
+        Logger_log(LOGGER_ERROR,
+                "-o can not be used with -w, -p, -m, -R or -S\n");
+        return (EXIT_FAILURE);
+    }
+
     int nfields   = argc - optind;
     char **cat_files = &argv[optind];
 
+    Catalog_loadFunc load = Catalog_openWith;
+    Catalog_footprintFunc footprint = Catalog_footprint;
+    if (ascii) {
+        AsciiFormat format = AsciiCat_defaultFormat;
+        format.nthreads = nthreads;
+        AsciiCat_setFormat(&format);
+        load = AsciiCat_openWith;
+        footprint = AsciiCat_footprint;
+    }
+
+    if (prune)
+        nfields = prune_files(cat_files, nfields, footprint);
+
     Field *fields = ALLOC(sizeof(Field) * nfields);
 
     int64_t nsides = pow(2, nsides_power);
-    PixelStore *store = PixelStore_new(nsides);
     int i;
+
+    if (nworkers > 0) {
+        /*
+         * Multi process mode, each worker process own a part of the sky.
+         */
+        PartitionMatch *matches;
+        Partition_crossFiles(cat_files, nfields, load, nsides,
+                radius_arcsec, nworkers, nthreads, &matches);
+        FREE(matches);
+        FREE(fields);
+        if (trace)
+            Trace_write(trace);
+        return (EXIT_SUCCESS);
+    }
+
+    if (nloaders > 0) {
+        /*
+         * Pipelined mode, regions of the sky are crossmatched as soon as
+         * all the catalogs covering them are loaded.
+         */
+        long nmatches = Pipeline_crossFiles(cat_files, nfields, fields,
+                load, footprint, nsides, radius_arcsec, nloaders, nthreads,
+                NULL, NULL);
+
+        Trace_begin("teardown", NULL);
+        for (i=0; i<nfields; i++)
+            Catalog_freeField(&fields[i]);
+        FREE(fields);
+        Trace_end();
+        if (trace)
+            Trace_write(trace);
+        return nmatches < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    if (budget_mb > 0) {
+        /*
+         * Out of core mode, samples are spilled to disk and crossmatched
+         * by chunks fitting in budget_mb.
+         */
+        ChunkStore *chunks =
+            ChunkStore_new(nsides, spilldir, budget_mb * 1024 * 1024);
+        for (i=0; i<nfields; i++)
+            load(cat_files[i], &fields[i],
+                    (Catalog_addFunc) ChunkStore_add, chunks);
+
+        ChunkStore_crossSamples(chunks, radius_arcsec, nthreads, NULL, NULL);
+
+        Trace_begin("teardown", NULL);
+        ChunkStore_free(chunks);
+        for (i=0; i<nfields; i++)
+            Catalog_freeField(&fields[i]);
+        FREE(fields);
+        Trace_end();
+        if (trace)
+            Trace_write(trace);
+        return (EXIT_SUCCESS);
+    }
+
+    PixelStore *store = PixelStore_new(nsides);
+    PerfCounters counters;
+    PerfCount_start(&counters);
+    Trace_begin("load", "%i files", nfields);
     for (i=0; i<nfields; i++)
-        Catalog_open(cat_files[i], &fields[i], store);
+        load(cat_files[i], &fields[i], (Catalog_addFunc) PixelStore_add, store);
+    Trace_end();
+    PerfCount_stop(&counters, "load", 0);
+
+    if (prune)
+        prune_fields(store, fields, nfields);
+
+    if (snapshot)
+        Snapshot_write(snapshot, store, fields, nfields, nthreads);
+
+    Snapshot *ref = NULL;
+    if (reference && !(ref = Snapshot_open(reference)))
+        return (EXIT_FAILURE);
+
+    if (server) {
+        /*
+         * Resident mode, the reference snapshot, or a snapshot of the
+         * loaded catalogs, stays mapped and exposures are cross matched
+         * with it on request.
+         */
+        if (!ref) {
+            char tmp[4096];
+            snprintf(tmp, sizeof(tmp), "%s/scamp-server-%i.snp",
+                    spilldir, getpid());
+            if (!snapshot && !Snapshot_write(tmp, store, fields, nfields,
+                        nthreads))
+                return (EXIT_FAILURE);
+            ref = Snapshot_open(snapshot ? snapshot : tmp);
+            /* the mapping outlives the file */
+            if (!snapshot)
+                unlink(tmp);
+            if (!ref)
+                return (EXIT_FAILURE);
+        }
+
+        Trace_begin("teardown", NULL);
+        for (i=0; i<nfields; i++)
+            Catalog_freeField(&fields[i]);
+        FREE(fields);
+        PixelStore_free(store);
+        Trace_end();
+
+        bool served = Server_run(server, ref, load, radius_arcsec, nthreads);
+        Snapshot_close(ref);
+        if (trace)
+            Trace_write(trace);
+        return served ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
     struct timespec start, end;
 	printf("match radius max is %0.30lf\n", (180.0f / (4 * nsides - 1)) * 3600  );
     clock_gettime(CLOCK_MONOTONIC_RAW, &start);
-    Crossmatch_crossSamples(store, radius_arcsec, nthreads);
+    if (ref)
+        Snapshot_crossSamples(ref, store, radius_arcsec, nthreads);
+    else
+        Crossmatch_crossSamples(store, radius_arcsec, nthreads);
     clock_gettime(CLOCK_MONOTONIC_RAW, &end);
     int sec = end.tv_sec - start.tv_sec;
     double nano = (end.tv_nsec - start.tv_nsec);
     double nano2 = nano / 1000000000;
     double elapsed = (double) sec + nano2;
     printf("Crossmatch done in %lf time seconds\n", elapsed);
+    PerfCount_log();
 
+    long nexported = 0;
+    if (output) {
+        size_t len = strlen(output);
+        int format = len > 4 && strcmp(output + len - 4, ".csv") == 0 ?
+            EXPORT_CSV : EXPORT_FITS;
+        nexported = Export_matches(output, format, store, fields, nfields,
+                nthreads);
+    }
+
+    Trace_begin("teardown", NULL);
     for (i=0; i<nfields; i++)
         Catalog_freeField(&fields[i]);
 
+    if (ref)
+        Snapshot_close(ref);
     PixelStore_free(store);
-    return (EXIT_SUCCESS);
+    Trace_end();
+
+    if (trace)
+        Trace_write(trace);
+    return nexported < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 
 }
 
@@ -0,0 +1,327 @@
+/*
+ * Multi Order Coverage maps: sky coverage of fields and sets.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "moc.h"
+#include "chealpix.h"
+#include "logger.h"
+#include "mem.h"
+
+#define MOC_BASE_SIZE 16
+
+
+/******************************************************************************
+ * PRIVATE FUNCTIONS
+ */
+static int
+cmp_range(const void *a, const void *b)
+{
+	int64_t ia = *(const int64_t*) a;
+	int64_t ib = *(const int64_t*) b;
+	return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
+
+static void
+push_range(
+	Moc		*moc,
+	int64_t	start,
+	int64_t	end)
+{
+	if (moc->nranges == moc->size) {
+		moc->size *= 2;
+		moc->ranges = REALLOC(moc->ranges, sizeof(int64_t) * 2 * moc->size);
+	}
+	moc->ranges[2 * moc->nranges] = start;
+	moc->ranges[2 * moc->nranges + 1] = end;
+	moc->nranges++;
+}
+
+/*
+ * Append [start, end[ to a normalized "moc" whose ranges all start before
+ * "start", merging it with the last range if they touch.
+ */
+static void
+append_range(
+	Moc		*moc,
+	int64_t	start,
+	int64_t	end)
+{
+	int64_t *last;
+
+	if (moc->nranges > 0) {
+		last = &moc->ranges[2 * (moc->nranges - 1)];
+		if (start <= last[1]) {
+			if (end > last[1])
+				last[1] = end;
+			return;
+		}
+	}
+	push_range(moc, start, end);
+}
+
+/**
+ * PRIVATE FUNCTIONS END
+ ******************************************************************************/
+
+
+
+/******************************************************************************
+ * PUBLIC FUNCTIONS
+ */
+Moc*
+Moc_new()
+{
+	Moc *moc = ALLOC(sizeof(Moc));
+	moc->ranges = ALLOC(sizeof(int64_t) * 2 * MOC_BASE_SIZE);
+	moc->nranges = 0;
+	moc->size = MOC_BASE_SIZE;
+	return moc;
+}
+
+
+void
+Moc_addPixel(
+	Moc		*moc,
+	int		order,
+	int64_t	pix)
+{
+	int shift = 2 * (MOC_MAXORDER - order);
+	push_range(moc, pix << shift, (pix + 1) << shift);
+}
+
+
+void
+Moc_normalize(Moc *moc)
+{
+	long i, n;
+	int64_t *r = moc->ranges;
+
+	if (moc->nranges < 2)
+		return;
+
+	/* ranges are pairs of int64_t, sort them on their start */
+	qsort(r, moc->nranges, sizeof(int64_t) * 2, cmp_range);
+
+	for (i=1, n=0; i<moc->nranges; i++) {
+		if (r[2*i] <= r[2*n+1]) {
+			if (r[2*i+1] > r[2*n+1])
+				r[2*n+1] = r[2*i+1];
+			continue;
+		}
+		n++;
+		r[2*n] = r[2*i];
+		r[2*n+1] = r[2*i+1];
+	}
+	moc->nranges = n + 1;
+}
+
+
+Moc*
+Moc_fromPixels(
+	int		order,
+	int64_t	*pixels,
+	long	npixels,
+	bool	dilate)
+{
+	int64_t neighbors[8];
+	long i;
+	int k;
+
+	Moc *moc = Moc_new();
+	for (i=0; i<npixels; i++) {
+		Moc_addPixel(moc, order, pixels[i]);
+		if (!dilate)
+			continue;
+		neighbours_nest64(((int64_t) 1) << order, pixels[i], neighbors);
+		for (k=0; k<8; k++)
+			if (neighbors[k] >= 0)
+				Moc_addPixel(moc, order, neighbors[k]);
+	}
+	Moc_normalize(moc);
+
+	return moc;
+}
+
+
+Moc*
+Moc_fromPositions(
+	int		order,
+	double	*col,
+	double	*lon,
+	long	nsamples)
+{
+	long i;
+
+	if (nsamples == 0)
+		return Moc_new();
+
+	int64_t *pixels = ALLOC(sizeof(int64_t) * nsamples);
+	ang2pix_nest64_batch(((int64_t) 1) << order, nsamples, col, lon, pixels);
+
+	Moc *moc = Moc_new();
+	for (i=0; i<nsamples; i++)
+		Moc_addPixel(moc, order, pixels[i]);
+	Moc_normalize(moc);
+	FREE(pixels);
+
+	return moc;
+}
+
+
+Moc*
+Moc_dilate(
+	Moc	*moc,
+	int	order)
+{
+	int shift = 2 * (MOC_MAXORDER - order);
+	int64_t neighbors[8], p, first, last;
+	long i;
+	int k;
+
+	Moc *dilated = Moc_new();
+	for (i=0; i<moc->nranges; i++) {
+		first = moc->ranges[2*i] >> shift;
+		last = (moc->ranges[2*i+1] - 1) >> shift;
+		for (p=first; p<=last; p++) {
+			Moc_addPixel(dilated, order, p);
+			neighbours_nest64(((int64_t) 1) << order, p, neighbors);
+			for (k=0; k<8; k++)
+				if (neighbors[k] >= 0)
+					Moc_addPixel(dilated, order, neighbors[k]);
+		}
+	}
+	Moc_normalize(dilated);
+
+	return dilated;
+}
+
+
+Moc*
+Moc_union(
+	Moc	*a,
+	Moc	*b)
+{
+	long i = 0, j = 0;
+	int64_t *ra = a->ranges, *rb = b->ranges;
+
+	Moc *moc = Moc_new();
+	while (i < a->nranges || j < b->nranges) {
+		if (j == b->nranges || (i < a->nranges && ra[2*i] <= rb[2*j])) {
+			append_range(moc, ra[2*i], ra[2*i+1]);
+			i++;
+		} else {
+			append_range(moc, rb[2*j], rb[2*j+1]);
+			j++;
+		}
+	}
+
+	return moc;
+}
+
+
+Moc*
+Moc_intersection(
+	Moc	*a,
+	Moc	*b)
+{
+	long i = 0, j = 0;
+	int64_t *ra = a->ranges, *rb = b->ranges, start, end;
+
+	Moc *moc = Moc_new();
+	while (i < a->nranges && j < b->nranges) {
+		start = ra[2*i] > rb[2*j] ? ra[2*i] : rb[2*j];
+		end = ra[2*i+1] < rb[2*j+1] ? ra[2*i+1] : rb[2*j+1];
+		if (start < end)
+			push_range(moc, start, end);
+		if (ra[2*i+1] < rb[2*j+1])
+			i++;
+		else
+			j++;
+	}
+
+	return moc;
+}
+
+
+bool
+Moc_intersects(
+	Moc	*a,
+	Moc	*b)
+{
+	long i = 0, j = 0;
+	int64_t *ra = a->ranges, *rb = b->ranges;
+
+	while (i < a->nranges && j < b->nranges) {
+		if (ra[2*i+1] <= rb[2*j])
+			i++;
+		else if (rb[2*j+1] <= ra[2*i])
+			j++;
+		else
+			return true;
+	}
+
+	return false;
+}
+
+
+int64_t
+Moc_npixels(Moc *moc)
+{
+	int64_t n = 0;
+	long i;
+	for (i=0; i<moc->nranges; i++)
+		n += moc->ranges[2*i+1] - moc->ranges[2*i];
+	return n;
+}
+
+
+int
+Moc_overlapping(
+	Moc		**mocs,
+	int		n,
+	int		order,
+	bool	*overlap)
+{
+	int i, j, noverlap = 0;
+	Moc *dilated;
+
+	for (i=0; i<n; i++) {
+		overlap[i] = false;
+		dilated = Moc_dilate(mocs[i], order);
+		for (j=0; j<n; j++) {
+			if (j != i && Moc_intersects(dilated, mocs[j])) {
+				overlap[i] = true;
+				noverlap++;
+				break;
+			}
+		}
+		Moc_free(dilated);
+	}
+
+	return noverlap;
+}
+
+
+void
+Moc_free(Moc *moc)
+{
+	if (!moc)
+		return;
+	FREE(moc->ranges);
+	FREE(moc);
+}
+/**
+ * PUBLIC FUNCTIONS END
+ ******************************************************************************/
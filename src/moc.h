@@ -0,0 +1,109 @@
+/*
+ * Multi Order Coverage maps: sky coverage of fields and sets.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __MOC_H__
+#define __MOC_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* ranges are nested pixel ids at this order */
+#define MOC_MAXORDER 29
+
+/*
+ * Order of field and set MOCs built at load time. Pixels are about 3.4
+ * arcmin wide, so that neighbor pixels cover any match radius.
+ */
+#define MOC_FIELD_ORDER 10
+
+/**
+ * A MOC is a sorted list of disjoint, non adjacent ranges [start, end[ of
+ * nested pixels at MOC_MAXORDER. A pixel "p" at order "o" is the range
+ * [p << 2(29 - o), (p + 1) << 2(29 - o)[, so that pixels of any order can
+ * be mixed.
+ */
+typedef struct Moc {
+    int64_t *ranges;    /* start and end of each range */
+    long    nranges;
+    long    size;       /* PRIVATE, allocated ranges */
+} Moc;
+
+extern Moc*
+Moc_new();
+
+/*
+ * Add pixel "pix" at "order". Ranges are not sorted until Moc_normalize()
+ * is called.
+ */
+extern void
+Moc_addPixel(Moc *moc, int order, int64_t pix);
+
+/*
+ * Sort and merge ranges. Must be called after Moc_addPixel() and before
+ * any other operation.
+ */
+extern void
+Moc_normalize(Moc *moc);
+
+/*
+ * MOC of "npixels" pixels at "order", with their neighbors if "dilate"
+ * is true.
+ */
+extern Moc*
+Moc_fromPixels(int order, int64_t *pixels, long npixels, bool dilate);
+
+/*
+ * MOC of the pixels at "order" holding the "nsamples" positions "col"
+ * (colatitude) and "lon", in radians.
+ */
+extern Moc*
+Moc_fromPositions(int order, double *col, double *lon, long nsamples);
+
+/*
+ * Add the neighbors at "order" of every pixel of "moc". Pixels of "moc"
+ * smaller than "order" are first extended to their parent pixel.
+ */
+extern Moc*
+Moc_dilate(Moc *moc, int order);
+
+extern Moc*
+Moc_union(Moc *a, Moc *b);
+
+extern Moc*
+Moc_intersection(Moc *a, Moc *b);
+
+/*
+ * Return true if "a" and "b" have a common pixel. Does not allocate.
+ */
+extern bool
+Moc_intersects(Moc *a, Moc *b);
+
+/*
+ * Return the number of pixels at MOC_MAXORDER covered by "moc".
+ */
+extern int64_t
+Moc_npixels(Moc *moc);
+
+/*
+ * Set "overlap[i]" to true if the neighborhood at "order" of "mocs[i]"
+ * intersects any other of the "n" MOCs. Other inputs can not match with
+ * samples of "mocs[i]" when it is false, and it can be skipped. Return
+ * the number of MOCs overlapping another.
+ */
+extern int
+Moc_overlapping(Moc **mocs, int n, int order, bool *overlap);
+
+extern void
+Moc_free(Moc *moc);
+
+#endif /* __MOC_H__ */
@@ -0,0 +1,566 @@
+/*
+ * Multi process cross matching, each process owning a range of the sky.
+ *
+ * Workers are forked from the calling process and connected to each others
+ * and to the parent by unix socket pairs. A run goes as follow:
+ * - 1 each worker loads its part of the files and route every sample to
+ *   the worker owning its pixel and to the workers owning a pixel it is in
+ *   the halo of,
+ * - 2 all to all exchange of the routed samples,
+ * - 3 each worker cross match the samples it has received, and send the
+ *   matches of the samples it owns to the parent,
+ * - 4 the parent merges and sorts the matches.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "partition.h"
+#include "chunkstore.h"
+#include "chealpix.h"
+#include "logger.h"
+#include "mem.h"
+
+/*
+ * Sample as sent between workers.
+ */
+typedef struct WireRecord {
+	int		field;
+	int		set;
+	long	row;
+	double	lon;
+	double	col;
+	int64_t	pix_nest;
+} WireRecord;
+
+/*
+ * A growing buffer of bytes to send or being received.
+ */
+typedef struct WireBuffer {
+	char	*data;
+	long	size;
+	long	capacity;
+	long	done;		/* bytes sent or received */
+	int64_t	count;		/* number of records, received first */
+} WireBuffer;
+
+typedef struct Worker {
+	int			rank;
+	int			nworkers;
+	int64_t		nsides;
+	int			order;		/* partition order */
+	int			*peers;		/* socket to other workers, -1 for self */
+	WireBuffer	*out;		/* per destination worker */
+	int			field;		/* file being loaded */
+} Worker;
+
+/* every worker owns at least this number of pixels at partition order */
+#define PIXELS_PER_WORKER 16
+
+
+/******************************************************************************
+ * PRIVATE FUNCTIONS
+ */
+static int
+nsides_order(int64_t nsides)
+{
+	int order = 0;
+	while ((((int64_t) 1) << order) < nsides)
+		order++;
+	return order;
+}
+
+static int
+owner_of(int64_t chunk, int order, int nworkers)
+{
+	int64_t nchunks = 12 * (((int64_t) 1) << (2 * order));
+	return (chunk * nworkers) / nchunks;
+}
+
+static void
+buffer_append(WireBuffer *buf, void *data, long size)
+{
+	if (buf->size + size > buf->capacity) {
+		while (buf->size + size > buf->capacity)
+			buf->capacity *= 2;
+		buf->data = REALLOC(buf->data, buf->capacity);
+	}
+	memcpy(&buf->data[buf->size], data, size);
+	buf->size += size;
+}
+
+static void
+buffer_init(WireBuffer *buf)
+{
+	buf->capacity = 4096;
+	buf->data = ALLOC(buf->capacity);
+	buf->size = 0;
+	buf->done = 0;
+	buf->count = 0;
+}
+
+static void
+write_all(int fd, void *data, long size)
+{
+	char *p = data;
+	ssize_t n;
+	while (size > 0) {
+		n = write(fd, p, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			Logger_log(LOGGER_CRITICAL, "Partition write failed\n");
+		p += n;
+		size -= n;
+	}
+}
+
+static void
+read_all(int fd, void *data, long size)
+{
+	char *p = data;
+	ssize_t n;
+	while (size > 0) {
+		n = read(fd, p, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			Logger_log(LOGGER_CRITICAL, "Partition read failed\n");
+		p += n;
+		size -= n;
+	}
+}
+
+/*
+ * Catalog_addFunc for workers: route the sample.
+ */
+static void
+worker_add(
+	Worker	*w,
+	Sample	spl,
+	Sample	**ext)
+{
+	WireRecord rec;
+	int64_t routes[9];
+	int i, j, n, dest[9], ndest;
+
+	rec.field	= w->field;
+	rec.set		= spl.set - spl.set->field->sets;
+	rec.row		= ext - spl.set->samples;
+	rec.lon		= spl.lon;
+	rec.col		= spl.col;
+	ang2pix_nest64(w->nsides, spl.col, spl.lon, &rec.pix_nest);
+
+	n = ChunkStore_route(w->nsides, w->order, rec.pix_nest, routes);
+	for (i=0, ndest=0; i<n; i++) {
+		int owner = owner_of(routes[i], w->order, w->nworkers);
+		for (j=0; j<ndest; j++)
+			if (dest[j] == owner)
+				break;
+		if (j == ndest)
+			dest[ndest++] = owner;
+	}
+
+	for (i=0; i<ndest; i++) {
+		buffer_append(&w->out[dest[i]], &rec, sizeof(WireRecord));
+		w->out[dest[i]].count++;
+	}
+
+	*ext = NULL;
+}
+
+/*
+ * All to all exchange of w->out buffers. Sockets are non blocking, and we
+ * poll until every buffer is sent and every peer buffer received, so that
+ * two workers writing to each others do not dead lock.
+ */
+static void
+worker_exchange(
+	Worker		*w,
+	WireBuffer	*in)
+{
+	struct pollfd *fds = ALLOC(sizeof(struct pollfd) * w->nworkers);
+	int *idx = ALLOC(sizeof(int) * w->nworkers);
+	int i, nfds, pending;
+	ssize_t n;
+
+	/* prepend record counts */
+	for (i=0; i<w->nworkers; i++) {
+		WireBuffer *out = &w->out[i];
+		if (i == w->rank)
+			continue;
+		WireBuffer msg;
+		buffer_init(&msg);
+		buffer_append(&msg, &out->count, sizeof(int64_t));
+		buffer_append(&msg, out->data, out->size);
+		FREE(out->data);
+		*out = msg;
+		fcntl(w->peers[i], F_SETFL, fcntl(w->peers[i], F_GETFL) | O_NONBLOCK);
+	}
+
+	for (;;) {
+		pending = 0;
+		for (i=0, nfds=0; i<w->nworkers; i++) {
+			if (i == w->rank)
+				continue;
+			short events = 0;
+			if (w->out[i].done < w->out[i].size)
+				events |= POLLOUT;
+			if (in[i].done < sizeof(int64_t) ||
+					in[i].done < in[i].size)
+				events |= POLLIN;
+			if (!events)
+				continue;
+			fds[nfds].fd = w->peers[i];
+			fds[nfds].events = events;
+			idx[nfds++] = i;
+			pending++;
+		}
+		if (!pending)
+			break;
+
+		if (poll(fds, nfds, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			Logger_log(LOGGER_CRITICAL, "Partition poll failed\n");
+		}
+
+		for (i=0; i<nfds; i++) {
+			WireBuffer *out = &w->out[idx[i]];
+			WireBuffer *buf = &in[idx[i]];
+
+			if (fds[i].revents & POLLOUT) {
+				n = write(fds[i].fd, &out->data[out->done],
+						out->size - out->done);
+				if (n < 0 && errno != EAGAIN && errno != EINTR)
+					Logger_log(LOGGER_CRITICAL, "Partition send failed\n");
+				if (n > 0)
+					out->done += n;
+			}
+
+			if (fds[i].revents & (POLLIN | POLLHUP)) {
+				if (buf->done < sizeof(int64_t)) {
+					n = read(fds[i].fd, ((char*) &buf->count) + buf->done,
+							sizeof(int64_t) - buf->done);
+				} else {
+					n = read(fds[i].fd, &buf->data[buf->done - sizeof(int64_t)],
+							buf->size - buf->done);
+				}
+				if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+					Logger_log(LOGGER_CRITICAL, "Partition receive failed\n");
+				if (n > 0)
+					buf->done += n;
+
+				/* header complete, allocate for records */
+				if (buf->done == sizeof(int64_t) && buf->data == NULL) {
+					buf->size = sizeof(int64_t) +
+							buf->count * sizeof(WireRecord);
+					buf->data = ALLOC(buf->size - sizeof(int64_t) + 1);
+				}
+			}
+		}
+	}
+
+	FREE(fds);
+	FREE(idx);
+}
+
+struct worker_results {
+	WireRecord	*wire;
+	ChunkRecord	*records;
+	WireBuffer	matches;
+};
+
+static void
+worker_on_match(
+	void		*udata,
+	ChunkRecord	*spl,
+	ChunkRecord	*match,
+	double		distance)
+{
+	struct worker_results *res = udata;
+	WireRecord *a = &res->wire[spl - res->records];
+	WireRecord *b = &res->wire[match - res->records];
+	PartitionMatch m;
+
+	m.field		= a->field;
+	m.set		= a->set;
+	m.row		= a->row;
+	m.mfield	= b->field;
+	m.mset		= b->set;
+	m.mrow		= b->row;
+	m.distance	= distance;
+
+	buffer_append(&res->matches, &m, sizeof(PartitionMatch));
+	res->matches.count++;
+}
+
+static void
+worker_run(
+	Worker				*w,
+	int					parent,
+	char				**files,
+	int					nfiles,
+	Catalog_loadFunc	load,
+	double				radius_arcsec,
+	int					nthreads)
+{
+	WireBuffer *in = CALLOC(w->nworkers, sizeof(WireBuffer));
+	Field field;
+	long i, j, nrecords;
+	int k;
+
+	/* 1 load and route */
+	w->out = ALLOC(sizeof(WireBuffer) * w->nworkers);
+	for (k=0; k<w->nworkers; k++)
+		buffer_init(&w->out[k]);
+
+	for (k=w->rank; k<nfiles; k+=w->nworkers) {
+		w->field = k;
+		load(files[k], &field, (Catalog_addFunc) worker_add, w);
+		Catalog_freeField(&field);
+	}
+
+	/* 2 exchange */
+	worker_exchange(w, in);
+
+	/* 3 cross match with placeholder sets: only fields must differ */
+	Field *fields = ALLOC(sizeof(Field) * nfiles);
+	Set *sets = ALLOC(sizeof(Set) * nfiles);
+	for (k=0; k<nfiles; k++) {
+		fields[k].sets = &sets[k];
+		fields[k].nsets = 1;
+		sets[k].samples = NULL;
+		sets[k].nsamples = 0;
+		sets[k].wcs = NULL;
+		sets[k].nwcs = 0;
+		sets[k].field = &fields[k];
+		sets[k].moc = NULL;
+		fields[k].moc = NULL;
+	}
+
+	for (k=0, nrecords=0; k<w->nworkers; k++)
+		nrecords += (k == w->rank) ? w->out[k].count : in[k].count;
+
+	struct worker_results res;
+	res.wire = ALLOC(sizeof(WireRecord) * (nrecords > 0 ? nrecords : 1));
+	res.records = ALLOC(sizeof(ChunkRecord) * (nrecords > 0 ? nrecords : 1));
+	buffer_init(&res.matches);
+
+	for (k=0, i=0; k<w->nworkers; k++) {
+		WireRecord *recs;
+		long n;
+		if (k == w->rank) {
+			recs = (WireRecord*) w->out[k].data;
+			n = w->out[k].count;
+		} else {
+			recs = (WireRecord*) in[k].data;
+			n = in[k].count;
+		}
+		for (j=0; j<n; j++, i++) {
+			res.wire[i] = recs[j];
+			res.records[i].set		= &sets[recs[j].field];
+			res.records[i].row		= recs[j].row;
+			res.records[i].id		= recs[j].row;
+			res.records[i].lon		= recs[j].lon;
+			res.records[i].col		= recs[j].col;
+			res.records[i].pix_nest	= recs[j].pix_nest;
+		}
+		FREE(w->out[k].data);
+		FREE(in[k].data);
+	}
+
+	/* owned pixels are the ones at partition order of our rank */
+	int64_t nchunks = 12 * (((int64_t) 1) << (2 * w->order));
+	int64_t first = (w->rank * nchunks + w->nworkers - 1) / w->nworkers;
+	int64_t last = ((w->rank + 1) * nchunks + w->nworkers - 1) / w->nworkers - 1;
+
+	if (nrecords > 0)
+		ChunkStore_crossRecords(w->nsides, w->order, first, last, res.records,
+				nrecords, radius_arcsec, nthreads, worker_on_match, &res);
+
+	LOGGER_LOG(LOGGER_DEBUG,
+			"Worker %i: %li samples, %li matches for pixels %li to %li\n",
+			w->rank, nrecords, (long) res.matches.count, first, last);
+
+	/* 4 send matches to the parent */
+	write_all(parent, &res.matches.count, sizeof(int64_t));
+	write_all(parent, res.matches.data, res.matches.size);
+
+	FREE(res.matches.data);
+	FREE(res.wire);
+	FREE(res.records);
+	FREE(fields);
+	FREE(sets);
+	FREE(in);
+	FREE(w->out);
+}
+
+static int
+cmp_match(const void *a, const void *b)
+{
+	const PartitionMatch *ma = a;
+	const PartitionMatch *mb = b;
+
+	if (ma->field != mb->field)
+		return ma->field < mb->field ? -1 : 1;
+	if (ma->set != mb->set)
+		return ma->set < mb->set ? -1 : 1;
+	if (ma->row != mb->row)
+		return ma->row < mb->row ? -1 : 1;
+	return 0;
+}
+
+/**
+ * PRIVATE FUNCTIONS END
+ ******************************************************************************/
+
+
+
+/******************************************************************************
+ * PUBLIC FUNCTIONS
+ */
+long
+Partition_crossFiles(
+	char				**files,
+	int					nfiles,
+	Catalog_loadFunc	load,
+	int64_t				nsides,
+	double				radius_arcsec,
+	int					nworkers,
+	int					nthreads,
+	PartitionMatch		**matches)
+{
+	int i, j, status, failed;
+	int sv[2];
+
+	/* partition order, at least PIXELS_PER_WORKER pixels per worker */
+	int order = 0;
+	while (order < nsides_order(nsides) &&
+			12 * (((int64_t) 1) << (2 * order)) < PIXELS_PER_WORKER * nworkers)
+		order++;
+
+	/* sockets[i][j] is the end of the pair i/j held by worker i */
+	int **sockets = ALLOC(sizeof(int*) * nworkers);
+	int *parents = ALLOC(sizeof(int) * nworkers);
+	int *childs = ALLOC(sizeof(int) * nworkers);
+	pid_t *pids = ALLOC(sizeof(pid_t) * nworkers);
+
+	for (i=0; i<nworkers; i++) {
+		sockets[i] = ALLOC(sizeof(int) * nworkers);
+		sockets[i][i] = -1;
+	}
+	for (i=0; i<nworkers; i++) {
+		for (j=i+1; j<nworkers; j++) {
+			if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+				Logger_log(LOGGER_CRITICAL, "socketpair failed\n");
+			sockets[i][j] = sv[0];
+			sockets[j][i] = sv[1];
+		}
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+			Logger_log(LOGGER_CRITICAL, "socketpair failed\n");
+		parents[i] = sv[0];
+		childs[i] = sv[1];
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+
+	for (i=0; i<nworkers; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0)
+			Logger_log(LOGGER_CRITICAL, "fork failed\n");
+		if (pids[i] > 0)
+			continue;
+
+		/* worker i, close what does not belong to us */
+		int k, l;
+		for (k=0; k<nworkers; k++) {
+			close(parents[k]);
+			if (k != i)
+				close(childs[k]);
+			for (l=0; l<nworkers; l++)
+				if (k != i && sockets[k][l] >= 0)
+					close(sockets[k][l]);
+		}
+
+		Worker w;
+		w.rank		= i;
+		w.nworkers	= nworkers;
+		w.nsides	= nsides;
+		w.order		= order;
+		w.peers		= sockets[i];
+		worker_run(&w, childs[i], files, nfiles, load, radius_arcsec, nthreads);
+
+		fflush(stdout);
+		_exit(EXIT_SUCCESS);
+	}
+
+	for (i=0; i<nworkers; i++) {
+		close(childs[i]);
+		for (j=0; j<nworkers; j++)
+			if (sockets[i][j] >= 0)
+				close(sockets[i][j]);
+	}
+
+	/* gather */
+	long nmatches = 0, capacity = 1024;
+	*matches = ALLOC(sizeof(PartitionMatch) * capacity);
+	for (i=0; i<nworkers; i++) {
+		int64_t count;
+		read_all(parents[i], &count, sizeof(int64_t));
+		if (nmatches + count > capacity) {
+			while (nmatches + count > capacity)
+				capacity *= 2;
+			*matches = REALLOC(*matches, sizeof(PartitionMatch) * capacity);
+		}
+		read_all(parents[i], &(*matches)[nmatches],
+				sizeof(PartitionMatch) * count);
+		nmatches += count;
+		close(parents[i]);
+	}
+
+	for (i=0, failed=0; i<nworkers; i++) {
+		waitpid(pids[i], &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+			failed++;
+	}
+	if (failed)
+		Logger_log(LOGGER_CRITICAL, "%i partition workers failed\n", failed);
+
+	/* deterministic merge */
+	qsort(*matches, nmatches, sizeof(PartitionMatch), cmp_match);
+
+	Logger_log(LOGGER_NORMAL,
+			"Partitioned crossmatch end: %li matches with %i workers\n",
+			nmatches, nworkers);
+
+	for (i=0; i<nworkers; i++)
+		FREE(sockets[i]);
+	FREE(sockets);
+	FREE(parents);
+	FREE(childs);
+	FREE(pids);
+
+	return nmatches;
+}
+/**
+ * PUBLIC FUNCTIONS END
+ ******************************************************************************/
@@ -0,0 +1,52 @@
+/*
+ * Multi process cross matching, each process owning a range of the sky.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __PARTITION_H__
+#define __PARTITION_H__
+
+#include <stdint.h>
+
+#include "scamp.h"
+#include "catalog.h"
+
+/*
+ * A match, samples are identified by the index of their file, of their set
+ * in the field, and of their row in the set.
+ */
+typedef struct PartitionMatch {
+    int     field;
+    int     set;
+    long    row;
+    int     mfield;
+    int     mset;
+    long    mrow;
+    double  distance;   /* euclidean distance between the samples vectors */
+} PartitionMatch;
+
+/**
+ * Cross match "files" with "nworkers" processes. Each worker loads a part
+ * of the files, and owns a contiguous range of nested pixels. Samples are
+ * sent to the worker owning them, and to the workers owning the pixels they
+ * are in the halo of, over local sockets. Workers then cross match their
+ * pixels with "nthreads" threads and send back their matches.
+ *
+ * "matches" is allocated and filled with one entry per sample having a
+ * match, sorted by field, set and row, so that the result does not depend
+ * on "nworkers". Return the number of matches.
+ */
+extern long
+Partition_crossFiles(char **files, int nfiles, Catalog_loadFunc load,
+        int64_t nsides, double radius_arcsec, int nworkers, int nthreads,
+        PartitionMatch **matches);
+
+#endif /* __PARTITION_H__ */
@@ -0,0 +1,294 @@
+/*
+ * Hardware performance counters of the load, index and match phases, per
+ * thread, with perf_event_open.
+ *
+ * Every event is opened on its own, for the calling thread only, so that
+ * the events the kernel refuses are skipped without losing the others.
+ * Kernel time is counted when perf_event_paranoid allows it, user time
+ * only otherwise. Values are scaled if the kernel multiplexed the events.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "perfcount.h"
+#include "logger.h"
+#include "mem.h"
+
+const char *PerfCount_names[PERFCOUNT_NEVENTS] = {
+	"cycles", "instructions", "llc_misses", "branch_misses",
+	"context_switches"};
+
+static bool enabled = false;
+
+/* unavailable events are logged once */
+static bool warned = false;
+
+static pthread_mutex_t records_mutex = PTHREAD_MUTEX_INITIALIZER;
+static PerfCountRecord *records = NULL;
+static long nrecords = 0;
+static long maxrecords = 0;
+
+
+/******************************************************************************
+ * PRIVATE FUNCTIONS
+ */
+#ifdef __linux__
+
+static const struct {
+	uint32_t type;
+	uint64_t config;
+} events[PERFCOUNT_NEVENTS] = {
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES}};
+
+static int
+open_event(int e)
+{
+	struct perf_event_attr attr;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[e].type;
+	attr.config = events[e].config;
+	attr.disabled = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+		PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	/* this thread, any cpu */
+	fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+
+	return fd;
+}
+
+static int64_t
+read_event(int fd)
+{
+	uint64_t v[3];
+
+	if (read(fd, v, sizeof(v)) != sizeof(v) || v[2] == 0)
+		return -1;
+	if (v[2] < v[1])
+		return (int64_t) ((double) v[0] * v[1] / v[2]);
+	return v[0];
+}
+
+#endif
+
+static PerfCountRecord*
+find_record(const char *phase, int thread)
+{
+	long i;
+
+	for (i=0; i<nrecords; i++)
+		if (records[i].thread == thread &&
+				strcmp(records[i].phase, phase) == 0)
+			return &records[i];
+
+	if (nrecords == maxrecords) {
+		maxrecords = maxrecords ? maxrecords * 2 : 64;
+		if (records)
+			records = REALLOC(records, sizeof(PerfCountRecord) * maxrecords);
+		else
+			records = ALLOC(sizeof(PerfCountRecord) * maxrecords);
+	}
+
+	PerfCountRecord *rec = &records[nrecords++];
+	rec->phase = phase;
+	rec->thread = thread;
+	rec->nruns = 0;
+	for (i=0; i<PERFCOUNT_NEVENTS; i++)
+		rec->values[i] = -1;
+
+	return rec;
+}
+
+/**
+ * PRIVATE FUNCTIONS END
+ ******************************************************************************/
+
+
+
+/******************************************************************************
+ * PUBLIC FUNCTIONS
+ */
+void
+PerfCount_setEnabled(bool enable)
+{
+	enabled = enable;
+}
+
+bool
+PerfCount_enabled()
+{
+	return enabled;
+}
+
+void
+PerfCount_start(PerfCounters *counters)
+{
+	int e, nopen = 0;
+
+	counters->on = enabled;
+	for (e=0; e<PERFCOUNT_NEVENTS; e++)
+		counters->fds[e] = -1;
+	if (!enabled)
+		return;
+
+#ifdef __linux__
+	for (e=0; e<PERFCOUNT_NEVENTS; e++) {
+		counters->fds[e] = open_event(e);
+		if (counters->fds[e] >= 0)
+			nopen++;
+	}
+	for (e=0; e<PERFCOUNT_NEVENTS; e++)
+		if (counters->fds[e] >= 0)
+			ioctl(counters->fds[e], PERF_EVENT_IOC_ENABLE, 0);
+#endif
+
+	if (nopen < PERFCOUNT_NEVENTS && !warned) {
+		warned = true;
+		Logger_log(LOGGER_NORMAL, "Only %i of %i performance counters "
+				"available, see /proc/sys/kernel/perf_event_paranoid\n",
+				nopen, PERFCOUNT_NEVENTS);
+	}
+}
+
+void
+PerfCount_stop(
+	PerfCounters	*counters,
+	const char		*phase,
+	int				thread)
+{
+	int64_t values[PERFCOUNT_NEVENTS];
+	int e;
+
+	if (!counters->on)
+		return;
+
+	for (e=0; e<PERFCOUNT_NEVENTS; e++) {
+		values[e] = -1;
+		if (counters->fds[e] < 0)
+			continue;
+#ifdef __linux__
+		ioctl(counters->fds[e], PERF_EVENT_IOC_DISABLE, 0);
+		values[e] = read_event(counters->fds[e]);
+#endif
+		close(counters->fds[e]);
+		counters->fds[e] = -1;
+	}
+	counters->on = false;
+
+	pthread_mutex_lock(&records_mutex);
+	PerfCountRecord *rec = find_record(phase, thread);
+	rec->nruns++;
+	for (e=0; e<PERFCOUNT_NEVENTS; e++) {
+		if (values[e] < 0)
+			continue;
+		rec->values[e] = rec->values[e] < 0 ?
+			values[e] : rec->values[e] + values[e];
+	}
+	pthread_mutex_unlock(&records_mutex);
+}
+
+PerfCountRecord*
+PerfCount_records(long *n)
+{
+	*n = nrecords;
+	return records;
+}
+
+void
+PerfCount_reset(const char *phase)
+{
+	long i, n;
+
+	pthread_mutex_lock(&records_mutex);
+	for (i=0, n=0; i<nrecords; i++)
+		if (phase && strcmp(records[i].phase, phase) != 0)
+			records[n++] = records[i];
+	nrecords = n;
+	pthread_mutex_unlock(&records_mutex);
+}
+
+void
+PerfCount_log()
+{
+	long i;
+	int e;
+
+	if (nrecords == 0)
+		return;
+
+	Logger_log(LOGGER_NORMAL, "%-8s %6s", "phase", "thread");
+	for (e=0; e<PERFCOUNT_NEVENTS; e++)
+		Logger_log(LOGGER_NORMAL, " %16s", PerfCount_names[e]);
+	Logger_log(LOGGER_NORMAL, "\n");
+
+	for (i=0; i<nrecords; i++) {
+		Logger_log(LOGGER_NORMAL, "%-8s %6i",
+				records[i].phase, records[i].thread);
+		for (e=0; e<PERFCOUNT_NEVENTS; e++) {
+			if (records[i].values[e] < 0)
+				Logger_log(LOGGER_NORMAL, " %16s", "-");
+			else
+				Logger_log(LOGGER_NORMAL, " %16lli",
+						(long long) records[i].values[e]);
+		}
+		Logger_log(LOGGER_NORMAL, "\n");
+	}
+}
+
+void
+PerfCount_printJson(FILE *out)
+{
+	long i;
+	int e;
+
+	fprintf(out, "[");
+	for (i=0; i<nrecords; i++) {
+		fprintf(out, "%s{\"phase\": \"%s\", \"thread\": %i, \"runs\": %li",
+				i ? ", " : "", records[i].phase, records[i].thread,
+				records[i].nruns);
+		for (e=0; e<PERFCOUNT_NEVENTS; e++) {
+			if (records[i].values[e] < 0)
+				fprintf(out, ", \"%s\": null", PerfCount_names[e]);
+			else
+				fprintf(out, ", \"%s\": %lli", PerfCount_names[e],
+						(long long) records[i].values[e]);
+		}
+		fprintf(out, "}");
+	}
+	fprintf(out, "]");
+}
+/**
+ * PUBLIC FUNCTIONS END
+ ******************************************************************************/
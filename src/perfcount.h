@@ -0,0 +1,103 @@
+/*
+ * Hardware performance counters of the load, index and match phases, per
+ * thread, with perf_event_open.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __PERFCOUNT_H__
+#define __PERFCOUNT_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    PERFCOUNT_CYCLES = 0,
+    PERFCOUNT_INSTRUCTIONS,
+    PERFCOUNT_LLC_MISSES,
+    PERFCOUNT_BRANCH_MISSES,
+    PERFCOUNT_CONTEXT_SWITCHES,
+    PERFCOUNT_NEVENTS
+} PerfCountEvent;
+
+/*
+ * Counters of the calling thread, between PerfCount_start and
+ * PerfCount_stop.
+ */
+typedef struct {
+    int     fds[PERFCOUNT_NEVENTS];
+    bool    on;
+} PerfCounters;
+
+/*
+ * Counted values of a phase on a thread. Values are -1 for events the
+ * kernel or the CPU can not count.
+ */
+typedef struct {
+    const char  *phase;
+    int         thread;
+    long        nruns;
+    int64_t     values[PERFCOUNT_NEVENTS];
+} PerfCountRecord;
+
+extern const char *PerfCount_names[PERFCOUNT_NEVENTS];
+
+/**
+ * Enable or disable counting, disabled by default. PerfCount_start and
+ * PerfCount_stop do nothing when disabled. Not thread safe.
+ */
+extern void
+PerfCount_setEnabled(bool enabled);
+
+extern bool
+PerfCount_enabled();
+
+/**
+ * Start counting the events of the calling thread. Events which can not
+ * be opened (no perf_event_open, perf_event_paranoid, virtual machine
+ * without PMU...) are skipped, a message is logged once.
+ */
+extern void
+PerfCount_start(PerfCounters *counters);
+
+/**
+ * Stop counting, and add the counted values to the record of "phase" and
+ * "thread". "phase" must be a static string. Thread safe.
+ */
+extern void
+PerfCount_stop(PerfCounters *counters, const char *phase, int thread);
+
+/**
+ * Records added since the last reset, in order of first use. The returned
+ * array is valid until the next PerfCount_stop or PerfCount_reset.
+ */
+extern PerfCountRecord*
+PerfCount_records(long *nrecords);
+
+/**
+ * Remove the records of "phase", or all records if NULL.
+ */
+extern void
+PerfCount_reset(const char *phase);
+
+/**
+ * Log the records, one line per phase and thread, at LOGGER_NORMAL.
+ */
+extern void
+PerfCount_log();
+
+/**
+ * Print the records in "out" as a JSON array, unavailable values are null.
+ */
+extern void
+PerfCount_printJson(FILE *out);
+
+#endif /* __PERFCOUNT_H__ */
@@ -0,0 +1,406 @@
+/*
+ * Pipelined cross matching, regions of the sky are cross matched while
+ * catalogs are still being loaded.
+ *
+ * A region is a nested pixel at PIPELINE_ORDER. Before loading, the
+ * footprint of each file is expanded with the neighbor regions, and every
+ * region counts the files still to be loaded touching it. Loaded samples
+ * are routed with ChunkStore_route() to their region and to the regions
+ * they are in the halo of. When the count of a region drops to zero, it is
+ * queued, and a matcher thread cross matches it with ChunkStore_crossRecords().
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "pipeline.h"
+#include "chealpix.h"
+#include "logger.h"
+#include "mem.h"
+
+typedef struct Region {
+	int				pending;	/* files touching the region to be loaded */
+	bool			submitted;	/* queued or done */
+	ChunkRecord		*records;
+	long			nrecords;
+	long			size;
+	pthread_mutex_t	mutex;
+} Region;
+
+typedef struct Pipeline {
+	int64_t					nsides;
+	int						order;		/* order of the regions */
+	long					nregions;
+	Region					*regions;
+
+	char					**files;
+	int						nfiles;
+	Field					*fields;
+	Catalog_loadFunc		load;
+	int64_t					**footprints;	/* with neighbor regions */
+	long					*nfootprints;
+
+	int						nextfile;
+	int						nloaded;
+	int						nloading;	/* loader threads running */
+	long					*queue;
+	long					qhead;
+	long					qtail;
+	pthread_mutex_t			mutex;
+	pthread_cond_t			cond;
+
+	double					radius_arcsec;
+	ChunkStore_matchFunc	onmatch;
+	void					*udata;
+	pthread_mutex_t			matchmutex;
+
+	long					nmatches;
+	long					nearly;		/* regions matched while loading */
+	long					nlate;		/* samples for a submitted region */
+} Pipeline;
+
+#define REGION_BASE_SIZE 1024
+
+
+/******************************************************************************
+ * PRIVATE FUNCTIONS
+ */
+static int
+nsides_order(int64_t nsides)
+{
+	int order = 0;
+	while ((((int64_t) 1) << order) < nsides)
+		order++;
+	return order;
+}
+
+static int
+cmp_int64(const void *a, const void *b)
+{
+	int64_t ia = *(const int64_t*) a;
+	int64_t ib = *(const int64_t*) b;
+	return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
+
+/*
+ * Add the neighbors of the "n" regions in "pixels" (which must be large
+ * enough), sort and remove duplicates. Return the new count.
+ */
+static long
+expand_footprint(
+	int		order,
+	int64_t	*pixels,
+	long	n)
+{
+	int64_t neighbors[8];
+	long i, total = n;
+	int j;
+
+	for (i=0; i<n; i++) {
+		neighbours_nest64(((int64_t) 1) << order, pixels[i], neighbors);
+		for (j=0; j<8; j++)
+			if (neighbors[j] >= 0)
+				pixels[total++] = neighbors[j];
+	}
+
+	if (total == 0)
+		return 0;
+
+	qsort(pixels, total, sizeof(int64_t), cmp_int64);
+	for (i=1, n=1; i<total; i++)
+		if (pixels[i] != pixels[n-1])
+			pixels[n++] = pixels[i];
+
+	return n;
+}
+
+/*
+ * Queue "region" for cross matching. Called with the pipeline mutex held.
+ * Empty regions are only marked as submitted.
+ */
+static void
+submit_region(
+	Pipeline	*p,
+	long		region)
+{
+	Region *r = &p->regions[region];
+
+	pthread_mutex_lock(&r->mutex);
+	if (r->submitted) {
+		pthread_mutex_unlock(&r->mutex);
+		return;
+	}
+	r->submitted = true;
+	pthread_mutex_unlock(&r->mutex);
+
+	if (r->nrecords == 0)
+		return;
+
+	p->queue[p->qtail++] = region;
+	if (p->nloaded < p->nfiles)
+		p->nearly++;
+	pthread_cond_signal(&p->cond);
+}
+
+/*
+ * Catalog_addFunc, route the sample to the regions it belongs to.
+ */
+static void
+pipeline_add(
+	Pipeline	*p,
+	Sample		spl,
+	Sample		**ext)
+{
+	ChunkRecord rec;
+	int64_t routes[9];
+	int i, n;
+	Region *r;
+
+	rec.set = spl.set;
+	rec.row = ext - spl.set->samples;
+	rec.id  = spl.id;
+	rec.lon = spl.lon;
+	rec.col = spl.col;
+	ang2pix_nest64(p->nsides, spl.col, spl.lon, &rec.pix_nest);
+
+	n = ChunkStore_route(p->nsides, p->order, rec.pix_nest, routes);
+	for (i=0; i<n; i++) {
+		r = &p->regions[routes[i]];
+		pthread_mutex_lock(&r->mutex);
+		if (r->submitted) {
+			pthread_mutex_unlock(&r->mutex);
+			pthread_mutex_lock(&p->mutex);
+			p->nlate++;
+			pthread_mutex_unlock(&p->mutex);
+			continue;
+		}
+		if (r->size == 0) {
+			r->size = REGION_BASE_SIZE;
+			r->records = ALLOC(sizeof(ChunkRecord) * r->size);
+		} else if (r->nrecords == r->size) {
+			r->size *= 2;
+			r->records = REALLOC(r->records, sizeof(ChunkRecord) * r->size);
+		}
+		r->records[r->nrecords++] = rec;
+		pthread_mutex_unlock(&r->mutex);
+	}
+
+	*ext = NULL;
+}
+
+static void
+pipeline_match(
+	Pipeline	*p,
+	ChunkRecord	*spl,
+	ChunkRecord	*match,
+	double		distance)
+{
+	pthread_mutex_lock(&p->matchmutex);
+	if (p->onmatch)
+		p->onmatch(p->udata, spl, match, distance);
+	pthread_mutex_unlock(&p->matchmutex);
+}
+
+static void*
+loader_thread(void *arg)
+{
+	Pipeline *p = (Pipeline*) arg;
+	long i, k;
+
+	for (;;) {
+		pthread_mutex_lock(&p->mutex);
+		k = p->nextfile++;
+		pthread_mutex_unlock(&p->mutex);
+		if (k >= p->nfiles)
+			break;
+
+		p->load(p->files[k], &p->fields[k], (Catalog_addFunc) pipeline_add, p);
+
+		pthread_mutex_lock(&p->mutex);
+		p->nloaded++;
+		for (i=0; i<p->nfootprints[k]; i++) {
+			long region = p->footprints[k][i];
+			if (--p->regions[region].pending == 0)
+				submit_region(p, region);
+		}
+		pthread_mutex_unlock(&p->mutex);
+	}
+
+	/*
+	 * The last loader submits what is left: regions touched by samples out
+	 * of their file footprint.
+	 */
+	pthread_mutex_lock(&p->mutex);
+	if (--p->nloading == 0) {
+		for (i=0; i<p->nregions; i++)
+			submit_region(p, i);
+		pthread_cond_broadcast(&p->cond);
+	}
+	pthread_mutex_unlock(&p->mutex);
+
+	return NULL;
+}
+
+static void*
+matcher_thread(void *arg)
+{
+	Pipeline *p = (Pipeline*) arg;
+	Region *r;
+	long region, nmatches;
+
+	for (;;) {
+		pthread_mutex_lock(&p->mutex);
+		while (p->qhead == p->qtail && p->nloading > 0)
+			pthread_cond_wait(&p->cond, &p->mutex);
+		if (p->qhead == p->qtail) {
+			pthread_mutex_unlock(&p->mutex);
+			break;
+		}
+		region = p->queue[p->qhead++];
+		pthread_mutex_unlock(&p->mutex);
+
+		r = &p->regions[region];
+		LOGGER_LOG(LOGGER_DEBUG, "Pipeline: region %li with %li samples\n",
+				region, r->nrecords);
+
+		nmatches = ChunkStore_crossRecords(p->nsides, p->order, region,
+				region, r->records, r->nrecords, p->radius_arcsec, 1,
+				(ChunkStore_matchFunc) pipeline_match, p);
+
+		FREE(r->records);
+		r->records = NULL;
+		r->nrecords = r->size = 0;
+
+		pthread_mutex_lock(&p->mutex);
+		p->nmatches += nmatches;
+		pthread_mutex_unlock(&p->mutex);
+	}
+
+	return NULL;
+}
+
+/**
+ * PRIVATE FUNCTIONS END
+ ******************************************************************************/
+
+
+
+/******************************************************************************
+ * PUBLIC FUNCTIONS
+ */
+long
+Pipeline_crossFiles(
+	char					**files,
+	int						nfiles,
+	Field					*fields,
+	Catalog_loadFunc		load,
+	Catalog_footprintFunc	footprint,
+	int64_t					nsides,
+	double					radius_arcsec,
+	int						nloaders,
+	int						nmatchers,
+	ChunkStore_matchFunc	onmatch,
+	void					*udata)
+{
+	Pipeline p;
+	long i, n;
+	int k;
+
+	p.nsides		= nsides;
+	p.order			= nsides_order(nsides);
+	if (p.order > PIPELINE_ORDER)
+		p.order = PIPELINE_ORDER;
+	p.nregions		= 12 * (((int64_t) 1) << (2 * p.order));
+	p.regions		= CALLOC(p.nregions, sizeof(Region));
+	p.files			= files;
+	p.nfiles		= nfiles;
+	p.fields		= fields;
+	p.load			= load;
+	p.footprints	= ALLOC(sizeof(int64_t*) * nfiles);
+	p.nfootprints	= ALLOC(sizeof(long) * nfiles);
+	p.nextfile		= 0;
+	p.nloaded		= 0;
+	p.nloading		= nloaders;
+	p.queue			= ALLOC(sizeof(long) * p.nregions);
+	p.qhead			= 0;
+	p.qtail			= 0;
+	p.radius_arcsec	= radius_arcsec;
+	p.onmatch		= onmatch;
+	p.udata			= udata;
+	p.nmatches		= 0;
+	p.nearly		= 0;
+	p.nlate			= 0;
+	pthread_mutex_init(&p.mutex, NULL);
+	pthread_mutex_init(&p.matchmutex, NULL);
+	pthread_cond_init(&p.cond, NULL);
+
+	for (i=0; i<p.nregions; i++)
+		pthread_mutex_init(&p.regions[i].mutex, NULL);
+
+	/* count the files touching every region */
+	for (k=0; k<nfiles; k++) {
+		int64_t *pixels;
+		n = footprint(files[k], p.order, &pixels);
+		pixels = REALLOC(pixels, sizeof(int64_t) * (n * 9 + 1));
+		n = expand_footprint(p.order, pixels, n);
+		p.footprints[k] = pixels;
+		p.nfootprints[k] = n;
+		for (i=0; i<n; i++)
+			p.regions[pixels[i]].pending++;
+	}
+
+	pthread_t *loaders = ALLOC(sizeof(pthread_t) * nloaders);
+	pthread_t *matchers = ALLOC(sizeof(pthread_t) * nmatchers);
+
+	for (k=0; k<nloaders; k++)
+		pthread_create(&loaders[k], NULL, loader_thread, &p);
+	for (k=0; k<nmatchers; k++)
+		pthread_create(&matchers[k], NULL, matcher_thread, &p);
+
+	for (k=0; k<nloaders; k++)
+		pthread_join(loaders[k], NULL);
+	for (k=0; k<nmatchers; k++)
+		pthread_join(matchers[k], NULL);
+
+	/*
+	 * A late sample was not matched, and may be the best match of samples
+	 * of its region already reported: the matches are wrong.
+	 */
+	if (p.nlate > 0)
+		Logger_log(LOGGER_ERROR,
+				"Pipeline: %li samples out of their file footprint, matches "
+				"are incomplete. Run without pipelining\n", p.nlate);
+
+	Logger_log(LOGGER_NORMAL,
+			"Pipelined crossmatch end: %li matches, %li regions of %li "
+			"matched while loading\n", p.nmatches, p.nearly, p.qtail);
+
+	for (i=0; i<p.nregions; i++)
+		pthread_mutex_destroy(&p.regions[i].mutex);
+	for (k=0; k<nfiles; k++)
+		FREE(p.footprints[k]);
+	pthread_mutex_destroy(&p.mutex);
+	pthread_mutex_destroy(&p.matchmutex);
+	pthread_cond_destroy(&p.cond);
+	FREE(p.footprints);
+	FREE(p.nfootprints);
+	FREE(p.queue);
+	FREE(p.regions);
+	FREE(loaders);
+	FREE(matchers);
+
+	return p.nlate > 0 ? -1 : p.nmatches;
+}
+/**
+ * PUBLIC FUNCTIONS END
+ ******************************************************************************/
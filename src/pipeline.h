@@ -0,0 +1,46 @@
+/*
+ * Pipelined cross matching, regions of the sky are cross matched while
+ * catalogs are still being loaded.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include <stdint.h>
+
+#include "scamp.h"
+#include "catalog.h"
+#include "chunkstore.h"
+
+/* order of the coarse pixels (regions) the pipeline works on */
+#define PIPELINE_ORDER 3
+
+/**
+ * Load "files" in "fields" with "nloaders" threads, and cross match with
+ * "nmatchers" threads. The footprint of every file is read first. As soon
+ * as all files whose footprint touches a region or its neighbors are loaded,
+ * the region is cross matched with its halo, while other files keep
+ * loading.
+ *
+ * Samples are not kept in memory: "onmatch" is called, from one thread at a
+ * time, for every sample having a match. Return the number of samples
+ * having a match, or -1 if samples were loaded out of the footprint of
+ * their file, after their region was cross matched: they are not matched,
+ * and the matches of their region may be wrong.
+ */
+extern long
+Pipeline_crossFiles(char **files, int nfiles, Field *fields,
+        Catalog_loadFunc load, Catalog_footprintFunc footprint,
+        int64_t nsides, double radius_arcsec, int nloaders, int nmatchers,
+        ChunkStore_matchFunc onmatch, void *udata);
+
+#endif /* __PIPELINE_H__ */
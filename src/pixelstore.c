@@ -25,6 +25,8 @@
 #include "assert.h"
 #include "string.h"
 #include "logger.h"
+#include "perfcount.h"
+#include "trace.h"
 
 /*****************************************************************************
  * 1 AVL Tree implementation
@@ -207,70 +209,70 @@ void pixelAvlFree(pixel_avl *pix) {
 	pixelAvlFree(pix->pBefore);
 
 	FREE(pix->pixel.samples);
+	FREE(pix->pixel.ext);
 	FREE(pix);
 }
 
-void pixelAvlLink(pixel_avl *root, pixel_avl *leaf) {
-	if (leaf->pAfter)
-		pixelAvlLink(root, leaf->pAfter);
-	if (leaf->pBefore)
-		pixelAvlLink(root, leaf->pBefore);
-
-	int i;
-	for (i=0; i<8; i++) {
-		pixel_avl *f = pixelAvlSearch(root, leaf->pixel.neighbors[i]);
-		leaf->pixel.pneighbors[i] = &f->pixel;
-	}
+/* Fill "array" with the pixels of the tree, sorted by id. */
+static long pixelAvlCollect(pixel_avl *p, HealPixel **array, long n) {
+	if (p == NULL)
+		return n;
+	n = pixelAvlCollect(p->pBefore, array, n);
+	array[n++] = &p->pixel;
+	return pixelAvlCollect(p->pAfter, array, n);
 }
 
-void fix_pixel_neighbors(pixel_avl *root) {
-	pixelAvlLink(root, root);
+/* Find the first node (the one with the smallest key).
+*/
+static pixel_avl *pixelAvlFirst(pixel_avl *p) {
+	if (p)
+		while (p->pBefore)
+			p = p->pBefore;
+	return p;
 }
 
-#if 0 /* NOT USED */
 /* Remove node pOld from the tree.  pOld must be an element of the tree or
 ** the AVL tree will become corrupt.
 */
-static void amatchAvlRemove(amatch_avl **ppHead, amatch_avl *pOld){
-	amatch_avl **ppParent;
-	amatch_avl *pBalance = 0;
-	/* assert( amatchAvlSearch(*ppHead, pOld->zKey)==pOld ); */
-	ppParent = amatchAvlFromPtr(pOld, ppHead);
-	if( pOld->pBefore==0 && pOld->pAfter==0 ){
+static void pixelAvlRemove(pixel_avl **ppHead, pixel_avl *pOld) {
+	pixel_avl **ppParent;
+	pixel_avl *pBalance = 0;
+	/* assert( pixelAvlSearch(*ppHead, pOld->pixel.id)==pOld ); */
+	ppParent = pixelAvrFromPtr(pOld, ppHead);
+	if (pOld->pBefore == 0 && pOld->pAfter == 0) {
 		*ppParent = 0;
 		pBalance = pOld->pUp;
-	}else if( pOld->pBefore && pOld->pAfter ){
-		amatch_avl *pX, *pY;
-		pX = amatchAvlFirst(pOld->pAfter);
-		*amatchAvlFromPtr(pX, 0) = pX->pAfter;
-		if( pX->pAfter ) pX->pAfter->pUp = pX->pUp;
+	} else if (pOld->pBefore && pOld->pAfter) {
+		pixel_avl *pX, *pY;
+		pX = pixelAvlFirst(pOld->pAfter);
+		*pixelAvrFromPtr(pX, 0) = pX->pAfter;
+		if (pX->pAfter)
+			pX->pAfter->pUp = pX->pUp;
 		pBalance = pX->pUp;
 		pX->pAfter = pOld->pAfter;
-		if( pX->pAfter ){
+		if (pX->pAfter) {
 			pX->pAfter->pUp = pX;
-		}else{
-			assert( pBalance==pOld );
+		} else {
+			assert(pBalance == pOld);
 			pBalance = pX;
 		}
 		pX->pBefore = pY = pOld->pBefore;
-		if( pY ) pY->pUp = pX;
+		if (pY)
+			pY->pUp = pX;
 		pX->pUp = pOld->pUp;
 		*ppParent = pX;
-	}else if( pOld->pBefore==0 ){
+	} else if (pOld->pBefore == 0) {
 		*ppParent = pBalance = pOld->pAfter;
 		pBalance->pUp = pOld->pUp;
-	}else if( pOld->pAfter==0 ){
+	} else if (pOld->pAfter == 0) {
 		*ppParent = pBalance = pOld->pBefore;
 		pBalance->pUp = pOld->pUp;
 	}
-	*ppHead = amatchAvlBalance(pBalance);
+	*ppHead = pixelAvlBalance(pBalance);
 	pOld->pUp = 0;
 	pOld->pBefore = 0;
 	pOld->pAfter = 0;
-	/* assert( amatchAvlIntegrity(*ppHead) ); */
-	/* assert( amatchAvlIntegrity2(*ppHead) ); */
 }
-#endif
 /**
  * AVL related functions end
  ******************************************************************************/
@@ -305,9 +307,13 @@ insert_sample_into_avltree_store(
 		avlpix->pixel.size = SPL_BASE_SIZE;
 		pthread_mutex_init(&avlpix->pixel.mutex, NULL);
 
-		for (i=0;i<8;i++)
+		/* neighbors are computed by PixelStore_linkNeighbors */
+		for (i=0;i<8;i++) {
 			avlpix->pixel.tneighbors[i] = false;
-		neighbours_nest64(store->nsides, spl.pix_nest, avlpix->pixel.neighbors);
+			avlpix->pixel.neighbors[i] = -1;
+			avlpix->pixel.nbindex[i] = -1;
+		}
+		store->linked = false;
 
 		/* insert new pixel */
 		pixelAvlInsert((pixel_avl**) &store->pixels, avlpix);
@@ -345,6 +351,233 @@ insert_sample_into_avltree_store(
 
 }
 
+static int
+cmp_pixelid(const void *a, const void *b)
+{
+	int64_t ia = *(const int64_t*) a;
+	int64_t ib = *(const int64_t*) b;
+	return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
+
+/*
+ * Redirect every bestMatch pointing into the "oldn" first samples of "pix" 
+ * (before compaction) to their new location given by "remap", or clear it
+ * if the sample have been removed. Only "pix" and its neighbors can
+ * reference "pix" samples.
+ */
+static void
+remap_best_matches(
+	PixelStore	*store,
+	HealPixel	*pix,
+	int			oldn,
+	int			*remap)
+{
+	int i, j;
+	HealPixel *test_pix;
+	Sample *test_spl;
+
+	for (i=-1; i<8; i++) {
+		if (i < 0) {
+			test_pix = pix;
+		} else {
+			if (pix->neighbors[i] < 0)
+				continue;
+			test_pix = PixelStore_get(store, pix->neighbors[i]);
+			if (!test_pix)
+				continue;
+		}
+
+		for (j=0; j<test_pix->nsamples; j++) {
+			test_spl = &test_pix->samples[j];
+			if (test_spl->bestMatch < pix->samples ||
+					test_spl->bestMatch >= pix->samples + oldn)
+				continue;
+
+			int k = remap[test_spl->bestMatch - pix->samples];
+			if (k < 0) {
+				test_spl->bestMatch = NULL;
+				test_spl->bestMatchDistance = store->maxradius;
+			} else {
+				test_spl->bestMatch = &pix->samples[k];
+			}
+		}
+	}
+}
+
+/*
+ * Remove from "avlpix" every sample belonging to "field", keeping the
+ * remaining samples in order. Return the number of samples left.
+ */
+static int
+remove_field_from_pixel(
+	PixelStore	*store,
+	pixel_avl	*avlpix,
+	Field		*field)
+{
+	HealPixel *pix = &avlpix->pixel;
+	int i, w, oldn;
+	int *remap = ALLOC(sizeof(int) * pix->nsamples);
+
+	oldn = pix->nsamples;
+	for (i=0, w=0; i<oldn; i++) {
+		if (pix->samples[i].set->field == field) {
+			remap[i] = -1;
+			continue;
+		}
+		if (w != i) {
+			pix->samples[w] = pix->samples[i];
+			pix->ext[w]		= pix->ext[i];
+			*pix->ext[w]	= &pix->samples[w];
+		}
+		remap[i] = w++;
+	}
+	pix->nsamples = w;
+
+	remap_best_matches(store, pix, oldn, remap);
+	FREE(remap);
+
+	return pix->nsamples;
+}
+
+/*
+ * Unlink, remove from the tree and free an empty pixel.
+ */
+static void
+free_empty_pixel(
+	PixelStore	*store,
+	pixel_avl	*avlpix)
+{
+	HealPixel *pix = &avlpix->pixel;
+	HealPixel *nb;
+	int i, j;
+
+	for (i=0; i<8; i++) {
+		nb = pix->pneighbors[i];
+		if (!nb)
+			continue;
+		for (j=0; j<8; j++)
+			if (nb->pneighbors[j] == pix)
+				nb->pneighbors[j] = NULL;
+	}
+
+	pixelAvlRemove((pixel_avl**) &store->pixels, avlpix);
+	store->linked = false;
+	pthread_mutex_destroy(&pix->mutex);
+	FREE(pix->samples);
+	FREE(pix->ext);
+	FREE(avlpix);
+}
+
+struct link_args {
+	PixelStore	*store;
+	int64_t		*ids;	/* sorted ids of pixelarray */
+	long		first;
+	long		last;	/* excluded */
+	int			thread;
+};
+
+/* a neighbor to resolve: its id and where to write its index */
+struct link_ref {
+	int64_t	id;
+	long	slot;	/* pixel index * 8 + neighbor number */
+};
+
+static int
+cmp_link_ref(const void *a, const void *b)
+{
+	int64_t ia = ((const struct link_ref*) a)->id;
+	int64_t ib = ((const struct link_ref*) b)->id;
+	return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
+
+/*
+ * Return the first index not less than "j" where ids[index] >= key,
+ * galloping from "j".
+ */
+static long
+gallop_ids(
+	int64_t	*ids,
+	long	n,
+	long	j,
+	int64_t	key)
+{
+	long lo = j, hi, step = 1;
+
+	if (j >= n || ids[j] >= key)
+		return j;
+
+	while (lo + step < n && ids[lo + step] < key) {
+		lo += step;
+		step *= 2;
+	}
+	hi = lo + step < n ? lo + step : n;
+
+	/* ids[lo] < key, ids[hi] >= key or hi == n */
+	while (hi - lo > 1) {
+		long mid = lo + (hi - lo) / 2;
+		if (ids[mid] < key)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return hi;
+}
+
+static void*
+link_neighbors_thread(void *args)
+{
+	struct link_args *la = args;
+	PixelStore *store = la->store;
+	HealPixel *pix;
+	long i, j, n, nrefs = 0;
+	int k;
+	PerfCounters counters;
+
+	if (la->last <= la->first)
+		return NULL;
+
+	PerfCount_start(&counters);
+	Trace_begin("link", "%li pixels", la->last - la->first);
+
+	struct link_ref *refs =
+		ALLOC(sizeof(struct link_ref) * 8 * (la->last - la->first));
+
+	for (i=la->first; i<la->last; i++) {
+		pix = store->pixelarray[i];
+		neighbours_nest64(store->nsides, pix->id, pix->neighbors);
+		for (k=0; k<8; k++) {
+			pix->nbindex[k] = -1;
+			pix->pneighbors[k] = NULL;
+			if (pix->neighbors[k] < 0)
+				continue;
+			refs[nrefs].id = pix->neighbors[k];
+			refs[nrefs].slot = i * 8 + k;
+			nrefs++;
+		}
+	}
+
+	/* one merge pass of the sorted references with the sorted ids */
+	qsort(refs, nrefs, sizeof(struct link_ref), cmp_link_ref);
+
+	n = store->npixels;
+	for (i=0, j=0; i<nrefs; i++) {
+		j = gallop_ids(la->ids, n, j, refs[i].id);
+		if (j == n)
+			break;
+		if (la->ids[j] != refs[i].id)
+			continue;
+		pix = store->pixelarray[refs[i].slot / 8];
+		pix->nbindex[refs[i].slot % 8] = j;
+		pix->pneighbors[refs[i].slot % 8] = store->pixelarray[j];
+	}
+
+	FREE(refs);
+	Trace_end();
+	PerfCount_stop(&counters, "index", la->thread);
+	return NULL;
+}
+
 #define PIXELIDS_BASE_SIZE 1000
 static PixelStore*
 new_store(int64_t nsides) {
@@ -353,9 +586,13 @@ new_store(int64_t nsides) {
 
 	store->pixels = NULL;
 	store->nsides = nsides;
+	store->maxradius = 0;
 	store->npixels = 0;
 	store->pixelids = ALLOC(sizeof(int64_t) * PIXELIDS_BASE_SIZE);
 	store->pixelids_size = PIXELIDS_BASE_SIZE;
+	store->pixelarray = NULL;
+	store->sortedids = NULL;
+	store->linked = false;
 
 	return store;
 }
@@ -426,6 +663,60 @@ PixelStore_add(
 }
 
 
+#define ADD_BATCH_BLOCK 1024
+void
+PixelStore_addBatch(
+	PixelStore	*store,
+	Sample		*spls,
+	long		nsamples,
+	Sample		***exts)
+{
+	double col[ADD_BATCH_BLOCK], lon[ADD_BATCH_BLOCK];
+	double vec[3 * ADD_BATCH_BLOCK];
+	int64_t pix[ADD_BATCH_BLOCK];
+	long i, b, n;
+	Sample spl;
+
+	for (b=0; b<nsamples; b+=ADD_BATCH_BLOCK) {
+		n = nsamples - b < ADD_BATCH_BLOCK ? nsamples - b : ADD_BATCH_BLOCK;
+
+		for (i=0; i<n; i++) {
+			col[i] = spls[b+i].col;
+			lon[i] = spls[b+i].lon;
+		}
+		ang2pix_vec_nest64_batch(store->nsides, n, col, lon, pix, vec);
+
+		for (i=0; i<n; i++) {
+			spl = spls[b+i];
+			spl.bestMatch = NULL;
+			spl.pix_nest = pix[i];
+			spl.vector[0] = vec[3*i];
+			spl.vector[1] = vec[3*i+1];
+			spl.vector[2] = vec[3*i+2];
+			insert_sample_into_avltree_store(store, spl, exts[b+i]);
+		}
+	}
+}
+
+
+void
+PixelStore_addComputed(
+	PixelStore	*store,
+	Sample		*spls,
+	long		nsamples,
+	Sample		***exts)
+{
+	long i;
+	Sample spl;
+
+	for (i=0; i<nsamples; i++) {
+		spl = spls[i];
+		spl.bestMatch = NULL;
+		insert_sample_into_avltree_store(store, spl, exts[i]);
+	}
+}
+
+
 HealPixel*
 PixelStore_get(
 	PixelStore	*store, 
@@ -440,6 +731,76 @@ PixelStore_get(
 
 }
 
+void
+PixelStore_linkNeighbors(
+	PixelStore	*store,
+	int			nthreads)
+{
+	long i, n;
+	int t;
+
+	FREE(store->pixelarray);
+	FREE(store->sortedids);
+	store->linked = true;
+	if (store->npixels == 0)
+		return;
+
+	Trace_begin("PixelStore_linkNeighbors", "%li pixels", store->npixels);
+
+	store->pixelarray = ALLOC(sizeof(HealPixel*) * store->npixels);
+	n = pixelAvlCollect((pixel_avl*) store->pixels, store->pixelarray, 0);
+	assert(n == store->npixels);
+
+	int64_t *ids = ALLOC(sizeof(int64_t) * n);
+	for (i=0; i<n; i++)
+		ids[i] = store->pixelarray[i]->id;
+
+	if (nthreads < 1)
+		nthreads = 1;
+	pthread_t *threads = ALLOC(sizeof(pthread_t) * nthreads);
+	struct link_args *args = ALLOC(sizeof(struct link_args) * nthreads);
+
+	for (t=0; t<nthreads; t++) {
+		args[t].store = store;
+		args[t].ids = ids;
+		args[t].first = n * t / nthreads;
+		args[t].last = n * (t + 1) / nthreads;
+		args[t].thread = t;
+		pthread_create(&threads[t], NULL, link_neighbors_thread, &args[t]);
+	}
+	for (t=0; t<nthreads; t++)
+		pthread_join(threads[t], NULL);
+
+	FREE(threads);
+	FREE(args);
+	store->sortedids = ids;
+
+	Trace_end();
+}
+
+
+long
+PixelStore_find(
+	PixelStore	*store,
+	int64_t		id)
+{
+	long lo = 0, hi = store->npixels, mid;
+
+	if (!store->sortedids)
+		return -1;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (store->sortedids[mid] < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo < store->npixels && store->sortedids[lo] == id ? lo : -1;
+}
+
+
 void
 pixelAvlSetMaxRadius(
 	pixel_avl	*leaf, 
@@ -452,8 +813,13 @@ pixelAvlSetMaxRadius(
 
 	HealPixel *p = &leaf->pixel;
 	int i;
-	for (i=0; i<p->nsamples; i++)
+	for (i=0; i<p->nsamples; i++) {
+		(&p->samples[i])->bestMatch = NULL;
 		(&p->samples[i])->bestMatchDistance = radius;
+		(&p->samples[i])->refMatch = -1;
+	}
+	for (i=0; i<8; i++)
+		p->tneighbors[i] = false;
 
 }
 
@@ -473,8 +839,89 @@ PixelStore_setMaxRadius(
 	ang2vec(radius,0, vb);
 	euclidean_dist = euclidean_distance(va,vb);
 
-	pixelAvlSetMaxRadius(root, euclidean_dist);
+	store->maxradius = euclidean_dist;
+	if (root)
+		pixelAvlSetMaxRadius(root, euclidean_dist);
+
+}
+
+
+void
+PixelStore_removeField(
+	PixelStore	*store,
+	Field		*field)
+{
+	int i, j;
+	long k, w, nids = 0, nfreed = 0;
+	Sample *spl;
+
+	for (i=0; i<field->nsets; i++)
+		nids += field->sets[i].nsamples;
+	if (nids == 0)
+		return;
+
+	/* pixels holding at least one sample of the field */
+	int64_t *ids = ALLOC(sizeof(int64_t) * nids);
+	for (i=0, nids=0; i<field->nsets; i++) {
+		for (j=0; j<field->sets[i].nsamples; j++) {
+			spl = field->sets[i].samples[j];
+			if (spl)
+				ids[nids++] = spl->pix_nest;
+		}
+	}
+	qsort(ids, nids, sizeof(int64_t), cmp_pixelid);
+
+	int64_t *freed = ALLOC(sizeof(int64_t) * nids);
+	for (k=0; k<nids; k++) {
+		if (k > 0 && ids[k] == ids[k-1])
+			continue;
+
+		pixel_avl *avlpix = pixelAvlSearch((pixel_avl*) store->pixels, ids[k]);
+		if (!avlpix)
+			continue;
+
+		if (remove_field_from_pixel(store, avlpix, field) == 0) {
+			free_empty_pixel(store, avlpix);
+			freed[nfreed++] = ids[k];
+		}
+	}
+
+	/* compact pixelids, "freed" is sorted */
+	if (nfreed > 0) {
+		for (k=0, w=0; k<store->npixels; k++) {
+			if (bsearch(&store->pixelids[k], freed, nfreed,
+						sizeof(int64_t), cmp_pixelid))
+				continue;
+			store->pixelids[w++] = store->pixelids[k];
+		}
+		store->npixels = w;
+	}
+
+	/* samples of the field are gone, do not let the sets point to them */
+	for (i=0; i<field->nsets; i++)
+		for (j=0; j<field->sets[i].nsamples; j++)
+			field->sets[i].samples[j] = NULL;
+
+	LOGGER_LOG(LOGGER_DEBUG,
+			"Removed %li samples, %li pixels freed\n", nids, nfreed);
+
+	FREE(ids);
+	FREE(freed);
+}
+
+
+long
+PixelStore_estimateBytes(
+	long	nsamples,
+	long	npixels)
+{
+	/* pixel arrays start at SPL_BASE_SIZE and grow by a factor of two */
+	long nslots = nsamples * 2;
+	if (nslots < npixels * SPL_BASE_SIZE)
+		nslots = npixels * SPL_BASE_SIZE;
 
+	return npixels * (sizeof(pixel_avl) + sizeof(int64_t)) +
+			nslots * (sizeof(Sample) + sizeof(Sample**));
 }
 
 
@@ -483,6 +930,8 @@ PixelStore_free(PixelStore* store)
 {
 	pixelAvlFree((pixel_avl*) store->pixels);
 	FREE(store->pixelids);
+	FREE(store->pixelarray);
+	FREE(store->sortedids);
 	FREE(store);
 
 }
@@ -34,7 +34,9 @@ struct HealPixel {
     int size;           /* for reallocation if required */
     int64_t neighbors[8];  /* Neighbors indexes */
     HealPixel *pneighbors[8];
+    int nbindex[8];     /* neighbors in PixelStore.pixelarray, -1 if none */
     bool tneighbors[8]; /* check if neighbors have allready been matched */
+    long first;         /* store wide index of samples[0] (atomic crossmatch) */
 	pthread_mutex_t mutex;
 
 };
@@ -43,11 +45,19 @@ typedef struct PixelStore {
     int64_t     nsides;
     void        *pixels; /* our opaque data */
 
+    /* euclidean distance of the last crossmatch radius */
+    double      maxradius;
+
     /* These are used to iterate over pixels */
     long        npixels;
     int64_t     *pixelids;
     int         pixelids_size; /* PRIVATE, for re allocation if required */
 
+    /* pixels sorted by id, and neighbors links, see PixelStore_linkNeighbors */
+    HealPixel   **pixelarray;
+    int64_t     *sortedids; /* ids of pixelarray */
+    bool        linked;
+
 } PixelStore;
 
 
@@ -62,6 +72,23 @@ PixelStore_new(int64_t nsides);
 extern void
 PixelStore_add(PixelStore *store, Sample spl, Sample **ext);
 
+/*
+ * Same as PixelStore_add() for "nsamples" samples, "exts[i]" being the
+ * "ext" of "spls[i]". Pixel ids and vectors are computed by blocks with
+ * ang2pix_vec_nest64_batch(), which shares the sines and cosines of both.
+ */
+extern void
+PixelStore_addBatch(PixelStore *store, Sample *spls, long nsamples,
+        Sample ***exts);
+
+/*
+ * Same as PixelStore_addBatch() for samples whose "pix_nest", at the store
+ * nsides, and "vector" are already computed, as read from a SkyCache.
+ */
+extern void
+PixelStore_addComputed(PixelStore *store, Sample *spls, long nsamples,
+        Sample ***exts);
+
 extern HealPixel*
 PixelStore_get(PixelStore *store, int64_t key);
 
@@ -70,4 +97,42 @@ PixelStore_free(PixelStore *store);
 
 extern void
 PixelStore_setMaxRadius(PixelStore *store, double radius);
+
+/*
+ * Compute the neighbors of every pixel with "nthreads" threads, and link
+ * them (HealPixel.pneighbors and HealPixel.nbindex). Pixels are first
+ * sorted by id in "pixelarray", then each thread resolves the neighbors of
+ * a range of pixels by merging them, sorted, with the pixel ids.
+ *
+ * Adding or removing pixels unlinks the store. Crossmatch_crossSamples()
+ * links it when required.
+ */
+extern void
+PixelStore_linkNeighbors(PixelStore *store, int nthreads);
+
+/*
+ * Return the index of pixel "id" in the "pixelarray" of a linked store, or
+ * -1. A binary search in "sortedids", cheaper than PixelStore_get().
+ */
+extern long
+PixelStore_find(PixelStore *store, int64_t id);
+
+/*
+ * Remove every sample of "field" from "store". Pixels left empty are freed,
+ * and bestMatch references to the removed samples are cleared. Samples of
+ * "field" sets are set to NULL, the field itself must still be freed
+ * with Catalog_freeField().
+ *
+ * Used to maintain a sliding window of fields: remove the oldest field,
+ * add the new one, and crossmatch again.
+ */
+extern void
+PixelStore_removeField(PixelStore *store, Field *field);
+
+/*
+ * Upper bound of the memory used by a store of "nsamples" samples spread
+ * over "npixels" pixels.
+ */
+extern long
+PixelStore_estimateBytes(long nsamples, long npixels);
 #endif /* SRC_PIXELSTORE_H_ */
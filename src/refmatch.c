@@ -0,0 +1,293 @@
+/*
+ * Exact reference cross match, to validate the PixelStore engines.
+ *
+ * The reference does not use HEALPix pixels nor the store: samples are
+ * sorted on their colatitude, and the angular distance between two samples
+ * is at least the difference of their colatitudes, so that the candidate
+ * matches of a sample are a contiguous band of the sorted samples. The
+ * colatitude is computed from the vector, with atan2 to stay accurate near
+ * the poles, where a band of z would hold whole rings of samples.
+ *
+ * Every thread sweeps a range of the sorted samples and writes the matches
+ * of its own samples only, so there is no locking.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "refmatch.h"
+#include "chealpix.h"
+#include "logger.h"
+#include "mem.h"
+
+/* a sample in the sweep order, with what the sweep reads */
+typedef struct sweep_entry {
+	double	col;
+	double	vector[3];
+	Field	*field;
+	long	index;	/* in RefMatch.samples */
+} sweep_entry;
+
+struct sweep_args {
+	RefMatch	*ref;
+	sweep_entry	*entries;
+	long		nentries;
+	long		first;
+	long		last;	/* excluded */
+	double		maxradius;	/* euclidean */
+	double		band;		/* colatitude */
+};
+
+
+/******************************************************************************
+ * PRIVATE FUNCTIONS
+ */
+static inline double
+dist(double *va, double *vb)
+{
+	double x = va[0] - vb[0];
+	double y = va[1] - vb[1];
+	double z = va[2] - vb[2];
+
+	return sqrt(x*x + y*y + z*z);
+}
+
+static int
+cmp_entry(const void *a, const void *b)
+{
+	const sweep_entry *x = a, *y = b;
+
+	if (x->col != y->col)
+		return x->col < y->col ? -1 : 1;
+	return x->index < y->index ? -1 : (x->index > y->index ? 1 : 0);
+}
+
+static inline void
+test_entry(
+	sweep_entry	*e,
+	sweep_entry	*c,
+	double		*bestdist,
+	long		*best)
+{
+	if (c->field == e->field)
+		return;
+
+	double d = dist(e->vector, c->vector);
+	if (d < *bestdist || (d == *bestdist && *best >= 0 && c->index < *best)) {
+		*bestdist = d;
+		*best = c->index;
+	}
+}
+
+static void*
+sweep_thread(void *args)
+{
+	struct sweep_args *sa = args;
+	sweep_entry *e, *entries = sa->entries;
+	double bestdist;
+	long i, j, best;
+
+	for (i=sa->first; i<sa->last; i++) {
+		e = &entries[i];
+		bestdist = sa->maxradius;
+		best = -1;
+
+		for (j=i-1; j>=0 && e->col - entries[j].col <= sa->band; j--)
+			test_entry(e, &entries[j], &bestdist, &best);
+		for (j=i+1; j<sa->nentries && entries[j].col - e->col <= sa->band;
+				j++)
+			test_entry(e, &entries[j], &bestdist, &best);
+
+		if (best >= 0) {
+			sa->ref->matches[e->index] = sa->ref->samples[best];
+			sa->ref->distances[e->index] = bestdist;
+		}
+	}
+
+	return NULL;
+}
+
+/* chord to angle, in arcsec */
+static inline double
+to_arcsec(double chord)
+{
+	return 2 * asin(chord / 2) / TO_RAD * 3600;
+}
+
+static void
+report_diff(
+	FILE		*report,
+	const char	*kind,
+	Sample		*spl,
+	Sample		*match,
+	Sample		*refmatch,
+	double		refdist)
+{
+	fprintf(report, "%-8s sample %li (%.7f, %.7f): ", kind, spl->id,
+			spl->ra, spl->dec);
+	if (match)
+		fprintf(report, "match %li at %.6f\", ", match->id,
+				to_arcsec(dist(spl->vector, match->vector)));
+	else
+		fprintf(report, "no match, ");
+	if (refmatch)
+		fprintf(report, "reference %li at %.6f\"\n", refmatch->id,
+				to_arcsec(refdist));
+	else
+		fprintf(report, "no reference\n");
+}
+
+/**
+ * PRIVATE FUNCTIONS END
+ ******************************************************************************/
+
+
+
+/******************************************************************************
+ * PUBLIC FUNCTIONS
+ */
+RefMatch*
+RefMatch_crossFields(
+	Field	*fields,
+	int		nfields,
+	double	radius_arcsec,
+	int		nthreads)
+{
+	RefMatch *ref = ALLOC(sizeof(RefMatch));
+	long i, n = 0;
+	int f, s, t;
+
+	for (f=0; f<nfields; f++)
+		for (s=0; s<fields[f].nsets; s++)
+			for (i=0; i<fields[f].sets[s].nsamples; i++)
+				if (fields[f].sets[s].samples[i])
+					n++;
+
+	ref->nsamples = n;
+	ref->samples = ALLOC(sizeof(Sample*) * (n + 1));
+	ref->matches = CALLOC(n + 1, sizeof(Sample*));
+	ref->distances = ALLOC(sizeof(double) * (n + 1));
+	sweep_entry *entries = ALLOC(sizeof(sweep_entry) * (n + 1));
+
+	n = 0;
+	for (f=0; f<nfields; f++) {
+		for (s=0; s<fields[f].nsets; s++) {
+			for (i=0; i<fields[f].sets[s].nsamples; i++) {
+				Sample *spl = fields[f].sets[s].samples[i];
+				if (!spl)
+					continue;
+				ref->samples[n] = spl;
+				entries[n].col = atan2(hypot(spl->vector[0], spl->vector[1]),
+						spl->vector[2]);
+				entries[n].vector[0] = spl->vector[0];
+				entries[n].vector[1] = spl->vector[1];
+				entries[n].vector[2] = spl->vector[2];
+				entries[n].field = spl->set->field;
+				entries[n].index = n;
+				n++;
+			}
+		}
+	}
+	qsort(entries, n, sizeof(sweep_entry), cmp_entry);
+
+	/* the store radius, see PixelStore_setMaxRadius */
+	double va[3], vb[3];
+	ang2vec(0, 0, va);
+	ang2vec(radius_arcsec / 3600 * TO_RAD, 0, vb);
+	double maxradius = euclidean_distance(va, vb);
+
+	/* with a margin for the rounding of the vectors and of atan2 */
+	double band = 2 * asin(maxradius / 2) * (1 + 1e-9) + 1e-12;
+
+	if (nthreads < 1)
+		nthreads = 1;
+	pthread_t *threads = ALLOC(sizeof(pthread_t) * nthreads);
+	struct sweep_args *args = ALLOC(sizeof(struct sweep_args) * nthreads);
+
+	for (t=0; t<nthreads; t++) {
+		args[t].ref = ref;
+		args[t].entries = entries;
+		args[t].nentries = n;
+		args[t].first = n * t / nthreads;
+		args[t].last = n * (t + 1) / nthreads;
+		args[t].maxradius = maxradius;
+		args[t].band = band;
+		pthread_create(&threads[t], NULL, sweep_thread, &args[t]);
+	}
+	for (t=0; t<nthreads; t++)
+		pthread_join(threads[t], NULL);
+
+	FREE(threads);
+	FREE(args);
+	FREE(entries);
+
+	return ref;
+}
+
+void
+RefMatch_free(RefMatch *ref)
+{
+	FREE(ref->samples);
+	FREE(ref->matches);
+	FREE(ref->distances);
+	FREE(ref);
+}
+
+RefMatchDiff
+RefMatch_compare(
+	RefMatch	*ref,
+	double		tolerance,
+	FILE		*report,
+	long		maxreport)
+{
+	RefMatchDiff diff = {0, 0, 0, 0, 0, 0};
+	const char *kind;
+	long i, nreported = 0;
+
+	diff.nsamples = ref->nsamples;
+	for (i=0; i<ref->nsamples; i++) {
+		Sample *spl = ref->samples[i];
+		Sample *match = spl->bestMatch, *refmatch = ref->matches[i];
+
+		if (match == refmatch) {
+			diff.nsame++;
+			continue;
+		}
+
+		if (!match) {
+			diff.nmissing++;
+			kind = "missing";
+		} else if (!refmatch) {
+			diff.nextra++;
+			kind = "extra";
+		} else if (match->set->field != spl->set->field &&
+				fabs(dist(spl->vector, match->vector) - ref->distances[i]) <=
+				tolerance * ref->distances[i]) {
+			diff.nties++;
+			continue;
+		} else {
+			diff.nwrong++;
+			kind = "wrong";
+		}
+
+		if (report && nreported++ < maxreport)
+			report_diff(report, kind, spl, match, refmatch,
+					ref->distances[i]);
+	}
+
+	return diff;
+}
+/**
+ * PUBLIC FUNCTIONS END
+ ******************************************************************************/
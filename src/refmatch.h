@@ -0,0 +1,72 @@
+/*
+ * Exact reference cross match, to validate the PixelStore engines.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __REFMATCH_H__
+#define __REFMATCH_H__
+
+#include <stdio.h>
+
+#include "scamp.h"
+
+/*
+ * Best matches of every sample of a set of fields. Samples are in fields,
+ * sets and samples order, samples removed from the store are skipped.
+ */
+typedef struct RefMatch {
+    long    nsamples;
+    Sample  **samples;
+    Sample  **matches;      /* best match of samples[i], NULL if none */
+    double  *distances;     /* euclidean distance to matches[i] */
+} RefMatch;
+
+/*
+ * Comparison of the bestMatch of the samples with a RefMatch.
+ */
+typedef struct RefMatchDiff {
+    long    nsamples;
+    long    nsame;      /* same match, or both without */
+    long    nties;      /* another match at the same distance */
+    long    nmissing;   /* reference match not found */
+    long    nextra;     /* match where the reference has none */
+    long    nwrong;     /* another match, farther or from the same field */
+} RefMatchDiff;
+
+/**
+ * Cross match the samples of "fields" without any pixelization: samples
+ * are sorted on their declination, and every sample is compared with all
+ * the samples of other fields in the declination band of the radius. A
+ * match is the nearest sample of another field, strictly within
+ * "radius_arcsec", with the distance Crossmatch_crossSamples uses. Ties
+ * go to the first sample in fields order.
+ *
+ * Samples are split between "nthreads" threads, in declination order.
+ * Sample structures are not modified.
+ */
+extern RefMatch*
+RefMatch_crossFields(Field *fields, int nfields, double radius_arcsec,
+        int nthreads);
+
+extern void
+RefMatch_free(RefMatch *ref);
+
+/**
+ * Compare the bestMatch of the samples of "ref" with the reference
+ * matches. Distances within "tolerance" (relative) of the reference
+ * distance are ties. The first "maxreport" differences are written on
+ * "report" if not NULL.
+ */
+extern RefMatchDiff
+RefMatch_compare(RefMatch *ref, double tolerance, FILE *report,
+        long maxreport);
+
+#endif /* __REFMATCH_H__ */
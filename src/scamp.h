@@ -59,6 +59,18 @@ struct Sample {
      */
     double bestMatchDistance;
 
+    /* Used by the atomic crossmatch engine: float bits of the distance to
+     * the best match in the upper 32 bits, store wide index of the best
+     * match in the lower 32 bits. Resolved to bestMatch at the end of the
+     * crossmatch.
+     */
+    uint64_t packedMatch;
+
+    /* Index of the best matching sample of a reference Snapshot, -1 if
+     * none. Set by Snapshot_crossSamples.
+     */
+    long refMatch;
+
     /* Object belong to this match bundle. */
     MatchBundle *matchBundle;
 
@@ -81,6 +93,9 @@ struct Set {
 
     Field *field;
 
+    /* sky coverage at MOC_FIELD_ORDER, see moc.h. May be NULL */
+    struct Moc *moc;
+
 };
 
 
@@ -92,6 +107,9 @@ struct Field {
     Set *sets;
     int  nsets;
 
+    /* union of the sets MOCs. May be NULL */
+    struct Moc *moc;
+
 };
 
 /**
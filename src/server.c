@@ -0,0 +1,509 @@
+/*
+ * Resident match server: a reference snapshot stays in memory and
+ * exposures are cross matched with it on request, over a unix socket.
+ *
+ * A request is a request_header followed by a catalog path of "size"
+ * bytes, or by "size" ServerPoint. The answer is the number of matches as
+ * an int64_t, -1 on error, followed by the ServerMatch records.
+ *
+ * Loaders abort on files they can not read. A catalog is then loaded and
+ * cross matched in a forked child, which sends the answer back to the
+ * server over a socket pair: a child dying only fails its request.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "server.h"
+#include "pixelstore.h"
+#include "trace.h"
+#include "logger.h"
+#include "mem.h"
+
+enum {
+	REQUEST_FILE,
+	REQUEST_POINTS,
+	REQUEST_STOP
+};
+
+typedef struct request_header {
+	int32_t	type;
+	int64_t	size;	/* path length or number of points */
+} request_header;
+
+/* larger requests are refused */
+#define MAX_PATH_SIZE 4096
+#define MAX_POINTS (((int64_t) 1) << 28)
+
+#define LISTEN_BACKLOG 16
+
+
+/******************************************************************************
+ * PRIVATE FUNCTIONS
+ */
+static bool
+write_all(int fd, const void *data, long size)
+{
+	const char *p = data;
+	ssize_t n;
+	while (size > 0) {
+		/* a client gone is not a reason to die on SIGPIPE */
+		n = send(fd, p, size, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool
+read_all(int fd, void *data, long size)
+{
+	char *p = data;
+	ssize_t n;
+	while (size > 0) {
+		n = read(fd, p, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool
+socket_address(char *path, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		Logger_log(LOGGER_ERROR, "Socket path %s is too long\n", path);
+		return false;
+	}
+	strcpy(addr->sun_path, path);
+	return true;
+}
+
+static void
+append_match(
+	ServerMatch	**matches,
+	long		*nmatches,
+	long		*capacity,
+	Snapshot	*ref,
+	Sample		*spl,
+	int			set,
+	long		row)
+{
+	if (*nmatches == *capacity) {
+		*capacity *= 2;
+		*matches = REALLOC(*matches, sizeof(ServerMatch) * *capacity);
+	}
+
+	ServerMatch *m = &(*matches)[(*nmatches)++];
+	m->set = set;
+	m->row = row;
+	m->ref = spl->refMatch;
+	m->refid = ref->ids[spl->refMatch];
+	m->reffield = ref->setfields[ref->sets[spl->refMatch]];
+	m->distance = spl->bestMatchDistance;
+}
+
+/*
+ * Load and cross match the catalog "file". Return the number of matches.
+ */
+static long
+load_and_match(
+	char			*file,
+	Snapshot		*ref,
+	Catalog_loadFunc	load,
+	double			radius_arcsec,
+	int				nthreads,
+	ServerMatch		**matches)
+{
+	long nmatches = 0, capacity = 1024, r;
+	Field field;
+	int s;
+
+	PixelStore *store = PixelStore_new(ref->nsides);
+	load(file, &field, (Catalog_addFunc) PixelStore_add, store);
+	Snapshot_crossSamples(ref, store, radius_arcsec, nthreads);
+
+	*matches = ALLOC(sizeof(ServerMatch) * capacity);
+	for (s=0; s<field.nsets; s++) {
+		Set *set = &field.sets[s];
+		for (r=0; r<set->nsamples; r++)
+			if (set->samples[r] && set->samples[r]->refMatch >= 0)
+				append_match(matches, &nmatches, &capacity, ref,
+						set->samples[r], s, r);
+	}
+
+	Catalog_freeField(&field);
+	PixelStore_free(store);
+
+	return nmatches;
+}
+
+/*
+ * Same as load_and_match, in a child process. Return -1 if the file can
+ * not be read, or if the child dies loading it.
+ */
+static long
+match_file(
+	char			*file,
+	Snapshot		*ref,
+	Catalog_loadFunc	load,
+	double			radius_arcsec,
+	int				nthreads,
+	ServerMatch		**matches)
+{
+	int64_t nmatches = -1;
+	int sv[2], status;
+	bool ok;
+
+	if (access(file, R_OK) != 0) {
+		Logger_log(LOGGER_ERROR, "Can not read %s\n", file);
+		return -1;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+		Logger_log(LOGGER_ERROR, "socketpair failed\n");
+		return -1;
+	}
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		Logger_log(LOGGER_ERROR, "fork failed\n");
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	}
+
+	if (pid == 0) {
+		close(sv[0]);
+		nmatches = load_and_match(file, ref, load, radius_arcsec, nthreads,
+				matches);
+		ok = write_all(sv[1], &nmatches, sizeof(int64_t)) &&
+			write_all(sv[1], *matches, sizeof(ServerMatch) * nmatches);
+		_exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	close(sv[1]);
+	ok = read_all(sv[0], &nmatches, sizeof(int64_t)) && nmatches >= 0;
+	if (ok) {
+		*matches = ALLOC(sizeof(ServerMatch) * (nmatches > 0 ? nmatches : 1));
+		ok = read_all(sv[0], *matches, sizeof(ServerMatch) * nmatches);
+		if (!ok)
+			FREE(*matches);
+	}
+	close(sv[0]);
+
+	waitpid(pid, &status, 0);
+	if (!ok || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+		Logger_log(LOGGER_ERROR, "Can not load %s\n", file);
+		if (ok)
+			FREE(*matches);
+		return -1;
+	}
+
+	return nmatches;
+}
+
+/*
+ * True if "point" is a position of the sphere, which the store can take.
+ */
+static bool
+valid_point(ServerPoint *point)
+{
+	double col = SC_HALFPI - point->dec * TO_RAD;
+	return isfinite(point->ra) && col >= 0 && col <= SC_PI;
+}
+
+/*
+ * Cross match the "npoints" positions. Return the number of matches, or
+ * -1 if a position is not valid.
+ */
+static long
+match_points(
+	ServerPoint	*points,
+	long		npoints,
+	Snapshot	*ref,
+	double		radius_arcsec,
+	int			nthreads,
+	ServerMatch	**matches)
+{
+	long nmatches = 0, capacity = 1024, i;
+
+	for (i=0; i<npoints; i++) {
+		if (!valid_point(&points[i])) {
+			Logger_log(LOGGER_ERROR, "Bad position %g %g of point %li\n",
+					points[i].ra, points[i].dec, i);
+			return -1;
+		}
+	}
+
+	Sample *spls = ALLOC(sizeof(Sample) * (npoints > 0 ? npoints : 1));
+	Sample **ptrs = ALLOC(sizeof(Sample*) * (npoints > 0 ? npoints : 1));
+	Sample ***exts = ALLOC(sizeof(Sample**) * (npoints > 0 ? npoints : 1));
+	for (i=0; i<npoints; i++) {
+		memset(&spls[i], 0, sizeof(Sample));
+		spls[i].id = i;
+		spls[i].ra = points[i].ra;
+		spls[i].dec = points[i].dec;
+		spls[i].lon = points[i].ra * TO_RAD;
+		spls[i].col = SC_HALFPI - points[i].dec * TO_RAD;
+		exts[i] = &ptrs[i];
+	}
+
+	PixelStore *store = PixelStore_new(ref->nsides);
+	PixelStore_addBatch(store, spls, npoints, exts);
+	Snapshot_crossSamples(ref, store, radius_arcsec, nthreads);
+
+	*matches = ALLOC(sizeof(ServerMatch) * capacity);
+	for (i=0; i<npoints; i++)
+		if (ptrs[i]->refMatch >= 0)
+			append_match(matches, &nmatches, &capacity, ref, ptrs[i], 0, i);
+
+	PixelStore_free(store);
+	FREE(spls);
+	FREE(ptrs);
+	FREE(exts);
+
+	return nmatches;
+}
+
+/*
+ * Read and answer one request of the client "fd". Return false when the
+ * connection is closed, or is to be closed because of a malformed request.
+ */
+static bool
+serve_request(
+	int					fd,
+	Snapshot			*ref,
+	Catalog_loadFunc	load,
+	double				radius_arcsec,
+	int					nthreads,
+	bool				*stop)
+{
+	request_header h;
+	ServerMatch *matches = NULL;
+	ServerPoint *points;
+	int64_t nmatches = -1;
+	char *file;
+	bool ok;
+
+	if (!read_all(fd, &h, sizeof(request_header)))
+		return false;
+
+	switch (h.type) {
+	case REQUEST_FILE:
+		if (h.size <= 0 || h.size > MAX_PATH_SIZE)
+			return false;
+		file = ALLOC(h.size + 1);
+		ok = read_all(fd, file, h.size);
+		file[h.size] = '\0';
+		if (ok) {
+			Trace_begin("Server_request", "%s", file);
+			nmatches = match_file(file, ref, load, radius_arcsec, nthreads,
+					&matches);
+			Trace_end();
+		}
+		FREE(file);
+		break;
+	case REQUEST_POINTS:
+		if (h.size < 0 || h.size > MAX_POINTS)
+			return false;
+		points = ALLOC(sizeof(ServerPoint) * (h.size > 0 ? h.size : 1));
+		ok = read_all(fd, points, sizeof(ServerPoint) * h.size);
+		if (ok) {
+			Trace_begin("Server_request", "%li points", (long) h.size);
+			nmatches = match_points(points, h.size, ref, radius_arcsec,
+					nthreads, &matches);
+			Trace_end();
+		}
+		FREE(points);
+		break;
+	case REQUEST_STOP:
+		*stop = true;
+		return true;
+	default:
+		Logger_log(LOGGER_ERROR, "Unknown server request %i\n", h.type);
+		return false;
+	}
+
+	if (!ok)
+		return false;
+	ok = write_all(fd, &nmatches, sizeof(int64_t));
+	if (ok && nmatches > 0)
+		ok = write_all(fd, matches, sizeof(ServerMatch) * nmatches);
+	if (matches)
+		FREE(matches);
+
+	return ok;
+}
+
+static long
+read_matches(int fd, ServerMatch **matches)
+{
+	int64_t nmatches;
+
+	if (!read_all(fd, &nmatches, sizeof(int64_t)) || nmatches < 0)
+		return -1;
+
+	*matches = ALLOC(sizeof(ServerMatch) * (nmatches > 0 ? nmatches : 1));
+	if (!read_all(fd, *matches, sizeof(ServerMatch) * nmatches)) {
+		FREE(*matches);
+		return -1;
+	}
+
+	return nmatches;
+}
+
+/**
+ * PRIVATE FUNCTIONS END
+ ******************************************************************************/
+
+
+
+/******************************************************************************
+ * PUBLIC FUNCTIONS
+ */
+bool
+Server_run(
+	char				*path,
+	Snapshot			*ref,
+	Catalog_loadFunc	load,
+	double				radius_arcsec,
+	int					nthreads)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	bool stop = false;
+	int sock, fd;
+
+	if (!socket_address(path, &addr))
+		return false;
+
+	/* socket left by a previous server */
+	if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0 ||
+			bind(sock, (struct sockaddr*) &addr, sizeof(addr)) != 0 ||
+			listen(sock, LISTEN_BACKLOG) != 0) {
+		Logger_log(LOGGER_ERROR, "Can not listen on %s\n", path);
+		if (sock >= 0)
+			close(sock);
+		return false;
+	}
+
+	Logger_log(LOGGER_NORMAL, "Serving %li reference samples on %s\n",
+			ref->nsamples, path);
+
+	while (!stop) {
+		fd = accept(sock, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			Logger_log(LOGGER_ERROR, "Server accept failed\n");
+			break;
+		}
+		while (serve_request(fd, ref, load, radius_arcsec, nthreads, &stop));
+		close(fd);
+	}
+
+	close(sock);
+	unlink(path);
+
+	return true;
+}
+
+
+int
+Server_connect(char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (!socket_address(path, &addr))
+		return -1;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+long
+Server_matchFile(
+	int			fd,
+	char		*file,
+	ServerMatch	**matches)
+{
+	request_header h = {REQUEST_FILE, strlen(file)};
+
+	if (!write_all(fd, &h, sizeof(request_header)) ||
+			!write_all(fd, file, h.size))
+		return -1;
+
+	return read_matches(fd, matches);
+}
+
+
+long
+Server_matchPoints(
+	int			fd,
+	ServerPoint	*points,
+	long		npoints,
+	ServerMatch	**matches)
+{
+	request_header h = {REQUEST_POINTS, npoints};
+
+	if (!write_all(fd, &h, sizeof(request_header)) ||
+			!write_all(fd, points, sizeof(ServerPoint) * npoints))
+		return -1;
+
+	return read_matches(fd, matches);
+}
+
+
+void
+Server_stop(int fd)
+{
+	request_header h = {REQUEST_STOP, 0};
+
+	write_all(fd, &h, sizeof(request_header));
+	close(fd);
+}
+/**
+ * PUBLIC FUNCTIONS END
+ ******************************************************************************/
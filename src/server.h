@@ -0,0 +1,89 @@
+/*
+ * Resident match server: a reference snapshot stays in memory and
+ * exposures are cross matched with it on request, over a unix socket.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "catalog.h"
+#include "snapshot.h"
+
+/*
+ * A position of a packed batch, in degrees.
+ */
+typedef struct ServerPoint {
+    double  ra;
+    double  dec;
+} ServerPoint;
+
+/*
+ * A match of an exposure sample with its closest reference sample.
+ */
+typedef struct ServerMatch {
+    int     set;        /* set of the sample in the catalog, 0 for a batch */
+    long    row;        /* row of the sample in its set, or in the batch */
+    long    ref;        /* index of the reference sample in the snapshot */
+    int64_t refid;      /* id of the reference sample */
+    int     reffield;   /* field of the reference sample */
+    double  distance;   /* euclidean distance between the samples vectors */
+} ServerMatch;
+
+/**
+ * Serve cross match requests against "ref" on the unix socket "path",
+ * until a client calls Server_stop. Exposures are loaded with "load" in a
+ * PixelStore of the snapshot nsides, cross matched with
+ * Snapshot_crossSamples and freed, so the cost of a request only depends
+ * on the exposure size. The snapshot is never modified.
+ *
+ * Requests are served one at a time, each one with "nthreads" threads. A
+ * catalog is loaded in a child process, so that a file the loader aborts
+ * on only fails its request. A connection may send any number of
+ * requests. Return false if the socket can not be created.
+ */
+extern bool
+Server_run(char *path, Snapshot *ref, Catalog_loadFunc load,
+        double radius_arcsec, int nthreads);
+
+/**
+ * Connect to the server listening on "path". Return the socket, or -1.
+ */
+extern int
+Server_connect(char *path);
+
+/**
+ * Cross match the catalog "file", read by the server, with the reference.
+ * "matches" is allocated and filled with one entry per sample having a
+ * match, in set and row order. Return the number of matches, or -1 if the
+ * server can not load the file or the connection fails.
+ */
+extern long
+Server_matchFile(int fd, char *file, ServerMatch **matches);
+
+/**
+ * Same as Server_matchFile for "npoints" positions sent with the request.
+ * Return -1 if a position is not finite, or its dec not in [-90, 90].
+ */
+extern long
+Server_matchPoints(int fd, ServerPoint *points, long npoints,
+        ServerMatch **matches);
+
+/**
+ * Ask the server to exit once the connection is closed, and close "fd".
+ */
+extern void
+Server_stop(int fd);
+
+#endif /* __SERVER_H__ */
@@ -0,0 +1,424 @@
+/*
+ * On disk cache of the projected samples of catalogs, keyed on their
+ * content.
+ *
+ * A cache file is a header, the number of samples of every set, then for
+ * every set its columns: ids, ra, dec, vectors and nested pixel ids. All
+ * values are 8 bytes wide and in host order, so that the columns can be
+ * read in place from a mapping.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "skycache.h"
+#include "catalog.h"
+#include "moc.h"
+#include "logger.h"
+#include "mem.h"
+
+#define SKYCACHE_MAGIC "SCAMPSKC"
+
+/* bytes of a cached sample: id, ra, dec, vector and pix_nest */
+#define SAMPLE_SIZE (7 * 8)
+
+/* samples inserted at once in the store */
+#define SAMPLE_BLOCK 1024
+
+typedef struct skc_header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	nsets;
+	uint64_t	key;
+	int64_t		nsides;
+	uint64_t	nsamples;
+} skc_header;
+
+static char *cache_dir = NULL;
+
+
+/******************************************************************************
+ * PRIVATE FUNCTIONS
+ */
+static inline uint64_t
+mix64(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static inline uint64_t
+rotl64(uint64_t v, int r)
+{
+	return (v << r) | (v >> (64 - r));
+}
+
+/*
+ * Hash of "n" bytes, four independent lanes of 8 bytes words so that
+ * hashing is not latency bound.
+ */
+static uint64_t
+hash_bytes(
+	const uint8_t	*p,
+	size_t			n)
+{
+	const uint64_t prime = 0x9e3779b97f4a7c15ULL;
+	uint64_t lanes[4] = {1, 2, 3, 4}, w;
+	size_t i;
+	int k;
+
+	for (i=0; i + 32 <= n; i+=32) {
+		for (k=0; k<4; k++) {
+			memcpy(&w, p + i + 8 * k, 8);
+			lanes[k] = rotl64(lanes[k] ^ (w * prime), 31) * prime;
+		}
+	}
+
+	uint64_t h = n;
+	for (k=0; k<4; k++)
+		h = mix64(h ^ lanes[k]);
+	for (; i<n; i++)
+		h = (h ^ p[i]) * prime;
+
+	return mix64(h);
+}
+
+static void
+cache_path(
+	uint64_t	key,
+	char		*path,
+	int			size)
+{
+	snprintf(path, size, "%s/%016llx.skc", cache_dir, (unsigned long long) key);
+}
+
+static int
+nsides_order(int64_t nsides)
+{
+	int order = 0;
+	while ((((int64_t) 1) << order) < nsides)
+		order++;
+	return order;
+}
+
+/*
+ * MOC of the "n" pixel ids "pix" at "order" >= MOC_FIELD_ORDER.
+ */
+static void
+moc_add_pixels(
+	Moc				*moc,
+	const int64_t	*pix,
+	long			n,
+	int				order)
+{
+	int shift = 2 * (order - MOC_FIELD_ORDER);
+	int64_t last = -1, p;
+	long j;
+
+	for (j=0; j<n; j++) {
+		p = pix[j] >> shift;
+		/* catalogs are usually sorted on y, skip runs */
+		if (p != last)
+			Moc_addPixel(moc, MOC_FIELD_ORDER, p);
+		last = p;
+	}
+}
+
+/*
+ * Build the set "set" from its cached columns.
+ */
+static void
+load_set(
+	Set				*set,
+	const uint8_t	*columns,
+	long			nsamples,
+	int64_t			nsides,
+	PixelStore		*store)
+{
+	Sample samples[SAMPLE_BLOCK];
+	Sample **exts[SAMPLE_BLOCK];
+	long b, j, n;
+
+	const int64_t *id = (const int64_t*) columns;
+	const double *ra = (const double*) (id + nsamples);
+	const double *dec = ra + nsamples;
+	const double *vector = dec + nsamples;
+	const int64_t *pix = (const int64_t*) (vector + 3 * nsamples);
+
+	set->samples = ALLOC(sizeof(Sample*) * (nsamples > 0 ? nsamples : 1));
+	set->nsamples = nsamples;
+
+	for (b=0; b<nsamples; b+=SAMPLE_BLOCK) {
+		n = nsamples - b < SAMPLE_BLOCK ? nsamples - b : SAMPLE_BLOCK;
+		for (j=0; j<n; j++) {
+			Sample *spl = &samples[j];
+			spl->id = id[b+j];
+			spl->ra = ra[b+j];
+			spl->dec = dec[b+j];
+			/* same conversions as the catalog loaders */
+			spl->lon = ra[b+j] * TO_RAD;
+			spl->col = SC_HALFPI - dec[b+j] * TO_RAD;
+			spl->vector[0] = vector[3*(b+j)];
+			spl->vector[1] = vector[3*(b+j)+1];
+			spl->vector[2] = vector[3*(b+j)+2];
+			spl->pix_nest = pix[b+j];
+			spl->set = set;
+			exts[j] = &set->samples[b+j];
+		}
+
+		if (nsides == store->nsides)
+			PixelStore_addComputed(store, samples, n, exts);
+		else
+			PixelStore_addBatch(store, samples, n, exts);
+	}
+
+	int order = nsides_order(nsides);
+	if (nsides == (((int64_t) 1) << order) && order >= MOC_FIELD_ORDER) {
+		set->moc = Moc_new();
+		moc_add_pixels(set->moc, pix, nsamples, order);
+		Moc_normalize(set->moc);
+	} else {
+		double *lon = ALLOC(sizeof(double) * (nsamples > 0 ? nsamples : 1));
+		double *col = ALLOC(sizeof(double) * (nsamples > 0 ? nsamples : 1));
+		for (j=0; j<nsamples; j++) {
+			lon[j] = ra[j] * TO_RAD;
+			col[j] = SC_HALFPI - dec[j] * TO_RAD;
+		}
+		set->moc = Moc_fromPositions(MOC_FIELD_ORDER, col, lon, nsamples);
+		FREE(lon);
+		FREE(col);
+	}
+}
+
+/*
+ * Write the column number "column" (id, ra, dec, vector, pix_nest) of the
+ * samples of "set".
+ */
+static bool
+write_column(
+	FILE	*fp,
+	Set		*set,
+	int		column)
+{
+	double buf[3 * SAMPLE_BLOCK];
+	long b, j, n, k;
+
+	for (b=0; b<set->nsamples; b+=SAMPLE_BLOCK) {
+		n = set->nsamples - b < SAMPLE_BLOCK ? set->nsamples - b : SAMPLE_BLOCK;
+		for (j=0, k=0; j<n; j++) {
+			Sample *spl = set->samples[b+j];
+			switch (column) {
+			case 0:
+				memcpy(&buf[k++], &(int64_t) {spl->id}, 8);
+				break;
+			case 1:
+				buf[k++] = spl->ra;
+				break;
+			case 2:
+				buf[k++] = spl->dec;
+				break;
+			case 3:
+				buf[k++] = spl->vector[0];
+				buf[k++] = spl->vector[1];
+				buf[k++] = spl->vector[2];
+				break;
+			case 4:
+				memcpy(&buf[k++], &spl->pix_nest, 8);
+				break;
+			}
+		}
+		if (fwrite(buf, 8, k, fp) != k)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * PRIVATE FUNCTIONS END
+ ******************************************************************************/
+
+
+
+/******************************************************************************
+ * PUBLIC FUNCTIONS
+ */
+void
+SkyCache_setDir(char *dir)
+{
+	cache_dir = dir;
+}
+
+
+bool
+SkyCache_enabled()
+{
+	return cache_dir != NULL;
+}
+
+
+uint64_t
+SkyCache_key(
+	char		*file,
+	uint64_t	salt)
+{
+	struct stat st;
+	uint64_t h;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0)
+		Logger_log(LOGGER_CRITICAL, "Can not open %s\n", file);
+
+	if (st.st_size == 0) {
+		close(fd);
+		return mix64(salt ^ SKYCACHE_VERSION);
+	}
+
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		Logger_log(LOGGER_CRITICAL, "Can not map %s\n", file);
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+	h = hash_bytes(data, st.st_size);
+	munmap(data, st.st_size);
+
+	return mix64(h ^ mix64(salt ^ SKYCACHE_VERSION));
+}
+
+
+bool
+SkyCache_load(
+	uint64_t	key,
+	Field		*field,
+	PixelStore	*store)
+{
+	char path[4096];
+	struct stat st;
+	uint32_t i;
+	int fd;
+
+	cache_path(key, path, sizeof(path));
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	if (fstat(fd, &st) != 0 || st.st_size < sizeof(skc_header)) {
+		close(fd);
+		return false;
+	}
+
+	const uint8_t *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return false;
+
+	/* the header and the set sizes must match the file size */
+	const skc_header *h = (const skc_header*) data;
+	const uint64_t *nsamples = (const uint64_t*) (h + 1);
+	bool valid = memcmp(h->magic, SKYCACHE_MAGIC, 8) == 0 &&
+		h->version == SKYCACHE_VERSION && h->key == key && h->nsides > 0 &&
+		sizeof(skc_header) + 8 * (uint64_t) h->nsets <= st.st_size;
+	if (valid) {
+		uint64_t total = 0;
+		for (i=0; i<h->nsets; i++)
+			total += nsamples[i];
+		valid = total == h->nsamples &&
+			st.st_size == sizeof(skc_header) + 8 * (uint64_t) h->nsets +
+			SAMPLE_SIZE * total;
+	}
+	if (!valid) {
+		Logger_log(LOGGER_ERROR, "Ignoring invalid cache file %s\n", path);
+		munmap((void*) data, st.st_size);
+		return false;
+	}
+
+	field->nsets = h->nsets;
+	field->sets = ALLOC(sizeof(Set) * (h->nsets > 0 ? h->nsets : 1));
+
+	const uint8_t *columns = (const uint8_t*) (nsamples + h->nsets);
+	for (i=0; i<h->nsets; i++) {
+		Set *set = &field->sets[i];
+		set->wcs = NULL;
+		set->nwcs = 0;
+		set->field = field;
+		load_set(set, columns, nsamples[i], h->nsides, store);
+		columns += SAMPLE_SIZE * nsamples[i];
+	}
+	Catalog_coverField(field);
+
+	LOGGER_LOG(LOGGER_DEBUG, "Loaded %llu samples from cache %s\n",
+			(unsigned long long) h->nsamples, path);
+	munmap((void*) data, st.st_size);
+
+	return true;
+}
+
+
+void
+SkyCache_save(
+	uint64_t	key,
+	Field		*field,
+	PixelStore	*store)
+{
+	char path[4096], tmp[sizeof(path) + 8];
+	skc_header h;
+	uint64_t n;
+	int i, c, fd;
+	bool ok = true;
+
+	cache_path(key, path, sizeof(path));
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		Logger_log(LOGGER_ERROR, "Can not create cache file %s\n", tmp);
+		return;
+	}
+	FILE *fp = fdopen(fd, "w");
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SKYCACHE_MAGIC, 8);
+	h.version = SKYCACHE_VERSION;
+	h.nsets = field->nsets;
+	h.key = key;
+	h.nsides = store->nsides;
+	h.nsamples = 0;
+	for (i=0; i<field->nsets; i++)
+		h.nsamples += field->sets[i].nsamples;
+
+	ok &= fwrite(&h, sizeof(h), 1, fp) == 1;
+	for (i=0; i<field->nsets; i++) {
+		n = field->sets[i].nsamples;
+		ok &= fwrite(&n, 8, 1, fp) == 1;
+	}
+	for (i=0; i<field->nsets && ok; i++)
+		for (c=0; c<5 && ok; c++)
+			ok &= write_column(fp, &field->sets[i], c);
+
+	ok &= fclose(fp) == 0;
+	if (!ok || rename(tmp, path) != 0) {
+		Logger_log(LOGGER_ERROR, "Can not write cache file %s\n", path);
+		unlink(tmp);
+	}
+}
+/**
+ * PUBLIC FUNCTIONS END
+ ******************************************************************************/
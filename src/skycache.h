@@ -0,0 +1,64 @@
+/*
+ * On disk cache of the projected samples of catalogs, keyed on their
+ * content.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __SKYCACHE_H__
+#define __SKYCACHE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "scamp.h"
+#include "pixelstore.h"
+
+#define SKYCACHE_VERSION 1
+
+/**
+ * Store cache files in "dir", NULL disables the cache (the default). Not
+ * thread safe.
+ */
+extern void
+SkyCache_setDir(char *dir);
+
+extern bool
+SkyCache_enabled();
+
+/**
+ * Return the cache key of "file": a hash of its content, which include the
+ * WCS headers, and of "salt", for loading options changing the projection.
+ */
+extern uint64_t
+SkyCache_key(char *file, uint64_t salt);
+
+/**
+ * Load the cached samples of "key" in "field" and "store". Sets have no
+ * wcs. Pixel ids and vectors are used as is if they were computed for the
+ * same nsides. Return false, without loading anything, if there is no
+ * valid cache file for "key".
+ *
+ * Thread safe.
+ */
+extern bool
+SkyCache_load(uint64_t key, Field *field, PixelStore *store);
+
+/**
+ * Write the samples of "field", inserted in "store", in the cache file of
+ * "key". The file is written under a temporary name then renamed, so that
+ * readers never see a partial file.
+ *
+ * Thread safe.
+ */
+extern void
+SkyCache_save(uint64_t key, Field *field, PixelStore *store);
+
+#endif /* __SKYCACHE_H__ */
@@ -0,0 +1,524 @@
+/*
+ * Read only, memory mapped snapshots of a built PixelStore.
+ *
+ * A snapshot file is a header followed by the pixel columns (ids, sample
+ * offsets, neighbor indexes), the sample columns (ids, ra, dec, vectors,
+ * set indexes) and the field index of every set. Columns start on 8 bytes
+ * boundaries and values are in host order.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+#include "chealpix.h"
+#include "logger.h"
+#include "perfcount.h"
+#include "trace.h"
+#include "mem.h"
+
+#define SNAPSHOT_MAGIC "SCAMPSNP"
+
+typedef struct snap_header {
+	char		magic[8];
+	uint32_t	version;
+	int32_t		nfields;
+	int64_t		nsides;
+	int64_t		npixels;
+	int64_t		nsamples;
+	int32_t		nsets;
+	int32_t		pad;
+} snap_header;
+
+/* byte offsets of the columns in a snapshot file */
+struct layout {
+	size_t	pixelids;
+	size_t	offsets;
+	size_t	neighbors;
+	size_t	ids;
+	size_t	ra;
+	size_t	dec;
+	size_t	vectors;
+	size_t	sets;
+	size_t	setfields;
+	size_t	size;
+};
+
+/* buffered output of a snapshot file */
+struct writer {
+	FILE	*fp;
+	size_t	n;
+	bool	ok;
+	char	buf[1 << 16];
+};
+
+struct cross_args {
+	Snapshot	*snap;
+	PixelStore	*store;
+	long		first;
+	long		last;	/* excluded */
+	long		nmatches;
+	int			thread;
+};
+
+
+/******************************************************************************
+ * PRIVATE FUNCTIONS
+ */
+static inline size_t
+align8(size_t n)
+{
+	return (n + 7) & ~((size_t) 7);
+}
+
+static void
+compute_layout(
+	long			npixels,
+	long			nsamples,
+	int				nsets,
+	struct layout	*l)
+{
+	l->pixelids = sizeof(snap_header);
+	l->offsets = l->pixelids + 8 * npixels;
+	l->neighbors = l->offsets + 8 * (npixels + 1);
+	l->ids = l->neighbors + 4 * 8 * npixels;
+	l->ra = l->ids + 8 * nsamples;
+	l->dec = l->ra + 8 * nsamples;
+	l->vectors = l->dec + 8 * nsamples;
+	l->sets = l->vectors + 3 * 8 * nsamples;
+	l->setfields = l->sets + align8(4 * nsamples);
+	l->size = l->setfields + align8(4 * (size_t) nsets);
+}
+
+static void
+flush(struct writer *w)
+{
+	if (w->n > 0 && fwrite(w->buf, 1, w->n, w->fp) != w->n)
+		w->ok = false;
+	w->n = 0;
+}
+
+static inline void
+put(
+	struct writer	*w,
+	const void		*value,
+	size_t			size)
+{
+	if (w->n + size > sizeof(w->buf))
+		flush(w);
+	memcpy(&w->buf[w->n], value, size);
+	w->n += size;
+}
+
+/* pad the 4 bytes column of "n" values to 8 bytes */
+static void
+pad(
+	struct writer	*w,
+	long			n)
+{
+	int32_t zero = 0;
+	if (n % 2)
+		put(w, &zero, 4);
+}
+
+/*
+ * Write the sample column "column" (id, ra, dec, vector, set index).
+ */
+static void
+write_samples(
+	struct writer	*w,
+	PixelStore		*store,
+	Field			*fields,
+	int				nfields,
+	int				*setfirst,
+	int				column)
+{
+	HealPixel *pix;
+	Sample *spl;
+	int32_t set;
+	long i, j, fi;
+
+	for (i=0; i<store->npixels; i++) {
+		pix = store->pixelarray[i];
+		for (j=0; j<pix->nsamples; j++) {
+			spl = &pix->samples[j];
+			switch (column) {
+			case 0:
+				put(w, &(int64_t) {spl->id}, 8);
+				break;
+			case 1:
+				put(w, &spl->ra, 8);
+				break;
+			case 2:
+				put(w, &spl->dec, 8);
+				break;
+			case 3:
+				put(w, spl->vector, 3 * 8);
+				break;
+			case 4:
+				fi = spl->set->field - fields;
+				if (fi < 0 || fi >= nfields)
+					Logger_log(LOGGER_CRITICAL,
+							"Snapshot sample %li is not in the given fields\n",
+							spl->id);
+				set = setfirst[fi] + (spl->set - fields[fi].sets);
+				put(w, &set, 4);
+				break;
+			}
+		}
+	}
+}
+
+static inline double
+dist(const double *va, const double *vb)
+{
+	double x = va[0] - vb[0];
+	double y = va[1] - vb[1];
+	double z = va[2] - vb[2];
+
+	return sqrt(x*x + y*y + z*z);
+}
+
+/*
+ * Fill "candidates" with the snapshot pixels that may hold a match of the
+ * samples of pixel "id": the pixel itself and its neighbors. Return their
+ * number.
+ */
+static int
+candidate_pixels(
+	Snapshot	*snap,
+	int64_t		id,
+	long		*candidates)
+{
+	long k, c, nb[8];
+	int n = 0, i;
+
+	k = Snapshot_find(snap, id);
+	if (k >= 0) {
+		/* neighbors are already resolved */
+		candidates[n++] = k;
+		for (i=0; i<8; i++)
+			if (snap->neighbors[8 * k + i] >= 0)
+				candidates[n++] = snap->neighbors[8 * k + i];
+		return n;
+	}
+
+	neighbours_nest64(snap->nsides, id, nb);
+	for (i=0; i<8; i++) {
+		if (nb[i] < 0)
+			continue;
+		c = Snapshot_find(snap, nb[i]);
+		if (c >= 0)
+			candidates[n++] = c;
+	}
+
+	return n;
+}
+
+static void*
+cross_thread(void *args)
+{
+	struct cross_args *ca = args;
+	Snapshot *snap = ca->snap;
+	HealPixel *pix;
+	Sample *spl;
+	long candidates[9], i, j, s, best;
+	double d, bestdist;
+	int c, n;
+	PerfCounters counters;
+
+	PerfCount_start(&counters);
+	Trace_begin("snapshot_cross", "%li pixels", ca->last - ca->first);
+	ca->nmatches = 0;
+	for (i=ca->first; i<ca->last; i++) {
+		pix = PixelStore_get(ca->store, ca->store->pixelids[i]);
+		n = candidate_pixels(snap, pix->id, candidates);
+
+		for (j=0; j<pix->nsamples; j++) {
+			spl = &pix->samples[j];
+			bestdist = ca->store->maxradius;
+			best = -1;
+
+			for (c=0; c<n; c++) {
+				for (s=snap->offsets[candidates[c]];
+						s<snap->offsets[candidates[c]+1]; s++) {
+					d = dist(spl->vector, &snap->vectors[3 * s]);
+					if (d < bestdist) {
+						bestdist = d;
+						best = s;
+					}
+				}
+			}
+
+			spl->refMatch = best;
+			if (best >= 0) {
+				spl->bestMatchDistance = bestdist;
+				ca->nmatches++;
+			}
+		}
+	}
+
+	Trace_end();
+	PerfCount_stop(&counters, "match", ca->thread);
+	return NULL;
+}
+
+/**
+ * PRIVATE FUNCTIONS END
+ ******************************************************************************/
+
+
+
+/******************************************************************************
+ * PUBLIC FUNCTIONS
+ */
+bool
+Snapshot_write(
+	char		*path,
+	PixelStore	*store,
+	Field		*fields,
+	int			nfields,
+	int			nthreads)
+{
+	char tmp[4096];
+	snap_header h;
+	long i, nsamples = 0;
+	int f, k, fd;
+
+	if (!store->linked)
+		PixelStore_linkNeighbors(store, nthreads);
+
+	for (i=0; i<store->npixels; i++)
+		nsamples += store->pixelarray[i]->nsamples;
+
+	int *setfirst = ALLOC(sizeof(int) * (nfields + 1));
+	for (f=0, setfirst[0]=0; f<nfields; f++)
+		setfirst[f+1] = setfirst[f] + fields[f].nsets;
+
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		Logger_log(LOGGER_ERROR, "Can not create snapshot %s\n", tmp);
+		FREE(setfirst);
+		return false;
+	}
+
+	struct writer *w = ALLOC(sizeof(struct writer));
+	w->fp = fdopen(fd, "w");
+	w->n = 0;
+	w->ok = true;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SNAPSHOT_MAGIC, 8);
+	h.version = SNAPSHOT_VERSION;
+	h.nfields = nfields;
+	h.nsides = store->nsides;
+	h.npixels = store->npixels;
+	h.nsamples = nsamples;
+	h.nsets = setfirst[nfields];
+	put(w, &h, sizeof(h));
+
+	/* pixel columns */
+	for (i=0; i<store->npixels; i++)
+		put(w, &store->pixelarray[i]->id, 8);
+	int64_t offset = 0;
+	for (i=0; i<store->npixels; i++) {
+		put(w, &offset, 8);
+		offset += store->pixelarray[i]->nsamples;
+	}
+	put(w, &offset, 8);
+	for (i=0; i<store->npixels; i++) {
+		for (k=0; k<8; k++) {
+			int32_t nb = store->pixelarray[i]->nbindex[k];
+			put(w, &nb, 4);
+		}
+	}
+
+	/* sample columns */
+	for (k=0; k<5; k++)
+		write_samples(w, store, fields, nfields, setfirst, k);
+	pad(w, nsamples);
+
+	/* field of every set */
+	for (f=0; f<nfields; f++) {
+		for (k=0; k<fields[f].nsets; k++) {
+			int32_t field = f;
+			put(w, &field, 4);
+		}
+	}
+	pad(w, setfirst[nfields]);
+
+	flush(w);
+	bool ok = w->ok;
+	ok &= fclose(w->fp) == 0;
+	if (ok && rename(tmp, path) != 0)
+		ok = false;
+	if (!ok) {
+		Logger_log(LOGGER_ERROR, "Can not write snapshot %s\n", path);
+		unlink(tmp);
+	}
+
+	FREE(w);
+	FREE(setfirst);
+
+	return ok;
+}
+
+
+Snapshot*
+Snapshot_open(char *path)
+{
+	struct layout l;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		Logger_log(LOGGER_ERROR, "Can not open snapshot %s\n", path);
+		return NULL;
+	}
+	if (fstat(fd, &st) != 0 || st.st_size < sizeof(snap_header)) {
+		Logger_log(LOGGER_ERROR, "%s is not a snapshot\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	/* shared, so that every process uses the same pages */
+	char *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		Logger_log(LOGGER_ERROR, "Can not map snapshot %s\n", path);
+		return NULL;
+	}
+
+	const snap_header *h = (const snap_header*) map;
+	bool valid = memcmp(h->magic, SNAPSHOT_MAGIC, 8) == 0 &&
+		h->version == SNAPSHOT_VERSION && h->nsides > 0 &&
+		h->npixels >= 0 && h->nsamples >= 0 && h->nfields >= 0 &&
+		h->nsets >= 0;
+	if (valid) {
+		compute_layout(h->npixels, h->nsamples, h->nsets, &l);
+		valid = l.size == st.st_size;
+	}
+	if (valid) {
+		const int64_t *offsets = (const int64_t*) (map + l.offsets);
+		valid = offsets[0] == 0 && offsets[h->npixels] == h->nsamples;
+	}
+	if (!valid) {
+		Logger_log(LOGGER_ERROR, "%s is not a valid snapshot\n", path);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	Snapshot *snap = ALLOC(sizeof(Snapshot));
+	snap->nsides = h->nsides;
+	snap->npixels = h->npixels;
+	snap->nsamples = h->nsamples;
+	snap->nfields = h->nfields;
+	snap->nsets = h->nsets;
+	snap->pixelids = (const int64_t*) (map + l.pixelids);
+	snap->offsets = (const int64_t*) (map + l.offsets);
+	snap->neighbors = (const int32_t*) (map + l.neighbors);
+	snap->ids = (const int64_t*) (map + l.ids);
+	snap->ra = (const double*) (map + l.ra);
+	snap->dec = (const double*) (map + l.dec);
+	snap->vectors = (const double*) (map + l.vectors);
+	snap->sets = (const int32_t*) (map + l.sets);
+	snap->setfields = (const int32_t*) (map + l.setfields);
+	snap->map = map;
+	snap->size = st.st_size;
+
+	return snap;
+}
+
+
+void
+Snapshot_close(Snapshot *snap)
+{
+	munmap(snap->map, snap->size);
+	FREE(snap);
+}
+
+
+long
+Snapshot_find(
+	Snapshot	*snap,
+	int64_t		id)
+{
+	long lo = 0, hi = snap->npixels, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (snap->pixelids[mid] < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo < snap->npixels && snap->pixelids[lo] == id ? lo : -1;
+}
+
+
+long
+Snapshot_crossSamples(
+	Snapshot	*snap,
+	PixelStore	*store,
+	double		radius_arcsec,
+	int			nthreads)
+{
+	long nmatches = 0;
+	int t;
+
+	if (snap->nsides != store->nsides)
+		Logger_log(LOGGER_CRITICAL,
+				"Snapshot nsides %li differs from the store nsides %li\n",
+				snap->nsides, store->nsides);
+
+	/* resets bestMatchDistance and refMatch */
+	PixelStore_setMaxRadius(store, radius_arcsec / 3600 * TO_RAD);
+
+	if (nthreads < 1)
+		nthreads = 1;
+	pthread_t *threads = ALLOC(sizeof(pthread_t) * nthreads);
+	struct cross_args *args = ALLOC(sizeof(struct cross_args) * nthreads);
+
+	for (t=0; t<nthreads; t++) {
+		args[t].snap = snap;
+		args[t].store = store;
+		args[t].first = store->npixels * t / nthreads;
+		args[t].last = store->npixels * (t + 1) / nthreads;
+		args[t].thread = t;
+		pthread_create(&threads[t], NULL, cross_thread, &args[t]);
+	}
+	for (t=0; t<nthreads; t++) {
+		pthread_join(threads[t], NULL);
+		nmatches += args[t].nmatches;
+	}
+
+	FREE(threads);
+	FREE(args);
+
+	Logger_log(LOGGER_NORMAL,
+			"Snapshot crossmatch end: %li matches\n", nmatches);
+
+	return nmatches;
+}
+/**
+ * PUBLIC FUNCTIONS END
+ ******************************************************************************/
@@ -0,0 +1,91 @@
+/*
+ * Read only, memory mapped snapshots of a built PixelStore.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "scamp.h"
+#include "pixelstore.h"
+
+#define SNAPSHOT_VERSION 1
+
+/**
+ * A snapshot holds the pixels of a store sorted by id, and the samples of
+ * every pixel in columns, pixel after pixel. All arrays point in a read
+ * only shared mapping of the snapshot file: processes opening the same
+ * snapshot share its pages.
+ */
+typedef struct Snapshot {
+    int64_t         nsides;
+    long            npixels;
+    long            nsamples;
+    int             nfields;
+    int             nsets;
+
+    const int64_t   *pixelids;  /* sorted */
+    const int64_t   *offsets;   /* npixels + 1, first sample of every pixel */
+    const int32_t   *neighbors; /* 8 per pixel, index in pixelids, -1 if none */
+
+    const int64_t   *ids;
+    const double    *ra;        /* degrees */
+    const double    *dec;
+    const double    *vectors;   /* 3 per sample */
+    const int32_t   *sets;      /* set index of every sample */
+    const int32_t   *setfields; /* field index of every set */
+
+    void            *map;
+    size_t          size;
+} Snapshot;
+
+/**
+ * Write a snapshot of "store" in "path". Samples must belong to the
+ * "nfields" fields of "fields", in which their set is identified. The
+ * store is linked first if required. The file is written under a
+ * temporary name then renamed. Return false on failure.
+ */
+extern bool
+Snapshot_write(char *path, PixelStore *store, Field *fields, int nfields,
+        int nthreads);
+
+/**
+ * Map the snapshot "path". Return NULL if it is not a valid snapshot.
+ */
+extern Snapshot*
+Snapshot_open(char *path);
+
+extern void
+Snapshot_close(Snapshot *snap);
+
+/**
+ * Return the index of pixel "id" in snap->pixelids, or -1.
+ */
+extern long
+Snapshot_find(Snapshot *snap, int64_t id);
+
+/**
+ * Cross match the samples of "store" with the samples of "snap", which
+ * must have the same nsides. Every sample of "store" gets the index of its
+ * closest snapshot sample within "radius_arcsec" in Sample.refMatch, or -1,
+ * and the euclidean distance to it in Sample.bestMatchDistance. Samples of
+ * "store" are not matched between them. Return the number of samples
+ * having a match.
+ */
+extern long
+Snapshot_crossSamples(Snapshot *snap, PixelStore *store,
+        double radius_arcsec, int nthreads);
+
+#endif /* __SNAPSHOT_H__ */
@@ -0,0 +1,228 @@
+/*
+ * Timeline of the load, index and match phases, in the Chrome trace event
+ * format (chrome://tracing, Perfetto).
+ *
+ * Every thread appends its begin and end events to its own buffer, a list
+ * of blocks of TRACE_BLOCK_EVENTS events: the global lock is only taken
+ * once per thread, when its buffer is created. Buffers of ended threads
+ * are kept until Trace_write.
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "trace.h"
+#include "logger.h"
+#include "mem.h"
+
+typedef struct trace_event {
+	int64_t		ts;		/* ns since Trace_enable */
+	const char	*name;	/* NULL for the end of a span */
+	char		detail[TRACE_DETAIL_SIZE];
+} trace_event;
+
+typedef struct trace_block {
+	trace_event			events[TRACE_BLOCK_EVENTS];
+	int					nevents;
+	struct trace_block	*next;
+} trace_block;
+
+typedef struct trace_buffer {
+	int					tid;
+	trace_block			*first;
+	trace_block			*last;
+	struct trace_buffer	*next;
+} trace_buffer;
+
+static bool enabled = false;
+static struct timespec origin;
+
+static pthread_mutex_t buffers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static trace_buffer *buffers = NULL;
+static int nbuffers = 0;
+
+/* buffers written by Trace_write are stale for the threads still alive */
+static int generation = 0;
+static __thread trace_buffer *local = NULL;
+static __thread int local_generation = -1;
+
+
+/******************************************************************************
+ * PRIVATE FUNCTIONS
+ */
+static trace_block*
+new_block()
+{
+	trace_block *block = ALLOC(sizeof(trace_block));
+	block->nevents = 0;
+	block->next = NULL;
+	return block;
+}
+
+static trace_buffer*
+local_buffer()
+{
+	if (local && local_generation == generation)
+		return local;
+
+	local = ALLOC(sizeof(trace_buffer));
+	local->first = local->last = new_block();
+
+	pthread_mutex_lock(&buffers_mutex);
+	local->tid = ++nbuffers;
+	local->next = buffers;
+	buffers = local;
+	local_generation = generation;
+	pthread_mutex_unlock(&buffers_mutex);
+
+	return local;
+}
+
+static trace_event*
+new_event()
+{
+	trace_buffer *buf = local_buffer();
+	struct timespec t;
+
+	if (buf->last->nevents == TRACE_BLOCK_EVENTS) {
+		buf->last->next = new_block();
+		buf->last = buf->last->next;
+	}
+	trace_event *ev = &buf->last->events[buf->last->nevents++];
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	ev->ts = (int64_t) (t.tv_sec - origin.tv_sec) * 1000000000 +
+		(t.tv_nsec - origin.tv_nsec);
+
+	return ev;
+}
+
+static void
+write_string(FILE *fp, const char *s)
+{
+	fputc('"', fp);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(fp, "\\%c", *s);
+		else if ((unsigned char) *s < 0x20)
+			fprintf(fp, "\\u%04x", *s);
+		else
+			fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+/**
+ * PRIVATE FUNCTIONS END
+ ******************************************************************************/
+
+
+
+/******************************************************************************
+ * PUBLIC FUNCTIONS
+ */
+void
+Trace_enable()
+{
+	clock_gettime(CLOCK_MONOTONIC, &origin);
+	enabled = true;
+}
+
+bool
+Trace_enabled()
+{
+	return enabled;
+}
+
+void
+Trace_begin(const char *name, const char *format, ...)
+{
+	va_list args;
+
+	if (!enabled)
+		return;
+
+	trace_event *ev = new_event();
+	ev->name = name;
+	ev->detail[0] = '\0';
+	if (format) {
+		va_start(args, format);
+		vsnprintf(ev->detail, TRACE_DETAIL_SIZE, format, args);
+		va_end(args);
+	}
+}
+
+void
+Trace_end()
+{
+	if (!enabled)
+		return;
+
+	new_event()->name = NULL;
+}
+
+bool
+Trace_write(char *path)
+{
+	trace_buffer *buf, *nextbuf;
+	trace_block *block, *nextblock;
+	int i, first = 1, pid = getpid();
+
+	FILE *fp = fopen(path, "w");
+	if (!fp)
+		Logger_log(LOGGER_ERROR, "Can not write trace %s\n", path);
+
+	pthread_mutex_lock(&buffers_mutex);
+	if (fp)
+		fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+	for (buf=buffers; buf; buf=nextbuf) {
+		for (block=buf->first; block; block=nextblock) {
+			for (i=0; fp && i<block->nevents; i++) {
+				trace_event *ev = &block->events[i];
+				fprintf(fp, "%s\n{\"ph\": \"%c\", \"pid\": %i, \"tid\": %i, "
+						"\"ts\": %.3f", first ? "" : ",", ev->name ? 'B' : 'E',
+						pid, buf->tid, ev->ts / 1000.0);
+				if (ev->name) {
+					fprintf(fp, ", \"name\": ");
+					write_string(fp, ev->name);
+					if (ev->detail[0]) {
+						fprintf(fp, ", \"args\": {\"detail\": ");
+						write_string(fp, ev->detail);
+						fprintf(fp, "}");
+					}
+				}
+				fprintf(fp, "}");
+				first = 0;
+			}
+			nextblock = block->next;
+			FREE(block);
+		}
+		nextbuf = buf->next;
+		FREE(buf);
+	}
+	buffers = NULL;
+	generation++;
+	pthread_mutex_unlock(&buffers_mutex);
+
+	if (!fp)
+		return false;
+	fprintf(fp, "\n]}\n");
+	return fclose(fp) == 0;
+}
+/**
+ * PUBLIC FUNCTIONS END
+ ******************************************************************************/
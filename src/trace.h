@@ -0,0 +1,60 @@
+/*
+ * Timeline of the load, index and match phases, in the Chrome trace event
+ * format (chrome://tracing, Perfetto).
+ *
+ * Copyright (C) 2017 University of Bordeaux. All right reserved.
+ * Written by Emmanuel Bertin
+ * Written by Sebastien Serre
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdbool.h>
+
+/* events of a thread buffer block */
+#define TRACE_BLOCK_EVENTS 1024
+
+/* bytes of the detail of an event, longer details are truncated */
+#define TRACE_DETAIL_SIZE 64
+
+/**
+ * Start recording, timestamps are relative to this call. Spans are not
+ * recorded before, Trace_begin and Trace_end return immediately. Not
+ * thread safe.
+ */
+extern void
+Trace_enable();
+
+extern bool
+Trace_enabled();
+
+/**
+ * Begin a span of the calling thread. "name" must be a static string, the
+ * detail is formatted from "format" if not NULL. Events are appended to a
+ * buffer of the calling thread, without locking.
+ */
+extern void
+Trace_begin(const char *name, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/**
+ * End the last span begun by the calling thread.
+ */
+extern void
+Trace_end();
+
+/**
+ * Write the events of all threads in "path" as a Chrome trace JSON file,
+ * then free them. No thread may be recording. Return false if the file
+ * can not be written.
+ */
+extern bool
+Trace_write(char *path);
+
+#endif /* __TRACE_H__ */
@@ -0,0 +1,184 @@
+/*
+ * compare_matchers.c
+ *
+ * Compare the best matches of the crossmatch engines with the exact
+ * reference matcher (refmatch.h), sample per sample:
+ *
+ *   compareMatchers [-t 1,4] [-n 16] [-r 2] [-e locked,atomic] [-T 1e-6]
+ *       [-v 10] [-A] [-g nsources [-f nfields] [-c center] [-k clusters]]
+ *       [catalogs...]
+ *
+ * -g generates ASCII catalogs with gencat in place of the catalogs given,
+ * -T is the relative distance tolerance of ties and -v the number of
+ * differences printed per run. Exit with failure if any engine differs.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../src/catalog.h"
+#include "../src/asciicat.h"
+#include "../src/crossmatch.h"
+#include "../src/refmatch.h"
+#include "../src/logger.h"
+#include "../src/mem.h"
+#include "../src/pixelstore.h"
+#include "gencat.h"
+
+#define MAX_VALUES 32
+
+static int
+parse_list(char *arg, double *values) {
+    int n = 0;
+    char *tok = strtok(arg, ",");
+    while (tok && n < MAX_VALUES) {
+        values[n++] = atof(tok);
+        tok = strtok(NULL, ",");
+    }
+    return n;
+}
+
+static double
+now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char **argv) {
+    double threads[MAX_VALUES] = {1, 4};
+    int nthreads = 2, power = 16, nengines = 2, ascii = 0, c;
+    int engines[2] = {CROSSMATCH_LOCKED, CROSSMATCH_ATOMIC};
+    double radius = 2, tolerance = 1e-6;
+    long maxreport = 10, generate = 0;
+    GenCatConfig config = GenCat_defaultConfig;
+
+    while ((c=getopt(argc,argv,"t:n:r:e:T:v:Ag:f:c:k:")) != -1) {
+        switch(c) {
+        case 't':
+            nthreads = parse_list(optarg, threads);
+            break;
+        case 'n':
+            power = atoi(optarg);
+            break;
+        case 'r':
+            radius = atof(optarg);
+            break;
+        case 'e':
+            nengines = 0;
+            if (strstr(optarg, "locked"))
+                engines[nengines++] = CROSSMATCH_LOCKED;
+            if (strstr(optarg, "atomic"))
+                engines[nengines++] = CROSSMATCH_ATOMIC;
+            break;
+        case 'T':
+            tolerance = atof(optarg);
+            break;
+        case 'v':
+            maxreport = atol(optarg);
+            break;
+        case 'A':
+            ascii = 1;
+            break;
+        case 'g':
+            generate = atol(optarg);
+            break;
+        case 'f':
+            config.nfields = atoi(optarg);
+            break;
+        case 'c':
+            if (!GenCat_setCenter(&config, optarg))
+                return EXIT_FAILURE;
+            break;
+        case 'k':
+            config.nclusters = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "bad option, see compare_matchers.c\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    Logger_setLevel(LOGGER_ERROR);
+
+    int n = argc - optind, i, e, t, status = EXIT_SUCCESS;
+    char **files = &argv[optind];
+    if (generate > 0) {
+        config.nsources = generate;
+        config.format = GENCAT_ASCII;
+        n = config.nfields;
+        files = ALLOC(sizeof(char*) * n);
+        for (i=0; i<n; i++) {
+            files[i] = ALLOC(64);
+            snprintf(files[i], 64, "/tmp/compare-matchers-%i_%i.txt",
+                    (int) getpid(), i);
+            if (!GenCat_write(&config, i, files[i]))
+                return EXIT_FAILURE;
+        }
+        ascii = 1;
+    }
+    if (n < 1 || nengines < 1)
+        return EXIT_FAILURE;
+
+    Catalog_loadFunc load = Catalog_openWith;
+    if (ascii)
+        load = AsciiCat_openWith;
+
+    Field *fields = ALLOC(sizeof(Field) * n);
+    PixelStore *store = PixelStore_new(pow(2, power));
+    for (i=0; i<n; i++)
+        load(files[i], &fields[i], (Catalog_addFunc) PixelStore_add, store);
+
+    int maxthreads = 1;
+    for (t=0; t<nthreads; t++)
+        if (threads[t] > maxthreads)
+            maxthreads = threads[t];
+
+    double start = now();
+    RefMatch *ref = RefMatch_crossFields(fields, n, radius, maxthreads);
+    long nmatches = 0;
+    for (i=0; i<ref->nsamples; i++)
+        if (ref->matches[i])
+            nmatches++;
+    printf("reference: %li samples, %li matches in %.3f s\n", ref->nsamples,
+            nmatches, now() - start);
+
+    for (e=0; e<nengines; e++) {
+        Crossmatch_setEngine(engines[e]);
+        for (t=0; t<nthreads; t++) {
+            start = now();
+            Crossmatch_crossSamples(store, radius, threads[t]);
+            double elapsed = now() - start;
+
+            RefMatchDiff diff = RefMatch_compare(ref, tolerance, stdout,
+                    maxreport);
+            printf("%s, nside 2^%i, %i threads: %li same, %li ties, "
+                    "%li missing, %li extra, %li wrong in %.3f s\n",
+                    engines[e] == CROSSMATCH_ATOMIC ? "atomic" : "locked",
+                    power, (int) threads[t], diff.nsame, diff.nties,
+                    diff.nmissing, diff.nextra, diff.nwrong, elapsed);
+            if (diff.nmissing || diff.nextra || diff.nwrong)
+                status = EXIT_FAILURE;
+        }
+    }
+
+    RefMatch_free(ref);
+    for (i=0; i<n; i++)
+        Catalog_freeField(&fields[i]);
+    FREE(fields);
+    PixelStore_free(store);
+    if (generate > 0) {
+        for (i=0; i<n; i++) {
+            remove(files[i]);
+            FREE(files[i]);
+        }
+        FREE(files);
+    }
+
+    return status;
+}
@@ -0,0 +1,45 @@
+/*
+ * fixture.c
+ *
+ * Helpers shared by the tests and benchmarks, see fixture.h.
+ */
+
+#include <stddef.h>
+
+#include "fixture.h"
+#include "../src/mem.h"
+
+static uint64_t rnd_state = 1;
+
+void
+Fixture_seed(uint64_t seed) {
+    rnd_state = seed;
+}
+
+uint64_t
+Fixture_bits() {
+    rnd_state = rnd_state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return rnd_state >> 11;
+}
+
+double
+Fixture_rnd() {
+    return Fixture_bits() * (1.0 / 9007199254740992.0);
+}
+
+void
+Fixture_field(Field *field, int nsets, int nsamples) {
+    int i;
+
+    field->nsets = nsets;
+    field->sets = ALLOC(sizeof(Set) * nsets);
+    field->moc = NULL;
+    for (i=0; i<nsets; i++) {
+        field->sets[i].samples = ALLOC(sizeof(Sample*) * nsamples);
+        field->sets[i].nsamples = nsamples;
+        field->sets[i].wcs = NULL;
+        field->sets[i].nwcs = 0;
+        field->sets[i].field = field;
+        field->sets[i].moc = NULL;
+    }
+}
@@ -0,0 +1,41 @@
+/*
+ * fixture.h
+ *
+ * Helpers shared by the tests and benchmarks: a seeded random generator,
+ * so that every run draws the same samples, and in memory fields to add
+ * them to.
+ */
+
+#ifndef __FIXTURE_H__
+#define __FIXTURE_H__
+
+#include <stdint.h>
+
+#include "../src/scamp.h"
+
+/*
+ * Restart the random sequence from "seed".
+ */
+extern void
+Fixture_seed(uint64_t seed);
+
+/*
+ * Next 53 random bits of the sequence.
+ */
+extern uint64_t
+Fixture_bits();
+
+/*
+ * Next random number of the sequence, uniform in [0, 1[.
+ */
+extern double
+Fixture_rnd();
+
+/*
+ * Initialize "field" with "nsets" sets of "nsamples" unset sample
+ * pointers, without WCS nor coverage, for samples built by the test.
+ */
+extern void
+Fixture_field(Field *field, int nsets, int nsamples);
+
+#endif /* __FIXTURE_H__ */
@@ -0,0 +1,109 @@
+/*
+ * gen_catalogs.c
+ *
+ * Write synthetic catalogs for benchmarks, see gencat.h:
+ *
+ *   genCatalogs [options] <prefix>
+ *
+ * writes <prefix>_<field>.cat (LDAC) or <prefix>_<field>.txt (ASCII).
+ * Sources having the same id in different fields are the injected
+ * matches.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "gencat.h"
+
+static void
+usage() {
+    fprintf(stderr,
+            "usage: genCatalogs [options] <prefix>\n"
+            "  -n <count>   sources per field (100000)\n"
+            "  -f <count>   fields (2)\n"
+            "  -s <count>   sets per field (4)\n"
+            "  -c <center>  pole, face, wrap or ra,dec in degrees (30,20)\n"
+            "  -w <deg>     side of the fields (1)\n"
+            "  -p <arcsec>  pixel scale (0.2)\n"
+            "  -k <count>   clusters per set, 0 for uniform (0)\n"
+            "  -g <frac>    cluster size, fraction of a set side (0.02)\n"
+            "  -m <frac>    fraction of sources in every field (0.5)\n"
+            "  -e <arcsec>  max offset of these sources (0.5)\n"
+            "  -S <seed>    random seed (1)\n"
+            "  -a           ASCII catalogs instead of LDAC\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    GenCatConfig config = GenCat_defaultConfig;
+    char path[4096];
+    int c, f;
+
+    while ((c=getopt(argc,argv,"n:f:s:c:w:p:k:g:m:e:S:a")) != -1) {
+        switch(c) {
+        case 'n':
+            config.nsources = atol(optarg);
+            break;
+        case 'f':
+            config.nfields = atoi(optarg);
+            break;
+        case 's':
+            config.nsets = atoi(optarg);
+            break;
+        case 'c':
+            if (!GenCat_setCenter(&config, optarg))
+                usage();
+            break;
+        case 'w':
+            config.width = atof(optarg);
+            break;
+        case 'p':
+            config.scale = atof(optarg);
+            break;
+        case 'k':
+            config.nclusters = atoi(optarg);
+            break;
+        case 'g':
+            config.sigma = atof(optarg);
+            break;
+        case 'm':
+            config.matches = atof(optarg);
+            break;
+        case 'e':
+            config.offset = atof(optarg);
+            break;
+        case 'S':
+            config.seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'a':
+            config.format = GENCAT_ASCII;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind != argc - 1 || config.nsources < 1 || config.nfields < 1 ||
+            config.nsets < 1)
+        usage();
+
+    for (f=0; f<config.nfields; f++) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        snprintf(path, sizeof(path), "%s_%i.%s", argv[optind], f,
+                config.format == GENCAT_ASCII ? "txt" : "cat");
+        if (!GenCat_write(&config, f, path)) {
+            fprintf(stderr, "can not write %s\n", path);
+            return EXIT_FAILURE;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("%s: %li sources in %.2f seconds\n", path, config.nsources,
+                end.tv_sec - start.tv_sec +
+                (end.tv_nsec - start.tv_nsec) / 1e9);
+    }
+
+    return EXIT_SUCCESS;
+}
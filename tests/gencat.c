@@ -0,0 +1,371 @@
+/*
+ * gencat.c
+ *
+ * Synthetic catalogs for benchmarks, see gencat.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+
+#include "gencat.h"
+
+#define D2R (M_PI / 180)
+#define FITS_BLOCK 2880
+#define FITS_CARD 80
+
+/* LDAC_OBJECTS rows: NUMBER (1K), X_IMAGE (1E), Y_IMAGE (1E) */
+#define LDAC_ROW 16
+
+#define OUTPUT_BUFFER (1 << 20)
+
+const GenCatConfig GenCat_defaultConfig = {
+    100000,     /* nsources */
+    2,          /* nfields */
+    4,          /* nsets */
+    30.0, 20.0, /* ra, dec */
+    1.0,        /* width */
+    0.2,        /* scale */
+    0,          /* nclusters */
+    0.02,       /* sigma */
+    0.5,        /* matches */
+    0.5,        /* offset */
+    GENCAT_LDAC,
+    1           /* seed */
+};
+
+/* buffered output */
+struct output {
+    FILE    *fp;
+    char    *buf;
+    size_t  n;
+    bool    ok;
+};
+
+static inline uint64_t
+mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* splitmix64 */
+static inline double
+next(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static inline uint64_t
+stream(uint64_t seed, uint64_t a, uint64_t b, uint64_t c) {
+    return mix(mix(mix(seed ^ a) ^ b) ^ c);
+}
+
+static double
+gauss(uint64_t *state) {
+    double u = next(state), v = next(state);
+    return sqrt(-2 * log(u > 0 ? u : 1e-300)) * cos(2 * M_PI * v);
+}
+
+/* grid of the sets tiles */
+static void
+tile(const GenCatConfig *c, int set, double *x0, double *y0, double *w,
+        double *h) {
+    int nx = (int) ceil(sqrt(c->nsets));
+    int ny = (c->nsets + nx - 1) / nx;
+
+    *w = c->width / nx;
+    *h = c->width / ny;
+    *x0 = -c->width / 2 + (set % nx) * *w;
+    *y0 = -c->width / 2 + (set / nx) * *h;
+}
+
+/* first source of "set" */
+static long
+first_source(const GenCatConfig *c, int set) {
+    return (long) ((double) c->nsources * set / c->nsets);
+}
+
+static void
+put(struct output *out, const void *data, size_t size) {
+    if (out->n + size > OUTPUT_BUFFER) {
+        if (fwrite(out->buf, 1, out->n, out->fp) != out->n)
+            out->ok = false;
+        out->n = 0;
+    }
+    memcpy(out->buf + out->n, data, size);
+    out->n += size;
+}
+
+static void
+pad(struct output *out, size_t size, char c) {
+    char block[FITS_BLOCK];
+    memset(block, c, sizeof(block));
+    if (size % FITS_BLOCK)
+        put(out, block, FITS_BLOCK - size % FITS_BLOCK);
+}
+
+static void
+card(char *header, int *ncards, const char *key, const char *fmt, ...) {
+    char c[FITS_CARD + 1], value[FITS_CARD];
+    va_list ap;
+
+    if (fmt) {
+        va_start(ap, fmt);
+        vsnprintf(value, sizeof(value), fmt, ap);
+        va_end(ap);
+        snprintf(c, sizeof(c), "%-8.8s= %-70.70s", key, value);
+    } else {
+        snprintf(c, sizeof(c), "%-80.80s", key);
+    }
+    memcpy(header + FITS_CARD * (*ncards)++, c, FITS_CARD);
+}
+
+/* write "ncards" cards of "header" padded to a block */
+static void
+put_header(struct output *out, char *header, int ncards) {
+    put(out, header, ncards * FITS_CARD);
+    pad(out, ncards * FITS_CARD, ' ');
+}
+
+static void
+put_be64(struct output *out, uint64_t v) {
+    v = __builtin_bswap64(v);
+    put(out, &v, 8);
+}
+
+static void
+put_float(struct output *out, float f) {
+    uint32_t v;
+    memcpy(&v, &f, 4);
+    v = __builtin_bswap32(v);
+    put(out, &v, 4);
+}
+
+static void
+write_ldac_set(const GenCatConfig *c, int field, int set,
+        struct output *out) {
+    char header[64 * FITS_CARD], imhead[64 * FITS_CARD];
+    double x0, y0, w, h, p = c->scale / 3600;
+    long i, first = first_source(c, set), last = first_source(c, set + 1);
+    int n = 0, nk = 0;
+    GenCatSource src;
+
+    tile(c, set, &x0, &y0, &w, &h);
+
+    /* the image header, as saved by sextractor */
+    card(imhead, &nk, "SIMPLE", "%20s", "T");
+    card(imhead, &nk, "BITPIX", "%20i", -32);
+    card(imhead, &nk, "NAXIS", "%20i", 2);
+    card(imhead, &nk, "NAXIS1", "%20li", (long) ceil(w / p));
+    card(imhead, &nk, "NAXIS2", "%20li", (long) ceil(h / p));
+    card(imhead, &nk, "EQUINOX", "%20.1f", 2000.0);
+    card(imhead, &nk, "RADESYS", "'ICRS    '");
+    card(imhead, &nk, "CTYPE1", "'RA---TAN'");
+    card(imhead, &nk, "CTYPE2", "'DEC--TAN'");
+    card(imhead, &nk, "CRVAL1", "%20.12E", c->ra);
+    card(imhead, &nk, "CRVAL2", "%20.12E", c->dec);
+    card(imhead, &nk, "CRPIX1", "%20.12E", 1 - x0 / p);
+    card(imhead, &nk, "CRPIX2", "%20.12E", 1 - y0 / p);
+    card(imhead, &nk, "CD1_1", "%20.12E", p);
+    card(imhead, &nk, "CD1_2", "%20.12E", 0.0);
+    card(imhead, &nk, "CD2_1", "%20.12E", 0.0);
+    card(imhead, &nk, "CD2_2", "%20.12E", p);
+    card(imhead, &nk, "END", NULL);
+
+    card(header, &n, "XTENSION", "'BINTABLE'");
+    card(header, &n, "BITPIX", "%20i", 8);
+    card(header, &n, "NAXIS", "%20i", 2);
+    card(header, &n, "NAXIS1", "%20i", nk * FITS_CARD);
+    card(header, &n, "NAXIS2", "%20i", 1);
+    card(header, &n, "PCOUNT", "%20i", 0);
+    card(header, &n, "GCOUNT", "%20i", 1);
+    card(header, &n, "TFIELDS", "%20i", 1);
+    card(header, &n, "TTYPE1", "'Field Header Card'");
+    card(header, &n, "TFORM1", "'%iA'", nk * FITS_CARD);
+    card(header, &n, "EXTNAME", "'LDAC_IMHEAD'");
+    card(header, &n, "END", NULL);
+    put_header(out, header, n);
+    put(out, imhead, nk * FITS_CARD);
+    pad(out, nk * FITS_CARD, '\0');
+
+    n = 0;
+    card(header, &n, "XTENSION", "'BINTABLE'");
+    card(header, &n, "BITPIX", "%20i", 8);
+    card(header, &n, "NAXIS", "%20i", 2);
+    card(header, &n, "NAXIS1", "%20i", LDAC_ROW);
+    card(header, &n, "NAXIS2", "%20li", last - first);
+    card(header, &n, "PCOUNT", "%20i", 0);
+    card(header, &n, "GCOUNT", "%20i", 1);
+    card(header, &n, "TFIELDS", "%20i", 3);
+    card(header, &n, "TTYPE1", "'NUMBER  '");
+    card(header, &n, "TFORM1", "'1K      '");
+    card(header, &n, "TTYPE2", "'X_IMAGE '");
+    card(header, &n, "TFORM2", "'1E      '");
+    card(header, &n, "TUNIT2", "'pixel   '");
+    card(header, &n, "TTYPE3", "'Y_IMAGE '");
+    card(header, &n, "TFORM3", "'1E      '");
+    card(header, &n, "TUNIT3", "'pixel   '");
+    card(header, &n, "EXTNAME", "'LDAC_OBJECTS'");
+    card(header, &n, "END", NULL);
+    put_header(out, header, n);
+
+    for (i=first; i<last; i++) {
+        GenCat_source(c, field, i, &src);
+        put_be64(out, src.id);
+        put_float(out, src.x);
+        put_float(out, src.y);
+    }
+    pad(out, (size_t) (last - first) * LDAC_ROW, '\0');
+}
+
+/* "v" >= 0 with 12 decimals */
+static char*
+format_fixed(char *p, double v) {
+    long units = (long) v, frac = (long) ((v - units) * 1e12 + 0.5), d;
+    if (frac >= 1000000000000L) {
+        units++;
+        frac -= 1000000000000L;
+    }
+    p += sprintf(p, "%li.", units);
+    for (d=100000000000L; d>0; d/=10)
+        *p++ = '0' + (frac / d) % 10;
+    return p;
+}
+
+static void
+write_ascii(const GenCatConfig *c, int field, struct output *out) {
+    char line[128], *p;
+    GenCatSource src;
+    long i;
+
+    for (i=0; i<c->nsources; i++) {
+        GenCat_source(c, field, i, &src);
+        p = line + sprintf(line, "%li ", src.id);
+        p = format_fixed(p, src.lon);
+        *p++ = ' ';
+        p = format_fixed(p, src.col);
+        *p++ = '\n';
+        put(out, line, p - line);
+    }
+}
+
+
+bool
+GenCat_setCenter(GenCatConfig *config, const char *name) {
+    if (strcmp(name, "pole") == 0) {
+        config->ra = 0;
+        config->dec = 90;
+    } else if (strcmp(name, "face") == 0) {
+        /* where base pixels 0, 1 and 5 meet */
+        config->ra = 90;
+        config->dec = asin(2.0 / 3) / D2R;
+    } else if (strcmp(name, "wrap") == 0) {
+        config->ra = 0;
+        config->dec = 0;
+    } else if (sscanf(name, "%lf,%lf", &config->ra, &config->dec) != 2) {
+        return false;
+    }
+    return true;
+}
+
+
+void
+GenCat_source(const GenCatConfig *c, int field, long i, GenCatSource *src) {
+    double x0, y0, w, h, u, v, xi, eta;
+    uint64_t state;
+    int set;
+
+    /* sets own contiguous ranges of sources */
+    set = (int) ((double) i * c->nsets / c->nsources);
+    while (set > 0 && i < first_source(c, set))
+        set--;
+    while (set < c->nsets - 1 && i >= first_source(c, set + 1))
+        set++;
+    tile(c, set, &x0, &y0, &w, &h);
+
+    state = stream(c->seed, 1, i, 0);
+    src->common = next(&state) < c->matches;
+    if (!src->common)
+        state = stream(c->seed, 2, i, field);
+
+    if (c->nclusters > 0) {
+        int k = (int) (next(&state) * c->nclusters);
+        uint64_t cs = stream(c->seed, 3, set, k);
+        u = next(&cs) + c->sigma * gauss(&state);
+        v = next(&cs) + c->sigma * gauss(&state);
+    } else {
+        u = next(&state);
+        v = next(&state);
+    }
+    xi = x0 + u * w;
+    eta = y0 + v * h;
+
+    if (src->common) {
+        uint64_t os = stream(c->seed, 4, i, field);
+        double d = c->offset / 3600 * next(&os), a = 2 * M_PI * next(&os);
+        xi += d * cos(a);
+        eta += d * sin(a);
+        src->id = i + 1;
+    } else {
+        src->id = (long) (field + 1) * c->nsources + i + 1;
+    }
+
+    src->set = set;
+    src->x = (xi - x0) / (c->scale / 3600) + 1;
+    src->y = (eta - y0) / (c->scale / 3600) + 1;
+
+    /* inverse gnomonic projection */
+    double d0 = c->dec * D2R;
+    xi *= D2R;
+    eta *= D2R;
+    double den = cos(d0) - eta * sin(d0);
+    double ra = c->ra * D2R + atan2(xi, den);
+    double dec = atan2(sin(d0) + eta * cos(d0), sqrt(xi * xi + den * den));
+    ra = fmod(ra, 2 * M_PI);
+    src->lon = ra < 0 ? ra + 2 * M_PI : ra;
+    src->col = M_PI / 2 - dec;
+}
+
+
+bool
+GenCat_write(const GenCatConfig *c, int field, const char *path) {
+    struct output out;
+    char header[8 * FITS_CARD];
+    int n = 0, set;
+
+    out.fp = fopen(path, "w");
+    if (!out.fp)
+        return false;
+    out.buf = malloc(OUTPUT_BUFFER);
+    out.n = 0;
+    out.ok = true;
+
+    if (c->format == GENCAT_ASCII) {
+        write_ascii(c, field, &out);
+    } else {
+        card(header, &n, "SIMPLE", "%20s", "T");
+        card(header, &n, "BITPIX", "%20i", 8);
+        card(header, &n, "NAXIS", "%20i", 0);
+        card(header, &n, "EXTEND", "%20s", "T");
+        card(header, &n, "END", NULL);
+        put_header(&out, header, n);
+        for (set=0; set<c->nsets; set++)
+            write_ldac_set(c, field, set, &out);
+    }
+
+    if (out.n > 0 && fwrite(out.buf, 1, out.n, out.fp) != out.n)
+        out.ok = false;
+    out.ok &= fclose(out.fp) == 0;
+    free(out.buf);
+
+    return out.ok;
+}
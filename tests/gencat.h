@@ -0,0 +1,74 @@
+/*
+ * gencat.h
+ *
+ * Synthetic catalogs for benchmarks: fields of sets (CCDs) tiling a
+ * square of the sky, with uniform or clustered sources, a fraction of
+ * them seen in every field with a bounded offset.
+ *
+ * Sources are generated from their index with a counter based random
+ * generator, so that any number of sources can be written without being
+ * kept in memory, and every run gives the same catalogs.
+ */
+
+#ifndef __GENCAT_H__
+#define __GENCAT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define GENCAT_LDAC  0
+#define GENCAT_ASCII 1
+
+typedef struct GenCatConfig {
+    long     nsources;  /* per field */
+    int      nfields;
+    int      nsets;     /* per field, on a grid of tiles */
+    double   ra, dec;   /* tangent point of the fields, degrees */
+    double   width;     /* side of the fields, degrees */
+    double   scale;     /* pixel scale, arcsec */
+    int      nclusters; /* per set, 0 for a uniform density */
+    double   sigma;     /* size of the clusters, fraction of a set side */
+    double   matches;   /* fraction of the sources seen in every field */
+    double   offset;    /* max offset of these sources, arcsec */
+    int      format;    /* GENCAT_LDAC or GENCAT_ASCII */
+    uint64_t seed;
+} GenCatConfig;
+
+/*
+ * A generated source. Sources seen in every field have the same id in
+ * every field, the other ones have ids unique to their field.
+ */
+typedef struct GenCatSource {
+    long    id;
+    int     set;
+    bool    common;
+    double  x, y;       /* pixel coordinates in the set */
+    double  lon, col;   /* radians */
+} GenCatSource;
+
+extern const GenCatConfig GenCat_defaultConfig;
+
+/*
+ * Set the center of "config" from "name": "pole" (north pole), "face" (a
+ * corner of healpix base pixels), "wrap" (ra = 0 on the equator), or
+ * "ra,dec" in degrees. Return false if "name" is not valid.
+ */
+extern bool
+GenCat_setCenter(GenCatConfig *config, const char *name);
+
+/*
+ * Generate source "i" of "field".
+ */
+extern void
+GenCat_source(const GenCatConfig *config, int field, long i,
+        GenCatSource *src);
+
+/*
+ * Write the catalog of "field" in "path": a sextractor LDAC catalog with
+ * a TAN WCS per set, or an ASCII catalog of "id lon col" lines in radians
+ * (AsciiCat default format). Return false on failure.
+ */
+extern bool
+GenCat_write(const GenCatConfig *config, int field, const char *path);
+
+#endif /* __GENCAT_H__ */
@@ -0,0 +1,282 @@
+/*
+ * perf_chealpix.c
+ *
+ * Microbenchmark of the chealpix functions on the cross match hot path,
+ * in ns per call, for scalar and batch variants, with and without BMI2.
+ * Inputs are drawn from several distributions:
+ *
+ *   uniform  uniform on the sphere
+ *   field    a 1 x 1 degree field, as loaded from a catalog
+ *   polar    polar caps only (|z| > 2/3)
+ *   edges    near the boundaries of the base pixels
+ *
+ * Results are printed in JSON on stdout:
+ *
+ *   perfChealpix [-n 16] [-N 1048576] [-R 5] [-l label]
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../src/chealpix.h"
+#include "../src/mem.h"
+
+#include "fixture.h"
+
+#define NDISTRIBUTIONS 4
+
+static const char *distributions[NDISTRIBUTIONS] =
+    {"uniform", "field", "polar", "edges"};
+
+static double
+now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* "n" positions of distribution "d" */
+static void
+positions(int d, long n, double *theta, double *phi) {
+    long i;
+    double z;
+
+    for (i=0; i<n; i++) {
+        switch (d) {
+        case 0:
+            z = 1 - 2 * Fixture_rnd();
+            phi[i] = 2 * M_PI * Fixture_rnd();
+            break;
+        case 1:
+            /* sorted on declination, as sextractor catalogs on y */
+            z = sin((30 + (double) i / n) * M_PI / 180);
+            phi[i] = (60 + Fixture_rnd()) * M_PI / 180;
+            break;
+        case 2:
+            z = (2.0 / 3 + Fixture_rnd() / 3) * (Fixture_rnd() < 0.5 ? -1 : 1);
+            phi[i] = 2 * M_PI * Fixture_rnd();
+            break;
+        default:
+            /* within 0.1 degree of the z = +-2/3 rings or of the
+             * meridians bounding the polar base pixels */
+            if (Fixture_rnd() < 0.5) {
+                z = (Fixture_rnd() < 0.5 ? -2.0 : 2.0) / 3 +
+                    (Fixture_rnd() - 0.5) * 0.2 * M_PI / 180;
+                phi[i] = 2 * M_PI * Fixture_rnd();
+            } else {
+                z = (2.0 / 3 + Fixture_rnd() / 3) * (Fixture_rnd() < 0.5 ? -1 : 1);
+                phi[i] = (int) (4 * Fixture_rnd()) * M_PI / 2 +
+                    (Fixture_rnd() - 0.5) * 0.2 * M_PI / 180;
+                if (phi[i] < 0)
+                    phi[i] += 2 * M_PI;
+            }
+            break;
+        }
+        theta[i] = acos(z);
+    }
+}
+
+struct bench {
+    int64_t nsides;
+    long    n;
+    double  *theta, *phi, *vec, *vec2;
+    int64_t *pix;
+    long    *nb;
+    double  sink;
+};
+
+static void
+run_ang2pix(struct bench *b) {
+    long i;
+    for (i=0; i<b->n; i++)
+        ang2pix_nest64(b->nsides, b->theta[i], b->phi[i], &b->pix[i]);
+}
+
+static void
+run_ang2pix_batch(struct bench *b) {
+    ang2pix_nest64_batch(b->nsides, b->n, b->theta, b->phi, b->pix);
+}
+
+static void
+run_vec2pix(struct bench *b) {
+    long i;
+    for (i=0; i<b->n; i++)
+        vec2pix_nest64(b->nsides, &b->vec[3*i], &b->pix[i]);
+}
+
+static void
+run_ang2vec(struct bench *b) {
+    long i;
+    for (i=0; i<b->n; i++)
+        ang2vec(b->theta[i], b->phi[i], &b->vec[3*i]);
+}
+
+/* what PixelStore_add() computes for a sample */
+static void
+run_ang2pix_ang2vec(struct bench *b) {
+    long i;
+    for (i=0; i<b->n; i++) {
+        ang2pix_nest64(b->nsides, b->theta[i], b->phi[i], &b->pix[i]);
+        ang2vec(b->theta[i], b->phi[i], &b->vec[3*i]);
+    }
+}
+
+/* what PixelStore_addBatch() computes */
+static void
+run_ang2pix_vec_batch(struct bench *b) {
+    ang2pix_vec_nest64_batch(b->nsides, b->n, b->theta, b->phi, b->pix,
+            b->vec);
+}
+
+static void
+run_neighbours(struct bench *b) {
+    long i;
+    for (i=0; i<b->n; i++)
+        neighbours_nest64(b->nsides, b->pix[i], &b->nb[8 * (i % 1024)]);
+    b->sink += b->nb[0];
+}
+
+static void
+run_euclidean(struct bench *b) {
+    double s = 0;
+    long i;
+    for (i=0; i<b->n; i++)
+        s += euclidean_distance(&b->vec[3*i], &b->vec2[3*i]);
+    b->sink += s;
+}
+
+static void
+run_angdist(struct bench *b) {
+    double s = 0;
+    long i;
+    for (i=0; i<b->n; i++)
+        s += angdist(&b->vec[3*i], &b->vec2[3*i]);
+    b->sink += s;
+}
+
+struct primitive {
+    const char  *name;
+    void        (*run)(struct bench*);
+    int         bmi2;   /* depends on BMI2 */
+};
+
+static const struct primitive primitives[] = {
+    {"ang2pix_nest64", run_ang2pix, 1},
+    {"ang2pix_nest64_batch", run_ang2pix_batch, 1},
+    {"vec2pix_nest64", run_vec2pix, 1},
+    {"ang2vec", run_ang2vec, 0},
+    {"ang2pix_nest64+ang2vec", run_ang2pix_ang2vec, 1},
+    {"ang2pix_vec_nest64_batch", run_ang2pix_vec_batch, 1},
+    {"neighbours_nest64", run_neighbours, 1},
+    {"euclidean_distance", run_euclidean, 0},
+    {"angdist", run_angdist, 0}};
+
+/* best of "repeats" runs after a warm up, in ns per call */
+static double
+measure(const struct primitive *p, struct bench *b, int repeats) {
+    double best = INFINITY, start, t;
+    int r;
+
+    p->run(b);
+    for (r=0; r<repeats; r++) {
+        start = now();
+        p->run(b);
+        t = now() - start;
+        if (t < best)
+            best = t;
+    }
+
+    return best / b->n * 1e9;
+}
+
+int
+main(int argc, char **argv) {
+    int power = 16, repeats = 5, c, d, bmi2, first = 1;
+    long n = 1 << 20, i;
+    char *label = "";
+    struct bench b;
+    unsigned p;
+
+    Fixture_seed(43);
+
+    while ((c=getopt(argc,argv,"n:N:R:l:")) != -1) {
+        switch(c) {
+        case 'n':
+            power = atoi(optarg);
+            break;
+        case 'N':
+            n = atol(optarg);
+            break;
+        case 'R':
+            repeats = atoi(optarg);
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        default:
+            fprintf(stderr, "bad option, see perf_chealpix.c\n");
+            return 1;
+        }
+    }
+
+    b.nsides = (int64_t) 1 << power;
+    b.n = n;
+    b.theta = ALLOC(sizeof(double) * n);
+    b.phi = ALLOC(sizeof(double) * n);
+    b.vec = ALLOC(sizeof(double) * 3 * n);
+    b.vec2 = ALLOC(sizeof(double) * 3 * n);
+    b.pix = ALLOC(sizeof(int64_t) * n);
+    b.nb = ALLOC(sizeof(long) * 8 * 1024);
+    b.sink = 0;
+
+    int has_bmi2 = healpix_bmi2(1);
+
+    printf("{\n  \"benchmark\": \"chealpix\",\n  \"label\": \"%s\",\n"
+            "  \"nside_power\": %i,\n  \"n\": %li,\n  \"repeats\": %i,\n"
+            "  \"bmi2\": %s,\n  \"results\": [",
+            label, power, n, repeats, has_bmi2 ? "true" : "false");
+
+    for (d=0; d<NDISTRIBUTIONS; d++) {
+        positions(d, n, b.theta, b.phi);
+        ang2pix_vec_nest64_batch(b.nsides, n, b.theta, b.phi, b.pix, b.vec);
+
+        /* second vectors about 1 arcsec away, for the distances */
+        for (i=0; i<n; i++) {
+            double t = b.theta[i] + (Fixture_rnd() - 0.5) * 1e-5;
+            ang2vec(t < 0 ? -t : t, b.phi[i] + (Fixture_rnd() - 0.5) * 1e-5,
+                    &b.vec2[3*i]);
+        }
+
+        for (p=0; p<sizeof(primitives) / sizeof(primitives[0]); p++) {
+            for (bmi2=has_bmi2; bmi2>=0; bmi2--) {
+                if (!primitives[p].bmi2 && bmi2 != has_bmi2)
+                    continue;
+                healpix_bmi2(bmi2);
+                double ns = measure(&primitives[p], &b, repeats);
+                printf("%s\n    {\"primitive\": \"%s\", "
+                        "\"distribution\": \"%s\", \"bmi2\": %s, "
+                        "\"ns_per_op\": %.3f}",
+                        first ? "" : ",", primitives[p].name,
+                        distributions[d],
+                        primitives[p].bmi2 && bmi2 ? "true" : "false", ns);
+                first = 0;
+            }
+            healpix_bmi2(has_bmi2);
+        }
+    }
+    printf("\n  ],\n  \"sink\": %g\n}\n", b.sink);
+
+    FREE(b.theta);
+    FREE(b.phi);
+    FREE(b.vec);
+    FREE(b.vec2);
+    FREE(b.pix);
+    FREE(b.nb);
+
+    return 0;
+}
@@ -0,0 +1,292 @@
+/*
+ * perf_crossmatch.c
+ *
+ * Cross match benchmark. Catalogs are loaded once per nside, then the
+ * index (PixelStore_linkNeighbors) and match (Crossmatch_crossSamples)
+ * phases are timed for every radius, engine and number of threads, after
+ * warm up runs. Results are printed in JSON on stdout:
+ *
+ *   perfCrossmatch [-t 1,2,4] [-n 16] [-r 2] [-e locked,atomic] [-R 3]
+ *       [-W 1] [-l label] [-A] [-P] [-g nsources [-f nfields]] [catalogs...]
+ *
+ * -A loads ASCII catalogs, -g generates ASCII catalogs with gencat in
+ * place of the catalogs given. Times are wall clock times in seconds.
+ * -P adds the hardware counters of every phase and thread to the runs:
+ * the load, and the index and match phases summed over the repeats.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../src/catalog.h"
+#include "../src/asciicat.h"
+#include "../src/crossmatch.h"
+#include "../src/logger.h"
+#include "../src/mem.h"
+#include "../src/perfcount.h"
+#include "../src/pixelstore.h"
+#include "gencat.h"
+
+#define MAX_VALUES 32
+
+struct timing {
+    double min;
+    double median;
+};
+
+static int
+parse_list(char *arg, double *values) {
+    int n = 0;
+    char *tok = strtok(arg, ",");
+    while (tok && n < MAX_VALUES) {
+        values[n++] = atof(tok);
+        tok = strtok(NULL, ",");
+    }
+    return n;
+}
+
+static double
+now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int
+cmp_double(const void *a, const void *b) {
+    double x = *(const double*) a, y = *(const double*) b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static struct timing
+summarize(double *times, int n) {
+    struct timing t;
+    qsort(times, n, sizeof(double), cmp_double);
+    t.min = times[0];
+    t.median = n % 2 ? times[n / 2] : (times[n / 2 - 1] + times[n / 2]) / 2;
+    return t;
+}
+
+/*
+ * Number of sample pairs tested: pairs in every pixel, and between every
+ * pair of neighbor pixels. The store must be linked.
+ */
+static double
+count_pairs(PixelStore *store) {
+    double pairs = 0;
+    long i;
+    int k;
+
+    for (i=0; i<store->npixels; i++) {
+        HealPixel *pix = store->pixelarray[i];
+        pairs += (double) pix->nsamples * (pix->nsamples - 1) / 2;
+        for (k=0; k<8; k++)
+            if (pix->pneighbors[k] && pix->pneighbors[k]->id > pix->id)
+                pairs += (double) pix->nsamples * pix->pneighbors[k]->nsamples;
+    }
+
+    return pairs;
+}
+
+int
+main(int argc, char **argv) {
+    double threads[MAX_VALUES] = {1, 2, 4}, powers[MAX_VALUES] = {16};
+    double radii[MAX_VALUES] = {2};
+    int nthreads = 3, npowers = 1, nradii = 1, nengines = 1;
+    int engines[2] = {CROSSMATCH_LOCKED, CROSSMATCH_ATOMIC};
+    int repeats = 3, warmups = 1, ascii = 0, c;
+    long generate = 0;
+    char *label = "";
+    GenCatConfig config = GenCat_defaultConfig;
+
+    while ((c=getopt(argc,argv,"t:n:r:e:R:W:l:APg:f:")) != -1) {
+        switch(c) {
+        case 't':
+            nthreads = parse_list(optarg, threads);
+            break;
+        case 'n':
+            npowers = parse_list(optarg, powers);
+            break;
+        case 'r':
+            nradii = parse_list(optarg, radii);
+            break;
+        case 'e':
+            nengines = 0;
+            if (strstr(optarg, "locked"))
+                engines[nengines++] = CROSSMATCH_LOCKED;
+            if (strstr(optarg, "atomic"))
+                engines[nengines++] = CROSSMATCH_ATOMIC;
+            break;
+        case 'R':
+            repeats = atoi(optarg);
+            break;
+        case 'W':
+            warmups = atoi(optarg);
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        case 'A':
+            ascii = 1;
+            break;
+        case 'P':
+            PerfCount_setEnabled(true);
+            break;
+        case 'g':
+            generate = atol(optarg);
+            break;
+        case 'f':
+            config.nfields = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "bad option, see perf_crossmatch.c\n");
+            return 1;
+        }
+    }
+    if (repeats < 1 || nengines < 1)
+        return 1;
+
+    /* benchmark output only on stdout */
+    Logger_setLevel(LOGGER_ERROR);
+
+    int n = argc - optind, i, j, p, r, e, t;
+    char **files = &argv[optind];
+    if (generate > 0) {
+        config.nsources = generate;
+        config.format = GENCAT_ASCII;
+        n = config.nfields;
+        files = ALLOC(sizeof(char*) * n);
+        for (i=0; i<n; i++) {
+            files[i] = ALLOC(64);
+            snprintf(files[i], 64, "/tmp/perf-crossmatch-%i_%i.txt",
+                    (int) getpid(), i);
+            if (!GenCat_write(&config, i, files[i]))
+                return 1;
+        }
+        ascii = 1;
+    }
+
+    int maxthreads = 1;
+    for (i=0; i<nthreads; i++)
+        if (threads[i] > maxthreads)
+            maxthreads = threads[i];
+
+    Catalog_loadFunc load = Catalog_openWith;
+    if (ascii) {
+        AsciiFormat format = AsciiCat_defaultFormat;
+        format.nthreads = maxthreads;
+        AsciiCat_setFormat(&format);
+        load = AsciiCat_openWith;
+    }
+
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+    printf("{\n  \"benchmark\": \"crossmatch\",\n  \"label\": \"%s\",\n"
+            "  \"host\": \"%s\",\n  \"cpus\": %li,\n  \"time\": %li,\n"
+            "  \"repeats\": %i,\n  \"warmups\": %i,\n  \"files\": [",
+            label, host, sysconf(_SC_NPROCESSORS_ONLN), (long) time(NULL),
+            repeats, warmups);
+    for (i=0; i<n; i++)
+        printf("%s\"%s\"", i ? ", " : "", files[i]);
+    printf("],\n  \"runs\": [");
+
+    double *index_times = ALLOC(sizeof(double) * repeats);
+    double *match_times = ALLOC(sizeof(double) * repeats);
+    int first = 1;
+
+    for (p=0; p<npowers; p++) {
+        int64_t nsides = pow(2, (int) powers[p]);
+        Field *fields = ALLOC(sizeof(Field) * n);
+        PixelStore *store = PixelStore_new(nsides);
+        long nsamples = 0;
+
+        PerfCounters counters;
+        PerfCount_reset(NULL);
+        PerfCount_start(&counters);
+        double start = now();
+        for (i=0; i<n; i++)
+            load(files[i], &fields[i], (Catalog_addFunc) PixelStore_add, store);
+        double load_time = now() - start;
+        PerfCount_stop(&counters, "load", 0);
+
+        for (i=0; i<n; i++)
+            for (j=0; j<fields[i].nsets; j++)
+                nsamples += fields[i].sets[j].nsamples;
+
+        PixelStore_linkNeighbors(store, maxthreads);
+        double pairs = count_pairs(store);
+
+        for (r=0; r<nradii; r++) {
+            for (e=0; e<nengines; e++) {
+                Crossmatch_setEngine(engines[e]);
+                for (t=0; t<nthreads; t++) {
+                    long nmatches = 0;
+                    for (j=-warmups; j<repeats; j++) {
+                        if (j == 0) {
+                            PerfCount_reset("index");
+                            PerfCount_reset("match");
+                        }
+                        start = now();
+                        PixelStore_linkNeighbors(store, threads[t]);
+                        double middle = now();
+                        nmatches = Crossmatch_crossSamples(store, radii[r],
+                                threads[t]);
+                        double end = now();
+                        if (j >= 0) {
+                            index_times[j] = middle - start;
+                            match_times[j] = end - middle;
+                        }
+                    }
+
+                    struct timing index = summarize(index_times, repeats);
+                    struct timing match = summarize(match_times, repeats);
+                    printf("%s\n    {\"nside_power\": %i, "
+                            "\"radius_arcsec\": %g, \"engine\": \"%s\", "
+                            "\"threads\": %i, \"nsamples\": %li, "
+                            "\"npixels\": %li, \"pairs\": %.0f, "
+                            "\"matches\": %li, \"load_s\": %.6f, "
+                            "\"index_s\": {\"min\": %.6f, \"median\": %.6f}, "
+                            "\"match_s\": {\"min\": %.6f, \"median\": %.6f}, "
+                            "\"samples_per_s\": %.0f, \"pairs_per_s\": %.0f",
+                            first ? "" : ",", (int) powers[p], radii[r],
+                            engines[e] == CROSSMATCH_ATOMIC ?
+                                "atomic" : "locked",
+                            (int) threads[t], nsamples, store->npixels,
+                            pairs, nmatches, load_time,
+                            index.min, index.median, match.min, match.median,
+                            nsamples / match.median, pairs / match.median);
+                    if (PerfCount_enabled()) {
+                        printf(", \"counters\": ");
+                        PerfCount_printJson(stdout);
+                    }
+                    printf("}");
+                    fflush(stdout);
+                    first = 0;
+                }
+            }
+        }
+
+        for (i=0; i<n; i++)
+            Catalog_freeField(&fields[i]);
+        FREE(fields);
+        PixelStore_free(store);
+    }
+    printf("\n  ]\n}\n");
+
+    if (generate > 0) {
+        for (i=0; i<n; i++) {
+            remove(files[i]);
+            FREE(files[i]);
+        }
+        FREE(files);
+    }
+    FREE(index_times);
+    FREE(match_times);
+
+    return 0;
+}
@@ -0,0 +1,201 @@
+/*
+ * perf_query.c
+ *
+ * Latency of single position queries, Crossmatch_nearest(), on a linked
+ * store of random samples in a 1 x 1 degree field. Every thread times each
+ * of its queries, half close to a sample and half anywhere in the field.
+ * Percentiles are computed over the queries of all threads. The same
+ * queries are then run as a batched cone search, Crossmatch_coneSearch(),
+ * for its throughput.
+ *
+ * Results are printed in JSON on stdout:
+ *
+ *   perfQuery [-n 16] [-N 1000000] [-Q 1000000] [-t 1] [-r 2] [-l label]
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "../src/scamp.h"
+#include "../src/pixelstore.h"
+#include "../src/crossmatch.h"
+#include "../src/mem.h"
+
+#include "fixture.h"
+
+static int64_t
+now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+struct query_args {
+    PixelStore  *store;
+    double      *ra;
+    double      *dec;
+    long        first;
+    long        last;
+    double      radius;
+    int64_t     *latency;   /* ns, per query */
+    long        nfound;
+    double      elapsed;    /* seconds */
+};
+
+static void*
+query_thread(void *args) {
+    struct query_args *qa = args;
+    int64_t start, t;
+    long i;
+
+    qa->nfound = 0;
+    start = now_ns();
+    for (i=qa->first; i<qa->last; i++) {
+        t = now_ns();
+        Sample *spl = Crossmatch_nearest(qa->store, qa->ra[i], qa->dec[i],
+                qa->radius, NULL);
+        qa->latency[i] = now_ns() - t;
+        qa->nfound += spl != NULL;
+    }
+    qa->elapsed = (now_ns() - start) / 1e9;
+
+    return NULL;
+}
+
+static int
+cmp_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t*) a, y = *(const int64_t*) b;
+    return (x > y) - (x < y);
+}
+
+int
+main(int argc, char **argv) {
+    int power = 16, nthreads = 1, c, t;
+    long nsamples = 1000000, nqueries = 1000000, i, nfound = 0;
+    double radius = 2.0, elapsed = 0;
+    char *label = "";
+
+    Fixture_seed(53);
+
+    while ((c=getopt(argc,argv,"n:N:Q:t:r:l:")) != -1) {
+        switch(c) {
+        case 'n':
+            power = atoi(optarg);
+            break;
+        case 'N':
+            nsamples = atol(optarg);
+            break;
+        case 'Q':
+            nqueries = atol(optarg);
+            break;
+        case 't':
+            nthreads = atoi(optarg);
+            break;
+        case 'r':
+            radius = atof(optarg);
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        default:
+            fprintf(stderr, "bad option, see perf_query.c\n");
+            return 1;
+        }
+    }
+    if (nthreads < 1 || nsamples < 1 || nqueries < 1)
+        return 1;
+
+    PixelStore *store = PixelStore_new((int64_t) 1 << power);
+    Sample *spls = ALLOC(sizeof(Sample) * nsamples);
+    Sample **ptrs = ALLOC(sizeof(Sample*) * nsamples);
+    Sample ***exts = ALLOC(sizeof(Sample**) * nsamples);
+    for (i=0; i<nsamples; i++) {
+        memset(&spls[i], 0, sizeof(Sample));
+        spls[i].id = i;
+        spls[i].ra = 150 + Fixture_rnd();
+        spls[i].dec = 2 + Fixture_rnd();
+        spls[i].lon = spls[i].ra * TO_RAD;
+        spls[i].col = SC_HALFPI - spls[i].dec * TO_RAD;
+        exts[i] = &ptrs[i];
+    }
+    PixelStore_addBatch(store, spls, nsamples, exts);
+    PixelStore_linkNeighbors(store, nthreads);
+
+    double *ra = ALLOC(sizeof(double) * nqueries);
+    double *dec = ALLOC(sizeof(double) * nqueries);
+    for (i=0; i<nqueries; i++) {
+        if (i % 2) {
+            long s = Fixture_rnd() * nsamples;
+            ra[i] = spls[s].ra + (Fixture_rnd() - 0.5) * radius / 3600;
+            dec[i] = spls[s].dec + (Fixture_rnd() - 0.5) * radius / 3600;
+        } else {
+            ra[i] = 150 + Fixture_rnd();
+            dec[i] = 2 + Fixture_rnd();
+        }
+    }
+
+    int64_t *latency = ALLOC(sizeof(int64_t) * nqueries);
+    pthread_t *threads = ALLOC(sizeof(pthread_t) * nthreads);
+    struct query_args *args = ALLOC(sizeof(struct query_args) * nthreads);
+    for (t=0; t<nthreads; t++) {
+        args[t].store = store;
+        args[t].ra = ra;
+        args[t].dec = dec;
+        args[t].first = nqueries * t / nthreads;
+        args[t].last = nqueries * (t + 1) / nthreads;
+        args[t].radius = radius;
+        args[t].latency = latency;
+        pthread_create(&threads[t], NULL, query_thread, &args[t]);
+    }
+    for (t=0; t<nthreads; t++) {
+        pthread_join(threads[t], NULL);
+        nfound += args[t].nfound;
+        if (args[t].elapsed > elapsed)
+            elapsed = args[t].elapsed;
+    }
+
+    qsort(latency, nqueries, sizeof(int64_t), cmp_int64);
+
+    /* a first search allocates the arrays, the timed one reuses them */
+    CrossmatchCones cones;
+    memset(&cones, 0, sizeof(CrossmatchCones));
+    Crossmatch_coneSearch(store, ra, dec, nqueries, radius, nthreads, &cones);
+    int64_t start = now_ns();
+    long nresults = Crossmatch_coneSearch(store, ra, dec, nqueries, radius,
+            nthreads, &cones);
+    double batch_elapsed = (now_ns() - start) / 1e9;
+    Crossmatch_freeCones(&cones);
+
+    printf("{\n  \"benchmark\": \"query\",\n  \"label\": \"%s\",\n"
+            "  \"nside_power\": %i,\n  \"nsamples\": %li,\n"
+            "  \"nqueries\": %li,\n  \"nthreads\": %i,\n"
+            "  \"radius_arcsec\": %g,\n  \"nfound\": %li,\n"
+            "  \"queries_per_second\": %.0f,\n"
+            "  \"p50_ns\": %li,\n  \"p99_ns\": %li,\n  \"p999_ns\": %li,\n"
+            "  \"max_ns\": %li,\n  \"batch_results\": %li,\n"
+            "  \"batch_queries_per_second\": %.0f\n}\n",
+            label, power, nsamples, nqueries, nthreads, radius, nfound,
+            nqueries / elapsed, (long) latency[nqueries / 2],
+            (long) latency[nqueries * 99 / 100],
+            (long) latency[nqueries * 999 / 1000],
+            (long) latency[nqueries - 1], nresults,
+            nqueries / batch_elapsed);
+
+    PixelStore_free(store);
+    FREE(spls);
+    FREE(ptrs);
+    FREE(exts);
+    FREE(ra);
+    FREE(dec);
+    FREE(latency);
+    FREE(threads);
+    FREE(args);
+
+    return 0;
+}
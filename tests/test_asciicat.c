@@ -0,0 +1,145 @@
+/*
+ * test_asciicat.c
+ *
+ * Load a generated ASCII catalog with 1 and 4 parser threads: samples
+ * must be in file order and their positions must be the ones given by
+ * strtod(). Then load a comma separated catalog in degrees, with a
+ * header, comments, empty fields, positions out of the sphere and lines
+ * that can not be parsed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/scamp.h"
+#include "../src/mem.h"
+#include "../src/catalog.h"
+#include "../src/asciicat.h"
+#include "../src/moc.h"
+#include "../src/pixelstore.h"
+
+#include "fixture.h"
+
+#define NSAMPLES 200000
+
+/* write lon and col with various precisions and notations */
+static void
+write_catalog(char *path, double *lon, double *col) {
+    char *formats[] = {"%li %.6f %.6f\n", "%li\t%.17g\t%.17g\r\n",
+        "  %li  %.3e %.12e\n", "%li %.20f %.2f\n"};
+    FILE *fp = fopen(path, "w");
+    char line[256];
+    int i;
+
+    for (i=0; i<NSAMPLES; i++) {
+        snprintf(line, sizeof(line), formats[i % 4], (long) i,
+                SC_TWOPI * Fixture_rnd(), SC_PI * Fixture_rnd());
+        fputs(line, fp);
+
+        /* reference values */
+        char *s = line;
+        strtol(s, &s, 10);
+        lon[i] = strtod(s, &s);
+        col[i] = strtod(s, &s);
+    }
+    fclose(fp);
+}
+
+static int
+check_field(Field *field, double *lon, double *col) {
+    int i;
+
+    if (field->nsets != 1 || field->sets[0].nsamples != NSAMPLES)
+        return 1;
+    for (i=0; i<NSAMPLES; i++) {
+        Sample *spl = field->sets[0].samples[i];
+        if (spl->id != i || spl->lon != lon[i] || spl->col != col[i]) {
+            fprintf(stderr, "sample %i: %.17g %.17g, expected %.17g %.17g\n",
+                    i, spl->lon, spl->col, lon[i], col[i]);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    static double lon[NSAMPLES], col[NSAMPLES];
+    char path[] = "/tmp/scamp-test-asciicat.txt";
+    AsciiFormat format = AsciiCat_defaultFormat;
+    int nthreads[] = {1, 4};
+    Field field;
+    int t;
+
+    Fixture_seed(21);
+
+    write_catalog(path, lon, col);
+
+    for (t=0; t<2; t++) {
+        PixelStore *store = PixelStore_new(pow(2, 10));
+        format.nthreads = nthreads[t];
+        AsciiCat_openFormat(path, &format, &field,
+                (Catalog_addFunc) PixelStore_add, store);
+        if (check_field(&field, lon, col)) {
+            fprintf(stderr, "bad samples with %i threads\n", nthreads[t]);
+            return 1;
+        }
+        Catalog_freeField(&field);
+        PixelStore_free(store);
+    }
+
+    /* comma separated, ra and dec in degrees */
+    FILE *fp = fopen(path, "w");
+    fprintf(fp, "dec,flux,ra,id\n");
+    fprintf(fp, "# a comment\n");
+    fprintf(fp, "45.0, 1.2, 180.0, 7\n");
+    fprintf(fp, "\n");
+    fprintf(fp, "-30.5,3,10.25,8\n");
+    fprintf(fp, "1.0,2.0\n");
+    fprintf(fp, "x,2.0,3.0,9\n");
+    fprintf(fp, ",2.0,3.0,11\n");
+    fprintf(fp, "4.0,2.0,,12\n");
+    fprintf(fp, "4.0,2.0, ,13\n");
+    fprintf(fp, "90.5,2.0,3.0,14\n");
+    fprintf(fp, "-95,2.0,3.0,15\n");
+    fprintf(fp, "nan,2.0,3.0,16\n");
+    fprintf(fp, "4.0,2.0,inf,17\n");
+    fprintf(fp, "4.0,2.0,-nan,18\n");
+    fprintf(fp, "0,0,0,10");
+    fclose(fp);
+
+    format = AsciiCat_defaultFormat;
+    format.separator = ',';
+    format.skiplines = 1;
+    format.units = ASCIICAT_DEGREES;
+    format.latcol = 0;
+    format.loncol = 2;
+    format.idcol = 3;
+
+    PixelStore *store = PixelStore_new(pow(2, 10));
+    AsciiCat_openFormat(path, &format, &field,
+            (Catalog_addFunc) PixelStore_add, store);
+
+    Sample **spls = field.sets[0].samples;
+    if (field.sets[0].nsamples != 3 ||
+            spls[0]->id != 7 || spls[1]->id != 8 || spls[2]->id != 10 ||
+            fabs(spls[0]->ra - 180.0) > 1e-12 ||
+            fabs(spls[0]->dec - 45.0) > 1e-12 ||
+            fabs(spls[1]->col - (90 + 30.5) * TO_RAD) > 1e-15 ||
+            fabs(spls[1]->lon - 10.25 * TO_RAD) > 1e-15) {
+        fprintf(stderr, "bad comma separated samples\n");
+        return 1;
+    }
+    /* three pixels at MOC_FIELD_ORDER */
+    int shift = 2 * (MOC_MAXORDER - MOC_FIELD_ORDER);
+    if (Moc_npixels(field.moc) != 3 * (((int64_t) 1) << shift))
+        return 1;
+
+    Catalog_freeField(&field);
+    PixelStore_free(store);
+    remove(path);
+
+    return 0;
+}
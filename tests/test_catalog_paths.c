@@ -0,0 +1,66 @@
+/*
+ * test_catalog_paths.c
+ *
+ * Load a plain LDAC catalog from its mapping and with CFITSIO: both
+ * readers must give exactly the same samples, so that a catalog matches
+ * the same way whether it is compressed or not.
+ *
+ * Take a single argument with the sextractor catalog to test against.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/scamp.h"
+#include "../src/catalog.h"
+#include "../src/pixelstore.h"
+
+extern bool test_Catalog_open_mapped(char*, Field*, Catalog_addFunc, void*);
+extern void test_Catalog_open_cfitsio(char*, Field*, Catalog_addFunc, void*);
+
+int main(int argc, char **argv) {
+    Field mapped, cfitsio;
+    long nsides = pow(2, 13), r;
+    int s;
+
+    if (argc < 2)
+        return 1;
+
+    PixelStore *mstore = PixelStore_new(nsides);
+    PixelStore *cstore = PixelStore_new(nsides);
+    if (!test_Catalog_open_mapped(argv[1], &mapped,
+                (Catalog_addFunc) PixelStore_add, mstore)) {
+        fprintf(stderr, "%s is not a plain LDAC catalog\n", argv[1]);
+        return 1;
+    }
+    test_Catalog_open_cfitsio(argv[1], &cfitsio,
+            (Catalog_addFunc) PixelStore_add, cstore);
+
+    if (mapped.nsets != cfitsio.nsets || mapped.nsets == 0)
+        return 1;
+    for (s=0; s<mapped.nsets; s++) {
+        Set *ms = &mapped.sets[s], *cs = &cfitsio.sets[s];
+        if (ms->nsamples != cs->nsamples)
+            return 1;
+        for (r=0; r<ms->nsamples; r++) {
+            Sample *m = ms->samples[r], *c = cs->samples[r];
+            if (m->id != c->id || m->lon != c->lon || m->col != c->col ||
+                    m->pix_nest != c->pix_nest ||
+                    memcmp(m->vector, c->vector, sizeof(m->vector)) != 0) {
+                fprintf(stderr, "set %i row %li: %.17g %.17g mapped, "
+                        "%.17g %.17g with CFITSIO\n", s, r, m->lon, m->col,
+                        c->lon, c->col);
+                return 1;
+            }
+        }
+    }
+
+    Catalog_freeField(&mapped);
+    Catalog_freeField(&cfitsio);
+    PixelStore_free(mstore);
+    PixelStore_free(cstore);
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+/*
+ * test_chealpix_batch.c
+ *
+ * ang2pix_nest64_batch() and ang2pix_vec_nest64_batch() must give exactly
+ * the same results as ang2pix_nest64() and ang2vec(), for random positions
+ * and positions on the poles, the equator, region and face boundaries.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../src/chealpix.h"
+
+#include "fixture.h"
+
+#define NRANDOM 100000
+#define NSPECIAL 64
+
+int main(int argc, char **argv) {
+    long i, n = 0;
+    int k;
+    int64_t nsides[] = {1, 2, 1024, 65536, 1 << 29};
+    static double theta[NRANDOM + NSPECIAL * NSPECIAL];
+    static double phi[NRANDOM + NSPECIAL * NSPECIAL];
+    static int64_t pix[NRANDOM + NSPECIAL * NSPECIAL];
+    static double vec[3 * (NRANDOM + NSPECIAL * NSPECIAL)];
+    double special_theta[NSPECIAL], special_phi[NSPECIAL];
+    int64_t p;
+    double v[3];
+
+    Fixture_seed(5);
+
+    /* boundaries, and values just around them */
+    double th[] = {0, M_PI, M_PI_2, acos(2.0 / 3), acos(-2.0 / 3),
+        acos(0.99), acos(-0.99)};
+    double ph[] = {0, M_PI_2, M_PI, 3 * M_PI_2, (2 * M_PI), -M_PI_2,
+        M_PI / 4, 7 * M_PI / 4};
+    int nspecial_theta = 0, nspecial_phi = 0;
+    for (k=0; k<sizeof(th)/sizeof(double); k++) {
+        special_theta[nspecial_theta++] = th[k];
+        if (th[k] > 0)
+            special_theta[nspecial_theta++] = nextafter(th[k], 0);
+        if (th[k] < M_PI)
+            special_theta[nspecial_theta++] = nextafter(th[k], M_PI);
+    }
+    for (k=0; k<sizeof(ph)/sizeof(double); k++) {
+        special_phi[nspecial_phi++] = ph[k];
+        special_phi[nspecial_phi++] = nextafter(ph[k], -10);
+        special_phi[nspecial_phi++] = nextafter(ph[k], 10);
+    }
+
+    for (i=0; i<nspecial_theta; i++) {
+        for (k=0; k<nspecial_phi; k++) {
+            theta[n] = special_theta[i];
+            phi[n] = special_phi[k];
+            n++;
+        }
+    }
+    for (i=0; i<NRANDOM; i++) {
+        theta[n] = acos(1 - 2 * Fixture_rnd());
+        phi[n] = (2 * M_PI) * Fixture_rnd();
+        n++;
+    }
+
+    for (k=0; k<sizeof(nsides)/sizeof(int64_t); k++) {
+        ang2pix_nest64_batch(nsides[k], n, theta, phi, pix);
+        for (i=0; i<n; i++) {
+            ang2pix_nest64(nsides[k], theta[i], phi[i], &p);
+            if (p != pix[i]) {
+                fprintf(stderr, "nside %li theta %.17g phi %.17g: "
+                        "%li scalar, %li batch\n", (long) nsides[k],
+                        theta[i], phi[i], (long) p, (long) pix[i]);
+                return 1;
+            }
+        }
+    }
+
+    for (k=0; k<sizeof(nsides)/sizeof(int64_t); k++) {
+        ang2pix_vec_nest64_batch(nsides[k], n, theta, phi, pix, vec);
+        for (i=0; i<n; i++) {
+            ang2pix_nest64(nsides[k], theta[i], phi[i], &p);
+            ang2vec(theta[i], phi[i], v);
+            if (p != pix[i] || memcmp(v, &vec[3 * i], sizeof(v)) != 0) {
+                fprintf(stderr, "nside %li theta %.17g phi %.17g: "
+                        "pixels or vectors differ\n", (long) nsides[k],
+                        theta[i], phi[i]);
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,83 @@
+/*
+ * test_chealpix_bmi2.c
+ *
+ * Pixel ids, positions and neighbors computed with the BMI2 and with the
+ * lookup table versions of the nested bit interleaving must be identical,
+ * up to nside 2^29. Nothing is compared if the CPU has no fast BMI2.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "../src/chealpix.h"
+
+#include "fixture.h"
+
+#define NPIXELS 20000
+
+int main(int argc, char **argv) {
+    int k, j, m;
+    long i;
+    int orders[] = {0, 1, 4, 16, 17, 24, 29};
+    static int64_t pix[NPIXELS], nb_table[NPIXELS][8];
+    static double theta[NPIXELS], phi[NPIXELS];
+    int64_t nb[8], p;
+    double t, f;
+
+    Fixture_seed(9);
+
+    if (!healpix_bmi2(1)) {
+        printf("No fast BMI2 on this CPU, nothing to compare\n");
+        return 0;
+    }
+
+    for (k=0; k<sizeof(orders)/sizeof(int); k++) {
+        int64_t nside = ((int64_t) 1) << orders[k];
+        int64_t npix = 12 * nside * nside;
+
+        for (i=0; i<NPIXELS; i++)
+            pix[i] = Fixture_bits() % npix;
+
+        /* reference: tables */
+        healpix_bmi2(0);
+        for (i=0; i<NPIXELS; i++) {
+            neighbours_nest64(nside, pix[i], nb_table[i]);
+            pix2ang_nest64(nside, pix[i], &theta[i], &phi[i]);
+        }
+
+        healpix_bmi2(1);
+        for (i=0; i<NPIXELS; i++) {
+            neighbours_nest64(nside, pix[i], nb);
+            for (j=0; j<8; j++) {
+                if (nb[j] != nb_table[i][j]) {
+                    fprintf(stderr, "order %i pixel %li: neighbor %i differ\n",
+                            orders[k], (long) pix[i], j);
+                    return 1;
+                }
+            }
+
+            pix2ang_nest64(nside, pix[i], &t, &f);
+            if (t != theta[i] || f != phi[i]) {
+                fprintf(stderr, "order %i pixel %li: position differ\n",
+                        orders[k], (long) pix[i]);
+                return 1;
+            }
+
+            ang2pix_nest64(nside, t, f, &p);
+            if (p != pix[i]) {
+                fprintf(stderr, "order %i pixel %li: got %li back\n",
+                        orders[k], (long) pix[i], (long) p);
+                return 1;
+            }
+
+            /* neighbors are pixels, or -1 if missing */
+            for (m=0; m<8; m++)
+                if (nb[m] < -1 || nb[m] >= npix)
+                    return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * test_chunkstore_crossmatch.c
+ *
+ * Cross match random samples spread over the whole sphere with a perturbed
+ * copy of themselves, in memory and out of core with a small memory budget
+ * forcing chunks to be split. Both runs should give the same matches.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "../src/scamp.h"
+#include "../src/mem.h"
+#include "../src/catalog.h"
+#include "../src/crossmatch.h"
+#include "../src/pixelstore.h"
+#include "../src/chunkstore.h"
+
+#include "fixture.h"
+
+#define NFIELDS 3
+#define NSAMPLES 20000
+
+static Sample positions[NSAMPLES];
+
+static void
+init_positions() {
+    int i;
+    for (i=0; i<NSAMPLES; i++) {
+        positions[i].id  = i;
+        positions[i].lon = SC_TWOPI * Fixture_rnd();
+        positions[i].col = acos(1 - 2 * Fixture_rnd());
+    }
+}
+
+/*
+ * Load field "n": positions moved by up to "n" arcsec.
+ */
+static void
+load_field(Field *field, int n, Catalog_addFunc add, void *sink) {
+    int i;
+    Sample spl;
+
+    Fixture_seed(1000 + n);
+    Fixture_field(field, 1, NSAMPLES);
+
+    for (i=0; i<NSAMPLES; i++) {
+        double d = n * Fixture_rnd() / 3600 * TO_RAD;
+        double a = SC_TWOPI * Fixture_rnd();
+        spl = positions[i];
+        spl.set = &field->sets[0];
+        spl.col += d * cos(a);
+        if (spl.col < 0 || spl.col > SC_PI)
+            spl.col = positions[i].col;
+        else
+            spl.lon += d * sin(a) / sin(positions[i].col);
+        spl.lon = fmod(spl.lon + SC_TWOPI, SC_TWOPI);
+        add(sink, spl, &field->sets[0].samples[i]);
+    }
+}
+
+struct results {
+    Field *fields;
+    int match_field[NFIELDS][NSAMPLES];
+    long match_id[NFIELDS][NSAMPLES];
+};
+
+static void
+on_match(void *udata, ChunkRecord *spl, ChunkRecord *match, double distance) {
+    struct results *res = udata;
+    int f = spl->set->field - res->fields;
+
+    res->match_field[f][spl->row] = match->set->field - res->fields;
+    res->match_id[f][spl->row] = match->id;
+}
+
+int main(int argc, char **argv) {
+    int i, j;
+    long nsides = pow(2, 10);
+    double radius_arcsec = 2.0;
+    Field mfields[NFIELDS], cfields[NFIELDS];
+    static struct results res;
+
+    Fixture_seed(42);
+
+    init_positions();
+
+    /* in memory */
+    PixelStore *store = PixelStore_new(nsides);
+    for (i=0; i<NFIELDS; i++)
+        load_field(&mfields[i], i, (Catalog_addFunc) PixelStore_add, store);
+    Crossmatch_crossSamples(store, radius_arcsec, 4);
+
+    /* out of core, 512KB */
+    ChunkStore *chunks = ChunkStore_new(nsides, "/tmp", 512 * 1024);
+    for (i=0; i<NFIELDS; i++)
+        load_field(&cfields[i], i, (Catalog_addFunc) ChunkStore_add, chunks);
+
+    res.fields = cfields;
+    for (i=0; i<NFIELDS; i++)
+        for (j=0; j<NSAMPLES; j++)
+            res.match_field[i][j] = -1;
+    long cmatches =
+        ChunkStore_crossSamples(chunks, radius_arcsec, 4, on_match, &res);
+    ChunkStore_free(chunks);
+
+    long nmatches = 0;
+    for (i=0; i<NFIELDS; i++)
+        for (j=0; j<NSAMPLES; j++)
+            if (mfields[i].sets[0].samples[j]->bestMatch)
+                nmatches++;
+
+    if (nmatches != cmatches) {
+        fprintf(stderr, "have %li chunked matches, %li in memory\n",
+                cmatches, nmatches);
+        return 1;
+    }
+
+    for (i=0; i<NFIELDS; i++) {
+        for (j=0; j<NSAMPLES; j++) {
+            Sample *spl = mfields[i].sets[0].samples[j];
+            int mf = spl->bestMatch ? spl->bestMatch->set->field - mfields : -1;
+            long mid = spl->bestMatch ? spl->bestMatch->id : -1;
+            if (mf != res.match_field[i][j] ||
+                    (mf >= 0 && mid != res.match_id[i][j])) {
+                fprintf(stderr, "field %i sample %i: %i/%li in memory, "
+                        "%i/%li chunked\n", i, j, mf, mid,
+                        res.match_field[i][j], res.match_id[i][j]);
+                return 1;
+            }
+        }
+    }
+
+    for (i=0; i<NFIELDS; i++) {
+        Catalog_freeField(&mfields[i]);
+        Catalog_freeField(&cfields[i]);
+    }
+    PixelStore_free(store);
+
+    return 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * test_crossmatch_atomic.c
+ *
+ * Cross match random samples with a perturbed copy of themselves given
+ * twice, so that every sample has two candidates at the same distance.
+ * The atomic engine should give the same matches with any number of
+ * threads, and as many matches as the locked engine.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "../src/scamp.h"
+#include "../src/mem.h"
+#include "../src/catalog.h"
+#include "../src/crossmatch.h"
+#include "../src/pixelstore.h"
+
+#include "fixture.h"
+
+#define NFIELDS 3
+#define NSAMPLES 20000
+
+/*
+ * Field 0 is the reference, fields 1 and 2 are the same copy moved by up
+ * to 1.5 arcsec.
+ */
+static void
+load_fields(Field *fields, PixelStore *store) {
+    int i, j;
+    Sample spl;
+    double lon[NSAMPLES], col[NSAMPLES];
+
+    for (j=0; j<NSAMPLES; j++) {
+        lon[j] = SC_TWOPI * Fixture_rnd();
+        col[j] = acos(1 - 2 * Fixture_rnd());
+    }
+
+    for (i=0; i<NFIELDS; i++)
+        Fixture_field(&fields[i], 1, NSAMPLES);
+
+    for (j=0; j<NSAMPLES; j++) {
+        double d = 1.5 * Fixture_rnd() / 3600 * TO_RAD;
+
+        spl.id = j;
+        spl.lon = lon[j];
+        spl.col = col[j];
+        spl.set = &fields[0].sets[0];
+        PixelStore_add(store, spl, &fields[0].sets[0].samples[j]);
+
+        spl.col = col[j] + d < SC_PI ? col[j] + d : col[j] - d;
+        for (i=1; i<NFIELDS; i++) {
+            spl.set = &fields[i].sets[0];
+            PixelStore_add(store, spl, &fields[i].sets[0].samples[j]);
+        }
+    }
+}
+
+static long
+count_matches(Field *fields) {
+    int i, j;
+    long n = 0;
+    for (i=0; i<NFIELDS; i++)
+        for (j=0; j<NSAMPLES; j++)
+            if (fields[i].sets[0].samples[j]->bestMatch)
+                n++;
+    return n;
+}
+
+int main(int argc, char **argv) {
+    int i, j, t;
+    long nsides = pow(2, 10);
+    double radius_arcsec = 2.0;
+    int nthreads[] = {1, 3, 8};
+    Field fields[NFIELDS];
+    static Sample *ref[NFIELDS][NSAMPLES];
+
+    Fixture_seed(3);
+
+    PixelStore *store = PixelStore_new(nsides);
+    load_fields(fields, store);
+
+    Crossmatch_setEngine(CROSSMATCH_LOCKED);
+    Crossmatch_crossSamples(store, radius_arcsec, 4);
+    long nlocked = count_matches(fields);
+
+    Crossmatch_setEngine(CROSSMATCH_ATOMIC);
+    for (t=0; t<3; t++) {
+        long n = Crossmatch_crossSamples(store, radius_arcsec, nthreads[t]);
+        if (n != nlocked || count_matches(fields) != nlocked) {
+            fprintf(stderr, "%i threads: %li matches, %li locked\n",
+                    nthreads[t], n, nlocked);
+            return 1;
+        }
+
+        for (i=0; i<NFIELDS; i++) {
+            for (j=0; j<NSAMPLES; j++) {
+                Sample *match = fields[i].sets[0].samples[j]->bestMatch;
+                if (t == 0) {
+                    ref[i][j] = match;
+                } else if (match != ref[i][j]) {
+                    fprintf(stderr, "%i threads: field %i sample %i differ\n",
+                            nthreads[t], i, j);
+                    return 1;
+                }
+            }
+        }
+    }
+    Crossmatch_setEngine(CROSSMATCH_LOCKED);
+
+    for (i=0; i<NFIELDS; i++)
+        Catalog_freeField(&fields[i]);
+    PixelStore_free(store);
+
+    return 0;
+}
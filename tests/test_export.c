@@ -0,0 +1,187 @@
+/*
+ * test_export.c
+ *
+ * Cross match random samples with a perturbed copy of themselves, and
+ * export the matches in CSV and FITS with 1 and 4 threads. Outputs must
+ * not depend on the number of threads, the CSV must have a line per
+ * match, and the FITS table, read back with FitsMap, the expected rows.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/scamp.h"
+#include "../src/mem.h"
+#include "../src/catalog.h"
+#include "../src/crossmatch.h"
+#include "../src/pixelstore.h"
+#include "../src/fitsmap.h"
+#include "../src/export.h"
+
+#include "fixture.h"
+
+#define NSAMPLES 20000
+
+static void
+load_fields(Field *fields, PixelStore *store) {
+    int i, j;
+    Sample spl;
+
+    for (i=0; i<2; i++)
+        Fixture_field(&fields[i], 1, NSAMPLES);
+
+    for (j=0; j<NSAMPLES; j++) {
+        spl.id = j;
+        spl.lon = SC_TWOPI * Fixture_rnd();
+        spl.col = acos(1 - 2 * Fixture_rnd());
+        spl.set = &fields[0].sets[0];
+        PixelStore_add(store, spl, &fields[0].sets[0].samples[j]);
+
+        /* ids of the copies are offset */
+        spl.id = NSAMPLES + j;
+        spl.col += (spl.col < SC_HALFPI ? 1 : -1) * Fixture_rnd() / 3600 * TO_RAD;
+        spl.set = &fields[1].sets[0];
+        PixelStore_add(store, spl, &fields[1].sets[0].samples[j]);
+    }
+}
+
+static char*
+read_file(char *path, long *size) {
+    FILE *fp = fopen(path, "r");
+    fseek(fp, 0, SEEK_END);
+    *size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *data = ALLOC(*size + 1);
+    if (fread(data, 1, *size, fp) != *size)
+        return NULL;
+    data[*size] = '\0';
+    fclose(fp);
+    return data;
+}
+
+static int
+same_files(char *a, char *b) {
+    long na, nb;
+    char *da = read_file(a, &na), *db = read_file(b, &nb);
+    int same = na == nb && memcmp(da, db, na) == 0;
+    FREE(da);
+    FREE(db);
+    return same;
+}
+
+static int
+check_csv(char *path, long nmatches) {
+    long size, n = 0, field, set, id, mfield, mset, mid;
+    double sep;
+    char *data = read_file(path, &size), *line;
+
+    line = strchr(data, '\n') + 1;
+    while (*line) {
+        if (sscanf(line, "%li,%li,%li,%li,%li,%li,%lf", &field, &set, &id,
+                    &mfield, &mset, &mid, &sep) != 7)
+            return 1;
+        /* samples match their copy */
+        if (set != 0 || mset != 0 || field == mfield ||
+                id % NSAMPLES != mid % NSAMPLES || sep < 0 || sep > 2)
+            return 1;
+        line = strchr(line, '\n') + 1;
+        n++;
+    }
+    FREE(data);
+
+    return n != nmatches;
+}
+
+static int
+check_fits(char *path, Field *fields, long nmatches) {
+    FitsMap *map = FitsMap_open(path);
+    long i;
+
+    if (!map || map->nhdus != 2 || map->hdus[1].nrows != nmatches)
+        return 1;
+
+    FitsHdu *hdu = &map->hdus[1];
+    long *field = ALLOC(sizeof(long) * nmatches);
+    long *id = ALLOC(sizeof(long) * nmatches);
+    long *mid = ALLOC(sizeof(long) * nmatches);
+    double *sep = ALLOC(sizeof(double) * nmatches);
+    if (!FitsMap_readLong(hdu, FitsMap_column(hdu, "FIELD"), field, 1) ||
+            !FitsMap_readLong(hdu, FitsMap_column(hdu, "ID"), id, 1) ||
+            !FitsMap_readLong(hdu, FitsMap_column(hdu, "MATCH_ID"), mid, 1) ||
+            !FitsMap_readDouble(hdu, FitsMap_column(hdu, "SEPARATION"),
+                sep, 1))
+        return 1;
+
+    for (i=0; i<nmatches; i++) {
+        Sample *spl = fields[field[i]].sets[0].samples[id[i] % NSAMPLES];
+        if (spl->id != id[i] || spl->bestMatch->id != mid[i] ||
+                fabs(sep[i] - 2 * asin(spl->bestMatchDistance / 2) / TO_RAD
+                    * 3600) > 1e-9)
+            return 1;
+    }
+
+    FREE(field);
+    FREE(id);
+    FREE(mid);
+    FREE(sep);
+    FitsMap_close(map);
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    char *csv[] = {"/tmp/scamp-test-export-1.csv",
+        "/tmp/scamp-test-export-4.csv"};
+    char *fits[] = {"/tmp/scamp-test-export-1.fits",
+        "/tmp/scamp-test-export-4.fits"};
+    int nthreads[] = {1, 4};
+    Field fields[2];
+    long i, j, nmatches = 0;
+    int t;
+
+    Fixture_seed(40);
+
+    PixelStore *store = PixelStore_new(pow(2, 10));
+    load_fields(fields, store);
+    Crossmatch_crossSamples(store, 2.0, 4);
+    for (i=0; i<2; i++)
+        for (j=0; j<NSAMPLES; j++)
+            if (fields[i].sets[0].samples[j]->bestMatch)
+                nmatches++;
+    if (nmatches < NSAMPLES)
+        return 1;
+
+    for (t=0; t<2; t++) {
+        if (Export_matches(csv[t], EXPORT_CSV, store, fields, 2,
+                    nthreads[t]) != nmatches)
+            return 1;
+        if (Export_matches(fits[t], EXPORT_FITS, store, fields, 2,
+                    nthreads[t]) != nmatches)
+            return 1;
+    }
+
+    if (!same_files(csv[0], csv[1]) || !same_files(fits[0], fits[1])) {
+        fprintf(stderr, "outputs depend on the number of threads\n");
+        return 1;
+    }
+    if (check_csv(csv[0], nmatches)) {
+        fprintf(stderr, "bad CSV output\n");
+        return 1;
+    }
+    if (check_fits(fits[0], fields, nmatches)) {
+        fprintf(stderr, "bad FITS output\n");
+        return 1;
+    }
+
+    for (t=0; t<2; t++) {
+        remove(csv[t]);
+        remove(fits[t]);
+    }
+    Catalog_freeField(&fields[0]);
+    Catalog_freeField(&fields[1]);
+    PixelStore_free(store);
+
+    return 0;
+}
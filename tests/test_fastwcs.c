@@ -0,0 +1,119 @@
+/*
+ * test_fastwcs.c
+ *
+ * Interpolate a distorted gnomonic projection of a CCD lying across
+ * ra = 0, and check the error on random pixels against the tolerance.
+ * A projection too irregular to interpolate must be refused.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "../src/fastwcs.h"
+
+#include "fixture.h"
+
+#define NPIXELS 100000
+#define D2R (M_PI / 180)
+
+struct tan {
+    double ra0, dec0;   /* tangent point, degrees */
+    double crpix[2];
+    double scale;       /* degrees per pixel */
+    double k3;          /* cubic radial distortion */
+    double jitter;      /* random noise, degrees */
+};
+
+static int
+tan_project(void *udata, long n, const double *pixcrd, double *world) {
+    struct tan *t = udata;
+    double a = t->ra0 * D2R, d = t->dec0 * D2R;
+    double nrm[3] = {cos(d) * cos(a), cos(d) * sin(a), sin(d)};
+    double era[3] = {-sin(a), cos(a), 0};
+    double edec[3] = {-sin(d) * cos(a), -sin(d) * sin(a), cos(d)};
+    double v[3];
+    long i;
+    int c;
+
+    for (i=0; i<n; i++) {
+        double xi = (pixcrd[2*i] - t->crpix[0]) * t->scale * D2R;
+        double eta = (pixcrd[2*i+1] - t->crpix[1]) * t->scale * D2R;
+        double r2 = xi * xi + eta * eta;
+        xi *= 1 + t->k3 * r2;
+        eta *= 1 + t->k3 * r2;
+        if (t->jitter > 0) {
+            xi += (Fixture_rnd() - 0.5) * t->jitter * D2R;
+            eta += (Fixture_rnd() - 0.5) * t->jitter * D2R;
+        }
+        for (c=0; c<3; c++)
+            v[c] = nrm[c] + xi * era[c] + eta * edec[c];
+        double norm = sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        world[2*i] = atan2(v[1], v[0]) / D2R;
+        world[2*i+1] = asin(v[2] / norm) / D2R;
+    }
+
+    return 0;
+}
+
+static double
+distance_arcsec(double ra1, double dec1, double ra2, double dec2) {
+    double s = sin((dec2 - dec1) * D2R / 2);
+    double t = sin((ra2 - ra1) * D2R / 2);
+    double h = s * s + cos(dec1 * D2R) * cos(dec2 * D2R) * t * t;
+    return 2 * asin(sqrt(h)) / D2R * 3600;
+}
+
+int main(int argc, char **argv) {
+    static double pixcrd[2 * NPIXELS], exact[2 * NPIXELS], fast[2 * NPIXELS];
+    double tolerance = 0.001, maxerror = 0;
+    long i;
+
+    Fixture_seed(27);
+
+    /* 2k x 4k CCD, 0.2 arcsec pixels, centered near ra = 0, about 2 arcsec
+     * of distortion in the corners */
+    struct tan t = {0.05, 35.0, {1024.5, 2048.5}, 0.2 / 3600, 150, 0};
+
+    FastWcs *fw = FastWcs_new(tan_project, &t, 1, 2048, 1, 4096,
+            tolerance, 10 * NPIXELS);
+    if (!fw) {
+        fprintf(stderr, "tolerance not met\n");
+        return 1;
+    }
+
+    for (i=0; i<NPIXELS; i++) {
+        pixcrd[2*i] = 1 + 2047 * Fixture_rnd();
+        pixcrd[2*i+1] = 1 + 4095 * Fixture_rnd();
+    }
+    tan_project(&t, NPIXELS, pixcrd, exact);
+    FastWcs_p2s(fw, NPIXELS, pixcrd, fast);
+
+    for (i=0; i<NPIXELS; i++) {
+        if (fast[2*i] < 0 || fast[2*i] >= 360)
+            return 1;
+        double d = distance_arcsec(exact[2*i], exact[2*i+1],
+                fast[2*i], fast[2*i+1]);
+        if (d > maxerror)
+            maxerror = d;
+    }
+    printf("grid %i x %i, measured %g, max %g arcsec\n",
+            fw->nx, fw->ny, fw->maxerror, maxerror);
+    if (maxerror > 2 * tolerance) {
+        fprintf(stderr, "error %g arcsec\n", maxerror);
+        return 1;
+    }
+    FastWcs_free(fw);
+
+    /* not enough evaluations allowed */
+    if (FastWcs_new(tan_project, &t, 1, 2048, 1, 4096, tolerance, 100))
+        return 1;
+
+    /* noise can not be interpolated */
+    t.jitter = 0.01 / 3600;
+    if (FastWcs_new(tan_project, &t, 1, 2048, 1, 4096, tolerance,
+                10 * NPIXELS))
+        return 1;
+
+    return 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * test_fitsmap.c
+ *
+ * Map the GAIA reference catalog and decode its position and magnitude
+ * columns. Then write a binary table with every numeric type, a scaled
+ * column and an unpadded last block, and decode it back.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../src/fitsmap.h"
+#include "../src/mem.h"
+
+#define NROWS 1000
+
+static FILE *fp;
+static int ncards;
+
+static void
+card(const char *fmt, const char *key, const char *value) {
+    char buf[FITSMAP_CARD + 1];
+    snprintf(buf, sizeof(buf), fmt, key, value);
+    fprintf(fp, "%-80s", buf);
+    ncards++;
+}
+
+static void
+end_header() {
+    card("%s%s", "END", "");
+    for (; ncards % 36; ncards++)
+        fprintf(fp, "%80s", "");
+    ncards = 0;
+}
+
+static void
+put_be(uint64_t v, int nbytes) {
+    int i;
+    for (i=nbytes-1; i>=0; i--)
+        fputc((v >> (8 * i)) & 0xff, fp);
+}
+
+static int
+check_gaia(char *file) {
+    static double x[5000], y[5000], mag[5000];
+    FitsMap *map = FitsMap_open(file);
+    char value[72];
+
+    if (!map || map->nhdus != 3)
+        return 1;
+
+    FitsHdu *head = &map->hdus[1], *table = &map->hdus[2];
+    if (!FitsMap_keyword(table, "EXTNAME", value, sizeof(value)) ||
+            strcmp(value, "LDAC_OBJECTS") != 0 || table->nrows != 4403)
+        return 1;
+    if (head->ncolumns != 1 || head->columns[0].type != 'A' ||
+            head->columns[0].repeat != 1680 ||
+            strcmp(head->columns[0].name, "Field Header Card") != 0)
+        return 1;
+    if (FitsMap_column(table, "X_IMAGE"))
+        return 1;
+
+    if (!FitsMap_readDouble(table, FitsMap_column(table, "X_WORLD"), x, 1) ||
+            !FitsMap_readDouble(table, FitsMap_column(table, "Y_WORLD"), y, 1) ||
+            !FitsMap_readDouble(table, FitsMap_column(table, "MAG"), mag, 1))
+        return 1;
+
+    if (x[0] != 203.9490790002 || y[0] != 37.1893608246 ||
+            x[4402] != 203.4132174038 || y[4402] != 38.5291644941 ||
+            mag[0] != (double) 20.167f)
+        return 1;
+
+    FitsMap_close(map);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    char path[] = "/tmp/scamp-test-fitsmap.fits";
+    static double x[NROWS], y[2 * NROWS];
+    static long number[NROWS], flags[NROWS], big[NROWS];
+    int i;
+
+    if (check_gaia("tests/data/fitscat/GAIA-DR1_1334+3754_r46.cat")) {
+        fprintf(stderr, "bad GAIA catalog\n");
+        return 1;
+    }
+
+    /* row: NUMBER 1J, NAME 3A, X_IMAGE 1E, Y_IMAGE 1D, FLAGS 1I, BIG 1K, U 1I */
+    fp = fopen(path, "w");
+    card("%-8s= %20s", "SIMPLE", "T");
+    card("%-8s= %20s", "BITPIX", "8");
+    card("%-8s= %20s", "NAXIS", "0");
+    end_header();
+    card("%-8s= %s", "XTENSION", "'BINTABLE'");
+    card("%-8s= %20s", "BITPIX", "8");
+    card("%-8s= %20s", "NAXIS", "2");
+    card("%-8s= %20s", "NAXIS1", "31");
+    card("%-8s= %20s / rows", "NAXIS2", "1000");
+    card("%-8s= %20s", "PCOUNT", "0");
+    card("%-8s= %20s", "GCOUNT", "1");
+    card("%-8s= %20s", "TFIELDS", "7");
+    card("%-8s= %s", "TTYPE1", "'NUMBER  '");
+    card("%-8s= %s", "TFORM1", "'1J      '");
+    card("%-8s= %s", "TTYPE2", "'NAME'");
+    card("%-8s= %s", "TFORM2", "'3A'");
+    card("%-8s= %s", "TTYPE3", "'X_IMAGE'");
+    card("%-8s= %s", "TFORM3", "'E'");
+    card("%-8s= %s", "TTYPE4", "'Y_IMAGE'");
+    card("%-8s= %s", "TFORM4", "'1D'");
+    card("%-8s= %s", "TTYPE5", "'FLAGS'");
+    card("%-8s= %s", "TFORM5", "'1I'");
+    card("%-8s= %s", "TTYPE6", "'BIG'");
+    card("%-8s= %s", "TFORM6", "'1K'");
+    card("%-8s= %s", "TTYPE7", "'U'");
+    card("%-8s= %s", "TFORM7", "'1I'");
+    card("%-8s= %20s", "TZERO7", "32768");
+    card("%-8s= %s / it''s a table", "EXTNAME", "'OBJ''S'");
+    end_header();
+    for (i=0; i<NROWS; i++) {
+        float fx = i * 1.5f - 300.25f;
+        double dy = i * 0.001 + 1e-9;
+        uint32_t ux;
+        uint64_t uy;
+        memcpy(&ux, &fx, 4);
+        memcpy(&uy, &dy, 8);
+        put_be((uint32_t) (i - 500), 4);
+        fputs("abc", fp);
+        put_be(ux, 4);
+        put_be(uy, 8);
+        put_be((uint16_t) (-i), 2);
+        put_be(((uint64_t) i) << 40, 8);
+        put_be(i, 2);
+    }
+    /* no padding of the last block */
+    fclose(fp);
+
+    FitsMap *map = FitsMap_open(path);
+    if (!map || map->nhdus != 2) {
+        fprintf(stderr, "can not map the table\n");
+        return 1;
+    }
+
+    FitsHdu *table = &map->hdus[1];
+    char value[72];
+    if (!FitsMap_keyword(table, "EXTNAME", value, sizeof(value)) ||
+            strcmp(value, "OBJ'S") != 0 ||
+            !FitsMap_keyword(table, "NAXIS2", value, sizeof(value)) ||
+            strcmp(value, "1000") != 0)
+        return 1;
+
+    if (!FitsMap_readLong(table, FitsMap_column(table, "NUMBER"), number, 1) ||
+            !FitsMap_readDouble(table, FitsMap_column(table, "X_IMAGE"), x, 1) ||
+            !FitsMap_readDouble(table, FitsMap_column(table, "Y_IMAGE"), y, 2) ||
+            !FitsMap_readLong(table, FitsMap_column(table, "FLAGS"), flags, 1) ||
+            !FitsMap_readLong(table, FitsMap_column(table, "BIG"), big, 1))
+        return 1;
+
+    for (i=0; i<NROWS; i++) {
+        if (number[i] != i - 500 || x[i] != (double) (i * 1.5f - 300.25f) ||
+                y[2*i] != i * 0.001 + 1e-9 || flags[i] != -i ||
+                big[i] != ((long) i) << 40) {
+            fprintf(stderr, "row %i differ\n", i);
+            return 1;
+        }
+    }
+
+    /* scaled and text columns are left to CFITSIO */
+    if (FitsMap_readLong(table, FitsMap_column(table, "U"), flags, 1) ||
+            FitsMap_readDouble(table, FitsMap_column(table, "NAME"), x, 1))
+        return 1;
+
+    FitsMap_close(map);
+    remove(path);
+
+    /* not a FITS file */
+    if (FitsMap_open("tests/data/asciicat/t4_cat.txt"))
+        return 1;
+
+    return 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * test_gencat.c
+ *
+ * Generate two ASCII fields, load and cross match them: the injected
+ * matches must be found. Then generate a clustered LDAC field around the
+ * pole, and read it back with FitsMap.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/scamp.h"
+#include "../src/mem.h"
+#include "../src/catalog.h"
+#include "../src/asciicat.h"
+#include "../src/crossmatch.h"
+#include "../src/pixelstore.h"
+#include "../src/fitsmap.h"
+#include "gencat.h"
+
+static int
+check_ascii() {
+    char *paths[] = {"/tmp/scamp-test-gencat_0.txt",
+        "/tmp/scamp-test-gencat_1.txt"};
+    GenCatConfig config = GenCat_defaultConfig;
+    Field fields[2];
+    long i, ncommon = 0, nfound = 0;
+    int f;
+
+    config.nsources = 5000;
+    config.format = GENCAT_ASCII;
+    GenCat_setCenter(&config, "wrap");
+
+    PixelStore *store = PixelStore_new(pow(2, 14));
+    for (f=0; f<2; f++) {
+        if (!GenCat_write(&config, f, paths[f]))
+            return 1;
+        AsciiCat_open(paths[f], &fields[f], store);
+        if (fields[f].sets[0].nsamples != config.nsources)
+            return 1;
+    }
+
+    /* offsets are up to 0.5 arcsec in each field */
+    Crossmatch_crossSamples(store, 1.0, 2);
+    for (i=0; i<config.nsources; i++) {
+        Sample *spl = fields[0].sets[0].samples[i];
+        if (spl->id > config.nsources)
+            continue;
+        ncommon++;
+        if (spl->bestMatch && spl->bestMatch->id == spl->id)
+            nfound++;
+    }
+    if (fabs(ncommon - config.matches * config.nsources) >
+            0.05 * config.nsources || nfound < 0.99 * ncommon) {
+        fprintf(stderr, "%li injected matches, %li found\n", ncommon, nfound);
+        return 1;
+    }
+
+    for (f=0; f<2; f++) {
+        Catalog_freeField(&fields[f]);
+        remove(paths[f]);
+    }
+    PixelStore_free(store);
+
+    return 0;
+}
+
+static int
+check_ldac() {
+    char path[] = "/tmp/scamp-test-gencat.cat";
+    GenCatConfig config = GenCat_defaultConfig;
+    GenCatSource src;
+    char value[80];
+    long i, n = 0;
+    int s;
+
+    config.nsources = 30001;
+    config.nsets = 6;
+    config.nclusters = 8;
+    GenCat_setCenter(&config, "pole");
+    if (!GenCat_write(&config, 1, path))
+        return 1;
+
+    FitsMap *map = FitsMap_open(path);
+    if (!map || map->nhdus != 1 + 2 * config.nsets)
+        return 1;
+
+    for (s=0; s<config.nsets; s++) {
+        FitsHdu *head = &map->hdus[1 + 2 * s], *table = &map->hdus[2 + 2 * s];
+        if (!FitsMap_keyword(head, "EXTNAME", value, sizeof(value)) ||
+                strcmp(value, "LDAC_IMHEAD") != 0 || head->nrows != 1 ||
+                head->columns[0].type != 'A' ||
+                strstr((char*) head->data, "'RA---TAN'") == NULL)
+            return 1;
+
+        long *ids = ALLOC(sizeof(long) * table->nrows);
+        double *x = ALLOC(sizeof(double) * table->nrows);
+        if (!FitsMap_readLong(table, FitsMap_column(table, "NUMBER"), ids, 1) ||
+                !FitsMap_readDouble(table, FitsMap_column(table, "X_IMAGE"),
+                    x, 1))
+            return 1;
+        for (i=0; i<table->nrows; i++, n++) {
+            GenCat_source(&config, 1, n, &src);
+            if (src.set != s || ids[i] != src.id ||
+                    fabs(x[i] - src.x) > 1e-3 * fabs(src.x))
+                return 1;
+            /* within the field around the pole, clusters may overflow */
+            if (src.col > config.width * TO_RAD)
+                return 1;
+        }
+        FREE(ids);
+        FREE(x);
+    }
+    if (n != config.nsources)
+        return 1;
+
+    FitsMap_close(map);
+    remove(path);
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    GenCatConfig config = GenCat_defaultConfig;
+    GenCatSource a, b;
+
+    /* sources do not depend on the order they are generated in */
+    GenCat_source(&config, 1, 12345, &a);
+    GenCat_source(&config, 0, 3, &b);
+    GenCat_source(&config, 1, 12345, &b);
+    if (a.id != b.id || a.set != b.set || a.common != b.common ||
+            a.x != b.x || a.y != b.y || a.lon != b.lon || a.col != b.col)
+        return 1;
+
+    if (check_ascii()) {
+        fprintf(stderr, "bad ASCII catalogs\n");
+        return 1;
+    }
+    if (check_ldac()) {
+        fprintf(stderr, "bad LDAC catalog\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * test_logger.c
+ *
+ * Log from several threads in asynchronous mode and check that every
+ * message is either written or counted as dropped. Check that the
+ * arguments of filtered levels, at run time or at compile time, are not
+ * evaluated. Check that a critical message in asynchronous mode writes
+ * the messages logged before it, and that a forked child still logs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+/* compile LOGGER_DEBUG and LOGGER_TRACE out of this file */
+#define LOGGER_MAX_LEVEL LOGGER_VERBOSE
+#include "../src/logger.h"
+
+#define NTHREADS 4
+#define NMESSAGES 5000
+
+static int nevaluated = 0;
+
+static int
+evaluated() {
+    return ++nevaluated;
+}
+
+static void*
+log_thread(void *args) {
+    int i, t = *(int*) args;
+
+    for (i=0; i<NMESSAGES; i++)
+        LOGGER_LOG(LOGGER_NORMAL, "thread %i message %i\n", t, i);
+
+    return NULL;
+}
+
+/* number of lines of "path" starting with "prefix" */
+static int
+count_lines(char *path, char *prefix) {
+    char line[LOGGER_MESSAGE_SIZE];
+    int n = 0;
+
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return -1;
+    while (fgets(line, sizeof(line), fp))
+        n += strncmp(line, prefix, strlen(prefix)) == 0;
+    fclose(fp);
+
+    return n;
+}
+
+/* log asynchronously to "path" from a child, then abort */
+static int
+critical_child(char *path) {
+    int i, status;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (!freopen(path, "w", stdout) || !freopen(path, "a", stderr))
+            _exit(0);
+        Logger_startAsync();
+        for (i=0; i<100; i++)
+            Logger_log(LOGGER_NORMAL, "before %i\n", i);
+        Logger_log(LOGGER_CRITICAL, "critical\n");
+        _exit(0);
+    }
+    if (waitpid(pid, &status, 0) != pid || !WIFSIGNALED(status) ||
+            WTERMSIG(status) != SIGABRT)
+        return 1;
+
+    return count_lines(path, "before") != 100 ||
+        count_lines(path, "critical") != 1;
+}
+
+/* in asynchronous mode, log from a forked child exiting at once */
+static int
+forked_child(char *path) {
+    int status;
+
+    if (!freopen(path, "w", stdout))
+        return 1;
+    Logger_startAsync();
+    pid_t pid = fork();
+    if (pid == 0) {
+        Logger_log(LOGGER_NORMAL, "child\n");
+        fflush(stdout);
+        _exit(0);
+    }
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status))
+        return 1;
+    Logger_stopAsync();
+    fflush(stdout);
+
+    return count_lines(path, "child") != 1;
+}
+
+int main(int argc, char **argv) {
+    char path[] = "/tmp/scamp-test-logger.txt";
+    char line[LOGGER_MESSAGE_SIZE];
+    pthread_t threads[NTHREADS];
+    int ids[NTHREADS], t;
+
+    Logger_setLevel(LOGGER_NORMAL);
+    LOGGER_LOG(LOGGER_VERBOSE, "%i\n", evaluated());
+    Logger_setLevel(LOGGER_TRACE);
+    LOGGER_LOG(LOGGER_DEBUG, "%i\n", evaluated());
+    LOGGER_LOG(LOGGER_TRACE, "%i\n", evaluated());
+    if (nevaluated != 0)
+        return 1;
+    Logger_setLevel(LOGGER_NORMAL);
+
+    if (critical_child(path) || forked_child(path))
+        return 1;
+
+    if (!freopen(path, "w", stdout))
+        return 1;
+
+    Logger_startAsync();
+    for (t=0; t<NTHREADS; t++) {
+        ids[t] = t;
+        pthread_create(&threads[t], NULL, log_thread, &ids[t]);
+    }
+    for (t=0; t<NTHREADS; t++)
+        pthread_join(threads[t], NULL);
+    Logger_stopAsync();
+    fflush(stdout);
+
+    /* messages of a thread are written in order */
+    int last[NTHREADS];
+    long nwritten = 0;
+    for (t=0; t<NTHREADS; t++)
+        last[t] = -1;
+
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return 1;
+    while (fgets(line, sizeof(line), fp)) {
+        int i;
+        if (sscanf(line, "thread %i message %i", &t, &i) != 2 ||
+                t < 0 || t >= NTHREADS || i <= last[t])
+            return 1;
+        last[t] = i;
+        nwritten++;
+    }
+    fclose(fp);
+    remove(path);
+
+    fprintf(stderr, "%li messages written, %li dropped\n",
+            nwritten, Logger_dropped());
+    if (nwritten + Logger_dropped() != NTHREADS * NMESSAGES)
+        return 1;
+
+    return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * test_moc.c
+ *
+ * Union and intersection of random MOCs must cover the same pixels as
+ * the union and intersection of their pixel sets. Then check that only
+ * overlapping fields are reported by Moc_overlapping().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "../src/moc.h"
+#include "../src/chealpix.h"
+
+#include "fixture.h"
+
+#define ORDER 6
+#define NPIX (12 * (1 << ORDER) * (1 << ORDER))
+#define NSAMPLES 2000
+
+/* mark the pixels at ORDER covered by "moc" */
+static void
+moc_to_pixels(Moc *moc, char *in) {
+    int shift = 2 * (MOC_MAXORDER - ORDER);
+    long i;
+    int64_t p;
+
+    memset(in, 0, NPIX);
+    for (i=0; i<moc->nranges; i++)
+        for (p=moc->ranges[2*i] >> shift; p<moc->ranges[2*i+1] >> shift; p++)
+            in[p] = 1;
+}
+
+/* random pixels, grouped in runs so that ranges are merged */
+static Moc*
+random_moc(char *in) {
+    int64_t pixels[NPIX];
+    long n = 0, i;
+
+    memset(in, 0, NPIX);
+    while (n < NPIX / 4) {
+        int64_t p = Fixture_rnd() * NPIX;
+        int run = 1 + Fixture_rnd() * 8;
+        for (i=0; i<run && p + i < NPIX; i++) {
+            pixels[n++] = p + i;
+            in[p + i] = 1;
+        }
+    }
+
+    return Moc_fromPixels(ORDER, pixels, n, false);
+}
+
+/* samples in a disc of "radius" radians around (col, lon) */
+static Moc*
+field_moc(double col, double lon, double radius) {
+    double cols[NSAMPLES], lons[NSAMPLES];
+    int i;
+
+    for (i=0; i<NSAMPLES; i++) {
+        cols[i] = col + (2 * Fixture_rnd() - 1) * radius;
+        lons[i] = lon + (2 * Fixture_rnd() - 1) * radius / sin(col);
+    }
+
+    return Moc_fromPositions(MOC_FIELD_ORDER, cols, lons, NSAMPLES);
+}
+
+int main(int argc, char **argv) {
+    static char ina[NPIX], inb[NPIX], inr[NPIX];
+    int i, t;
+    long j;
+
+    Fixture_seed(17);
+
+    for (t=0; t<10; t++) {
+        Moc *a = random_moc(ina);
+        Moc *b = random_moc(inb);
+        Moc *u = Moc_union(a, b);
+        Moc *x = Moc_intersection(a, b);
+        int common = 0;
+
+        moc_to_pixels(u, inr);
+        for (j=0; j<NPIX; j++) {
+            if (inr[j] != (ina[j] | inb[j])) {
+                fprintf(stderr, "union differ at pixel %li\n", j);
+                return 1;
+            }
+        }
+
+        moc_to_pixels(x, inr);
+        for (j=0; j<NPIX; j++) {
+            if (inr[j] != (ina[j] & inb[j])) {
+                fprintf(stderr, "intersection differ at pixel %li\n", j);
+                return 1;
+            }
+            common |= inr[j];
+        }
+        if (Moc_intersects(a, b) != common)
+            return 1;
+
+        /* normalized: sorted, disjoint and not adjacent */
+        for (j=1; j<u->nranges; j++)
+            if (u->ranges[2*j] <= u->ranges[2*j-1])
+                return 1;
+
+        Moc_free(a);
+        Moc_free(b);
+        Moc_free(u);
+        Moc_free(x);
+    }
+
+    /*
+     * Fields 0 and 1 share a border, field 2 is on the other side of the
+     * sky.
+     */
+    double radius = 0.2 * M_PI / 180;
+    Moc *fields[3];
+    bool overlap[3];
+    fields[0] = field_moc(1.0, 1.0, radius);
+    fields[1] = field_moc(1.0, 1.0 + 2 * radius / sin(1.0), radius);
+    fields[2] = field_moc(2.0, 4.0, radius);
+
+    if (Moc_overlapping(fields, 3, MOC_FIELD_ORDER, overlap) != 2 ||
+            !overlap[0] || !overlap[1] || overlap[2]) {
+        fprintf(stderr, "bad overlapping fields\n");
+        return 1;
+    }
+
+    Moc *dilated = Moc_dilate(fields[2], MOC_FIELD_ORDER);
+    if (!Moc_intersects(dilated, fields[2]) ||
+            Moc_npixels(dilated) <= Moc_npixels(fields[2]))
+        return 1;
+    Moc_free(dilated);
+
+    for (i=0; i<3; i++)
+        Moc_free(fields[i]);
+
+    return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * test_partition_crossmatch.c
+ *
+ * Write three ascii catalogs of random samples spread over the sphere, with
+ * positions moved by up to 1.5 arcsec from one to the other, and cross match
+ * them in memory and with 1, 2 and 5 worker processes. Every run should
+ * give the same matches.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "../src/scamp.h"
+#include "../src/mem.h"
+#include "../src/catalog.h"
+#include "../src/crossmatch.h"
+#include "../src/pixelstore.h"
+#include "../src/partition.h"
+
+#include "fixture.h"
+
+extern void test_Catalog_open_ascii(char*, Field*, PixelStore*);
+extern void test_Catalog_open_ascii_with(char*, Field*, Catalog_addFunc, void*);
+
+#define NFILES 3
+#define NSAMPLES 5000
+
+static void
+write_catalogs(char **files) {
+    double lon[NSAMPLES], col[NSAMPLES];
+    int i, j;
+
+    for (j=0; j<NSAMPLES; j++) {
+        lon[j] = SC_TWOPI * Fixture_rnd();
+        col[j] = acos(1 - 2 * Fixture_rnd());
+    }
+
+    for (i=0; i<NFILES; i++) {
+        FILE *fp = fopen(files[i], "w");
+        for (j=0; j<NSAMPLES; j++) {
+            double d = 1.5 * i * Fixture_rnd() / 3600 * TO_RAD;
+            double c = col[j] + d;
+            if (c > SC_PI)
+                c = col[j] - d;
+            fprintf(fp, "%i %.17g %.17g\n", j, lon[j], c);
+        }
+        fclose(fp);
+    }
+}
+
+static int
+cmp_match(const void *a, const void *b) {
+    const PartitionMatch *ma = a, *mb = b;
+    if (ma->field != mb->field)
+        return ma->field - mb->field;
+    return ma->row < mb->row ? -1 : ma->row > mb->row;
+}
+
+int main(int argc, char **argv) {
+    int i, j, w;
+    long nsides = pow(2, 12);
+    double radius_arcsec = 2.0;
+    char *files[NFILES];
+    int nworkers[] = {1, 2, 5};
+
+    Fixture_seed(7);
+
+    for (i=0; i<NFILES; i++) {
+        files[i] = ALLOC(64);
+        sprintf(files[i], "/tmp/scamp-partition-%i-%i.txt", (int) getpid(), i);
+    }
+    write_catalogs(files);
+
+    /* reference, in memory */
+    PixelStore *store = PixelStore_new(nsides);
+    Field fields[NFILES];
+    for (i=0; i<NFILES; i++)
+        test_Catalog_open_ascii(files[i], &fields[i], store);
+    Crossmatch_crossSamples(store, radius_arcsec, 4);
+
+    PartitionMatch *ref = ALLOC(sizeof(PartitionMatch) * NFILES * NSAMPLES);
+    long nref = 0;
+    for (i=0; i<NFILES; i++) {
+        for (j=0; j<NSAMPLES; j++) {
+            Sample *spl = fields[i].sets[0].samples[j];
+            if (!spl->bestMatch)
+                continue;
+            ref[nref].field = i;
+            ref[nref].set = 0;
+            ref[nref].row = j;
+            ref[nref].mfield = spl->bestMatch->set->field - fields;
+            ref[nref].mset = 0;
+            ref[nref].mrow = spl->bestMatch->id;
+            nref++;
+        }
+    }
+    qsort(ref, nref, sizeof(PartitionMatch), cmp_match);
+
+    for (w=0; w<3; w++) {
+        PartitionMatch *matches;
+        long nmatches = Partition_crossFiles(files, NFILES,
+                test_Catalog_open_ascii_with, nsides, radius_arcsec,
+                nworkers[w], 2, &matches);
+
+        if (nmatches != nref) {
+            fprintf(stderr, "%i workers: %li matches, %li expected\n",
+                    nworkers[w], nmatches, nref);
+            return 1;
+        }
+        for (i=0; i<nmatches; i++) {
+            if (matches[i].field != ref[i].field ||
+                    matches[i].row != ref[i].row ||
+                    matches[i].mfield != ref[i].mfield ||
+                    matches[i].mrow != ref[i].mrow) {
+                fprintf(stderr, "%i workers: match %i differ\n",
+                        nworkers[w], i);
+                return 1;
+            }
+        }
+        FREE(matches);
+    }
+
+    for (i=0; i<NFILES; i++) {
+        Catalog_freeField(&fields[i]);
+        unlink(files[i]);
+        FREE(files[i]);
+    }
+    PixelStore_free(store);
+    FREE(ref);
+
+    return 0;
+}
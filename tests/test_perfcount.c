@@ -0,0 +1,95 @@
+/*
+ * test_perfcount.c
+ *
+ * Count a busy loop on two threads, twice. Records must be kept per phase
+ * and thread, whether the counters are available or not.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "../src/perfcount.h"
+#include "../src/logger.h"
+
+static volatile double sink;
+
+static void*
+busy_thread(void *args) {
+    PerfCounters counters;
+    double s = 0;
+    long i;
+
+    PerfCount_start(&counters);
+    for (i=0; i<1000000; i++)
+        s += i * 0.5;
+    sink = s;
+    PerfCount_stop(&counters, "busy", *(int*) args);
+
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    pthread_t threads[2];
+    int ids[2] = {0, 1}, r, t, e;
+    PerfCounters counters;
+    PerfCountRecord *records;
+    long nrecords;
+    char json[4096];
+
+    /* disabled by default */
+    PerfCount_start(&counters);
+    PerfCount_stop(&counters, "load", 0);
+    PerfCount_records(&nrecords);
+    if (nrecords != 0)
+        return 1;
+
+    PerfCount_setEnabled(true);
+    PerfCount_start(&counters);
+    for (r=0; r<2; r++) {
+        for (t=0; t<2; t++)
+            pthread_create(&threads[t], NULL, busy_thread, &ids[t]);
+        for (t=0; t<2; t++)
+            pthread_join(threads[t], NULL);
+    }
+    PerfCount_stop(&counters, "load", 0);
+
+    /* threads may end in any order */
+    records = PerfCount_records(&nrecords);
+    if (nrecords != 3 || records[0].thread + records[1].thread != 1)
+        return 1;
+    for (t=0; t<2; t++)
+        if (strcmp(records[t].phase, "busy") != 0 || records[t].nruns != 2)
+            return 1;
+    if (strcmp(records[2].phase, "load") != 0 || records[2].nruns != 1)
+        return 1;
+
+    /* one loop is at least a million instructions, if counted */
+    for (t=0; t<2; t++) {
+        for (e=0; e<PERFCOUNT_NEVENTS; e++)
+            printf("%s %i %s %lli\n", records[t].phase, records[t].thread,
+                    PerfCount_names[e], (long long) records[t].values[e]);
+        if (records[t].values[PERFCOUNT_INSTRUCTIONS] >= 0 &&
+                records[t].values[PERFCOUNT_INSTRUCTIONS] < 2000000)
+            return 1;
+    }
+
+    FILE *out = fmemopen(json, sizeof(json), "w");
+    PerfCount_printJson(out);
+    fclose(out);
+    if (json[0] != '[' || !strstr(json, "\"phase\": \"busy\", \"thread\": 1"))
+        return 1;
+
+    PerfCount_reset("busy");
+    records = PerfCount_records(&nrecords);
+    if (nrecords != 1 || strcmp(records[0].phase, "load") != 0)
+        return 1;
+    PerfCount_log();
+    PerfCount_reset(NULL);
+    PerfCount_records(&nrecords);
+    if (nrecords != 0)
+        return 1;
+
+    return 0;
+}
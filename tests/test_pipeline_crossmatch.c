@@ -0,0 +1,177 @@
+/*
+ * test_pipeline_crossmatch.c
+ *
+ * Write four ascii catalogs: two epochs of two bands of the sky, with
+ * positions moved by up to 1.5 arcsec from one epoch to the other. Cross
+ * match them in memory, and with the pipeline, where the regions of the
+ * first band can be matched while the second band is loading. Both runs
+ * should give the same matches. Then give the last file an empty
+ * footprint: its samples come after their regions are matched, and the
+ * pipeline must fail.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "../src/scamp.h"
+#include "../src/mem.h"
+#include "../src/catalog.h"
+#include "../src/crossmatch.h"
+#include "../src/pixelstore.h"
+#include "../src/partition.h"
+#include "../src/pipeline.h"
+
+#include "fixture.h"
+
+extern void test_Catalog_open_ascii(char*, Field*, PixelStore*);
+extern void test_Catalog_open_ascii_with(char*, Field*, Catalog_addFunc, void*);
+extern long test_Catalog_footprint_ascii(char*, int, int64_t**);
+
+#define NFILES 4
+#define NSAMPLES 5000
+
+/*
+ * Files 0 and 1 are the first band (lon in [0, pi[), 2 and 3 the second.
+ */
+static void
+write_catalogs(char **files) {
+    double lon[NSAMPLES], col[NSAMPLES];
+    int b, e, j;
+
+    for (b=0; b<2; b++) {
+        for (j=0; j<NSAMPLES; j++) {
+            lon[j] = SC_PI * (b + Fixture_rnd());
+            col[j] = acos(1 - 2 * Fixture_rnd());
+        }
+        for (e=0; e<2; e++) {
+            FILE *fp = fopen(files[b * 2 + e], "w");
+            for (j=0; j<NSAMPLES; j++) {
+                double d = 1.5 * e * Fixture_rnd() / 3600 * TO_RAD;
+                double c = col[j] + d;
+                if (c > SC_PI)
+                    c = col[j] - d;
+                fprintf(fp, "%i %.17g %.17g\n", j, lon[j], c);
+            }
+            fclose(fp);
+        }
+    }
+}
+
+static int
+cmp_match(const void *a, const void *b) {
+    const PartitionMatch *ma = a, *mb = b;
+    if (ma->field != mb->field)
+        return ma->field - mb->field;
+    return ma->row < mb->row ? -1 : ma->row > mb->row;
+}
+
+static char *last_file;
+
+/* the footprint of every file but the last one */
+static long
+partial_footprint(char *file, int order, int64_t **pixels) {
+    long n = test_Catalog_footprint_ascii(file, order, pixels);
+    return file == last_file ? 0 : n;
+}
+
+static Field pfields[NFILES];
+static PartitionMatch *matches;
+static long nmatches = 0;
+
+static void
+on_match(void *udata, ChunkRecord *spl, ChunkRecord *match, double distance) {
+    matches[nmatches].field = spl->set->field - pfields;
+    matches[nmatches].set = 0;
+    matches[nmatches].row = spl->row;
+    matches[nmatches].mfield = match->set->field - pfields;
+    matches[nmatches].mset = 0;
+    matches[nmatches].mrow = match->row;
+    matches[nmatches].distance = distance;
+    nmatches++;
+}
+
+int main(int argc, char **argv) {
+    int i, j;
+    long nsides = pow(2, 12);
+    double radius_arcsec = 2.0;
+    char *files[NFILES];
+
+    Fixture_seed(11);
+
+    for (i=0; i<NFILES; i++) {
+        files[i] = ALLOC(64);
+        sprintf(files[i], "/tmp/scamp-pipeline-%i-%i.txt", (int) getpid(), i);
+    }
+    write_catalogs(files);
+
+    /* reference, in memory */
+    PixelStore *store = PixelStore_new(nsides);
+    Field fields[NFILES];
+    for (i=0; i<NFILES; i++)
+        test_Catalog_open_ascii(files[i], &fields[i], store);
+    Crossmatch_crossSamples(store, radius_arcsec, 4);
+
+    PartitionMatch *ref = ALLOC(sizeof(PartitionMatch) * NFILES * NSAMPLES);
+    long nref = 0;
+    for (i=0; i<NFILES; i++) {
+        for (j=0; j<NSAMPLES; j++) {
+            Sample *spl = fields[i].sets[0].samples[j];
+            if (!spl->bestMatch)
+                continue;
+            ref[nref].field = i;
+            ref[nref].set = 0;
+            ref[nref].row = j;
+            ref[nref].mfield = spl->bestMatch->set->field - fields;
+            ref[nref].mset = 0;
+            ref[nref].mrow = spl->bestMatch->id;
+            nref++;
+        }
+    }
+    qsort(ref, nref, sizeof(PartitionMatch), cmp_match);
+
+    matches = ALLOC(sizeof(PartitionMatch) * NFILES * NSAMPLES);
+    long n = Pipeline_crossFiles(files, NFILES, pfields,
+            test_Catalog_open_ascii_with, test_Catalog_footprint_ascii,
+            nsides, radius_arcsec, 2, 2, on_match, NULL);
+    qsort(matches, nmatches, sizeof(PartitionMatch), cmp_match);
+
+    if (n != nref || nmatches != nref) {
+        fprintf(stderr, "%li matches, %li expected\n", nmatches, nref);
+        return 1;
+    }
+    for (i=0; i<nmatches; i++) {
+        if (matches[i].field != ref[i].field ||
+                matches[i].row != ref[i].row ||
+                matches[i].mfield != ref[i].mfield ||
+                matches[i].mrow != ref[i].mrow) {
+            fprintf(stderr, "match %i differ\n", i);
+            return 1;
+        }
+    }
+
+    /* one loader, the last file is loaded after the regions are matched */
+    Field lfields[NFILES];
+    last_file = files[NFILES - 1];
+    n = Pipeline_crossFiles(files, NFILES, lfields,
+            test_Catalog_open_ascii_with, partial_footprint,
+            nsides, radius_arcsec, 1, 2, NULL, NULL);
+    if (n != -1) {
+        fprintf(stderr, "samples out of footprint not reported\n");
+        return 1;
+    }
+
+    for (i=0; i<NFILES; i++) {
+        Catalog_freeField(&fields[i]);
+        Catalog_freeField(&pfields[i]);
+        Catalog_freeField(&lfields[i]);
+        unlink(files[i]);
+        FREE(files[i]);
+    }
+    PixelStore_free(store);
+    FREE(matches);
+    FREE(ref);
+
+    return 0;
+}
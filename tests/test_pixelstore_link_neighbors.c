@@ -0,0 +1,122 @@
+/*
+ * test_pixelstore_link_neighbors.c
+ *
+ * Link a store of random samples with 1 and 4 threads. Every pixel must
+ * be linked to its existing neighbors, as given by neighbours_nest64() and
+ * PixelStore_get(). Then check that samples on both sides of a pixel
+ * border are matched.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "../src/scamp.h"
+#include "../src/mem.h"
+#include "../src/catalog.h"
+#include "../src/crossmatch.h"
+#include "../src/pixelstore.h"
+#include "../src/chealpix.h"
+
+#include "fixture.h"
+
+#define NSAMPLES 50000
+
+static int
+check_links(PixelStore *store) {
+    long i;
+    int k;
+    int64_t nb[8];
+
+    for (i=0; i<store->npixels; i++) {
+        HealPixel *pix = PixelStore_get(store, store->pixelids[i]);
+        neighbours_nest64(store->nsides, pix->id, nb);
+        for (k=0; k<8; k++) {
+            HealPixel *expected = nb[k] < 0 ? NULL :
+                PixelStore_get(store, nb[k]);
+            if (pix->pneighbors[k] != expected)
+                return 1;
+            if (expected &&
+                    store->pixelarray[pix->nbindex[k]] != expected)
+                return 1;
+            if (!expected && pix->nbindex[k] != -1)
+                return 1;
+        }
+    }
+    for (i=1; i<store->npixels; i++)
+        if (store->pixelarray[i-1]->id >= store->pixelarray[i]->id)
+            return 1;
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int i;
+    long nsides = pow(2, 8);
+    Field field, pair[2];
+    Sample spl;
+
+    Fixture_seed(13);
+
+    /* sparse enough to have missing neighbors */
+    PixelStore *store = PixelStore_new(nsides);
+    Fixture_field(&field, 1, NSAMPLES);
+    for (i=0; i<NSAMPLES; i++) {
+        spl.id = i;
+        spl.lon = SC_TWOPI * Fixture_rnd();
+        spl.col = acos(1 - 2 * Fixture_rnd());
+        spl.set = &field.sets[0];
+        PixelStore_add(store, spl, &field.sets[0].samples[i]);
+    }
+
+    PixelStore_linkNeighbors(store, 1);
+    if (check_links(store)) {
+        fprintf(stderr, "bad links with 1 thread\n");
+        return 1;
+    }
+    PixelStore_linkNeighbors(store, 4);
+    if (check_links(store)) {
+        fprintf(stderr, "bad links with 4 threads\n");
+        return 1;
+    }
+
+    Catalog_freeField(&field);
+    PixelStore_free(store);
+
+    /* two samples 1 arcsec apart, on each side of a pixel border */
+    int64_t nsides16 = pow(2, 16), p0, p1;
+    double step = 0.1 / 3600 * TO_RAD, lon = 0.3, col = 1.0;
+    ang2pix_nest64(nsides16, col, lon, &p0);
+    do {
+        lon += step;
+        ang2pix_nest64(nsides16, col, lon, &p1);
+    } while (p1 == p0);
+
+    store = PixelStore_new(nsides16);
+    for (i=0; i<2; i++) {
+        Fixture_field(&pair[i], 1, 1);
+        spl.id = 0;
+        spl.lon = lon + (i ? 5 : -5) * step;
+        spl.col = col;
+        spl.set = &pair[i].sets[0];
+        PixelStore_add(store, spl, &pair[i].sets[0].samples[0]);
+    }
+    if (pair[0].sets[0].samples[0]->pix_nest ==
+            pair[1].sets[0].samples[0]->pix_nest) {
+        fprintf(stderr, "samples should be in different pixels\n");
+        return 1;
+    }
+
+    Crossmatch_crossSamples(store, 2.0, 2);
+    if (pair[0].sets[0].samples[0]->bestMatch != pair[1].sets[0].samples[0] ||
+            pair[1].sets[0].samples[0]->bestMatch != pair[0].sets[0].samples[0]) {
+        fprintf(stderr, "samples in neighbor pixels not matched\n");
+        return 1;
+    }
+
+    for (i=0; i<2; i++)
+        Catalog_freeField(&pair[i]);
+    PixelStore_free(store);
+
+    return 0;
+}
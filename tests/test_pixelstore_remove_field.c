@@ -0,0 +1,174 @@
+/*
+ * test_pixelstore_remove_field.c
+ *
+ * Sliding window of three fields over the same catalog. Remove the oldest
+ * field and check that the remaining matches point to live samples of
+ * resident fields, within the radius. Add a new one and crossmatch again:
+ * every sample should match a sample of another resident field. Removing
+ * every field should leave an empty store.
+ *
+ * Take a single argument with the ascii catalog to test against.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "../src/scamp.h"
+#include "../src/mem.h"
+#include "../src/catalog.h"
+#include "../src/crossmatch.h"
+#include "../src/pixelstore.h"
+#include "../src/chealpix.h"
+
+extern void test_Catalog_open_ascii(char*, Field*, PixelStore*);
+
+#define WINDOW 3
+#define NFIELDS 6
+
+static int
+check_field(Field *field, Field *removed)
+{
+    int i, j;
+    Sample *spl;
+
+    for (i=0; i<field->nsets; i++) {
+        for (j=0; j<field->sets[i].nsamples; j++) {
+            spl = field->sets[i].samples[j];
+            if (spl->set != &field->sets[i]) {
+                fprintf(stderr, "sample %i do not belong to his set\n", j);
+                return 1;
+            }
+            if (spl->bestMatch == NULL) {
+                fprintf(stderr, "sample %li have no match\n", spl->id);
+                return 1;
+            }
+            if (spl->bestMatch->set->field == removed ||
+                    spl->bestMatch->set->field == field) {
+                fprintf(stderr, "sample %li have a wrong match\n", spl->id);
+                return 1;
+            }
+            if (spl->bestMatch->id != spl->id) {
+                fprintf(stderr, "sample %li match %li\n", spl->id,
+                        spl->bestMatch->id);
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Return 1 if "match" is not one of the samples stored in the pixel of
+ * "spl" or in its neighbors, without dereferencing it.
+ */
+static int
+dead_match(PixelStore *store, Sample *spl, Sample *match)
+{
+    long ids[9];
+    HealPixel *pix;
+    int i;
+
+    neighbours_nest64(store->nsides, spl->pix_nest, ids);
+    ids[8] = spl->pix_nest;
+    for (i=0; i<9; i++) {
+        if (ids[i] < 0 || (pix = PixelStore_get(store, ids[i])) == NULL)
+            continue;
+        if (match >= pix->samples && match < pix->samples + pix->nsamples)
+            return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * After PixelStore_removeField(), matches of the remaining samples must
+ * point to live samples of another resident field, within the radius.
+ */
+static int
+check_remaining(PixelStore *store, Field *field, Field *removed)
+{
+    int i, j;
+    Sample *spl, *match;
+
+    for (i=0; i<field->nsets; i++) {
+        for (j=0; j<field->sets[i].nsamples; j++) {
+            spl = field->sets[i].samples[j];
+            match = spl->bestMatch;
+            if (match == NULL)
+                continue;
+            if (dead_match(store, spl, match)) {
+                fprintf(stderr, "sample %li match a dead sample\n", spl->id);
+                return 1;
+            }
+            if (match->set->field == removed) {
+                fprintf(stderr, "dangling match to removed field\n");
+                return 1;
+            }
+            if (match->set->field == field) {
+                fprintf(stderr, "sample %li match its own field\n", spl->id);
+                return 1;
+            }
+            if (euclidean_distance(spl->vector, match->vector) >
+                    store->maxradius) {
+                fprintf(stderr, "sample %li match out of radius\n", spl->id);
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int i, j;
+    long nsides = pow(2, 13);
+    long npixels;
+    double radius_arcsec = 2.0;
+    Field fields[NFIELDS];
+
+    PixelStore *store = PixelStore_new(nsides);
+
+    for (i=0; i<WINDOW; i++)
+        test_Catalog_open_ascii(argv[1], &fields[i], store);
+    Crossmatch_crossSamples(store, radius_arcsec, 4);
+    npixels = store->npixels;
+
+    for (i=WINDOW; i<NFIELDS; i++) {
+
+        /* remove the oldest field, remaining matches must be valid */
+        PixelStore_removeField(store, &fields[i - WINDOW]);
+        for (j=i - WINDOW + 1; j<i; j++)
+            if (check_remaining(store, &fields[j], &fields[i - WINDOW]))
+                return 1;
+        Catalog_freeField(&fields[i - WINDOW]);
+
+        test_Catalog_open_ascii(argv[1], &fields[i], store);
+        Crossmatch_crossSamples(store, radius_arcsec, 4);
+
+        if (store->npixels != npixels) {
+            fprintf(stderr, "have %li pixels when %li expected\n",
+                    store->npixels, npixels);
+            return 1;
+        }
+
+        for (j=i - WINDOW + 1; j<=i; j++)
+            if (check_field(&fields[j], &fields[i - WINDOW]))
+                return 1;
+    }
+
+    for (i=NFIELDS - WINDOW; i<NFIELDS; i++) {
+        PixelStore_removeField(store, &fields[i]);
+        Catalog_freeField(&fields[i]);
+    }
+
+    if (store->npixels != 0 || store->pixels != NULL) {
+        fprintf(stderr, "store should be empty, have %li pixels\n",
+                store->npixels);
+        return 1;
+    }
+
+    PixelStore_free(store);
+    return 0;
+}
@@ -0,0 +1,220 @@
+/*
+ * test_query.c
+ *
+ * Query positions close to random samples, and random positions, in a
+ * store before and after it is linked: the nearest sample must be the one
+ * found by brute force. Then query the linked store from several threads
+ * at once and check that the answers do not change. Finally run the same
+ * queries as batched cone searches: results must be the samples found by
+ * brute force within the radius.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <math.h>
+
+#include "../src/scamp.h"
+#include "../src/mem.h"
+#include "../src/chealpix.h"
+#include "../src/pixelstore.h"
+#include "../src/crossmatch.h"
+
+#include "fixture.h"
+
+#define NSAMPLES 20000
+#define NQUERIES 4000
+#define NTHREADS 4
+#define RADIUS_ARCSEC 2.0
+
+static Sample *samples;
+static double qra[NQUERIES], qdec[NQUERIES];
+static Sample *expected[NQUERIES];
+
+struct query_args {
+    PixelStore  *store;
+    int         errors;
+};
+
+/* a 0.1 x 0.1 degree patch */
+static void
+random_position(double *ra, double *dec) {
+    *ra = 40 + 0.1 * Fixture_rnd();
+    *dec = 40 + 0.1 * Fixture_rnd();
+}
+
+/* the euclidean distance of unit vectors RADIUS_ARCSEC apart */
+static double
+chord_radius() {
+    double va[3], vb[3];
+    ang2vec(0, 0, va);
+    ang2vec(RADIUS_ARCSEC / 3600 * TO_RAD, 0, vb);
+    return euclidean_distance(va, vb);
+}
+
+static Sample*
+brute_force(double ra, double dec) {
+    double v[3], d, best = chord_radius();
+    Sample *nearest = NULL;
+    long i;
+
+    ang2vec(SC_HALFPI - dec * TO_RAD, ra * TO_RAD, v);
+    for (i=0; i<NSAMPLES; i++) {
+        double *w = samples[i].vector;
+        d = sqrt((v[0] - w[0]) * (v[0] - w[0]) + (v[1] - w[1]) * (v[1] - w[1])
+                + (v[2] - w[2]) * (v[2] - w[2]));
+        if (d < best) {
+            best = d;
+            nearest = &samples[i];
+        }
+    }
+
+    return nearest;
+}
+
+static int
+cmp_long(const void *a, const void *b) {
+    long x = *(const long*) a, y = *(const long*) b;
+    return (x > y) - (x < y);
+}
+
+/* check the cones of the "n" first queries */
+static int
+check_cones(CrossmatchCones *cones, long n) {
+    double v[3], d, radius = chord_radius();
+    long ids[64], got[64], nids, first, i, j, q;
+
+    if (cones->nqueries != n || cones->offsets[0] != 0 ||
+            cones->offsets[n] != cones->nresults)
+        return 1;
+
+    for (q=0; q<n; q++) {
+        ang2vec(SC_HALFPI - qdec[q] * TO_RAD, qra[q] * TO_RAD, v);
+        for (i=0, nids=0; i<NSAMPLES; i++) {
+            double *w = samples[i].vector;
+            d = sqrt((v[0] - w[0]) * (v[0] - w[0]) +
+                    (v[1] - w[1]) * (v[1] - w[1]) +
+                    (v[2] - w[2]) * (v[2] - w[2]));
+            if (d < radius && nids < 64)
+                ids[nids++] = samples[i].id;
+        }
+
+        if (cones->offsets[q + 1] - cones->offsets[q] != nids)
+            return 1;
+        first = cones->offsets[q];
+        for (j=0; j<nids; j++) {
+            got[j] = cones->samples[first + j]->id;
+            if (cones->distances[first + j] >= radius)
+                return 1;
+        }
+        qsort(ids, nids, sizeof(long), cmp_long);
+        qsort(got, nids, sizeof(long), cmp_long);
+        if (memcmp(ids, got, sizeof(long) * nids) != 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+static int
+check_queries(PixelStore *store) {
+    double d;
+    int i;
+
+    for (i=0; i<NQUERIES; i++) {
+        Sample *spl = Crossmatch_nearest(store, qra[i], qdec[i],
+                RADIUS_ARCSEC, &d);
+        if ((spl == NULL) != (expected[i] == NULL))
+            return 1;
+        if (spl && (spl->id != expected[i]->id || d >= chord_radius()))
+            return 1;
+    }
+
+    return 0;
+}
+
+static void*
+query_thread(void *args) {
+    struct query_args *qa = args;
+    qa->errors = check_queries(qa->store);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    pthread_t threads[NTHREADS];
+    struct query_args args[NTHREADS];
+    Sample **exts = ALLOC(sizeof(Sample*) * NSAMPLES);
+    int i, t, nfound = 0;
+
+    Fixture_seed(47);
+
+    PixelStore *store = PixelStore_new(pow(2, 16));
+    samples = ALLOC(sizeof(Sample) * NSAMPLES);
+    for (i=0; i<NSAMPLES; i++) {
+        Sample spl;
+        memset(&spl, 0, sizeof(Sample));
+        spl.id = i;
+        random_position(&spl.ra, &spl.dec);
+        spl.lon = spl.ra * TO_RAD;
+        spl.col = SC_HALFPI - spl.dec * TO_RAD;
+        PixelStore_add(store, spl, &exts[i]);
+    }
+    /* brute force reference, in vectors as stored */
+    for (i=0; i<NSAMPLES; i++)
+        samples[i] = *exts[i];
+
+    /* half close to a sample, half anywhere in the patch */
+    for (i=0; i<NQUERIES; i++) {
+        if (i % 2) {
+            Sample *spl = &samples[(long) (Fixture_rnd() * NSAMPLES)];
+            qra[i] = spl->ra + (Fixture_rnd() - 0.5) * 2 / 3600;
+            qdec[i] = spl->dec + (Fixture_rnd() - 0.5) * 2 / 3600;
+        } else {
+            random_position(&qra[i], &qdec[i]);
+        }
+        expected[i] = brute_force(qra[i], qdec[i]);
+        nfound += expected[i] != NULL;
+    }
+    if (nfound < NQUERIES / 2)
+        return 1;
+
+    /* no match far from the samples */
+    if (Crossmatch_nearest(store, 200, -30, RADIUS_ARCSEC, NULL))
+        return 1;
+
+    if (check_queries(store))
+        return 1;
+
+    PixelStore_linkNeighbors(store, 2);
+    if (check_queries(store))
+        return 1;
+
+    for (t=0; t<NTHREADS; t++) {
+        args[t].store = store;
+        pthread_create(&threads[t], NULL, query_thread, &args[t]);
+    }
+    for (t=0; t<NTHREADS; t++) {
+        pthread_join(threads[t], NULL);
+        if (args[t].errors)
+            return 1;
+    }
+
+    /* the arrays of a first search are reused by the second one */
+    CrossmatchCones cones;
+    memset(&cones, 0, sizeof(CrossmatchCones));
+    if (Crossmatch_coneSearch(store, qra, qdec, NQUERIES, RADIUS_ARCSEC,
+                NTHREADS, &cones) < nfound || check_cones(&cones, NQUERIES))
+        return 1;
+    Crossmatch_coneSearch(store, qra, qdec, NQUERIES / 3, RADIUS_ARCSEC, 3,
+            &cones);
+    if (check_cones(&cones, NQUERIES / 3))
+        return 1;
+    Crossmatch_freeCones(&cones);
+
+    PixelStore_free(store);
+    FREE(samples);
+    FREE(exts);
+
+    return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * test_refmatch.c
+ *
+ * Check the reference matcher against an all pairs loop, then the
+ * crossmatch engines against the reference, around the pole and the
+ * ra = 0 meridian.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/scamp.h"
+#include "../src/mem.h"
+#include "../src/catalog.h"
+#include "../src/asciicat.h"
+#include "../src/crossmatch.h"
+#include "../src/pixelstore.h"
+#include "../src/refmatch.h"
+#include "gencat.h"
+
+#define NFIELDS 3
+
+static double
+dist(double *a, double *b) {
+    double x = a[0] - b[0], y = a[1] - b[1], z = a[2] - b[2];
+    return sqrt(x*x + y*y + z*z);
+}
+
+/* all pairs */
+static int
+check_pairs(RefMatch *ref, double radius_arcsec) {
+    double maxradius = 2 * sin(radius_arcsec / 3600 * TO_RAD / 2);
+    long i, j;
+
+    for (i=0; i<ref->nsamples; i++) {
+        Sample *a = ref->samples[i], *best = NULL;
+        double bestdist = maxradius;
+        for (j=0; j<ref->nsamples; j++) {
+            Sample *b = ref->samples[j];
+            if (a->set->field == b->set->field)
+                continue;
+            double d = dist(a->vector, b->vector);
+            if (d < bestdist) {
+                bestdist = d;
+                best = b;
+            }
+        }
+        if (best != ref->matches[i] &&
+                !(best && ref->matches[i] &&
+                    fabs(ref->distances[i] - bestdist) < 1e-15))
+            return 1;
+    }
+
+    return 0;
+}
+
+static int
+check(const char *center, long nsources, int nclusters, int pairs) {
+    GenCatConfig config = GenCat_defaultConfig;
+    Field fields[NFIELDS];
+    char path[64];
+    int f, engine, nthreads;
+
+    config.nsources = nsources;
+    config.nfields = NFIELDS;
+    config.nclusters = nclusters;
+    config.format = GENCAT_ASCII;
+    GenCat_setCenter(&config, (char*) center);
+
+    PixelStore *store = PixelStore_new(pow(2, 15));
+    for (f=0; f<NFIELDS; f++) {
+        snprintf(path, sizeof(path), "/tmp/scamp-test-refmatch_%i.txt", f);
+        if (!GenCat_write(&config, f, path))
+            return 1;
+        AsciiCat_open(path, &fields[f], store);
+        remove(path);
+    }
+
+    RefMatch *ref = RefMatch_crossFields(fields, NFIELDS, 2.0, 1);
+    RefMatch *ref4 = RefMatch_crossFields(fields, NFIELDS, 2.0, 4);
+    if (ref->nsamples != NFIELDS * nsources ||
+            memcmp(ref->matches, ref4->matches,
+                sizeof(Sample*) * ref->nsamples) != 0)
+        return 1;
+    if (pairs && check_pairs(ref, 2.0))
+        return 1;
+
+    long nmatches = 0, i;
+    for (i=0; i<ref->nsamples; i++)
+        if (ref->matches[i])
+            nmatches++;
+    if (nmatches < config.matches * ref->nsamples * 0.9)
+        return 1;
+
+    for (engine=CROSSMATCH_LOCKED; engine<=CROSSMATCH_ATOMIC; engine++) {
+        Crossmatch_setEngine(engine);
+        for (nthreads=1; nthreads<=3; nthreads+=2) {
+            Crossmatch_crossSamples(store, 2.0, nthreads);
+            RefMatchDiff diff = RefMatch_compare(ref, 1e-6, stderr, 5);
+            if (diff.nmissing || diff.nextra || diff.nwrong ||
+                    diff.nsame + diff.nties != ref->nsamples) {
+                fprintf(stderr, "%s: engine %i, %i threads differs\n",
+                        center, engine, nthreads);
+                return 1;
+            }
+        }
+    }
+
+    RefMatch_free(ref);
+    RefMatch_free(ref4);
+    for (f=0; f<NFIELDS; f++)
+        Catalog_freeField(&fields[f]);
+    PixelStore_free(store);
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (check("pole", 1500, 4, 1))
+        return 1;
+    if (check("wrap", 1500, 0, 1))
+        return 1;
+    if (check("face", 30000, 8, 0))
+        return 1;
+
+    return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * test_server.c
+ *
+ * Serve a snapshot of the ASCII catalog given from a child process. Ask
+ * for the matches of the same catalog, of a batch of perturbed reference
+ * positions, of a missing catalog, of a directory the loader aborts on and
+ * of positions out of the sphere: matches must be the ones of a direct
+ * Snapshot_crossSamples, and the server must survive the failed requests.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "../src/scamp.h"
+#include "../src/mem.h"
+#include "../src/asciicat.h"
+#include "../src/pixelstore.h"
+#include "../src/snapshot.h"
+#include "../src/server.h"
+
+#define NPOINTS 200
+#define RADIUS_ARCSEC 2.0
+
+static int
+connect_retry(char *path) {
+    int i, fd;
+    for (i=0; i<500; i++) {
+        if ((fd = Server_connect(path)) >= 0)
+            return fd;
+        usleep(10000);
+    }
+    return -1;
+}
+
+int main(int argc, char **argv) {
+    char snappath[] = "/tmp/scamp-test-server.snp";
+    char sockpath[] = "/tmp/scamp-test-server.sock";
+    char dirpath[] = "/tmp/scamp-test-server.dir";
+    ServerMatch *matches;
+    ServerPoint points[NPOINTS];
+    Field field;
+    long i, n;
+    int status;
+
+    if (argc < 2)
+        return 1;
+
+    PixelStore *store = PixelStore_new(pow(2, 16));
+    AsciiCat_open(argv[1], &field, store);
+    if (!Snapshot_write(snappath, store, &field, 1, 2))
+        return 1;
+    Snapshot *ref = Snapshot_open(snappath);
+    remove(snappath);
+    if (!ref || ref->nsamples < NPOINTS)
+        return 1;
+
+    /* expected matches of the catalog with itself */
+    long nexpected = Snapshot_crossSamples(ref, store, RADIUS_ARCSEC, 2);
+
+    pid_t pid = fork();
+    if (pid == 0)
+        exit(Server_run(sockpath, ref, AsciiCat_openWith, RADIUS_ARCSEC, 2) ?
+                0 : 1);
+
+    int fd = connect_retry(sockpath);
+    if (fd < 0)
+        return 1;
+
+    /* every sample matches itself, or a sample at the same position */
+    n = Server_matchFile(fd, argv[1], &matches);
+    if (n != nexpected || n != field.sets[0].nsamples)
+        return 1;
+    for (i=0; i<n; i++) {
+        Sample *spl = field.sets[0].samples[matches[i].row];
+        if ((i > 0 && matches[i].row <= matches[i-1].row) ||
+                matches[i].set != 0 || matches[i].reffield != 0 ||
+                matches[i].ref != spl->refMatch ||
+                matches[i].refid != ref->ids[spl->refMatch] ||
+                matches[i].distance != spl->bestMatchDistance)
+            return 1;
+    }
+    FREE(matches);
+
+    /* the connection is still usable after a failed request */
+    if (Server_matchFile(fd, "/nonexistent/catalog.txt", &matches) != -1)
+        return 1;
+
+    /* a readable file the loader aborts on, then the catalog again */
+    mkdir(dirpath, 0700);
+    n = Server_matchFile(fd, dirpath, &matches);
+    rmdir(dirpath);
+    if (n != -1)
+        return 1;
+    n = Server_matchFile(fd, argv[1], &matches);
+    if (n != nexpected)
+        return 1;
+    FREE(matches);
+
+    /* reference positions moved by 0.5 arcsec, and far away ones */
+    for (i=0; i<NPOINTS; i++) {
+        long s = i * (ref->nsamples / NPOINTS);
+        points[i].ra = ref->ra[s];
+        points[i].dec = ref->dec[s] + (i % 2 ? 0.5 / 3600 : 10.0);
+    }
+    n = Server_matchPoints(fd, points, NPOINTS, &matches);
+    if (n < NPOINTS / 2)
+        return 1;
+    for (i=0; i<n; i++) {
+        long s = matches[i].row * (ref->nsamples / NPOINTS);
+        if (matches[i].row % 2 == 0 ||
+                matches[i].distance > 0.5 / 3600 * TO_RAD * 1.001 ||
+                (matches[i].ref != s &&
+                 matches[i].distance > 0.5 / 3600 * TO_RAD * 0.999))
+            return 1;
+    }
+    FREE(matches);
+
+    /* a bad position fails the request, the same batch then succeeds */
+    ServerPoint good = points[1];
+    points[1].dec = 100;
+    if (Server_matchPoints(fd, points, NPOINTS, &matches) != -1)
+        return 1;
+    points[1].dec = NAN;
+    if (Server_matchPoints(fd, points, NPOINTS, &matches) != -1)
+        return 1;
+    points[1] = good;
+    points[2].ra = INFINITY;
+    if (Server_matchPoints(fd, points, NPOINTS, &matches) != -1)
+        return 1;
+    points[2].ra = ref->ra[2 * (ref->nsamples / NPOINTS)];
+    if (Server_matchPoints(fd, points, NPOINTS, &matches) != n)
+        return 1;
+    FREE(matches);
+    Server_stop(fd);
+
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != 0 || access(sockpath, F_OK) == 0)
+        return 1;
+
+    Catalog_freeField(&field);
+    PixelStore_free(store);
+    Snapshot_close(ref);
+
+    return 0;
+}
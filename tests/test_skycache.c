@@ -0,0 +1,140 @@
+/*
+ * test_skycache.c
+ *
+ * Load a generated ASCII catalog, write it to the cache, and reload it in
+ * stores of the same and of a different nsides: samples and coverage must
+ * be the same. Cache files of other keys, and damaged ones, must be
+ * ignored.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "../src/scamp.h"
+#include "../src/mem.h"
+#include "../src/catalog.h"
+#include "../src/asciicat.h"
+#include "../src/skycache.h"
+#include "../src/moc.h"
+#include "../src/pixelstore.h"
+
+#include "fixture.h"
+
+#define NSAMPLES 100000
+
+/* samples of a 1 x 1 degree field */
+static void
+write_catalog(char *path) {
+    FILE *fp = fopen(path, "w");
+    int i;
+
+    for (i=0; i<NSAMPLES; i++)
+        fprintf(fp, "%i %.17g %.17g\n", i, (120 + Fixture_rnd()) * TO_RAD,
+                (60 + Fixture_rnd()) * TO_RAD);
+    fclose(fp);
+}
+
+static int
+compare_fields(Field *a, Field *b, int64_t nsides, int shift) {
+    int i, c;
+
+    if (b->nsets != 1 || b->sets[0].nsamples != a->sets[0].nsamples)
+        return 1;
+    if (b->sets[0].wcs != NULL || b->sets[0].field != b)
+        return 1;
+    if (Moc_npixels(a->moc) != Moc_npixels(b->moc))
+        return 1;
+
+    for (i=0; i<a->sets[0].nsamples; i++) {
+        Sample *x = a->sets[0].samples[i], *y = b->sets[0].samples[i];
+        if (x->id != y->id || x->ra != y->ra || x->dec != y->dec ||
+                fabs(x->lon - y->lon) > 1e-14 ||
+                fabs(x->col - y->col) > 1e-14 ||
+                y->set != &b->sets[0] || y->bestMatch != NULL)
+            return 1;
+        for (c=0; c<3; c++)
+            if (x->vector[c] != y->vector[c])
+                return 1;
+        /* pixels of a coarser store */
+        if (x->pix_nest >> shift != y->pix_nest)
+            return 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    char dir[] = "/tmp/scamp-test-skycache-XXXXXX";
+    char path[] = "/tmp/scamp-test-skycache.txt";
+    char cache[4096];
+    Field field, cached;
+
+    Fixture_seed(38);
+
+    if (!mkdtemp(dir))
+        return 1;
+    write_catalog(path);
+
+    PixelStore *store = PixelStore_new(pow(2, 16));
+    AsciiCat_open(path, &field, store);
+
+    if (SkyCache_enabled())
+        return 1;
+    SkyCache_setDir(dir);
+    if (!SkyCache_enabled())
+        return 1;
+
+    uint64_t key = SkyCache_key(path, 0);
+    if (SkyCache_key(path, 0) != key || SkyCache_key(path, 1) == key)
+        return 1;
+    if (SkyCache_load(key, &cached, store))
+        return 1;
+    SkyCache_save(key, &field, store);
+
+    /* same nsides, pixels and vectors are used as is */
+    PixelStore *same = PixelStore_new(pow(2, 16));
+    if (!SkyCache_load(key, &cached, same))
+        return 1;
+    if (compare_fields(&field, &cached, same->nsides, 0)) {
+        fprintf(stderr, "bad samples with the same nsides\n");
+        return 1;
+    }
+    Catalog_freeField(&cached);
+    PixelStore_free(same);
+
+    /* other nsides, pixels are computed again */
+    PixelStore *coarse = PixelStore_new(pow(2, 12));
+    if (!SkyCache_load(key, &cached, coarse))
+        return 1;
+    if (compare_fields(&field, &cached, coarse->nsides, 8)) {
+        fprintf(stderr, "bad samples with another nsides\n");
+        return 1;
+    }
+    Catalog_freeField(&cached);
+    PixelStore_free(coarse);
+
+    /* other key */
+    PixelStore *other = PixelStore_new(pow(2, 16));
+    if (SkyCache_load(SkyCache_key(path, 1), &cached, other))
+        return 1;
+
+    /* truncated file */
+    snprintf(cache, sizeof(cache), "%s/%016llx.skc", dir,
+            (unsigned long long) key);
+    if (truncate(cache, 1000) != 0)
+        return 1;
+    if (SkyCache_load(key, &cached, other))
+        return 1;
+    PixelStore_free(other);
+
+    Catalog_freeField(&field);
+    PixelStore_free(store);
+    remove(cache);
+    remove(path);
+    rmdir(dir);
+
+    return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * test_snapshot.c
+ *
+ * Write a snapshot of a store of random samples, map it, and check its
+ * columns against the store. Then cross match perturbed copies of some
+ * samples, and random ones, with the snapshot: matches must be the ones
+ * found by brute force.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/scamp.h"
+#include "../src/mem.h"
+#include "../src/catalog.h"
+#include "../src/pixelstore.h"
+#include "../src/snapshot.h"
+
+#include "fixture.h"
+
+#define NSAMPLES 20000
+#define NQUERIES 4000
+
+/* a 2 x 2 degrees patch */
+static void
+random_sample(Sample *spl) {
+    spl->lon = (40 + 2 * Fixture_rnd()) * TO_RAD;
+    spl->col = (50 + 2 * Fixture_rnd()) * TO_RAD;
+    spl->ra = spl->lon / TO_RAD;
+    spl->dec = 90 - spl->col / TO_RAD;
+}
+
+static int
+check_columns(Snapshot *snap, PixelStore *store, Field *fields) {
+    long i, j, s;
+
+    if (snap->npixels != store->npixels || snap->nsamples != NSAMPLES ||
+            snap->nfields != 2 || snap->nsets != 3 ||
+            snap->setfields[0] != 0 || snap->setfields[1] != 1 ||
+            snap->setfields[2] != 1)
+        return 1;
+
+    for (i=0, s=0; i<snap->npixels; i++) {
+        HealPixel *pix = PixelStore_get(store, snap->pixelids[i]);
+        if ((i > 0 && snap->pixelids[i] <= snap->pixelids[i-1]) || !pix ||
+                snap->offsets[i+1] - snap->offsets[i] != pix->nsamples)
+            return 1;
+        if (Snapshot_find(snap, snap->pixelids[i]) != i)
+            return 1;
+
+        for (j=0; j<pix->nsamples; j++, s++) {
+            Sample *spl = &pix->samples[j];
+            int set = spl->set == &fields[0].sets[0] ? 0 :
+                (spl->set == &fields[1].sets[0] ? 1 : 2);
+            if (snap->ids[s] != spl->id || snap->ra[s] != spl->ra ||
+                    snap->dec[s] != spl->dec || snap->sets[s] != set ||
+                    memcmp(&snap->vectors[3*s], spl->vector, 24) != 0)
+                return 1;
+        }
+    }
+
+    return 0;
+}
+
+static double
+dist(const double *a, const double *b) {
+    double x = a[0] - b[0], y = a[1] - b[1], z = a[2] - b[2];
+    return sqrt(x * x + y * y + z * z);
+}
+
+int main(int argc, char **argv) {
+    char path[] = "/tmp/scamp-test-snapshot.snp";
+    int64_t nsides = pow(2, 12);
+    double radius_arcsec = 2.0;
+    Field fields[2], query;
+    Sample spl, refs[NSAMPLES];
+    long i, j;
+
+    Fixture_seed(39);
+
+    /* field 0 has one set, field 1 two */
+    PixelStore *store = PixelStore_new(nsides);
+    Fixture_field(&fields[0], 1, NSAMPLES / 2);
+    Fixture_field(&fields[1], 2, NSAMPLES / 4);
+    for (i=0; i<NSAMPLES; i++) {
+        Set *set = i < NSAMPLES / 2 ? &fields[0].sets[0] :
+            &fields[1].sets[i < 3 * NSAMPLES / 4 ? 0 : 1];
+        long row = i < NSAMPLES / 2 ? i : (i - NSAMPLES / 2) % (NSAMPLES / 4);
+        random_sample(&spl);
+        spl.id = i;
+        spl.set = set;
+        refs[i] = spl;
+        PixelStore_add(store, spl, &set->samples[row]);
+    }
+
+    if (!Snapshot_write(path, store, fields, 2, 4))
+        return 1;
+    Snapshot *snap = Snapshot_open(path);
+    if (!snap)
+        return 1;
+    if (check_columns(snap, store, fields)) {
+        fprintf(stderr, "bad snapshot columns\n");
+        return 1;
+    }
+
+    /* half moved copies of reference samples, half random */
+    PixelStore *qstore = PixelStore_new(nsides);
+    Fixture_field(&query, 1, NQUERIES);
+    for (i=0; i<NQUERIES; i++) {
+        if (i % 2) {
+            spl = refs[(i * 7919) % NSAMPLES];
+            spl.col += 1.5 * Fixture_rnd() / 3600 * TO_RAD;
+        } else {
+            random_sample(&spl);
+        }
+        spl.id = i;
+        spl.set = &query.sets[0];
+        PixelStore_add(qstore, spl, &query.sets[0].samples[i]);
+    }
+
+    long nmatches = Snapshot_crossSamples(snap, qstore, radius_arcsec, 3);
+    if (nmatches < NQUERIES / 2)
+        return 1;
+
+    long nbrute = 0;
+    for (i=0; i<NQUERIES; i++) {
+        Sample *q = query.sets[0].samples[i];
+        double best = qstore->maxradius;
+        long ibest = -1;
+        for (j=0; j<snap->nsamples; j++) {
+            double d = dist(q->vector, &snap->vectors[3*j]);
+            if (d < best) {
+                best = d;
+                ibest = j;
+            }
+        }
+        if (ibest >= 0)
+            nbrute++;
+        if (q->refMatch != ibest ||
+                (ibest >= 0 && q->bestMatchDistance != best)) {
+            fprintf(stderr, "query %li: match %li, expected %li\n",
+                    i, q->refMatch, ibest);
+            return 1;
+        }
+    }
+    if (nbrute != nmatches)
+        return 1;
+
+    Snapshot_close(snap);
+
+    /* not a snapshot */
+    FILE *fp = fopen(path, "w");
+    fprintf(fp, "not a snapshot\n");
+    fclose(fp);
+    if (Snapshot_open(path))
+        return 1;
+    remove(path);
+
+    Catalog_freeField(&query);
+    Catalog_freeField(&fields[0]);
+    Catalog_freeField(&fields[1]);
+    PixelStore_free(qstore);
+    PixelStore_free(store);
+
+    return 0;
+}
@@ -79,6 +79,258 @@ else
 	printf "%-70s %10s\n" "===> Test for testSingleCatCrossmatchAscii" "SUCCESS"
 fi
 
+echo "==> Running testPixelstoreRemoveField"
+${DIR}/testPixelstoreRemoveField ${DIR}/data/asciicat/t4_cat.txt > /dev/null
+if [ $? -gt 0 ]
+then 
+	printf "%-70s %10s\n" "===> Test for testPixelstoreRemoveField" "FAILED"
+	STATUS=1
+else
+	printf "%-70s %10s\n" "===> Test for testPixelstoreRemoveField" "SUCCESS"
+fi
+
+
+echo "==> Running testChunkstoreCrossmatch"
+${DIR}/testChunkstoreCrossmatch > /dev/null
+if [ $? -gt 0 ]
+then 
+	printf "%-70s %10s\n" "===> Test for testChunkstoreCrossmatch" "FAILED"
+	STATUS=1
+else
+	printf "%-70s %10s\n" "===> Test for testChunkstoreCrossmatch" "SUCCESS"
+fi
+
+
+echo "==> Running testPartitionCrossmatch"
+${DIR}/testPartitionCrossmatch > /dev/null
+if [ $? -gt 0 ]
+then 
+	printf "%-70s %10s\n" "===> Test for testPartitionCrossmatch" "FAILED"
+	STATUS=1
+else
+	printf "%-70s %10s\n" "===> Test for testPartitionCrossmatch" "SUCCESS"
+fi
+
+
+echo "==> Running testPipelineCrossmatch"
+${DIR}/testPipelineCrossmatch > /dev/null
+if [ $? -gt 0 ]
+then 
+	printf "%-70s %10s\n" "===> Test for testPipelineCrossmatch" "FAILED"
+	STATUS=1
+else
+	printf "%-70s %10s\n" "===> Test for testPipelineCrossmatch" "SUCCESS"
+fi
+
+
+echo "==> Running testCrossmatchAtomic"
+${DIR}/testCrossmatchAtomic > /dev/null
+if [ $? -gt 0 ]
+then 
+	printf "%-70s %10s\n" "===> Test for testCrossmatchAtomic" "FAILED"
+	STATUS=1
+else
+	printf "%-70s %10s\n" "===> Test for testCrossmatchAtomic" "SUCCESS"
+fi
+
+
+echo "==> Running testChealpixBatch"
+${DIR}/testChealpixBatch > /dev/null
+if [ $? -gt 0 ]
+then 
+	printf "%-70s %10s\n" "===> Test for testChealpixBatch" "FAILED"
+	STATUS=1
+else
+	printf "%-70s %10s\n" "===> Test for testChealpixBatch" "SUCCESS"
+fi
+
+
+echo "==> Running testChealpixBmi2"
+${DIR}/testChealpixBmi2 > /dev/null
+if [ $? -gt 0 ]
+then 
+	printf "%-70s %10s\n" "===> Test for testChealpixBmi2" "FAILED"
+	STATUS=1
+else
+	printf "%-70s %10s\n" "===> Test for testChealpixBmi2" "SUCCESS"
+fi
+
+
+echo "==> Running testPixelstoreLinkNeighbors"
+${DIR}/testPixelstoreLinkNeighbors > /dev/null
+if [ $? -gt 0 ]
+then 
+	printf "%-70s %10s\n" "===> Test for testPixelstoreLinkNeighbors" "FAILED"
+	STATUS=1
+else
+	printf "%-70s %10s\n" "===> Test for testPixelstoreLinkNeighbors" "SUCCESS"
+fi
+
+
+echo "==> Running testMoc"
+${DIR}/testMoc > /dev/null
+if [ $? -gt 0 ]
+then 
+	printf "%-70s %10s\n" "===> Test for testMoc" "FAILED"
+	STATUS=1
+else
+	printf "%-70s %10s\n" "===> Test for testMoc" "SUCCESS"
+fi
+
+
+echo "==> Running testAsciicat"
+${DIR}/testAsciicat > /dev/null
+if [ $? -gt 0 ]
+then 
+	printf "%-70s %10s\n" "===> Test for testAsciicat" "FAILED"
+	STATUS=1
+else
+	printf "%-70s %10s\n" "===> Test for testAsciicat" "SUCCESS"
+fi
+
+
+echo "==> Running testFitsmap"
+${DIR}/testFitsmap > /dev/null
+if [ $? -gt 0 ]
+then 
+	printf "%-70s %10s\n" "===> Test for testFitsmap" "FAILED"
+	STATUS=1
+else
+	printf "%-70s %10s\n" "===> Test for testFitsmap" "SUCCESS"
+fi
+
+
+echo "==> Running testFastwcs"
+${DIR}/testFastwcs > /dev/null
+if [ $? -gt 0 ]
+then 
+	printf "%-70s %10s\n" "===> Test for testFastwcs" "FAILED"
+	STATUS=1
+else
+	printf "%-70s %10s\n" "===> Test for testFastwcs" "SUCCESS"
+fi
+
+
+echo "==> Running testSkycache"
+${DIR}/testSkycache > /dev/null
+if [ $? -gt 0 ]
+then 
+	printf "%-70s %10s\n" "===> Test for testSkycache" "FAILED"
+	STATUS=1
+else
+	printf "%-70s %10s\n" "===> Test for testSkycache" "SUCCESS"
+fi
+
+
+echo "==> Running testSnapshot"
+${DIR}/testSnapshot > /dev/null
+if [ $? -gt 0 ]
+then 
+	printf "%-70s %10s\n" "===> Test for testSnapshot" "FAILED"
+	STATUS=1
+else
+	printf "%-70s %10s\n" "===> Test for testSnapshot" "SUCCESS"
+fi
+
+
+echo "==> Running testExport"
+${DIR}/testExport > /dev/null
+if [ $? -gt 0 ]
+then 
+	printf "%-70s %10s\n" "===> Test for testExport" "FAILED"
+	STATUS=1
+else
+	printf "%-70s %10s\n" "===> Test for testExport" "SUCCESS"
+fi
+
+
+echo "==> Running testGencat"
+${DIR}/testGencat > /dev/null
+if [ $? -gt 0 ]
+then 
+	printf "%-70s %10s\n" "===> Test for testGencat" "FAILED"
+	STATUS=1
+else
+	printf "%-70s %10s\n" "===> Test for testGencat" "SUCCESS"
+fi
+
+
+echo "==> Running testPerfcount"
+${DIR}/testPerfcount > /dev/null
+if [ $? -gt 0 ]
+then 
+	printf "%-70s %10s\n" "===> Test for testPerfcount" "FAILED"
+	STATUS=1
+else
+	printf "%-70s %10s\n" "===> Test for testPerfcount" "SUCCESS"
+fi
+
+
+echo "==> Running testRefmatch"
+${DIR}/testRefmatch > /dev/null
+if [ $? -gt 0 ]
+then 
+	printf "%-70s %10s\n" "===> Test for testRefmatch" "FAILED"
+	STATUS=1
+else
+	printf "%-70s %10s\n" "===> Test for testRefmatch" "SUCCESS"
+fi
+
+
+echo "==> Running testTrace"
+${DIR}/testTrace ${DIR}/data/asciicat/t4_cat.txt > /dev/null
+if [ $? -gt 0 ]
+then 
+	printf "%-70s %10s\n" "===> Test for testTrace" "FAILED"
+	STATUS=1
+else
+	printf "%-70s %10s\n" "===> Test for testTrace" "SUCCESS"
+fi
+
+
+echo "==> Running testLogger"
+${DIR}/testLogger > /dev/null
+if [ $? -gt 0 ]
+then 
+	printf "%-70s %10s\n" "===> Test for testLogger" "FAILED"
+	STATUS=1
+else
+	printf "%-70s %10s\n" "===> Test for testLogger" "SUCCESS"
+fi
+
+
+echo "==> Running testServer"
+${DIR}/testServer ${DIR}/data/asciicat/t4_cat.txt > /dev/null
+if [ $? -gt 0 ]
+then 
+	printf "%-70s %10s\n" "===> Test for testServer" "FAILED"
+	STATUS=1
+else
+	printf "%-70s %10s\n" "===> Test for testServer" "SUCCESS"
+fi
+
+
+echo "==> Running testQuery"
+${DIR}/testQuery > /dev/null
+if [ $? -gt 0 ]
+then 
+	printf "%-70s %10s\n" "===> Test for testQuery" "FAILED"
+	STATUS=1
+else
+	printf "%-70s %10s\n" "===> Test for testQuery" "SUCCESS"
+fi
+
+
+echo "==> Running testCatalogPaths"
+${DIR}/testCatalogPaths ${DIR}/data/fitscat/data8.fits.cat > /dev/null
+if [ $? -gt 0 ]
+then 
+	printf "%-70s %10s\n" "===> Test for testCatalogPaths" "FAILED"
+	STATUS=1
+else
+	printf "%-70s %10s\n" "===> Test for testCatalogPaths" "SUCCESS"
+fi
+
 
 echo "=> Test suite end"
 
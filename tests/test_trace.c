@@ -0,0 +1,131 @@
+/*
+ * test_trace.c
+ *
+ * Record nested spans on several threads, more than a buffer block, write
+ * them and check the JSON events. Then cross match the ASCII catalog given
+ * with tracing enabled and check that every phase is in the timeline.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <math.h>
+
+#include "../src/trace.h"
+#include "../src/asciicat.h"
+#include "../src/catalog.h"
+#include "../src/crossmatch.h"
+#include "../src/pixelstore.h"
+#include "../src/mem.h"
+
+#define NTHREADS 3
+#define NSPANS (TRACE_BLOCK_EVENTS + 10)
+
+static void*
+span_thread(void *args) {
+    int i, t = *(int*) args;
+
+    Trace_begin("thread", "thread \"%i\"", t);
+    for (i=0; i<NSPANS; i++) {
+        Trace_begin("span", "%i", i);
+        Trace_end();
+    }
+    Trace_end();
+
+    return NULL;
+}
+
+static char*
+read_file(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *data = ALLOC(size + 1);
+    data[fread(data, 1, size, fp)] = '\0';
+    fclose(fp);
+    return data;
+}
+
+static long
+count(const char *data, const char *pattern) {
+    long n = 0;
+    const char *p = data;
+    while ((p = strstr(p, pattern))) {
+        n++;
+        p += strlen(pattern);
+    }
+    return n;
+}
+
+int main(int argc, char **argv) {
+    char path[] = "/tmp/scamp-test-trace.json";
+    pthread_t threads[NTHREADS];
+    int ids[NTHREADS], t;
+
+    if (argc < 2)
+        return 1;
+
+    /* disabled */
+    Trace_begin("ignored", NULL);
+    Trace_end();
+
+    Trace_enable();
+    for (t=0; t<NTHREADS; t++) {
+        ids[t] = t;
+        pthread_create(&threads[t], NULL, span_thread, &ids[t]);
+    }
+    for (t=0; t<NTHREADS; t++)
+        pthread_join(threads[t], NULL);
+    Trace_begin("main", NULL);
+    Trace_end();
+    if (!Trace_write(path))
+        return 1;
+
+    char *data = read_file(path);
+    if (!data || strncmp(data, "{\"displayTimeUnit\"", 18) != 0 ||
+            strstr(data, "ignored") ||
+            count(data, "\"ph\": \"B\"") != NTHREADS * (NSPANS + 1) + 1 ||
+            count(data, "\"ph\": \"E\"") != NTHREADS * (NSPANS + 1) + 1 ||
+            count(data, "\"name\": \"span\"") != NTHREADS * NSPANS ||
+            !strstr(data, "\"detail\": \"thread \\\"2\\\"\""))
+        return 1;
+    FREE(data);
+
+    /* written events are freed, recording goes on in new buffers */
+    Trace_begin("main", NULL);
+    Trace_end();
+    if (!Trace_write(path))
+        return 1;
+    data = read_file(path);
+    if (count(data, "\"ph\": \"B\"") != 1)
+        return 1;
+    FREE(data);
+
+    Field field;
+    PixelStore *store = PixelStore_new(pow(2, 16));
+    AsciiCat_open(argv[1], &field, store);
+    Crossmatch_crossSamples(store, 2.0, 2);
+    Catalog_freeField(&field);
+    PixelStore_free(store);
+    if (!Trace_write(path))
+        return 1;
+
+    data = read_file(path);
+    if (!strstr(data, "\"name\": \"AsciiCat_open\"") ||
+            !strstr(data, "\"name\": \"parse\"") ||
+            !strstr(data, "\"name\": \"insert\"") ||
+            !strstr(data, "\"name\": \"PixelStore_linkNeighbors\"") ||
+            !strstr(data, "\"name\": \"link\"") ||
+            !strstr(data, "\"name\": \"Crossmatch_crossSamples\"") ||
+            !strstr(data, "\"name\": \"cross_pixels\"") ||
+            count(data, "\"ph\": \"B\"") != count(data, "\"ph\": \"E\""))
+        return 1;
+    FREE(data);
+    remove(path);
+
+    return 0;
+}